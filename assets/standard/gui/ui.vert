@@ -1,5 +1,5 @@
 #version 450
-layout(set=0, binding=0) uniform PerWindow { mat4 u_transform; };
+layout(push_constant) uniform PerWindow { mat4 u_transform; };
 layout(location=0) in vec2 v_position;
 layout(location=1) in vec2 v_texcoord;
 layout(location=2) in vec4 v_color;
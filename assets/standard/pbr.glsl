@@ -6,6 +6,12 @@ const int PER_VIEW = 1;		// Used for descriptors that vary between viewpoints bu
 const int PER_MATERIAL = 2;	// Used for textures and material properties which may be shared by several objects
 const int PER_OBJECT = 3;	// Used for static or skeletal mesh pose data specific to a single object (optional for skyboxes, particle systems, and instances)
 
+// Bindless materials bind an rhi::resource_table in place of their PER_MATERIAL set, and select their textures from it by index, typically
+// supplied per object through push constants or object uniforms. Define RESOURCE_TABLE_SIZE, at most the capacity of the bound table, before including this file.
+#ifdef RESOURCE_TABLE_SIZE
+layout(set=PER_MATERIAL, binding=0) uniform sampler2D u_resource_table[RESOURCE_TABLE_SIZE];
+#endif
+
 struct point_light { vec3 position, light; };
 
 // Per-scene descriptors
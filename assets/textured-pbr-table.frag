@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : enable
+#define RESOURCE_TABLE_SIZE 16
+#include "standard/pbr.glsl"
+layout(set=PER_OBJECT,binding=0,std140) uniform PerTableObject
+{
+	mat4 u_object_matrices[2];	// The model matrix and its inverse transpose, as read by static-mesh.vert
+	vec3 u_albedo_tint;
+	float u_roughness;
+	float u_metalness;
+	float u_opacity;
+	int u_albedo_index;
+};
+layout(location=0) in vec3 position;
+layout(location=1) in vec3 normal;
+layout(location=2) in vec2 texcoord;
+layout(location=0) out vec4 f_color;
+void main() 
+{ 
+	f_color = vec4(compute_lighting(position, normalize(normal), u_albedo_tint*texture(u_resource_table[u_albedo_index], texcoord).rgb, u_roughness, u_metalness, 1.0), u_opacity);
+}
\ No newline at end of file
@@ -7,7 +7,7 @@ struct mesh_asset
 {
     std::string name;
     mesh cmesh;
-    gfx::simple_mesh gmesh;
+    gfx::arena_mesh gmesh;
 
     std::optional<ray_mesh_hit> raycast(const ray & r) const;
 };
@@ -17,6 +17,7 @@ struct texture_asset
     std::string name;
     bool linear;
     rhi::ptr<rhi::image> gtex;
+    int table_index = -1;   // Index of gtex in a resource table, if it has been written to one
 };
 
 struct material_asset
@@ -97,7 +97,7 @@ void gizmo::draw(rhi::command_buffer & cmd, gfx::transient_resource_pool & pool,
     }
 
     auto object_set = pool.alloc_descriptor_set(*passes[0], pbr::object_set_index);
-    object_set.write(0, pbr::object_uniforms{translation_matrix(position)});
+    object_set.write_dynamic(0, sizeof(pbr::object_uniforms));
     gfx::descriptor_set material_sets[6] {
         pool.alloc_descriptor_set(*passes[0], pbr::material_set_index),
         pool.alloc_descriptor_set(*passes[0], pbr::material_set_index),
@@ -110,7 +110,7 @@ void gizmo::draw(rhi::command_buffer & cmd, gfx::transient_resource_pool & pool,
 
     int refs[] {1,0,1,1,1};
     //cmd.clear_depth(1.0);
-    object_set.bind(cmd);
+    object_set.bind(cmd, pbr::object_uniforms{translation_matrix(position)});
     for(size_t j=0; j<5; ++j)
     {
         cmd.set_stencil_ref(refs[j]);
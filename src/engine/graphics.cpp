@@ -25,6 +25,682 @@ rhi::ptr<rhi::device> gfx::context::create_device(array_view<rhi::client_api> ap
 }
 void gfx::context::poll_events() { glfwPollEvents(); }
 
+////////////////
+// mesh_arena //
+////////////////
+
+gfx::mesh_arena::mesh_arena(rhi::device & dev, size_t vertex_size, int block_vertices, int block_indices) : 
+    dev{&dev}, vertex_size{vertex_size}, block_vertices{block_vertices}, block_indices{block_indices}
+{
+    if(vertex_size == 0 || block_vertices < 1 || block_indices < 1) throw std::logic_error("mesh_arena blocks must have room for at least one vertex and index");
+}
+
+auto gfx::mesh_arena::get_stats() const -> stats
+{
+    stats s {blocks.size(), meshes.size() - free_handles.size()};
+    for(auto & m : meshes) if(m.live) { s.used_vertices += m.vertices.count; s.used_indices += m.indices.count; }
+    for(auto & b : blocks) { s.vertex_capacity += b.vertex_capacity; s.index_capacity += b.index_capacity; }
+    return s;
+}
+
+int gfx::mesh_arena::add(binary_view vertices, binary_view indices)
+{
+    if(vertices.size == 0 || vertices.size % vertex_size) throw std::logic_error("mesh_arena meshes must contain a whole number of vertices");
+    if(indices.size == 0 || indices.size % sizeof(uint32_t)) throw std::logic_error("mesh_arena meshes must contain a whole number of 32-bit indices");
+    const int vertex_count = exactly(vertices.size / vertex_size), index_count = exactly(indices.size / sizeof(uint32_t));
+
+    // Indices are offset by the position of the mesh within its block when drawn, so an out of range index would read the vertices of another mesh
+    auto first = reinterpret_cast<const uint32_t *>(indices.data);
+    if(std::any_of(first, first + index_count, [=](uint32_t i) { return i >= static_cast<uint32_t>(vertex_count); })) throw std::logic_error("mesh_arena mesh contains an index beyond its vertices");
+
+    auto a = allocate(vertex_count, index_count);
+    auto & b = blocks[a.block];
+    memcpy(b.vertices.data() + a.vertices.offset*vertex_size, vertices.data, vertices.size);
+    memcpy(b.indices.data() + a.indices.offset, indices.data, indices.size);
+
+    if(free_handles.empty())
+    {
+        meshes.push_back(a);
+        return exactly(meshes.size()-1);
+    }
+    const int handle = free_handles.back();
+    free_handles.pop_back();
+    meshes[handle] = a;
+    return handle;
+}
+
+void gfx::mesh_arena::free(int handle)
+{
+    if(handle < 0 || static_cast<size_t>(handle) >= meshes.size() || !meshes[handle].live) throw std::logic_error("invalid mesh_arena handle");
+    auto & a = meshes[handle];
+    auto & b = blocks[a.block];
+
+    // The freed contents stay in the block's buffers, which cannot be written once created, until they are overwritten by a later mesh and the block flushed
+    free_range(b.free_vertices, a.vertices);
+    free_range(b.free_indices, a.indices);
+    a.live = false;
+    free_handles.push_back(handle);
+}
+
+void gfx::mesh_arena::compact()
+{
+    // Indices are relative to the first vertex of their mesh, so meshes can be moved by copying their contents, without rewriting any indices.
+    // Placing the largest meshes first leaves the smaller ones to fill the gaps at the ends of blocks.
+    std::vector<int> handles;
+    for(size_t i=0; i<meshes.size(); ++i) if(meshes[i].live) handles.push_back(exactly(i));
+    std::sort(begin(handles), end(handles), [&](int a, int b) { return meshes[a].vertices.count > meshes[b].vertices.count; });
+
+    const auto old_blocks = std::move(blocks);
+    blocks.clear();
+    for(int h : handles)
+    {
+        const auto & from = old_blocks[meshes[h].block];
+        const auto & old = meshes[h];
+        auto a = allocate(old.vertices.count, old.indices.count);
+        auto & to = blocks[a.block];
+        memcpy(to.vertices.data() + a.vertices.offset*vertex_size, from.vertices.data() + old.vertices.offset*vertex_size, old.vertices.count*vertex_size);
+        std::copy_n(from.indices.begin() + old.indices.offset, old.indices.count, to.indices.begin() + a.indices.offset);
+        meshes[h] = a;
+    }
+
+    // With no live meshes left to refer to them, freed handles can be reused in any order
+    while(!meshes.empty() && !meshes.back().live) meshes.pop_back();
+    free_handles.clear();
+    for(size_t i=0; i<meshes.size(); ++i) if(!meshes[i].live) free_handles.push_back(exactly(i));
+}
+
+void gfx::mesh_arena::flush()
+{
+    for(auto & b : blocks)
+    {
+        const bool empty = b.free_vertices.size() == 1 && b.free_vertices[0].count == b.vertex_capacity && b.free_indices.size() == 1 && b.free_indices[0].count == b.index_capacity;
+        if(empty)
+        {
+            b.vertex_buffer = {};
+            b.index_buffer = {};
+            b.vertices = {};
+            b.indices = {};
+            b.dirty = false;
+        }
+        if(!b.dirty) continue;
+
+        // Contents past the last allocated range are dropped, rather than uploaded
+        if(!b.free_vertices.empty() && b.free_vertices.back().offset + b.free_vertices.back().count == b.vertex_capacity) b.vertices.resize(b.free_vertices.back().offset*vertex_size);
+        if(!b.free_indices.empty() && b.free_indices.back().offset + b.free_indices.back().count == b.index_capacity) b.indices.resize(b.free_indices.back().offset);
+        b.vertex_buffer = {*dev, rhi::vertex_buffer_bit, b.vertices};
+        b.index_buffer = {*dev, rhi::index_buffer_bit, b.indices};
+        b.dirty = false;
+    }
+}
+
+gfx::mesh_view gfx::mesh_arena::get_view(int handle) const
+{
+    if(handle < 0 || static_cast<size_t>(handle) >= meshes.size() || !meshes[handle].live) throw std::logic_error("invalid mesh_arena handle");
+    auto & a = meshes[handle];
+    auto & b = blocks[a.block];
+    if(b.dirty) throw std::logic_error("mesh_arena must be flushed before its new meshes are drawn");
+    return {b.vertex_buffer.buffer, b.index_buffer.buffer, b.vertex_buffer.size, b.index_buffer.size, a.indices.offset, a.indices.count, a.vertices.offset};
+}
+
+auto gfx::mesh_arena::allocate(int vertex_count, int index_count) -> allocation
+{
+    allocation a {0, {0, vertex_count}, {0, index_count}, true};
+    for(; a.block < blocks.size(); ++a.block)
+    {
+        auto & b = blocks[a.block];
+        auto vertex_offset = alloc_range(b.free_vertices, vertex_count);
+        if(!vertex_offset) continue;
+        auto index_offset = alloc_range(b.free_indices, index_count);
+        if(!index_offset)
+        {
+            free_range(b.free_vertices, {*vertex_offset, vertex_count});
+            continue;
+        }
+        a.vertices.offset = *vertex_offset;
+        a.indices.offset = *index_offset;
+        break;
+    }
+    if(a.block == blocks.size())
+    {
+        // Meshes too large for a block are given a block of exactly their own size
+        const int vertex_capacity = std::max(block_vertices, vertex_count), index_capacity = std::max(block_indices, index_count);
+        blocks.push_back({{}, {}, {}, {}, {{vertex_count, vertex_capacity - vertex_count}}, {{index_count, index_capacity - index_count}}, vertex_capacity, index_capacity, false});
+        for(auto * ranges : {&blocks.back().free_vertices, &blocks.back().free_indices}) if(ranges->back().count == 0) ranges->pop_back();
+    }
+
+    auto & b = blocks[a.block];
+    b.vertices.resize(std::max(b.vertices.size(), (a.vertices.offset + vertex_count)*vertex_size));
+    b.indices.resize(std::max(b.indices.size(), static_cast<size_t>(a.indices.offset + index_count)));
+    b.dirty = true;
+    return a;
+}
+
+std::optional<int> gfx::mesh_arena::alloc_range(std::vector<range> & free_ranges, int count)
+{
+    // First fit keeps allocations toward the start of each block, so that the contents uploaded by flush() can be trimmed
+    for(auto it = free_ranges.begin(); it != free_ranges.end(); ++it)
+    {
+        if(it->count < count) continue;
+        const int offset = it->offset;
+        it->offset += count;
+        it->count -= count;
+        if(it->count == 0) free_ranges.erase(it);
+        return offset;
+    }
+    return std::nullopt;
+}
+
+void gfx::mesh_arena::free_range(std::vector<range> & free_ranges, range r)
+{
+    auto it = free_ranges.insert(std::lower_bound(free_ranges.begin(), free_ranges.end(), r.offset, [](const range & f, int offset) { return f.offset < offset; }), r);
+    if(next(it) != free_ranges.end() && it->offset + it->count == next(it)->offset)
+    {
+        it->count += next(it)->count;
+        free_ranges.erase(next(it));
+    }
+    if(it != free_ranges.begin() && prev(it)->offset + prev(it)->count == it->offset)
+    {
+        prev(it)->count += it->count;
+        free_ranges.erase(it);
+    }
+}
+
+DOCTEST_TEST_CASE("mesh_arena sub-allocates, frees and compacts meshes")
+{
+    auto dev = rhi::create_null_device();
+
+    const float3 tri[] {{0,0,0}, {1,0,0}, {0,1,0}}, quad[] {{0,0,0}, {1,0,0}, {0,1,0}, {1,1,0}};
+    const uint32_t tri_indices[] {0,1,2}, quad_indices[] {0,1,2, 2,1,3};
+    gfx::mesh_arena arena {*dev, sizeof(float3), 8, 12};
+    const int a = arena.add(tri, tri_indices), b = arena.add(quad, quad_indices), c = arena.add(tri, tri_indices);
+    DOCTEST_CHECK_THROWS_AS(arena.get_view(a), std::logic_error);
+    DOCTEST_CHECK_THROWS_AS(arena.add(tri, quad_indices), std::logic_error);
+    arena.flush();
+    DOCTEST_CHECK(arena.get_stats().blocks == 2);
+    DOCTEST_CHECK(arena.get_view(a).shares_buffers(arena.get_view(b)));
+    DOCTEST_CHECK(!arena.get_view(a).shares_buffers(arena.get_view(c)));
+    DOCTEST_CHECK(arena.get_view(b).first_index == 3);
+    DOCTEST_CHECK(arena.get_view(b).index_count == 6);
+    DOCTEST_CHECK(arena.get_view(b).vertex_offset == 3);
+
+    DOCTEST_SUBCASE("freed ranges and handles are reused")
+    {
+        arena.free(a);
+        DOCTEST_CHECK_THROWS_AS(arena.get_view(a), std::logic_error);
+        const int d = arena.add(tri, tri_indices);
+        arena.flush();
+        DOCTEST_CHECK(d == a);
+        DOCTEST_CHECK(arena.get_view(d).vertex_offset == 0);
+        DOCTEST_CHECK(arena.get_view(d).shares_buffers(arena.get_view(b)));
+        DOCTEST_CHECK(arena.get_stats().blocks == 2);
+    }
+
+    DOCTEST_SUBCASE("compaction packs live meshes into fewer blocks without invalidating their handles")
+    {
+        arena.free(a);
+        arena.compact();
+        arena.flush();
+        DOCTEST_CHECK(arena.get_stats().blocks == 1);
+        DOCTEST_CHECK(arena.get_stats().meshes == 2);
+        DOCTEST_CHECK(arena.get_stats().used_vertices == 7);
+        DOCTEST_CHECK(arena.get_view(b).shares_buffers(arena.get_view(c)));
+        DOCTEST_CHECK(arena.get_view(b).index_count == 6);
+        DOCTEST_CHECK(arena.get_view(c).index_count == 3);
+        DOCTEST_CHECK_THROWS_AS(arena.free(a), std::logic_error);
+    }
+}
+
+////////////////////
+// dynamic_buffer //
+////////////////////
+
+gfx::dynamic_buffer::dynamic_buffer(rhi::device & dev, rhi::buffer_flags flags, size_t page_size) : dev{&dev}, flags{flags | rhi::mapped_memory_bit}, 
+    current_page{0}, offset{0}, used{0}, frame_bytes{0}, peak_frame_bytes{0}, total_bytes{0}, frames{0}, low_use_frames{0}
+{
+    auto buffer = dev.create_buffer({page_size, this->flags}, nullptr);
+    alignment = buffer->get_offset_alignment();
+    pages.push_back({buffer, page_size, buffer->get_mapped_memory()});
+}
+
+void gfx::dynamic_buffer::reset()
+{
+    peak_frame_bytes = std::max(peak_frame_bytes, frame_bytes);
+    total_bytes += frame_bytes;
+    ++frames;
+
+    // Pages are only released after a sustained period of low use, so that a workload which hovers around a page boundary does not keep recreating it
+    if(pages.size() > 1 && frame_bytes*2 <= get_capacity() - pages.back().size)
+    {
+        if(++low_use_frames >= shrink_after_frames)
+        {
+            pages.pop_back();
+            low_use_frames = 0;
+        }
+    }
+    else low_use_frames = 0;
+
+    current_page = offset = used = frame_bytes = 0;
+}
+
+void gfx::dynamic_buffer::next_page(size_t min_size)
+{
+    // Skip over any later pages which are too small, and if there are none left, add a page at least as large as all the others combined
+    size_t next = current_page + 1;
+    while(next < pages.size() && pages[next].size < min_size) ++next;
+    if(next == pages.size())
+    {
+        const size_t page_size = std::max(get_capacity(), min_size);
+        auto buffer = dev->create_buffer({page_size, flags}, nullptr);
+        pages.push_back({buffer, page_size, buffer->get_mapped_memory()});
+    }
+
+    // Ranges must be contiguous, so carry over whatever has already been written of the current one. This reads back from mapped memory, which may be slow,
+    // but only happens once per overflowing page.
+    memcpy(pages[next].mapped, pages[current_page].mapped + offset, used - offset);
+    used -= offset;
+    offset = 0;
+    current_page = next;
+}
+
+////////////////////
+// descriptor_set //
+////////////////////
+
+void gfx::descriptor_set::rewrite_dynamic(rhi::buffer & page)
+{
+    // The current set may already have been bound by recorded commands, so write all of its bindings to a new set which addresses the new page instead
+    set = pool.alloc(layout.get_descriptor_set_layout(set_index));
+    for(auto & w : writes)
+    {
+        if(w.buffer) set->write(w.binding, {*w.buffer, w.offset, w.size});
+        else if(w.sampler) set->write(w.binding, *w.sampler, *w.image);
+        else if(w.image) set->write(w.binding, *w.image, w.mip);
+        else set->write(w.binding, {page, 0, w.size});
+    }
+    dynamic_page = &page;
+}
+
+DOCTEST_TEST_CASE("dynamic_buffer chains pages, and descriptor_set follows its dynamic uniforms onto new pages")
+{
+    auto dev = rhi::create_null_device();
+
+    DOCTEST_SUBCASE("ranges which overflow a page continue on a later one, and unused pages are eventually released")
+    {
+        gfx::dynamic_buffer buffer {*dev, rhi::vertex_buffer_bit, 1024};
+        const auto first = buffer.upload(std::vector<uint32_t>(16, 7));
+
+        // The range begins at offset 256 of the first page, and outgrows it and then a second page, so its contents must be carried over twice
+        buffer.begin();
+        for(uint32_t i=0; i<500; ++i) buffer.write(i);
+        const auto range = buffer.end();
+        DOCTEST_CHECK(buffer.get_page_count() == 3);
+        DOCTEST_CHECK(&range.buffer != &first.buffer);
+        DOCTEST_CHECK(range.offset == 0);
+        DOCTEST_CHECK(range.size == 2000);
+        std::vector<uint32_t> contents(500);
+        memcpy(contents.data(), range.buffer.get_mapped_memory(), range.size);
+        bool contents_match = true;
+        for(uint32_t i=0; i<500; ++i) contents_match &= contents[i] == i;
+        DOCTEST_CHECK(contents_match);
+        buffer.reset();
+        DOCTEST_CHECK(buffer.get_peak_frame_bytes() == 2064);
+        DOCTEST_CHECK(buffer.get_average_frame_bytes() == 2064);
+
+        // A write too large for the second page skips straight to the third
+        buffer.upload(std::vector<uint8_t>(64));
+        const auto large = buffer.upload(std::vector<uint8_t>(1100));
+        DOCTEST_CHECK(&large.buffer == &range.buffer);
+        DOCTEST_CHECK(buffer.get_page_count() == 3);
+        buffer.reset();
+        DOCTEST_CHECK(buffer.get_peak_frame_bytes() == 2064);
+        DOCTEST_CHECK(buffer.get_average_frame_bytes() == (2064+1164)/2);
+
+        for(uint64_t i=1; i<gfx::dynamic_buffer::shrink_after_frames; ++i)
+        {
+            buffer.upload(uint32_t{0});
+            buffer.reset();
+        }
+        DOCTEST_CHECK(buffer.get_page_count() == 3);
+        buffer.upload(uint32_t{0});
+        buffer.reset();
+        DOCTEST_CHECK(buffer.get_page_count() == 2);
+    }
+
+    DOCTEST_SUBCASE("a descriptor_set whose dynamic uniforms land on a new page is rewritten to address it")
+    {
+        auto set_layout = dev->create_descriptor_set_layout({{0, rhi::descriptor_type::uniform_buffer_dynamic, 1}});
+        auto pipe_layout = dev->create_pipeline_layout({set_layout});
+        gfx::descriptor_pool_chain pools {*dev};
+        gfx::dynamic_buffer uniforms {*dev, rhi::uniform_buffer_bit, 1024};
+        gfx::descriptor_set set {*pipe_layout, 0, pools, uniforms};
+        set.write_dynamic(0, sizeof(float4));
+        auto & first_page = uniforms.get_dynamic_range(sizeof(float4)).buffer;
+        auto get_bound_buffer = [&]() -> const rhi::buffer * { return static_cast<const rhi::emulated_descriptor_set &>(set.get()).buffer_bindings[0].buffer; };
+        DOCTEST_CHECK(get_bound_buffer() == &first_page);
+
+        // Uniforms are aligned to 256 bytes by the null backend, so the first page holds four uploads
+        auto cmd = dev->create_command_buffer();
+        for(int i=0; i<5; ++i) set.bind(*cmd, float4{static_cast<float>(i),0,0,1});
+        auto & second_page = uniforms.get_dynamic_range(sizeof(float4)).buffer;
+        DOCTEST_CHECK(&second_page != &first_page);
+        DOCTEST_CHECK(get_bound_buffer() == &second_page);
+        DOCTEST_CHECK(reinterpret_cast<const float4 &>(*second_page.get_mapped_memory()) == float4{4,0,0,1});
+        dev->submit(*cmd);
+    }
+}
+
+DOCTEST_TEST_CASE("descriptor_pool_chain grows past one pool, reuses its pools after reset(), and tracks the recent peak")
+{
+    auto dev = rhi::create_null_device();
+
+    // The null backend's pools hold 1024 sets each
+    auto layout = dev->create_descriptor_set_layout({{0, rhi::descriptor_type::uniform_buffer, 1}});
+    gfx::descriptor_pool_chain pools {*dev};
+    auto alloc_frame = [&](int sets)
+    {
+        bool allocated = true;
+        for(int i=0; i<sets; ++i) if(!pools.alloc(*layout)) allocated = false;
+        DOCTEST_CHECK(allocated);
+        pools.reset();
+    };
+    alloc_frame(1500);
+    DOCTEST_CHECK(pools.get_pool_count() == 2);
+    DOCTEST_CHECK(pools.get_peak_sets() == 1500);
+
+    alloc_frame(1500);
+    DOCTEST_CHECK(pools.get_pool_count() == 2);
+    DOCTEST_CHECK(pools.get_allocated_sets() == 0);
+    DOCTEST_CHECK(pools.get_peak_sets() == 1500);
+
+    // The peak of a busy frame is forgotten after at most two windows of quieter ones
+    for(size_t i=0; i<2*gfx::descriptor_pool_chain::peak_window; ++i) alloc_frame(10);
+    DOCTEST_CHECK(pools.get_pool_count() == 2);
+    DOCTEST_CHECK(pools.get_peak_sets() == 10);
+}
+
+/////////////////////
+// frame_scheduler //
+/////////////////////
+
+gfx::frame_scheduler::frame_scheduler(rhi::device & dev, int frames_in_flight) : dev{&dev}, current_pool{0}, is_submitted{false}, current{}, last{}, average{}, frames{0}, gpu_bound_frames{0}
+{
+    set_frames_in_flight(frames_in_flight);
+}
+
+void gfx::frame_scheduler::set_frames_in_flight(int frames_in_flight)
+{
+    if(frames_in_flight < 1) throw std::logic_error("frame_scheduler requires at least one frame in flight");
+    dev->wait_until_complete(dev->get_last_submission_id());
+    while(pools.size() > static_cast<size_t>(frames_in_flight)) pools.pop_back();
+    while(pools.size() < static_cast<size_t>(frames_in_flight)) pools.push_back(std::make_unique<transient_resource_pool>(*dev));
+    current_pool = 0;
+}
+
+gfx::transient_resource_pool & gfx::frame_scheduler::begin_frame()
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    current_pool = (current_pool+1) % pools.size();
+    auto & pool = *pools[current_pool];
+    pool.begin_frame(*dev);
+    wait_end = std::chrono::steady_clock::now();
+    is_submitted = false;
+    current.wait_ms = std::chrono::duration<double, std::milli>(wait_end - t0).count();
+    current.interval_ms = frames ? std::chrono::duration<double, std::milli>(t0 - last_begin).count() : 0;
+    last_begin = t0;
+    return pool;
+}
+
+void gfx::frame_scheduler::submitted()
+{
+    submit_time = std::chrono::steady_clock::now();
+    is_submitted = true;
+}
+
+void gfx::frame_scheduler::end_frame()
+{
+    pools[current_pool]->end_frame(*dev);
+    const auto t1 = std::chrono::steady_clock::now(), cpu_end = is_submitted ? submit_time : t1;
+    current.cpu_ms = std::chrono::duration<double, std::milli>(cpu_end - wait_end).count();
+    current.present_ms = std::chrono::duration<double, std::milli>(t1 - cpu_end).count();
+    if(current.wait_ms > gpu_bound_threshold_ms) ++gpu_bound_frames;
+
+    // Weight recent frames heavily, so that the average settles within a second or so of a change in workload
+    const double alpha = frames ? 0.05 : 1.0;
+    average.wait_ms += (current.wait_ms - average.wait_ms) * alpha;
+    average.cpu_ms += (current.cpu_ms - average.cpu_ms) * alpha;
+    average.present_ms += (current.present_ms - average.present_ms) * alpha;
+    average.interval_ms += (current.interval_ms - average.interval_ms) * alpha;
+    last = current;
+    ++frames;
+}
+
+DOCTEST_TEST_CASE("frame_scheduler cycles through one pool per frame in flight")
+{
+    auto dev = rhi::create_null_device();
+    gfx::frame_scheduler frames {*dev, 3};
+    DOCTEST_CHECK(frames.get_frames_in_flight() == 3);
+    DOCTEST_CHECK_THROWS_AS(frames.set_frames_in_flight(0), std::logic_error);
+
+    // Run a frame which writes some uniforms and submits a command buffer, returning the pool it was given
+    auto run_frame = [&]() -> gfx::transient_resource_pool &
+    {
+        auto & pool = frames.begin_frame();
+        pool.uniforms.upload(float4{1,2,3,4});
+        auto cmd = dev->create_command_buffer();
+        frames.submitted();
+        dev->submit(*cmd);
+        frames.end_frame();
+        return pool;
+    };
+
+    // Each pool is handed out again only after every other pool has had a turn
+    gfx::transient_resource_pool * pools[6];
+    for(auto & p : pools) p = &run_frame();
+    DOCTEST_CHECK(pools[0] != pools[1]);
+    DOCTEST_CHECK(pools[1] != pools[2]);
+    DOCTEST_CHECK(pools[0] != pools[2]);
+    for(int i=0; i<3; ++i) DOCTEST_CHECK(pools[i] == pools[i+3]);
+    DOCTEST_CHECK(frames.get_frame_count() == 6);
+    DOCTEST_CHECK(frames.get_last_timing().cpu_ms >= 0);
+    DOCTEST_CHECK(frames.get_last_timing().present_ms >= 0);
+    DOCTEST_CHECK(frames.get_last_timing().interval_ms >= 0);
+
+    // Pools kept when the number of frames in flight changes stay where they were
+    frames.set_frames_in_flight(4);
+    DOCTEST_CHECK(frames.get_frames_in_flight() == 4);
+    std::set<gfx::transient_resource_pool *> four;
+    for(int i=0; i<4; ++i) four.insert(&run_frame());
+    DOCTEST_CHECK(four.size() == 4);
+    for(int i=0; i<3; ++i) DOCTEST_CHECK(four.count(pools[i]) == 1);
+
+    frames.set_frames_in_flight(2);
+    std::set<gfx::transient_resource_pool *> two;
+    for(int i=0; i<4; ++i) two.insert(&run_frame());
+    for(auto p : two) DOCTEST_CHECK(std::count(pools, pools+3, p) == 1);
+    DOCTEST_CHECK(frames.get_frame_count() == 14);
+}
+
+//////////////////////
+// descriptor_cache //
+//////////////////////
+
+template<class T> static void append_key(std::string & key, const T & value) { key.append(reinterpret_cast<const char *>(&value), sizeof(value)); }
+
+gfx::descriptor_cache::set_builder::set_builder(descriptor_cache & cache, const rhi::pipeline_layout & layout, int set_index) : cache{cache}, layout{layout}, set_index{set_index}
+{
+    append_key(key, &layout.get_descriptor_set_layout(set_index));
+}
+
+void gfx::descriptor_cache::set_builder::write(int binding, rhi::buffer_range range)
+{
+    // Mapped buffers are rewritten in place, such as when a dynamic_buffer page is reused, so a cached set would go on to read whatever replaced the range
+    if(range.buffer.get_mapped_memory()) throw std::logic_error("descriptor_cache cannot cache ranges of mapped buffers");
+    writes.push_back({binding, &range.buffer, range.offset, range.size, nullptr, nullptr, 0});
+    append_key(key, binding);
+    append_key(key, &range.buffer);
+    append_key(key, range.offset);
+    append_key(key, range.size);
+}
+void gfx::descriptor_cache::set_builder::write(int binding, gfx::binary_view view)
+{
+    // Uniforms have no buffer until the set is created, so record the location of their contents within the key instead
+    writes.push_back({binding, nullptr, key.size() + sizeof(int) + sizeof(size_t), view.size, nullptr, nullptr, 0});
+    append_key(key, binding);
+    append_key(key, view.size);
+    key.append(reinterpret_cast<const char *>(view.data), view.size);
+}
+void gfx::descriptor_cache::set_builder::write(int binding, rhi::sampler & sampler, rhi::image & image)
+{
+    writes.push_back({binding, nullptr, 0, 0, &sampler, &image, 0});
+    append_key(key, binding);
+    append_key(key, &sampler);
+    append_key(key, &image);
+}
+void gfx::descriptor_cache::set_builder::write(int binding, rhi::image & image, int mip)
+{
+    writes.push_back({binding, nullptr, 0, 0, nullptr, &image, mip});
+    append_key(key, binding);
+    append_key(key, &image);
+    append_key(key, mip);
+}
+
+rhi::descriptor_set & gfx::descriptor_cache::get(const rhi::descriptor_set_layout & layout, const std::vector<write_desc> & writes, const std::string & key)
+{
+    auto & e = entries[key];
+    e.last_used_frame = frame;
+    if(e.set) return *e.set;
+
+    // Cached sets are immutable, so they are only ever written here, before their first use
+    e.set = pools.alloc(layout);
+    for(auto & w : writes)
+    {
+        if(w.buffer)
+        {
+            e.set->write(w.binding, {*w.buffer, w.offset, w.size});
+            e.resources.push_back(w.buffer);
+        }
+        else if(w.sampler)
+        {
+            e.set->write(w.binding, *w.sampler, *w.image);
+            e.resources.push_back(w.sampler);
+            e.resources.push_back(w.image);
+        }
+        else if(w.image)
+        {
+            e.set->write(w.binding, *w.image, w.mip);
+            e.resources.push_back(w.image);
+        }
+        else
+        {
+            auto buffer = dev->create_buffer({w.size, rhi::uniform_buffer_bit}, key.data() + w.offset);
+            e.set->write(w.binding, {*buffer, 0, w.size});
+            e.resources.push_back(buffer);
+        }
+    }
+    return *e.set;
+}
+
+void gfx::descriptor_cache::begin_frame()
+{
+    ++frame;
+    for(auto it = entries.begin(); it != entries.end(); )
+    {
+        if(it->second.last_used_frame + max_unused_frames < frame) { it = entries.erase(it); ++evicted_sets; }
+        else ++it;
+    }
+
+    // Descriptor sets cannot be freed individually, so once most of the sets in our pools have been evicted, retire the pools and let surviving
+    // sets be recreated on demand. The retired pools are kept alive until the GPU has certainly finished with any command buffers which used them.
+    if(evicted_sets > 256 && evicted_sets > entries.size())
+    {
+        entries.clear();
+        retired.push_back({std::move(pools), dev->get_last_submission_id(), frame});
+        pools = descriptor_pool_chain{*dev};
+        evicted_sets = 0;
+    }
+    while(!retired.empty() && retired.front().frame + max_unused_frames < frame)
+    {
+        dev->wait_until_complete(retired.front().submission_id);
+        retired.erase(retired.begin());
+    }
+}
+
+void gfx::descriptor_cache::invalidate(const rhi::object & resource)
+{
+    for(auto it = entries.begin(); it != entries.end(); )
+    {
+        if(std::find(begin(it->second.resources), end(it->second.resources), &resource) != end(it->second.resources)) { it = entries.erase(it); ++evicted_sets; }
+        else ++it;
+    }
+}
+
+DOCTEST_TEST_CASE("descriptor_cache shares sets between identical bindings and evicts unused ones")
+{
+    auto dev = rhi::create_null_device();
+
+    auto set_layout = dev->create_descriptor_set_layout({{0, rhi::descriptor_type::uniform_buffer, 1}, {1, rhi::descriptor_type::combined_image_sampler, 1}});
+    auto pipe_layout = dev->create_pipeline_layout({set_layout});
+    auto sampler = dev->create_sampler({rhi::filter::linear, rhi::filter::linear, std::nullopt, rhi::address_mode::repeat, rhi::address_mode::repeat});
+    auto image = dev->create_image({rhi::image_shape::_2d, {1,1,1}, 1, rhi::image_format::rgba_unorm8, rhi::sampled_image_bit}, {nullptr});
+    gfx::descriptor_cache cache {*dev};
+    auto get_set = [&](const float4 & color) -> rhi::descriptor_set &
+    {
+        auto builder = cache.begin_set(*pipe_layout, 0);
+        builder.write(0, color);
+        builder.write(1, *sampler, *image);
+        return builder.get();
+    };
+
+    auto & red = get_set({1,0,0,1});
+    DOCTEST_CHECK(&get_set({1,0,0,1}) == &red);
+    DOCTEST_CHECK(&get_set({0,1,0,1}) != &red);
+    DOCTEST_CHECK(cache.get_cached_sets() == 2);
+
+    auto mapped = dev->create_buffer({sizeof(float4), rhi::uniform_buffer_bit | rhi::mapped_memory_bit}, nullptr);
+    DOCTEST_CHECK_THROWS_AS(cache.begin_set(*pipe_layout, 0).write(0, {*mapped, 0, sizeof(float4)}), std::logic_error);
+
+    DOCTEST_SUBCASE("sets unused for max_unused_frames are evicted")
+    {
+        for(uint64_t i=0; i<gfx::descriptor_cache::max_unused_frames; ++i)
+        {
+            cache.begin_frame();
+            get_set({1,0,0,1});
+        }
+        cache.begin_frame();
+        DOCTEST_CHECK(cache.get_cached_sets() == 1);
+        DOCTEST_CHECK(&get_set({1,0,0,1}) == &red);
+    }
+
+    DOCTEST_SUBCASE("invalidating a resource evicts the sets which reference it")
+    {
+        auto other_image = dev->create_image({rhi::image_shape::_2d, {1,1,1}, 1, rhi::image_format::rgba_unorm8, rhi::sampled_image_bit}, {nullptr});
+        auto builder = cache.begin_set(*pipe_layout, 0);
+        builder.write(0, float4{1,0,0,1});
+        builder.write(1, *sampler, *other_image);
+        builder.get();
+        DOCTEST_CHECK(cache.get_cached_sets() == 3);
+        cache.invalidate(*other_image);
+        DOCTEST_CHECK(cache.get_cached_sets() == 2);
+        cache.invalidate(*image);
+        DOCTEST_CHECK(cache.get_cached_sets() == 0);
+    }
+
+    DOCTEST_SUBCASE("pools are retired once most of their sets have been evicted, and released once the GPU is done with them")
+    {
+        for(int i=0; i<300; ++i) get_set({static_cast<float>(i),0,0,1});
+        for(uint64_t i=0; i<=gfx::descriptor_cache::max_unused_frames; ++i)
+        {
+            cache.begin_frame();
+            get_set({1,0,0,1});
+        }
+        DOCTEST_CHECK(cache.get_retired_pools() == 1);
+        DOCTEST_CHECK(cache.get_cached_sets() == 1);
+        DOCTEST_CHECK(&get_set({1,0,0,1}) != &red);
+        for(uint64_t i=0; i<=gfx::descriptor_cache::max_unused_frames; ++i) cache.begin_frame();
+        DOCTEST_CHECK(cache.get_retired_pools() == 0);
+    }
+}
+
 ////////////
 // window //
 ////////////
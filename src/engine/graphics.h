@@ -1,5 +1,9 @@
 #pragma once
 #include "rhi.h"
+#include <unordered_map>
+#include <chrono>
+#include <utility>
+#include <memory>
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
@@ -40,6 +44,26 @@ namespace gfx
         operator rhi::buffer_range() const { return {*buffer, 0, size}; }
     };
 
+    // gfx::mesh_view refers to a range of indexed geometry within a pair of vertex and index buffers, such as a whole simple_mesh, or a mesh allocated from a mesh_arena.
+    // Views of different meshes which share their buffers may be drawn one after another with a single bind(...).
+    struct mesh_view
+    {
+        rhi::buffer * vertex_buffer, * index_buffer;
+        size_t vertex_buffer_size, index_buffer_size;
+        int first_index, index_count, vertex_offset;
+
+        bool shares_buffers(const mesh_view & other) const { return vertex_buffer == other.vertex_buffer && index_buffer == other.index_buffer; }
+        bool operator == (const mesh_view & other) const { return shares_buffers(other) && first_index == other.first_index && index_count == other.index_count && vertex_offset == other.vertex_offset; }
+        bool operator != (const mesh_view & other) const { return !(*this == other); }
+
+        void bind(rhi::command_buffer & cmd) const
+        {
+            cmd.bind_vertex_buffer(0, {*vertex_buffer, 0, vertex_buffer_size});
+            cmd.bind_index_buffer({*index_buffer, 0, index_buffer_size});
+        }
+        void draw(rhi::command_buffer & cmd, int first_instance=0, int instance_count=1) const { cmd.draw_indexed(first_index, index_count, first_instance, instance_count, vertex_offset); } // Buffers must already be bound
+    };
+
     struct simple_mesh
     {
         gfx::static_buffer vertex_buffer, index_buffer;
@@ -47,65 +71,232 @@ namespace gfx
         simple_mesh() = default;
         simple_mesh(rhi::device & dev, binary_view vertices, binary_view indices) : vertex_buffer{dev, rhi::vertex_buffer_bit, vertices}, index_buffer{dev, rhi::index_buffer_bit, indices} {}
 
-        void draw(rhi::command_buffer & cmd) const
+        int get_index_count() const { return exactly(index_buffer.size/sizeof(int)); }
+
+        void bind(rhi::command_buffer & cmd) const
         {
             cmd.bind_vertex_buffer(0, vertex_buffer);
             cmd.bind_index_buffer(index_buffer);
-            cmd.draw_indexed(0, exactly(index_buffer.size/sizeof(int)));
         }
+        void draw(rhi::command_buffer & cmd, int instance_count=1) const
+        {
+            bind(cmd);
+            cmd.draw_indexed(0, get_index_count(), 0, instance_count);
+        }
+
+        operator mesh_view() const { return {vertex_buffer.buffer, index_buffer.buffer, vertex_buffer.size, index_buffer.size, 0, get_index_count(), 0}; }
     };
 
+    // gfx::mesh_arena sub-allocates the geometry of many static meshes from a few large blocks, each with one vertex and one index buffer, so that draws of different
+    // meshes can share buffer bindings, and select their vertices through the vertex_offset of draw_indexed(...). Indices are stored as given, relative to the first
+    // vertex of their own mesh. Meshes larger than a block are given a block of their own.
+    //
+    // The arena keeps a copy of the contents of each block, and the changes made by add(...), free(...) and compact() are uploaded by flush(), which replaces the
+    // buffers of every modified block with new static buffers. Buffers are never written once created, so meshes may be added and freed while earlier frames
+    // are still in flight, but flush() must not be called while draws of the arena's meshes are being recorded. Handles remain valid across compaction.
+    class mesh_arena
+    {
+    public:
+        struct stats { size_t blocks, meshes, used_vertices, used_indices, vertex_capacity, index_capacity; };
+    private:
+        struct range { int offset, count; };
+        struct block
+        {
+            static_buffer vertex_buffer, index_buffer;
+            std::vector<char> vertices;                 // Contents of the block, up to the end of its last allocated vertex
+            std::vector<uint32_t> indices;              // Contents of the block, up to the end of its last allocated index
+            std::vector<range> free_vertices, free_indices; // Sorted by offset, with adjacent ranges merged
+            int vertex_capacity, index_capacity;
+            bool dirty;
+        };
+        struct allocation { size_t block; range vertices, indices; bool live; };
+
+        rhi::ptr<rhi::device> dev;
+        size_t vertex_size;
+        int block_vertices, block_indices;
+        std::vector<block> blocks;
+        std::vector<allocation> meshes;                 // Indexed by handle
+        std::vector<int> free_handles;
+    public:
+        mesh_arena(rhi::device & dev, size_t vertex_size, int block_vertices, int block_indices);
+
+        stats get_stats() const;
+        bool is_dirty() const { for(auto & b : blocks) if(b.dirty) return true; return false; }
+
+        int add(binary_view vertices, binary_view indices); // Returns a handle to a new mesh, drawable after the next flush(). vertices must hold whole vertices, and indices 32-bit indices
+        void free(int handle);
+        void compact();                                 // Repacks all live meshes into as few blocks as possible, releasing the rest
+        void flush();                                   // Uploads the contents of modified blocks to new buffers, and releases the buffers of empty blocks
+
+        mesh_view get_view(int handle) const;           // Valid until the next flush()
+    private:
+        allocation allocate(int vertex_count, int index_count); // Finds or creates a block with room for both ranges, and extends its contents to cover them
+        static std::optional<int> alloc_range(std::vector<range> & free_ranges, int count);
+        static void free_range(std::vector<range> & free_ranges, range r);
+    };
+
+    // gfx::arena_mesh owns a mesh allocated from a gfx::mesh_arena, and frees it when destroyed. The arena must outlive it.
+    class arena_mesh
+    {
+        mesh_arena * arena;
+        int handle;
+    public:
+        arena_mesh() : arena{nullptr}, handle{-1} {}
+        arena_mesh(mesh_arena & arena, binary_view vertices, binary_view indices) : arena{&arena}, handle{arena.add(vertices, indices)} {}
+        arena_mesh(arena_mesh && r) : arena{std::exchange(r.arena, nullptr)}, handle{std::exchange(r.handle, -1)} {}
+        arena_mesh & operator = (arena_mesh && r) { std::swap(arena, r.arena); std::swap(handle, r.handle); return *this; }
+        ~arena_mesh() { if(arena) arena->free(handle); }
+
+        int get_index_count() const { return get_view().index_count; }
+        mesh_view get_view() const { return arena->get_view(handle); }
+        operator mesh_view() const { return get_view(); }
+
+        void bind(rhi::command_buffer & cmd) const { get_view().bind(cmd); }
+        void draw(rhi::command_buffer & cmd, int instance_count=1) const
+        {
+            const auto view = get_view();
+            view.bind(cmd);
+            view.draw(cmd, 0, instance_count);
+        }
+    };
+
+    // gfx::dynamic_buffer sub-allocates transient ranges from a chain of mapped pages. A range which outgrows the current page is moved to the start of the next one,
+    // creating pages on demand, so a frame may write any amount. Pages are kept across reset() so that a steady workload stops creating them, and the largest page
+    // is released once shrink_after_frames consecutive frames have used less than half of the others. The bytes written per frame are tracked for tuning page sizes.
     class dynamic_buffer
     {
-        rhi::ptr<rhi::buffer> buffer;
-        size_t size, alignment;
-        char * mapped;
-        
-        size_t offset, used;
+        struct page { rhi::ptr<rhi::buffer> buffer; size_t size; char * mapped; };
+
+        rhi::ptr<rhi::device> dev;
+        rhi::buffer_flags flags;
+        std::vector<page> pages;
+        size_t alignment;
+        size_t current_page, offset, used;              // The range being written is [offset, used) within pages[current_page]
+        size_t frame_bytes, peak_frame_bytes;
+        uint64_t total_bytes, frames, low_use_frames;
     public:
-        dynamic_buffer(rhi::device & dev, rhi::buffer_flags flags, size_t size) : buffer{dev.create_buffer({size, flags | rhi::mapped_memory_bit}, nullptr)}, size{size}, alignment{buffer->get_offset_alignment()}, mapped{buffer->get_mapped_memory()}, offset{0}, used{0} {}
+        static constexpr uint64_t shrink_after_frames = 120;
+
+        dynamic_buffer(rhi::device & dev, rhi::buffer_flags flags, size_t page_size);
+
+        size_t get_page_count() const { return pages.size(); }
+        size_t get_capacity() const { size_t capacity = 0; for(auto & p : pages) capacity += p.size; return capacity; }
+        size_t get_frame_bytes() const { return frame_bytes; } // Bytes written since the last reset()
+        size_t get_peak_frame_bytes() const { return peak_frame_bytes; } // High-water mark of get_frame_bytes() at reset()
+        size_t get_average_frame_bytes() const { return frames ? static_cast<size_t>(total_bytes/frames) : 0; } // Mean of get_frame_bytes() at reset()
 
-        void reset() { offset = used = 0; }
+        void reset(); // Records the usage of the frame just finished, and rewinds to the start of the first page
 
         void begin() { offset = used = round_up(used, alignment); }
         void write(binary_view contents)
         {
-            if(used + contents.size > size) throw std::runtime_error("out of memory");
-            memcpy(mapped + used, contents.data, contents.size);
+            if(used + contents.size > pages[current_page].size) next_page(used - offset + contents.size);
+            memcpy(pages[current_page].mapped + used, contents.data, contents.size);
             used += contents.size;
+            frame_bytes += contents.size;
         }
-        rhi::buffer_range end() { return {*buffer, offset, used-offset}; }
+        rhi::buffer_range end() { return {*pages[current_page].buffer, offset, used-offset}; }
 
         rhi::buffer_range upload(binary_view contents) { begin(); write(contents); return end(); }
+
+        // A range at the start of the current page, to be bound to a dynamic uniform buffer and offset by the offsets of ranges returned from upload(...).
+        // Ranges uploaded once later pages are in use must be bound through a range on their own page.
+        rhi::buffer_range get_dynamic_range(size_t size) { return {*pages[current_page].buffer, 0, size}; }
+    private:
+        void next_page(size_t min_size); // Moves the range being written to the start of a later page with room for at least min_size bytes
+    };
+    
+    // gfx::descriptor_pool_chain allocates from a list of rhi::descriptor_pools, creating a new pool whenever the existing ones run out of space.
+    // Pools are kept across reset() so that a steady workload stops creating them. The peak number of sets allocated between resets is tracked over a
+    // window of recent resets, so that it follows the current workload, rather than its largest ever frame, when sizing pools.
+    class descriptor_pool_chain
+    {
+        rhi::ptr<rhi::device> dev;
+        std::vector<rhi::ptr<rhi::descriptor_pool>> pools;
+        size_t current_pool, allocated_sets;
+        size_t window_resets, window_peak_sets, last_window_peak_sets; // The peak is kept for the window in progress and the one before it
+    public:
+        static constexpr size_t peak_window = 120; // Resets per window
+
+        descriptor_pool_chain() : current_pool{0}, allocated_sets{0}, window_resets{0}, window_peak_sets{0}, last_window_peak_sets{0} {}
+        descriptor_pool_chain(rhi::device & dev) : dev{&dev}, current_pool{0}, allocated_sets{0}, window_resets{0}, window_peak_sets{0}, last_window_peak_sets{0} {}
+
+        size_t get_pool_count() const { return pools.size(); }
+        size_t get_allocated_sets() const { return allocated_sets; } // Sets allocated since the last reset()
+        size_t get_peak_sets() const { return std::max(window_peak_sets, last_window_peak_sets); } // High-water mark of get_allocated_sets() over the last peak_window to 2*peak_window resets
+
+        void reset() 
+        { 
+            for(size_t i=0; i<pools.size() && i<=current_pool; ++i) pools[i]->reset();
+            current_pool = allocated_sets = 0;
+            if(++window_resets == peak_window)
+            {
+                last_window_peak_sets = window_peak_sets;
+                window_peak_sets = window_resets = 0;
+            }
+        }
+
+        rhi::ptr<rhi::descriptor_set> alloc(const rhi::descriptor_set_layout & layout)
+        {
+            for(; current_pool < pools.size(); ++current_pool) if(auto set = pools[current_pool]->alloc(layout)) return track(set);
+            pools.push_back(dev->create_descriptor_pool());
+            if(auto set = pools.back()->alloc(layout)) return track(set);
+            throw std::logic_error("descriptor_set_layout too large for an empty descriptor_pool");
+        }
+    private:
+        rhi::ptr<rhi::descriptor_set> track(rhi::ptr<rhi::descriptor_set> set) { window_peak_sets = std::max(window_peak_sets, ++allocated_sets); return set; }
     };
     
     // gfx::descriptor_set wraps rhi::descriptor_set, but remembers its pipeline and set index, and provides access to transient resources
     class descriptor_set
     {
+        struct write_desc { int binding; rhi::buffer * buffer; size_t offset, size; rhi::sampler * sampler; rhi::image * image; int mip; };
+
         const rhi::pipeline_layout & layout;
         const int set_index;
-        const rhi::ptr<rhi::descriptor_set> set;
+        descriptor_pool_chain & pool;
+        rhi::ptr<rhi::descriptor_set> set;
         dynamic_buffer & uniforms;
+        std::vector<write_desc> writes;                 // Replayed into a new set if its dynamic uniforms move to another page of uniforms
+        const rhi::buffer * dynamic_page;               // The page of uniforms addressed by the set's dynamic uniform buffer, if any
     public:
-        descriptor_set(const rhi::pipeline_layout & layout, int set_index, rhi::descriptor_pool & pool, dynamic_buffer & uniforms) : 
-            layout(layout), set_index(set_index), set{pool.alloc(layout.get_descriptor_set_layout(set_index))}, uniforms(uniforms) {}
+        descriptor_set(const rhi::pipeline_layout & layout, int set_index, descriptor_pool_chain & pool, dynamic_buffer & uniforms) : 
+            layout(layout), set_index(set_index), pool(pool), set{pool.alloc(layout.get_descriptor_set_layout(set_index))}, uniforms(uniforms), dynamic_page{nullptr} {}
 
-        void write(int binding, rhi::buffer_range range) { set->write(binding, range); }
-        void write(int binding, gfx::binary_view view) { set->write(binding, uniforms.upload(view)); }
-        void write(int binding, rhi::sampler & sampler, rhi::image & image) { set->write(binding, sampler, image); }
+        void write(int binding, rhi::buffer_range range) { set->write(binding, range); writes.push_back({binding, &range.buffer, range.offset, range.size, nullptr, nullptr, 0}); }
+        void write(int binding, gfx::binary_view view) { write(binding, uniforms.upload(view)); }
+        void write(int binding, rhi::sampler & sampler, rhi::image & image) { set->write(binding, sampler, image); writes.push_back({binding, nullptr, 0, 0, &sampler, &image, 0}); }
+        void write(int binding, rhi::image & image, int mip) { set->write(binding, image, mip); writes.push_back({binding, nullptr, 0, 0, nullptr, &image, mip}); }
+        void write_dynamic(int binding, size_t size) 
+        { 
+            const auto range = uniforms.get_dynamic_range(size);
+            set->write(binding, range); 
+            writes.push_back({binding, nullptr, 0, size, nullptr, nullptr, 0});
+            dynamic_page = &range.buffer;
+        }
 
+        rhi::descriptor_set & get() const { return *set; } // Replaced whenever bind(cmd, dynamic_uniforms) moves the dynamic uniforms to another page
         void bind(rhi::command_buffer & cmd) const { cmd.bind_descriptor_set(layout, set_index, *set); }
+        void bind(rhi::command_buffer & cmd, binary_view dynamic_uniforms) // Uploads the contents of a set's only dynamic uniform buffer, and binds it at their offset
+        { 
+            const auto range = uniforms.upload(dynamic_uniforms);
+            if(&range.buffer != dynamic_page) rewrite_dynamic(range.buffer);
+            const uint32_t offset = exactly(range.offset);
+            cmd.bind_descriptor_set(layout, set_index, *set, {offset}); 
+        }
+    private:
+        void rewrite_dynamic(rhi::buffer & page);
     };
 
     struct transient_resource_pool
     {
-        rhi::ptr<rhi::descriptor_pool> descriptors;
+        descriptor_pool_chain descriptors;
         dynamic_buffer uniforms, vertices, indices;
         uint64_t last_submission_id=0;
 
         transient_resource_pool() = default;
         transient_resource_pool(rhi::device & dev) : 
-            descriptors{dev.create_descriptor_pool()}, 
+            descriptors{dev}, 
             uniforms{dev, rhi::uniform_buffer_bit, 1024*1024},
             vertices{dev, rhi::vertex_buffer_bit, 1024*1024},
             indices{dev, rhi::index_buffer_bit, 1024*1024} {}
@@ -113,18 +304,117 @@ namespace gfx
         void begin_frame(rhi::device & dev)
         {
             dev.wait_until_complete(last_submission_id);
-            descriptors->reset();
+            descriptors.reset();
             uniforms.reset();
             vertices.reset();
             indices.reset();
         }
 
-        descriptor_set alloc_descriptor_set(const rhi::pipeline_layout & layout, int set_index) { return {layout, set_index, *descriptors, uniforms}; }
-        descriptor_set alloc_descriptor_set(const rhi::pipeline & pipeline, int set_index) { return {pipeline.get_layout(), set_index, *descriptors, uniforms}; }
+        descriptor_set alloc_descriptor_set(const rhi::pipeline_layout & layout, int set_index) { return {layout, set_index, descriptors, uniforms}; }
+        descriptor_set alloc_descriptor_set(const rhi::pipeline & pipeline, int set_index) { return {pipeline.get_layout(), set_index, descriptors, uniforms}; }
 
         void end_frame(rhi::device & dev) { last_submission_id = dev.get_last_submission_id(); }
     };
 
+    // Time spent in each phase of a frame, as measured by gfx::frame_scheduler
+    struct frame_timing
+    {
+        double wait_ms;     // Time spent in begin_frame() waiting for the GPU to finish with an earlier frame
+        double cpu_ms;      // Time between begin_frame() returning and submitted(), or end_frame() if submitted() was not called
+        double present_ms;  // Time between submitted() and end_frame(), spent submitting, acquiring and presenting
+        double interval_ms; // Time between successive calls to begin_frame()
+    };
+
+    // gfx::frame_scheduler owns one transient_resource_pool per frame in flight, and cycles through them. begin_frame() waits until the GPU has finished with
+    // the oldest frame before handing its pool out again, so the CPU may run up to frames_in_flight-1 frames ahead of the GPU. Two frames in flight give lower
+    // latency, three give the GPU more queued work to overlap with. Time spent waiting is reported separately from time spent recording, to guide that choice.
+    // Calling submitted() just before submitting and presenting a frame stops its CPU timer, so that blocking on swapchain acquire or present, such as waiting
+    // for vertical blank, is reported as present time rather than as CPU time.
+    class frame_scheduler
+    {
+        rhi::ptr<rhi::device> dev;
+        std::vector<std::unique_ptr<transient_resource_pool>> pools; // Held by pointer, so that adding pools does not move those already handed out
+        size_t current_pool;
+        std::chrono::steady_clock::time_point last_begin, wait_end, submit_time;
+        bool is_submitted;
+        frame_timing current, last, average;
+        uint64_t frames, gpu_bound_frames;
+    public:
+        // Frames which waited longer than this in begin_frame() are counted as GPU bound. The wait is for the fence of an earlier submission, which on some
+        // backends only signals once that frame has also been presented, so a frame throttled by vertical sync is counted even if the GPU was otherwise idle.
+        // Compare wait_ms against the GPU timers of rhi::command_buffer to tell the two apart.
+        static constexpr double gpu_bound_threshold_ms = 0.5;
+
+        frame_scheduler(rhi::device & dev, int frames_in_flight);
+
+        int get_frames_in_flight() const { return exactly(pools.size()); }
+        uint64_t get_frame_count() const { return frames; }
+        uint64_t get_gpu_bound_frames() const { return gpu_bound_frames; }
+        const frame_timing & get_last_timing() const { return last; } // Timing of the most recently ended frame
+        const frame_timing & get_average_timing() const { return average; } // Exponential moving average of the timings of recent frames
+
+        // Waits until the GPU is idle, then changes the number of pools. Must be called between frames, as removing pools destroys any descriptor_sets allocated from them.
+        void set_frames_in_flight(int frames_in_flight);
+
+        transient_resource_pool & begin_frame();
+        void submitted(); // Marks the end of the frame's CPU work, just before it is submitted and presented
+        void end_frame();
+    };
+
+    // gfx::descriptor_cache hands out persistent descriptor sets for bindings which rarely change, such as those of materials. Sets are keyed by their layout,
+    // the resources written to them, and the contents of any uniforms written through them, so that identical bindings share a single rhi::descriptor_set.
+    // Cached sets hold references to their resources, and are evicted once unused for max_unused_frames, allowing released resources to be destroyed.
+    // Eviction is otherwise purely by age, so code which replaces a resource, such as a reloaded texture, should invalidate(...) the old one to release it
+    // immediately. Only buffers whose contents never change may be cached, so ranges of mapped buffers, such as those of gfx::dynamic_buffer, are rejected.
+    class descriptor_cache
+    {
+        struct write_desc { int binding; rhi::buffer * buffer; size_t offset, size; rhi::sampler * sampler; rhi::image * image; int mip; };
+        struct entry { rhi::ptr<rhi::descriptor_set> set; std::vector<rhi::ptr<const rhi::object>> resources; uint64_t last_used_frame; };
+        struct retired_pools { descriptor_pool_chain pools; uint64_t submission_id, frame; };
+
+        rhi::ptr<rhi::device> dev;
+        descriptor_pool_chain pools;
+        std::vector<retired_pools> retired;
+        std::unordered_map<std::string, entry> entries;
+        size_t evicted_sets;
+        uint64_t frame;
+    public:
+        static constexpr uint64_t max_unused_frames = 60;
+
+        // Accumulates the writes to a cached descriptor set, and looks up or creates a matching set when bound
+        class set_builder
+        {
+            descriptor_cache & cache;
+            const rhi::pipeline_layout & layout;
+            const int set_index;
+            std::vector<write_desc> writes;
+            std::string key; // Identity of the layout and all writes, followed by the contents of uniforms
+        public:
+            set_builder(descriptor_cache & cache, const rhi::pipeline_layout & layout, int set_index);
+
+            void write(int binding, rhi::buffer_range range); // Throws if range is in a mapped buffer
+            void write(int binding, gfx::binary_view view); // Uniforms are stored in a buffer owned by the cached set
+            void write(int binding, rhi::sampler & sampler, rhi::image & image);
+            void write(int binding, rhi::image & image, int mip);
+
+            rhi::descriptor_set & get() const { return cache.get(layout.get_descriptor_set_layout(set_index), writes, key); } // Valid until the cache's next begin_frame()
+            void bind(rhi::command_buffer & cmd) const { cmd.bind_descriptor_set(layout, set_index, get()); }
+        };
+
+        descriptor_cache(rhi::device & dev) : dev{&dev}, pools{dev}, evicted_sets{0}, frame{0} {}
+
+        size_t get_cached_sets() const { return entries.size(); }
+        size_t get_retired_pools() const { return retired.size(); } // Pool chains awaiting the completion of the GPU work which used them
+
+        set_builder begin_set(const rhi::pipeline_layout & layout, int set_index) { return {*this, layout, set_index}; }
+        set_builder begin_set(const rhi::pipeline & pipeline, int set_index) { return {*this, pipeline.get_layout(), set_index}; }
+
+        void begin_frame(); // Evicts stale sets, and recycles descriptor pools once most of their sets have been evicted
+        void invalidate(const rhi::object & resource); // Immediately evicts all sets referencing resource
+    private:
+        rhi::descriptor_set & get(const rhi::descriptor_set_layout & layout, const std::vector<write_desc> & writes, const std::string & key);
+    };
+
     class window
     {
         struct ignore { template<class... T> operator std::function<void(T...)>() const { return [](T...) {}; } };
@@ -167,9 +457,14 @@ namespace gfx
 
     template<class T> struct vertex_binder : rhi::vertex_binding_desc
     {
-        vertex_binder(int binding_index) { index = binding_index; stride = sizeof(T); }
+        vertex_binder(int binding_index, rhi::input_rate input_rate=rhi::input_rate::per_vertex) { index = binding_index; stride = sizeof(T); rate = input_rate; }
         vertex_binder attribute(int attribute_index, float2 T::*field) { attributes.push_back({attribute_index, rhi::attribute_format::float2, exactly(member_offset(field))}); return *this; }
         vertex_binder attribute(int attribute_index, float3 T::*field) { attributes.push_back({attribute_index, rhi::attribute_format::float3, exactly(member_offset(field))}); return *this; }
         vertex_binder attribute(int attribute_index, float4 T::*field) { attributes.push_back({attribute_index, rhi::attribute_format::float4, exactly(member_offset(field))}); return *this; }
+        vertex_binder attribute(int attribute_index, float4x4 T::*field) // Occupies four consecutive attribute indices, one per column
+        { 
+            for(int i=0; i<4; ++i) attributes.push_back({attribute_index+i, rhi::attribute_format::float4, exactly(member_offset(field) + sizeof(float4)*i)}); 
+            return *this; 
+        }
     };
 }
\ No newline at end of file
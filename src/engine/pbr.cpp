@@ -95,7 +95,7 @@ pbr::device_objects::device_objects(rhi::ptr<rhi::device> dev, const shaders & s
 rhi::ptr<rhi::image> pbr::device_objects::create_cubemap_from_spheremap(gfx::transient_resource_pool & pool, int width, rhi::image & spheremap, const coord_system & preferred_coords)
 {
     auto target = dev->create_image({rhi::image_shape::cube, {width,width,1}, exactly(std::ceil(std::log2(width)+1)), rhi::image_format::rgba_float16, rhi::sampled_image_bit|rhi::color_attachment_bit}, {});
-    auto set = pool.descriptors->alloc(*op_set_layout);
+    auto set = pool.descriptors.alloc(*op_set_layout);
     set->write(0, *spheremap_sampler, spheremap);
     set->write(1, pool.uniforms.upload(get_transform_matrix(coord_transform{preferred_coords, {coord_axis::right, coord_axis::down, coord_axis::forward}})));
     render_to_cubemap(*target, 0, {width,width}, true, [&](rhi::command_buffer & cmd)
@@ -109,7 +109,7 @@ rhi::ptr<rhi::image> pbr::device_objects::create_cubemap_from_spheremap(gfx::tra
 rhi::ptr<rhi::image> pbr::device_objects::create_irradiance_cubemap(gfx::transient_resource_pool & pool, int width, rhi::image & cubemap)
 {
     auto target = dev->create_image({rhi::image_shape::cube, {width,width,1}, 1, rhi::image_format::rgba_float16, rhi::sampled_image_bit|rhi::color_attachment_bit}, {});
-    auto set = pool.descriptors->alloc(*op_set_layout);
+    auto set = pool.descriptors.alloc(*op_set_layout);
     set->write(0, *cubemap_sampler, cubemap);
     render_to_cubemap(*target, 0, {width,width}, false, [&](rhi::command_buffer & cmd)
     {
@@ -124,7 +124,7 @@ rhi::ptr<rhi::image> pbr::device_objects::create_reflectance_cubemap(gfx::transi
     auto target = dev->create_image({rhi::image_shape::cube, {width,width,1}, 5, rhi::image_format::rgba_float16, rhi::sampled_image_bit|rhi::color_attachment_bit}, {});
     for(int mip=0; mip<5; ++mip)
     {
-        auto set = pool.descriptors->alloc(*op_set_layout);
+        auto set = pool.descriptors.alloc(*op_set_layout);
         set->write(0, *cubemap_sampler, cubemap);
         set->write(1, pool.uniforms.upload(mip/4.0f));
         render_to_cubemap(*target, mip, {width,width}, false, [&](rhi::command_buffer & cmd)
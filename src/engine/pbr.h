@@ -90,6 +90,15 @@ namespace pbr
     {
         alignas(16) float4x4 model_matrix;
         alignas(16) float4x4 model_matrix_it;
+        object_uniforms() = default;
         object_uniforms(float4x4 model_matrix) : model_matrix{model_matrix}, model_matrix_it{inverse(transpose(model_matrix))} {}
     };
+
+    // Supplies object_uniforms per instance to batched-mesh.vert, for the instanced variants of pipelines drawn through gfx::render_queue
+    inline rhi::vertex_binding_desc get_object_instance_binding(int binding_index)
+    {
+        return gfx::vertex_binder<object_uniforms>(binding_index, rhi::input_rate::per_instance)
+            .attribute(5, &object_uniforms::model_matrix)
+            .attribute(9, &object_uniforms::model_matrix_it);
+    }
 }
\ No newline at end of file
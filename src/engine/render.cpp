@@ -0,0 +1,294 @@
+#include "render.h"
+#include "rhi/rhi-internal.h"
+#include <utility>
+
+template<class Map, class Key> static uint32_t get_id(Map & ids, const Key & key)
+{
+    return ids.emplace(key, exactly(ids.size())).first->second;
+}
+
+// Positive floats compare in the same order as their bit patterns, so the high bits of a depth serve as a coarse, monotonic key
+static uint32_t quantize_depth(float depth)
+{
+    if(!(depth > 0)) return 0;
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    return bits >> 11;
+}
+
+// Sorts items by key with an LSD radix sort over each byte, skipping those bytes which are the same across all keys
+template<class Item> static void radix_sort(std::vector<Item> & items, std::vector<Item> & scratch)
+{
+    size_t counts[8][256] {};
+    for(auto & item : items) for(int i=0; i<8; ++i) ++counts[i][(item.key >> i*8) & 0xFF];
+
+    scratch.resize(items.size());
+    for(int i=0; i<8; ++i)
+    {
+        if(items.empty() || counts[i][(items[0].key >> i*8) & 0xFF] == items.size()) continue;
+        size_t offset = 0;
+        for(auto & count : counts[i]) offset += std::exchange(count, offset);
+        for(auto & item : items) scratch[counts[i][(item.key >> i*8) & 0xFF]++] = item;
+        swap(items, scratch);
+    }
+}
+
+gfx::render_queue::render_queue(int material_set_index, int object_set_index, int instance_binding) : 
+    material_set_index{material_set_index}, object_set_index{object_set_index}, instance_binding{instance_binding}, last_stats{}
+{
+    for(auto & order : pass_orders) order = depth_order::front_to_back;
+}
+
+void gfx::render_queue::set_depth_order(int pass, depth_order order)
+{
+    if(pass < 0 || pass >= max_passes) throw std::logic_error("pass out of range");
+    pass_orders[pass] = order;
+}
+
+void gfx::render_queue::set_instanced_variant(const rhi::pipeline & pipeline, const rhi::pipeline & instanced)
+{
+    if(&instanced.get_layout() != &pipeline.get_layout()) throw std::logic_error("instanced variant must share the layout of its pipeline");
+    instanced_variants[&pipeline] = &instanced;
+}
+
+void gfx::render_queue::add(int pass, const rhi::pipeline & pipeline, const rhi::descriptor_set * material_set, const mesh_view & mesh, binary_view object_uniforms, float depth)
+{
+    if(pass < 0 || pass >= max_passes) throw std::logic_error("pass out of range");
+
+    // Identifiers which overflow their fields wrap around, which costs some redundant binds but never affects correctness
+    const uint64_t pipeline_id = get_id(pipeline_ids, &pipeline) & 0xFFF;
+    const uint64_t material_id = get_id(material_ids, material_set) & 0xFFFF;
+    const uint64_t mesh_id = get_id(mesh_ids, std::pair<const void *, int>{mesh.index_buffer, mesh.first_index}) & 0xFFF;
+    const uint64_t depth_bits = quantize_depth(depth);
+    const uint64_t key = uint64_t(pass) << 60 | (pass_orders[pass] == depth_order::front_to_back
+        ? pipeline_id << 48 | material_id << 32 | mesh_id << 20 | depth_bits
+        : (~depth_bits & 0xFFFFF) << 40 | pipeline_id << 28 | material_id << 12 | mesh_id);
+
+    items.push_back({key, exactly(packets.size())});
+    packets.push_back({&pipeline, material_set, mesh, uniforms.size(), object_uniforms.size});
+    uniforms.insert(uniforms.end(), reinterpret_cast<const char *>(object_uniforms.data), reinterpret_cast<const char *>(object_uniforms.data) + object_uniforms.size);
+}
+
+void gfx::render_queue::draw(rhi::command_buffer & cmd, transient_resource_pool & pool)
+{
+    radix_sort(items, scratch);
+
+    last_stats = {};
+    const rhi::pipeline * pipeline = nullptr;
+    const rhi::descriptor_set * material_set = nullptr;
+    const mesh_view * mesh = nullptr;
+    std::unordered_map<const rhi::pipeline_layout *, descriptor_set> object_sets;
+    for(size_t i=0; i<items.size(); )
+    {
+        // Sorting leaves draws which share all of their state next to each other, so find the run beginning at this one, if it can be instanced.
+        // Runs of a single draw use the instanced variant too, so that a lone draw between two batches does not switch pipelines back and forth.
+        auto & p = packets[items[i].index];
+        auto variant = instanced_variants.find(p.pipeline);
+        const bool instanced = variant != instanced_variants.end();
+        size_t instances = 1;
+        if(instanced)
+        {
+            for(; i+instances < items.size(); ++instances)
+            {
+                auto & q = packets[items[i+instances].index];
+                if(q.pipeline != p.pipeline || q.material_set != p.material_set || q.mesh != p.mesh || q.uniforms_size != p.uniforms_size) break;
+            }
+        }
+
+        auto & pipe = instanced ? *variant->second : *p.pipeline;
+        if(&pipe != pipeline)
+        {
+            // Vertex buffer and descriptor set bindings do not necessarily survive a change of pipeline, so rebind everything
+            cmd.bind_pipeline(pipe);
+            pipeline = &pipe;
+            material_set = nullptr;
+            mesh = nullptr;
+            ++last_stats.pipeline_binds;
+        }
+        if(p.material_set && p.material_set != material_set)
+        {
+            cmd.bind_descriptor_set(pipeline->get_layout(), material_set_index, *p.material_set);
+            material_set = p.material_set;
+            ++last_stats.material_binds;
+        }
+        if(!mesh || !p.mesh.shares_buffers(*mesh))
+        {
+            p.mesh.bind(cmd);
+            mesh = &p.mesh;
+            ++last_stats.mesh_binds;
+        }
+
+        if(instanced)
+        {
+            pool.vertices.begin();
+            for(size_t j=0; j<instances; ++j) pool.vertices.write({p.uniforms_size, uniforms.data() + packets[items[i+j].index].uniforms_offset});
+            cmd.bind_vertex_buffer(instance_binding, pool.vertices.end());
+            p.mesh.draw(cmd, 0, exactly(instances));
+            ++last_stats.instanced_draw_calls;
+        }
+        else
+        {
+            auto & layout = pipeline->get_layout();
+            auto it = object_sets.find(&layout);
+            if(it == object_sets.end())
+            {
+                it = object_sets.emplace(&layout, pool.alloc_descriptor_set(layout, object_set_index)).first;
+                it->second.write_dynamic(0, p.uniforms_size);
+            }
+            it->second.bind(cmd, {p.uniforms_size, uniforms.data() + p.uniforms_offset});
+            p.mesh.draw(cmd);
+        }
+        ++last_stats.draw_calls;
+        last_stats.draws += instances;
+        i += instances;
+    }
+
+    packets.clear();
+    items.clear();
+    uniforms.clear();
+    pipeline_ids.clear();
+    material_ids.clear();
+    mesh_ids.clear();
+}
+
+DOCTEST_TEST_CASE("render_queue sorts and batches draws to minimize state changes")
+{
+    auto dev = rhi::create_null_device();
+
+    auto material_layout = dev->create_descriptor_set_layout({{0, rhi::descriptor_type::uniform_buffer, 1}});
+    auto object_layout = dev->create_descriptor_set_layout({{0, rhi::descriptor_type::uniform_buffer_dynamic, 1}});
+    auto pipe_layout = dev->create_pipeline_layout({material_layout, object_layout});
+    const rhi::vertex_binding_desc binding {0, sizeof(float3), {{0, rhi::attribute_format::float3, 0}}};
+    rhi::ptr<rhi::pipeline> pipes[2];
+    for(auto & pipe : pipes) pipe = dev->create_pipeline({pipe_layout, {binding}, {}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, std::nullopt, std::nullopt, {}});
+
+    const float3 vertices[] {{0,0,0}, {1,0,0}, {0,1,0}};
+    const uint32_t indices[] {0,1,2};
+    const gfx::simple_mesh meshes[] {{*dev, vertices, indices}, {*dev, vertices, indices}};
+    std::vector<gfx::mesh_view> mesh_views {meshes[0], meshes[1]};
+    const gfx::static_buffer material_uniforms {*dev, rhi::uniform_buffer_bit, float4{1,1,1,1}};
+    auto material_pool = dev->create_descriptor_pool();
+    rhi::ptr<rhi::descriptor_set> materials[] {material_pool->alloc(*material_layout), material_pool->alloc(*material_layout)};
+    for(auto & material : materials) material->write(0, material_uniforms);
+    gfx::transient_resource_pool pool {*dev};
+
+    auto image = dev->create_image({rhi::image_shape::_2d, {4,4,1}, 1, rhi::image_format::rgba_unorm8, rhi::color_attachment_bit}, {});
+    auto fb = dev->create_framebuffer({{4,4}, {{image, 0, 0}}});
+    rhi::render_pass_desc pass;
+    pass.color_attachments = {{rhi::dont_care{}, rhi::dont_care{}}};
+
+    // Interleave 64 draws across every combination of state, which recorded in order would change state on every draw
+    gfx::render_queue queue {0, 1};
+    auto draw_queue = [&]()
+    {
+        for(int i=0; i<64; ++i) queue.add(0, *pipes[i%2], materials[i/2%2], mesh_views[i/4%2], float4x4{linalg::identity}, static_cast<float>(64-i));
+        DOCTEST_CHECK(queue.get_queued_draws() == 64);
+        auto cmd = dev->create_command_buffer();
+        cmd->begin_render_pass(pass, *fb);
+        queue.draw(*cmd, pool);
+        cmd->end_render_pass();
+        dev->submit(*cmd);
+        DOCTEST_CHECK(queue.get_queued_draws() == 0);
+        return queue.get_stats();
+    };
+    const auto before = *rhi::get_null_device_stats(*dev);
+
+    DOCTEST_SUBCASE("each draw is recorded individually, binding only the state which changes")
+    {
+        const auto stats = draw_queue();
+        DOCTEST_CHECK(stats.draws == 64);
+        DOCTEST_CHECK(stats.draw_calls == 64);
+        DOCTEST_CHECK(stats.pipeline_binds == 2);
+        DOCTEST_CHECK(stats.material_binds == 4);
+        DOCTEST_CHECK(stats.mesh_binds == 8);
+        DOCTEST_CHECK(rhi::get_null_device_stats(*dev)->draws == before.draws + 64);
+    }
+
+    DOCTEST_SUBCASE("draws of pipelines with instanced variants are batched")
+    {
+        const rhi::vertex_binding_desc instance_binding {1, sizeof(float4x4), {{1, rhi::attribute_format::float4, 0}}, rhi::input_rate::per_instance};
+        rhi::ptr<rhi::pipeline> instanced_pipes[2];
+        for(int i=0; i<2; ++i)
+        {
+            instanced_pipes[i] = dev->create_pipeline({pipe_layout, {binding, instance_binding}, {}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, std::nullopt, std::nullopt, {}});
+            queue.set_instanced_variant(*pipes[i], *instanced_pipes[i]);
+        }
+        const auto stats = draw_queue();
+        DOCTEST_CHECK(stats.draws == 64);
+        DOCTEST_CHECK(stats.draw_calls == 8);
+        DOCTEST_CHECK(stats.instanced_draw_calls == 8);
+        DOCTEST_CHECK(stats.pipeline_binds == 2);
+        DOCTEST_CHECK(rhi::get_null_device_stats(*dev)->draws == before.draws + 8);
+        DOCTEST_CHECK(rhi::get_null_device_stats(*dev)->instances == before.instances + 64);
+
+        auto other_layout = dev->create_pipeline_layout({material_layout});
+        auto mismatched = dev->create_pipeline({other_layout, {binding, instance_binding}, {}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, std::nullopt, std::nullopt, {}});
+        DOCTEST_CHECK_THROWS_AS(queue.set_instanced_variant(*pipes[0], *mismatched), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("a lone draw between two batches is drawn with the instanced variant, without switching pipelines")
+    {
+        const rhi::vertex_binding_desc instance_binding {1, sizeof(float4x4), {{1, rhi::attribute_format::float4, 0}}, rhi::input_rate::per_instance};
+        auto instanced_pipe = dev->create_pipeline({pipe_layout, {binding, instance_binding}, {}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, std::nullopt, std::nullopt, {}});
+        queue.set_instanced_variant(*pipes[0], *instanced_pipe);
+        for(int i=0; i<4; ++i) queue.add(0, *pipes[0], materials[0], mesh_views[0], float4x4{linalg::identity}, 1.0f);
+        queue.add(0, *pipes[0], materials[0], mesh_views[1], float4x4{linalg::identity}, 1.0f);
+        for(int i=0; i<4; ++i) queue.add(0, *pipes[0], materials[1], mesh_views[0], float4x4{linalg::identity}, 1.0f);
+
+        auto cmd = dev->create_command_buffer();
+        cmd->begin_render_pass(pass, *fb);
+        queue.draw(*cmd, pool);
+        cmd->end_render_pass();
+        dev->submit(*cmd);
+        const auto stats = queue.get_stats();
+        DOCTEST_CHECK(stats.draws == 9);
+        DOCTEST_CHECK(stats.draw_calls == 3);
+        DOCTEST_CHECK(stats.instanced_draw_calls == 3);
+        DOCTEST_CHECK(stats.pipeline_binds == 1);
+        DOCTEST_CHECK(rhi::get_null_device_stats(*dev)->pipeline_binds == before.pipeline_binds + 1);
+        DOCTEST_CHECK(rhi::get_null_device_stats(*dev)->instances == before.instances + 9);
+    }
+
+    DOCTEST_SUBCASE("meshes sharing the buffers of a mesh_arena are bound once per pipeline")
+    {
+        gfx::mesh_arena arena {*dev, sizeof(float3), 1024, 1024};
+        const gfx::arena_mesh arena_meshes[] {{arena, vertices, indices}, {arena, vertices, indices}};
+        arena.flush();
+        mesh_views = {arena_meshes[0], arena_meshes[1]};
+        DOCTEST_CHECK(mesh_views[1].first_index == 3);
+        DOCTEST_CHECK(mesh_views[1].vertex_offset == 3);
+
+        const auto stats = draw_queue();
+        DOCTEST_CHECK(stats.draw_calls == 64);
+        DOCTEST_CHECK(stats.pipeline_binds == 2);
+        DOCTEST_CHECK(stats.mesh_binds == 2);
+        DOCTEST_CHECK(rhi::get_null_device_stats(*dev)->vertex_buffer_binds == before.vertex_buffer_binds + 2);
+    }
+
+    DOCTEST_SUBCASE("materials which index a resource table share one material binding, and pass their indices as object uniforms")
+    {
+        auto table = dev->create_resource_table(2);
+        auto sampler = dev->create_sampler({rhi::filter::nearest, rhi::filter::nearest, std::nullopt, rhi::address_mode::repeat, rhi::address_mode::repeat, rhi::address_mode::repeat});
+        rhi::ptr<rhi::image> textures[2];
+        for(int i=0; i<2; ++i)
+        {
+            textures[i] = dev->create_image({rhi::image_shape::_2d, {4,4,1}, 1, rhi::image_format::rgba_unorm8, rhi::sampled_image_bit}, {});
+            table->write(i, *sampler, *textures[i]);
+        }
+        auto table_pipe_layout = dev->create_pipeline_layout({&table->get_descriptor_set_layout(), object_layout});
+        for(auto & pipe : pipes) pipe = dev->create_pipeline({table_pipe_layout, {binding}, {}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, std::nullopt, std::nullopt, {}});
+
+        struct table_uniforms { float4x4 model_matrix; int32_t texture_index; };
+        for(int i=0; i<64; ++i) queue.add(0, *pipes[i%2], &table->get_descriptor_set(), mesh_views[i/4%2], table_uniforms{linalg::identity, i/2%2}, static_cast<float>(64-i));
+        auto cmd = dev->create_command_buffer();
+        cmd->begin_render_pass(pass, *fb);
+        queue.draw(*cmd, pool);
+        cmd->end_render_pass();
+        dev->submit(*cmd);
+        const auto stats = queue.get_stats();
+        DOCTEST_CHECK(stats.draw_calls == 64);
+        DOCTEST_CHECK(stats.pipeline_binds == 2);
+        DOCTEST_CHECK(stats.material_binds == 2);
+        DOCTEST_CHECK(rhi::get_null_device_stats(*dev)->image_bindings == before.image_bindings + 2*2);
+    }
+}
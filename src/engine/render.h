@@ -0,0 +1,55 @@
+#pragma once
+#include "graphics.h"
+#include <map>
+
+namespace gfx
+{
+    // gfx::render_queue collects the draws of a frame and records them in an order which minimizes state changes. Each draw is given a 64-bit sort key,
+    //
+    //     | pass:4 | pipeline:12 | material:16 | mesh:12 | depth:20 |
+    //
+    // which groups draws by pass, then by pipeline, material and mesh, and orders the draws sharing all of these front-to-back, to make the most of early
+    // depth testing. Passes set to back_to_front, such as those containing blended surfaces, move depth (inverted) up to sit directly beneath the pass.
+    // Keys are radix sorted, and pipelines, material sets and mesh buffers are only bound when they differ from those of the previous draw, so meshes allocated
+    // from the same block of a mesh_arena are drawn one after another without rebinding their buffers. If a pipeline has an
+    // instanced variant, consecutive draws sharing its pipeline, material and mesh are merged into one instanced draw, with their object uniforms packed
+    // into a per-instance vertex buffer. Draws which share their state with no others are drawn through the variant as a single instance, so that all draws
+    // of the pipeline share one pipeline binding.
+    class render_queue
+    {
+    public:
+        enum class depth_order { front_to_back, back_to_front };
+        struct stats { size_t draws, draw_calls, instanced_draw_calls, pipeline_binds, material_binds, mesh_binds; };
+        static constexpr int max_passes = 16;
+    private:
+        struct packet { const rhi::pipeline * pipeline; const rhi::descriptor_set * material_set; mesh_view mesh; size_t uniforms_offset, uniforms_size; };
+        struct sort_item { uint64_t key; uint32_t index; };
+
+        int material_set_index, object_set_index, instance_binding;
+        depth_order pass_orders[max_passes];
+        std::unordered_map<const rhi::pipeline *, rhi::ptr<const rhi::pipeline>> instanced_variants;
+        std::vector<packet> packets;
+        std::vector<sort_item> items, scratch;
+        std::vector<char> uniforms;                                     // Object uniforms of all queued draws, uploaded as each draw is recorded
+        std::unordered_map<const void *, uint32_t> pipeline_ids, material_ids;   // Assigned in order of first use since the last draw(...)
+        std::map<std::pair<const void *, int>, uint32_t> mesh_ids;              // Keyed by index buffer and first index, as arena meshes share their buffers
+        stats last_stats;
+    public:
+        render_queue(int material_set_index, int object_set_index, int instance_binding=1);
+
+        void set_depth_order(int pass, depth_order order);
+
+        // Registers instanced as a variant of pipeline which reads object uniforms from a per-instance vertex buffer at instance_binding, instead of from the set at
+        // object_set_index. It must share pipeline's layout and vertex bindings, with the addition of instance_binding, whose stride is the size of the uniforms.
+        void set_instanced_variant(const rhi::pipeline & pipeline, const rhi::pipeline & instanced);
+        size_t get_queued_draws() const { return packets.size(); }
+        const stats & get_stats() const { return last_stats; } // Counts from the most recent call to draw(...)
+
+        // Queues a draw of mesh using pipeline, binding material_set (if not null) at material_set_index, and object_uniforms to the single dynamic uniform buffer
+        // of the set at object_set_index. depth is the distance from the viewer along the view direction.
+        void add(int pass, const rhi::pipeline & pipeline, const rhi::descriptor_set * material_set, const mesh_view & mesh, binary_view object_uniforms, float depth);
+
+        // Records all queued draws into cmd in sorted order, allocating transient object descriptor sets and uniforms from pool, and empties the queue
+        void draw(rhi::command_buffer & cmd, transient_resource_pool & pool);
+    };
+}
@@ -22,6 +22,7 @@ namespace rhi
     struct pipeline;
     struct descriptor_pool;
     struct descriptor_set;
+    struct resource_table;
     struct command_buffer;
 
     using buffer_flags = int;
@@ -36,6 +37,7 @@ namespace rhi
     enum class address_mode : int;
     enum class descriptor_type : int;
     enum class attribute_format : int;
+    enum class input_rate : int;
     enum class primitive_topology : int;
     enum class front_face : int;
     enum class cull_mode : int;
@@ -85,7 +87,8 @@ namespace rhi
         int mip_levels;
         image_format format;
         image_flags flags;
-        // Not yet supported: multisampling, arrays
+        int array_layers = 1;   // Number of layers of a _2d_array image, or of cubes in a cube_array image, must be 1 for all other shapes
+        // Not yet supported: multisampling
     };
 
     struct sampler_desc
@@ -108,7 +111,7 @@ namespace rhi
     struct shader_desc { shader_stage stage; std::vector<uint32_t> spirv; };
 
     struct vertex_attribute_desc { int index; attribute_format type; int offset; };
-    struct vertex_binding_desc { int index, stride; std::vector<vertex_attribute_desc> attributes; }; // TODO: per_vertex/per_instance
+    struct vertex_binding_desc { int index, stride; std::vector<vertex_attribute_desc> attributes; input_rate rate {}; };
     struct blend_equation { blend_factor source_factor; blend_op op; blend_factor dest_factor; };
     struct blend_state { bool write_mask; bool enable; blend_equation color, alpha; };
     struct depth_state
@@ -141,6 +144,11 @@ namespace rhi
         std::optional<stencil_state> stencil;   // If non-null, parameters for stencil test, if null, no stencil test or writes are performed
         std::vector<blend_state> blend;         // blending state
     };
+    struct compute_pipeline_desc
+    {
+        ptr<const pipeline_layout> layout;      // descriptors
+        ptr<const shader> stage;                // compute stage
+    };
    
     struct dont_care {};
     struct clear_color { float r,g,b,a; };
@@ -153,9 +161,44 @@ namespace rhi
     {
         std::vector<color_attachment_desc> color_attachments;
         std::optional<depth_attachment_desc> depth_attachment;
+        bool secondary_command_buffers = false; // If true, the pass may only contain execute_commands(...), and all other commands must be recorded into secondary command buffers
     };
     
-    struct device_info { linalg::z_range z_range; bool inverted_framebuffers; };
+    // Layouts of the records read from a buffer created with indirect_buffer_bit, which match the native argument layouts of every backend
+    struct draw_indirect_args { uint32_t vertex_count, instance_count, first_vertex, first_instance; };
+    struct draw_indexed_indirect_args { uint32_t index_count, instance_count, first_index; int32_t vertex_offset; uint32_t first_instance; };
+
+    struct device_info 
+    { 
+        linalg::z_range z_range; 
+        bool inverted_framebuffers; 
+        int max_resource_table_images;  // Largest capacity of a resource_table, or 0 if the device cannot index arrays of images from shaders
+    };
+    struct device_stats
+    {
+        uint64_t submissions, presents, render_passes;                                          // Work submitted to the device
+        uint64_t secondary_command_buffers;                                                     // Secondary command buffers executed within render passes
+        uint64_t timers;                                                                        // GPU timers recorded via begin_timer(...) and end_timer()
+        uint64_t draws, instances, vertices;                                                    // Draw calls, instances drawn, and the vertices or indices they consume
+        uint64_t dispatches, workgroups, memory_barriers;                                       // Compute dispatches, workgroups launched, and barriers between them
+        uint64_t pipeline_binds, descriptor_set_binds, vertex_buffer_binds, index_buffer_binds; // State changes
+        uint64_t buffer_bindings, image_bindings;                                               // Individual descriptors bound via descriptor sets
+        uint64_t storage_buffer_bindings, storage_image_bindings;                               // Individual storage descriptors bound via descriptor sets
+        uint64_t push_constant_updates, push_constant_bytes;                                    // Push constant writes and the bytes they carry
+        uint64_t bytes_uploaded;                                                                // Initial contents of buffers and images
+    };
+    struct memory_stats
+    {
+        uint64_t device_allocations, device_allocated_bytes;    // Blocks of device memory obtained from the driver, including dedicated allocations
+        uint64_t dedicated_allocations;                         // Allocations too large to be placed within a shared block
+        uint64_t suballocations, suballocated_bytes;            // Live buffers and images placed within those blocks
+    };
+    struct timer_result
+    {
+        std::string name;       // As passed to begin_timer(...)
+        uint64_t submission_id; // Submission which contained the timer
+        double milliseconds;    // GPU time elapsed between begin_timer(...) and end_timer()
+    };
     using debug_callback = std::function<void(const char *)>;
 
     struct client_info
@@ -181,22 +224,32 @@ namespace rhi
 
         virtual ptr<buffer> create_buffer(const buffer_desc & desc, const void * initial_data) = 0;
         virtual ptr<sampler> create_sampler(const sampler_desc & desc) = 0;
-        virtual ptr<image> create_image(const image_desc & desc, std::vector<const void *> initial_data) = 0; // one ptr for non-cube, six ptrs in +x,-x,+y,-y,+z,-z order for cube
+        virtual ptr<image> create_image(const image_desc & desc, std::vector<const void *> initial_data) = 0; // one ptr per layer as counted by get_layer_count(desc), six ptrs in +x,-x,+y,-y,+z,-z order for each cube
         virtual ptr<framebuffer> create_framebuffer(const framebuffer_desc & desc) = 0;
         virtual ptr<window> create_window(const int2 & dimensions, std::string_view title) = 0;
 
         virtual ptr<descriptor_set_layout> create_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) = 0;
-        virtual ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets) = 0;
-        virtual ptr<shader> create_shader(const shader_desc & desc) = 0;
+        virtual ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size=0) = 0; // push_constant_size bytes starting at offset 0, visible to all stages, at most 128, declared in shaders by a block which follows std140 rules
+        virtual ptr<shader> create_shader(const shader_desc & desc) = 0; // Throws if the push constant block does not follow std140 rules, as some backends emulate push constants with uniform blocks
         virtual ptr<pipeline> create_pipeline(const pipeline_desc & desc) = 0;
+        virtual ptr<pipeline> create_compute_pipeline(const compute_pipeline_desc & desc) = 0;
+        virtual void precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer) = 0; // Compile a graphics pipeline ahead of time for render passes targeting framebuffer, may be called from a worker thread
 
         virtual ptr<descriptor_pool> create_descriptor_pool() = 0;
-        virtual ptr<command_buffer> create_command_buffer() = 0;
+        virtual ptr<resource_table> create_resource_table(int capacity) = 0; // capacity must be at least 1 and at most get_info().max_resource_table_images
+        virtual ptr<command_buffer> create_command_buffer(bool reusable=false) = 0; // May be called from any thread, and the command buffer recorded on that thread. If reusable, see below
+        virtual ptr<command_buffer> create_secondary_command_buffer(const framebuffer & framebuffer, bool reusable=false) = 0; // As above, but records commands inside a render pass targeting framebuffer, to be issued via execute_commands(...)
+        // A reusable command buffer may be submitted, or executed, any number of times, and keeps the objects its commands refer to alive until it is released. 
+        // Recording ends with its first submission or execution. It may not contain timers, and may only execute secondary command buffers which are themselves reusable.
+        // A reusable primary command buffer may not begin a render pass on a window's swapchain framebuffer, whose backbuffer changes every frame. To replay
+        // commands into a window, record them into a reusable secondary command buffer, and execute it from a primary command buffer recorded each frame.
 
         virtual uint64_t submit(command_buffer & cmd) = 0;
         virtual uint64_t acquire_and_submit_and_present(command_buffer & cmd, window & window) = 0; // Submit commands to execute when the next frame is available, followed by a present
+        virtual uint64_t flush_uploads() = 0; // Submit any pending copies of initial data made by create_buffer(...) and create_image(...), and return a submission id which may be passed to wait_until_complete(...)
         virtual uint64_t get_last_submission_id() = 0;
         virtual void wait_until_complete(uint64_t submission_id) = 0;
+        virtual std::vector<timer_result> get_timer_results() = 0; // Returns, without blocking, the results of timers in submissions which have completed since the last call, in submission order
     };
 
     struct buffer : object 
@@ -218,6 +271,7 @@ namespace rhi
     {
         virtual int get_descriptor_set_count() const = 0;
         virtual const descriptor_set_layout & get_descriptor_set_layout(int index) const = 0;
+        virtual size_t get_push_constant_size() const = 0;
     };
     struct shader : object {};
     struct pipeline : object 
@@ -230,13 +284,25 @@ namespace rhi
     {
         virtual void write(int binding, buffer_range range) = 0;
         virtual void write(int binding, sampler & sampler, image & image) = 0;    
+        virtual void write(int binding, image & image, int mip) = 0; // Binds a single mip level of an image created with storage_image_bit, for reading and writing
     };
     struct descriptor_pool : object 
     {
         virtual void reset() = 0;
-        virtual ptr<descriptor_set> alloc(const descriptor_set_layout & layout) = 0;
+        virtual ptr<descriptor_set> alloc(const descriptor_set_layout & layout) = 0; // Returns nullptr if the pool has run out of space. May be called from multiple threads at once, but not concurrently with reset()
     };    
 
+    // A large array of sampled images, which shaders index with an integer rather than having each image bound through its own descriptor set
+    struct resource_table : object
+    {
+        virtual int get_capacity() const = 0;
+        virtual const descriptor_set_layout & get_descriptor_set_layout() const = 0;    // Binding 0 is an array of get_capacity() combined image samplers, for use in pipeline layouts
+        virtual const descriptor_set & get_descriptor_set() = 0;                        // Bound with command_buffer::bind_descriptor_set(...), commands see the contents of the table at the time they were recorded
+        // Shaders must not access elements which have not been written. The first write after the table has been bound starts a new version of its contents,
+        // which copies the element bindings of the previous one, and in Vulkan may create a descriptor pool, so writes are best batched between binds.
+        virtual void write(int index, sampler & sampler, image & image) = 0;
+    };
+
     struct command_buffer : object
     {
         virtual void generate_mipmaps(image & image) = 0;
@@ -248,15 +314,50 @@ namespace rhi
         virtual void set_scissor_rect(int x0, int y0, int x1, int y1) = 0;
         virtual void set_stencil_ref(uint8_t ref) = 0;
         virtual void bind_pipeline(const pipeline & pipe) = 0;
-        virtual void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set) = 0;
+        virtual void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set, array_view<uint32_t> dynamic_offsets={}) = 0; // One offset per dynamic uniform buffer in set, in binding order
+        virtual void push_constants(const pipeline_layout & layout, size_t offset, size_t size, const void * data) = 0; // Values persist until overwritten, and are visible to subsequent draws and dispatches
         virtual void bind_vertex_buffer(int index, buffer_range range) = 0;
         virtual void bind_index_buffer(buffer_range range) = 0;
-        virtual void draw(int first_vertex, int vertex_count) = 0;
-        virtual void draw_indexed(int first_index, int index_count) = 0;
+        virtual void draw(int first_vertex, int vertex_count, int first_instance=0, int instance_count=1) = 0;
+        virtual void draw_indexed(int first_index, int index_count, int first_instance=0, int instance_count=1, int vertex_offset=0) = 0; // vertex_offset is added to each index before vertices are fetched
+        virtual void draw_indirect(buffer_range args, int draw_count, size_t stride=sizeof(draw_indirect_args)) = 0;                 // Issues draw_count draws, whose draw_indirect_args are read from args at the time the commands execute
+        virtual void draw_indexed_indirect(buffer_range args, int draw_count, size_t stride=sizeof(draw_indexed_indirect_args)) = 0; // Issues draw_count indexed draws, whose draw_indexed_indirect_args are read from args at the time the commands execute, index buffer must be bound at offset 0
+        virtual void execute_commands(command_buffer & secondary) = 0; // Only within a render pass begun with secondary_command_buffers, secondary must have been created for a framebuffer of the same formats
         virtual void end_render_pass() = 0;
+
+        // GPU timers, which may be nested, but not recorded into secondary command buffers or render passes whose contents are secondary command buffers.
+        // The first timer of a command buffer must be begun outside of a render pass, and command buffers which begin no timers incur no timing cost.
+        virtual void begin_timer(std::string_view name) = 0;
+        virtual void end_timer() = 0;
+
+        // Compute commands, recorded outside of render passes
+        virtual void dispatch(int group_count_x, int group_count_y, int group_count_z) = 0;
+        virtual void memory_barrier() = 0; // Makes writes to storage buffers and storage images visible to all subsequent commands
     };
 
     size_t get_pixel_size(image_format format);
+    int get_layer_count(const image_desc & desc); // Number of layers addressable by framebuffer attachments and initial_data, six per cube
+    std::optional<device_stats> get_null_device_stats(const device & dev); // Returns the work counted by a device of the null backend, or std::nullopt for any other device
+    std::optional<memory_stats> get_vulkan_memory_stats(const device & dev); // Returns the device memory usage of a device of the Vulkan backend, or std::nullopt for any other device
+
+    // The software backend rasterizes into images held in host memory, producing deterministic images on machines without a GPU. It cannot translate SPIR-V
+    // itself, so each shader it runs is a C++ function registered against the SPIR-V module it stands in for, such as one generated from that module ahead of time.
+    struct software_shader_resources
+    {
+        virtual const void * get_uniform_buffer(int set, int binding, size_t size) const = 0;                    // Throws unless the bound range holds at least size bytes
+        virtual const void * get_push_constants() const = 0;                                                     // The push constant range of the bound pipeline's layout
+        virtual float4 sample(int set, int binding, int element, const float4 & coords, float lod) const = 0;   // coords holds texcoords in xy, or a direction in xyz for cubes, and the layer in z for 2D arrays, or in w for cube arrays
+    };
+    constexpr int max_software_attributes = 16, max_software_varyings = 8;
+    struct software_vertex { float4 position; float4 varyings[max_software_varyings]; };
+    struct software_shader
+    {
+        std::function<void(const software_shader_resources & resources, const float4 * attributes, software_vertex & out)> vertex;  // attributes are indexed by location
+        std::function<bool(const software_shader_resources & resources, const float4 * varyings, float4 * colors)> fragment;        // colors are indexed by color attachment, returns false to discard the fragment
+    };
+    void register_software_shader(const std::vector<uint32_t> & spirv, software_shader shader); // Shader functions may be called from several threads at once
+    ptr<device> create_software_device(debug_callback debug_callback); // Not among the backends of gfx::context, as it can only run shaders which have been registered
+    std::optional<std::vector<float4>> read_software_image(const image & image, int mip, int layer); // Returns the texels of one layer of a mip level of an image of the software backend, top row first, or std::nullopt for any other image
 
     //////////////////////
     // Enumerated types //
@@ -269,6 +370,7 @@ namespace rhi
         uniform_buffer_bit = 1<<2, // Buffer can supply the contents of uniform blocks
         storage_buffer_bit = 1<<3, // Buffer can supply the contents of buffer blocks
         mapped_memory_bit  = 1<<4, // Buffer is permanently mapped into the client's address space
+        indirect_buffer_bit = 1<<5, // Buffer can supply the arguments of indirect draw calls
     };
 
     enum image_flag : image_flags
@@ -276,13 +378,15 @@ namespace rhi
         sampled_image_bit    = 1<<0, // Image can be bound to a sampler
         color_attachment_bit = 1<<1, // Image can be bound to a framebuffer as a color attachment
         depth_attachment_bit = 1<<2, // Image can be bound to a framebuffer as the depth/stencil attachment
+        storage_image_bit    = 1<<3, // Image can be read and written by shaders as a storage image, cannot be combined with attachment bits
     };
 
     enum class client_api : int
     {
         vulkan, // Vulkan 1.0
         opengl, // OpenGL 4.5 Core
-        d3d11   // Direct3D 11.1
+        d3d11,  // Direct3D 11.1
+        null,   // No GPU, commands are validated and counted but not executed
     };
 
     enum class shader_stage : int
@@ -300,7 +404,9 @@ namespace rhi
         _1d,
         _2d,
         _3d,
-        cube
+        cube,
+        _2d_array,  // Sampled as sampler2DArray
+        cube_array, // Sampled as samplerCubeArray, layers are ordered by cube and then by face
     };
     enum class image_format 
     {
@@ -359,8 +465,20 @@ namespace rhi
         mirror_clamp_to_edge,
         clamp_to_border,
     };
-    enum class descriptor_type { combined_image_sampler, uniform_buffer };
+    enum class descriptor_type 
+    { 
+        combined_image_sampler, // Bound with descriptor_set::write(int, sampler &, image &)
+        uniform_buffer,         // Bound with descriptor_set::write(int, buffer_range)
+        uniform_buffer_dynamic, // Bound with descriptor_set::write(int, buffer_range), offset further by a dynamic offset supplied to command_buffer::bind_descriptor_set(...), which must be a multiple of buffer::get_offset_alignment()
+        storage_buffer,         // Bound with descriptor_set::write(int, buffer_range), buffer must have storage_buffer_bit
+        storage_image,          // Bound with descriptor_set::write(int, image &, int), image must have storage_image_bit
+    };
     enum class attribute_format { float1, float2, float3, float4 };
+    enum class input_rate
+    {
+        per_vertex,   // Attributes advance once per vertex
+        per_instance, // Attributes advance once per instance
+    };
     enum class primitive_topology 
     { 
         points, 
@@ -1,5 +1,6 @@
 #include "rhi-internal.h"
 #include <sstream>
+#include <deque>
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
@@ -94,8 +95,14 @@ namespace rhi
         com_ptr<ID3D11DeviceContext4> ctx;
         com_ptr<IDXGIFactory> factory;
         com_ptr<ID3D11Fence> fence;
+        com_ptr<ID3D11Buffer> push_constant_buffer;
         uint64_t submitted_index = 0;
 
+        // GPU timers, whose timestamps are only meaningful if the disjoint query spanning their submission reports a steady clock
+        struct d3d_timer { uint64_t submission_id; std::string name; com_ptr<ID3D11Query> disjoint, begin, end; };
+        std::deque<d3d_timer> pending_timers;
+        std::vector<com_ptr<ID3D11Query>> free_timestamp_queries, free_disjoint_queries; // Queries whose results have been read, and which can be issued again
+
         d3d_device(std::function<void(const char *)> debug_callback) : debug_callback{debug_callback}
         {
             const D3D_FEATURE_LEVEL feature_levels[] {D3D_FEATURE_LEVEL_11_1};
@@ -113,9 +120,16 @@ namespace rhi
             check("IDXGIAdapter::GetParent", adapter->GetParent(__uuidof(IDXGIFactory), (void **)factory.init()));
 
             check("ID3D11Device5::CreateFence", dev->CreateFence(0, D3D11_FENCE_FLAG_NONE, __uuidof(ID3D11Fence), (void **)&fence));
+
+            // Push constants are emulated with a single constant buffer, rebound to the slot reserved by each pipeline layout
+            D3D11_BUFFER_DESC push_constant_desc {};
+            push_constant_desc.ByteWidth = exactly(max_push_constant_size);
+            push_constant_desc.Usage = D3D11_USAGE_DEFAULT;
+            push_constant_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+            check("ID3D11Device::CreateBuffer", dev->CreateBuffer(&push_constant_desc, nullptr, push_constant_buffer.init()));
         }
 
-        device_info get_info() const final { return {linalg::zero_to_one, true}; }
+        device_info get_info() const final { return {linalg::zero_to_one, true, 0}; }
 
         ptr<buffer> create_buffer(const buffer_desc & desc, const void * initial_data) final;
         ptr<sampler> create_sampler(const sampler_desc & desc) final;
@@ -124,17 +138,26 @@ namespace rhi
         ptr<window> create_window(const int2 & dimensions, std::string_view title) final;        
         
         ptr<descriptor_set_layout> create_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) final { return new delete_when_unreferenced<emulated_descriptor_set_layout>{bindings}; }
-        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets) final { return new delete_when_unreferenced<emulated_pipeline_layout>{sets}; }
+        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) final { return new delete_when_unreferenced<emulated_pipeline_layout>{sets, push_constant_size}; }
         ptr<shader> create_shader(const shader_desc & module) final;
         ptr<pipeline> create_pipeline(const pipeline_desc & desc) final;
+        ptr<pipeline> create_compute_pipeline(const compute_pipeline_desc & desc) final { throw std::logic_error("compute pipelines not supported by Direct3D 11.1 backend"); }
+        void precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer) final {} // Shaders and state objects are created when pipelines are created
 
         ptr<descriptor_pool> create_descriptor_pool() final { return new delete_when_unreferenced<emulated_descriptor_pool>{}; }
-        ptr<command_buffer> create_command_buffer() final { return new delete_when_unreferenced<emulated_command_buffer>(); }
+        ptr<resource_table> create_resource_table(int capacity) final { throw std::logic_error("resource tables not supported by Direct3D 11.1 backend"); }
+        ptr<command_buffer> create_command_buffer(bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(nullptr, reusable); }
+        ptr<command_buffer> create_secondary_command_buffer(const framebuffer & framebuffer, bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(&framebuffer, reusable); }
 
         uint64_t submit(command_buffer & cmd) final;
         uint64_t acquire_and_submit_and_present(command_buffer & cmd, window & window) final;
+        uint64_t flush_uploads() final { return submitted_index; } // Initial data is uploaded immediately
         uint64_t get_last_submission_id() final { return submitted_index; }
         void wait_until_complete(uint64_t submit_id) final;
+        std::vector<timer_result> get_timer_results() final;
+
+        com_ptr<ID3D11Query> acquire_query(std::vector<com_ptr<ID3D11Query>> & free_queries, D3D11_QUERY type);
+        com_ptr<ID3D11Query> write_timestamp();
     };
 
     autoregister_backend<d3d_device> autoregister_d3d_backend {"Direct3D 11.1", client_api::d3d11};
@@ -165,13 +188,13 @@ namespace rhi
         d3d_image(ID3D11Device & device, const image_desc & desc, std::vector<const void *> initial_data);
     };
 
-    struct d3d_framebuffer : framebuffer
+    struct d3d_framebuffer : base_framebuffer
     {
         int2 dims;
         std::vector<com_ptr<ID3D11RenderTargetView>> render_target_views;
         com_ptr<ID3D11DepthStencilView> depth_stencil_view;
 
-        d3d_framebuffer() {}
+        d3d_framebuffer() : base_framebuffer{true} {} // The framebuffer of a window, whose views are filled in by d3d_window
         d3d_framebuffer(ID3D11Device & device, const framebuffer_desc & desc);
         coord_system get_ndc_coords() const final { return {coord_axis::right, coord_axis::up, coord_axis::forward}; }
     };
@@ -219,14 +242,19 @@ ptr<sampler> d3d_device::create_sampler(const sampler_desc & desc) { return new
 ptr<image> d3d_device::create_image(const image_desc & desc, std::vector<const void *> initial_data) { return new delete_when_unreferenced<d3d_image>{*dev, desc, initial_data}; }
 ptr<framebuffer> d3d_device::create_framebuffer(const framebuffer_desc & desc) { return new delete_when_unreferenced<d3d_framebuffer>{*dev, desc}; }
 ptr<window> d3d_device::create_window(const int2 & dimensions, std::string_view title) { return new delete_when_unreferenced<d3d_window>{*this, dimensions, std::string{title}}; }
-ptr<shader> d3d_device::create_shader(const shader_desc & desc) { return new delete_when_unreferenced<d3d_shader>{desc}; }
+ptr<shader> d3d_device::create_shader(const shader_desc & desc) { validate_push_constant_block(desc.spirv); return new delete_when_unreferenced<d3d_shader>{desc}; }
 ptr<pipeline> d3d_device::create_pipeline(const pipeline_desc & desc) { return new delete_when_unreferenced<d3d_pipeline>{*dev, desc}; }
 
 uint64_t d3d_device::submit(command_buffer & cmd)
 {
+    if(static_cast<const emulated_command_buffer &>(cmd).open_timers) throw std::logic_error("command buffer submitted with timers still open");
+    static_cast<emulated_command_buffer &>(cmd).finish();
     d3d_framebuffer * current_framebuffer = 0;
     const d3d_pipeline * current_pipeline = 0;
     uint8_t stencil_ref = 0;
+    std::array<uint8_t, max_push_constant_size> push_constant_data {};
+    com_ptr<ID3D11Query> disjoint;
+    std::vector<d3d_timer> open_timers;
     ctx->ClearState();
     static_cast<const emulated_command_buffer &>(cmd).execute(overload(
         [&](const generate_mipmaps_command & c)
@@ -235,7 +263,7 @@ uint64_t d3d_device::submit(command_buffer & cmd)
         },
         [&](const begin_render_pass_command & c)
         {
-            auto & pass = c.pass;
+            auto & pass = *c.pass;
             auto & fb = static_cast<d3d_framebuffer &>(*c.framebuffer);
 
             // Clear render targets if specified by render pass
@@ -302,7 +330,7 @@ uint64_t d3d_device::submit(command_buffer & cmd)
         },
         [&](const bind_descriptor_set_command & c)
         {
-            bind_descriptor_set(*c.layout, c.set_index, *c.set, [this](size_t index, buffer & buffer, size_t offset, size_t size)
+            bind_descriptor_set(*c.layout, c.set_index, *c.set, c.get_dynamic_offsets(), [this](size_t index, buffer & buffer, size_t offset, size_t size)
             { 
                 ID3D11Buffer * buf = static_cast<d3d_buffer &>(buffer).buffer_object;
                 const UINT first_constant = exactly(offset/16), num_constants = exactly(round_up<size_t>(size,256)/16);
@@ -318,6 +346,16 @@ uint64_t d3d_device::submit(command_buffer & cmd)
                 ctx->PSSetShaderResources(exactly(index), 1, &shader_resource_view);
             });
         },
+        [&](const push_constants_command & c)
+        {
+            // Constant buffers cannot be partially updated, so we keep a copy of the whole block and upload all of it
+            memcpy(push_constant_data.data() + c.offset, c.get_data(), c.size);
+            ctx->UpdateSubresource(push_constant_buffer, 0, nullptr, push_constant_data.data(), 0, 0);
+            ID3D11Buffer * buf = push_constant_buffer;
+            const UINT index = exactly(static_cast<const emulated_pipeline_layout &>(*c.layout).get_push_constant_buffer_binding());
+            ctx->VSSetConstantBuffers(index, 1, &buf);
+            ctx->PSSetConstantBuffers(index, 1, &buf);
+        },
         [&](const bind_vertex_buffer_command & c)
         {
             for(auto & buf : current_pipeline->input)
@@ -336,18 +374,105 @@ uint64_t d3d_device::submit(command_buffer & cmd)
         },
         [&](const draw_command & c)
         { 
-            ctx->Draw(c.vertex_count, c.first_vertex); 
+            ctx->DrawInstanced(c.vertex_count, c.instance_count, c.first_vertex, c.first_instance); 
         },
         [&](const draw_indexed_command & c)
         { 
-            ctx->DrawIndexed(c.index_count, c.first_index, 0); 
+            ctx->DrawIndexedInstanced(c.index_count, c.instance_count, c.first_index, c.vertex_offset, c.first_instance); 
         },
-        [&](const end_render_pass_command &) {}
+        [&](const draw_indirect_command & c)
+        {
+            // Direct3D 11 reads a single draw's arguments per call
+            ID3D11Buffer * buffer = static_cast<d3d_buffer &>(c.args.buffer).buffer_object;
+            for(int i=0; i<c.draw_count; ++i) ctx->DrawInstancedIndirect(buffer, exactly(c.args.offset + i*c.stride));
+        },
+        [&](const draw_indexed_indirect_command & c)
+        {
+            ID3D11Buffer * buffer = static_cast<d3d_buffer &>(c.args.buffer).buffer_object;
+            for(int i=0; i<c.draw_count; ++i) ctx->DrawIndexedInstancedIndirect(buffer, exactly(c.args.offset + i*c.stride));
+        },
+        [&](const execute_commands_command & c)
+        {
+            // Secondary command buffers start from the same viewport, scissor, and stencil reference as a newly begun render pass
+            auto & fb = static_cast<const d3d_framebuffer &>(*c.secondary->secondary_framebuffer);
+            D3D11_VIEWPORT vp {0, 0, exactly(fb.dims.x), exactly(fb.dims.y), 0, 1};
+            ctx->RSSetViewports(1, &vp);
+            const D3D11_RECT scissor {0, 0, fb.dims.x, fb.dims.y};
+            ctx->RSSetScissorRects(1, &scissor);
+            stencil_ref = 0;
+            if(current_pipeline) ctx->OMSetDepthStencilState(current_pipeline->depth_stencil_state, stencil_ref);
+        },
+        [&](const end_render_pass_command &) {},
+        [&](const begin_timer_command & c)
+        {
+            if(!disjoint)
+            {
+                disjoint = acquire_query(free_disjoint_queries, D3D11_QUERY_TIMESTAMP_DISJOINT);
+                ctx->Begin(disjoint);
+            }
+            open_timers.push_back({submitted_index+1, std::string{c.get_name()}, disjoint, write_timestamp()});
+        },
+        [&](const end_timer_command &)
+        {
+            open_timers.back().end = write_timestamp();
+            pending_timers.push_back(std::move(open_timers.back()));
+            open_timers.pop_back();
+        },
+        [&](const dispatch_command &) { throw std::logic_error("dispatch not supported by Direct3D 11.1 backend"); },
+        [&](const memory_barrier_command &) {} // Direct3D 11 tracks hazards between commands implicitly
     ));
+    if(disjoint) ctx->End(disjoint);
     if(fence) check("ID3D11DeviceContext4::Signal", ctx->Signal(fence, ++submitted_index));
     return submitted_index;
 }
 
+com_ptr<ID3D11Query> d3d_device::acquire_query(std::vector<com_ptr<ID3D11Query>> & free_queries, D3D11_QUERY type)
+{
+    com_ptr<ID3D11Query> query;
+    if(free_queries.empty())
+    {
+        const D3D11_QUERY_DESC query_desc {type};
+        check("ID3D11Device::CreateQuery", dev->CreateQuery(&query_desc, query.init()));
+    }
+    else
+    {
+        query = free_queries.back();
+        free_queries.pop_back();
+    }
+    return query;
+}
+
+com_ptr<ID3D11Query> d3d_device::write_timestamp()
+{
+    auto query = acquire_query(free_timestamp_queries, D3D11_QUERY_TIMESTAMP);
+    ctx->End(query);
+    return query;
+}
+
+std::vector<timer_result> d3d_device::get_timer_results()
+{
+    // Poll timers in submission order, without flushing, and stop at the first whose queries are not yet available
+    std::vector<timer_result> results;
+    while(!pending_timers.empty())
+    {
+        auto & timer = pending_timers.front();
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        UINT64 begin, end;
+        if(ctx->GetData(timer.disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) break;
+        if(ctx->GetData(timer.begin, &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) break;
+        if(ctx->GetData(timer.end, &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) break;
+        if(!disjoint.Disjoint) results.push_back({std::move(timer.name), timer.submission_id, (end - begin) * 1000.0 / disjoint.Frequency});
+        free_timestamp_queries.push_back(timer.begin);
+        free_timestamp_queries.push_back(timer.end);
+
+        // All timers of a submission share its disjoint query, which can be reused once the last of them has been read
+        const com_ptr<ID3D11Query> disjoint_query = timer.disjoint;
+        pending_timers.pop_front();
+        if(pending_timers.empty() || pending_timers.front().disjoint != disjoint_query) free_disjoint_queries.push_back(disjoint_query);
+    }
+    return results;
+}
+
 uint64_t d3d_device::acquire_and_submit_and_present(command_buffer & cmd, window & window)
 {
     submit(cmd);
@@ -369,6 +494,7 @@ d3d_buffer::d3d_buffer(ID3D11Device & device, ID3D11DeviceContext & ctx, const b
     if(desc.flags & rhi::index_buffer_bit) buffer_desc.BindFlags |= D3D11_BIND_INDEX_BUFFER;
     if(desc.flags & rhi::uniform_buffer_bit) buffer_desc.BindFlags |= D3D11_BIND_CONSTANT_BUFFER;
     if(desc.flags & rhi::storage_buffer_bit) buffer_desc.BindFlags |= D3D11_BIND_SHADER_RESOURCE;
+    if(desc.flags & rhi::indirect_buffer_bit) buffer_desc.MiscFlags |= D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
     if(desc.flags & rhi::mapped_memory_bit)
     {
         buffer_desc.Usage = D3D11_USAGE_DYNAMIC;
@@ -405,7 +531,7 @@ d3d_sampler::d3d_sampler(ID3D11Device & device, const sampler_desc & desc)
     
 d3d_image::d3d_image(ID3D11Device & device, const image_desc & desc, std::vector<const void *> initial_data) : format{desc.format}
 {
-    UINT array_size = 1, bind_flags = 0, misc_flags = 0;
+    UINT array_size = exactly(get_layer_count(desc)), bind_flags = 0, misc_flags = 0;
     if(desc.flags & rhi::image_flag::sampled_image_bit) bind_flags |= D3D11_BIND_SHADER_RESOURCE;
     if(desc.flags & rhi::image_flag::color_attachment_bit) bind_flags |= D3D11_BIND_RENDER_TARGET;
     if(desc.flags & rhi::image_flag::depth_attachment_bit) bind_flags |= D3D11_BIND_DEPTH_STENCIL;
@@ -414,11 +540,7 @@ d3d_image::d3d_image(ID3D11Device & device, const image_desc & desc, std::vector
         bind_flags |= (D3D11_BIND_SHADER_RESOURCE|D3D11_BIND_RENDER_TARGET);
         misc_flags |= D3D11_RESOURCE_MISC_GENERATE_MIPS;
     }
-    if(desc.shape == rhi::image_shape::cube)
-    {
-        array_size *= 6;
-        misc_flags |= D3D11_RESOURCE_MISC_TEXTURECUBE;
-    }
+    if(desc.shape == rhi::image_shape::cube || desc.shape == rhi::image_shape::cube_array) misc_flags |= D3D11_RESOURCE_MISC_TEXTURECUBE;
     std::vector<D3D11_SUBRESOURCE_DATA> data;
     const size_t row_pitch = get_pixel_size(desc.format)*desc.dimensions.x, slice_pitch = row_pitch*desc.dimensions.y;
     for(auto d : initial_data) data.push_back({d, exactly(row_pitch), exactly(slice_pitch)});
@@ -437,7 +559,7 @@ d3d_image::d3d_image(ID3D11Device & device, const image_desc & desc, std::vector
         check("ID3D11Device::CreateTexture2D", device.CreateTexture3D(&tex_desc, data.empty() ? nullptr : data.data(), tex.init()));
         resource = tex;
     }
-    else // 2D or cube textures
+    else // 2D, cube, and array textures, whose default shader resource views are arrayed according to array_size and misc_flags
     {
         const D3D11_TEXTURE2D_DESC tex_desc {exactly(desc.dimensions.x), exactly(desc.dimensions.y), exactly(desc.mip_levels), array_size, convert_dx(desc.format), {1,0}, D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags};
         com_ptr<ID3D11Texture2D> tex;
@@ -469,7 +591,7 @@ com_ptr<ID3D11DepthStencilView> create_depth_stencil_view(ID3D11Device & device,
     return view;
 }
 
-d3d_framebuffer::d3d_framebuffer(ID3D11Device & device, const framebuffer_desc & desc)
+d3d_framebuffer::d3d_framebuffer(ID3D11Device & device, const framebuffer_desc & desc) : base_framebuffer{false}
 {
     dims = desc.dimensions;
     for(auto attachment : desc.color_attachments) render_target_views.push_back(create_render_target_view(device, static_cast<d3d_image &>(*attachment.image).resource, static_cast<d3d_image &>(*attachment.image).format, attachment.mip, attachment.layer));
@@ -514,10 +636,17 @@ d3d_pipeline::d3d_pipeline(ID3D11Device & device, const pipeline_desc & desc) :
         auto & shader = static_cast<const d3d_shader &>(*s);
 
         // Compile SPIR-V to HLSL
-        spirv_cross::CompilerHLSL compiler(shader.desc.spirv);
+        auto spirv = shader.desc.spirv;
+        const uint32_t push_constant_block = convert_push_constants_to_uniform_block(spirv);
+        spirv_cross::CompilerHLSL compiler(spirv);
 	    spirv_cross::ShaderResources resources = compiler.get_shader_resources();
 	    for(auto & resource : resources.uniform_buffers)
 	    {
+            if(resource.id == push_constant_block)
+            {
+                compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(*desc.layout).get_push_constant_buffer_binding()));
+                continue;
+            }
             compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(*desc.layout).get_flat_buffer_binding(compiler.get_decoration(resource.id, spv::DecorationDescriptorSet), compiler.get_decoration(resource.id, spv::DecorationBinding))));
 		    compiler.unset_decoration(resource.id, spv::DecorationDescriptorSet);
 	    }
@@ -546,7 +675,7 @@ d3d_pipeline::d3d_pipeline(ID3D11Device & device, const pipeline_desc & desc) :
             check("D3DCompile", D3DCompile(hlsl.c_str(), hlsl.size(), "spirv-cross.hlsl", nullptr, nullptr, "main", "vs_5_0", 0, 0, &shader_blob, &error_blob));
             check("ID3D11Device::CreateVertexShader", device.CreateVertexShader(shader_blob->GetBufferPointer(), shader_blob->GetBufferSize(), nullptr, vs.init()));           
             std::vector<D3D11_INPUT_ELEMENT_DESC> input_descs;  
-            for(auto & buf : desc.input) for(auto & attrib : buf.attributes) input_descs.push_back({"TEXCOORD", (UINT)attrib.index, convert_dx(attrib.type), (UINT)buf.index, (UINT)attrib.offset, D3D11_INPUT_PER_VERTEX_DATA, 0});
+            for(auto & buf : desc.input) for(auto & attrib : buf.attributes) input_descs.push_back({"TEXCOORD", (UINT)attrib.index, convert_dx(attrib.type), (UINT)buf.index, (UINT)attrib.offset, buf.rate == input_rate::per_instance ? D3D11_INPUT_PER_INSTANCE_DATA : D3D11_INPUT_PER_VERTEX_DATA, buf.rate == input_rate::per_instance ? 1u : 0u});
             check("ID3D11Device::CreateInputLayout", device.CreateInputLayout(input_descs.data(), exactly(input_descs.size()), shader_blob->GetBufferPointer(), shader_blob->GetBufferSize(), layout.init()));
             break;
         }
@@ -1,4 +1,5 @@
 #include "rhi-internal.h"
+#include "../../dep/SPIRV-Cross/spirv.hpp"
 using namespace rhi;
 
 std::vector<client_info> & rhi::global_backend_list()
@@ -17,6 +18,58 @@ attachment_type rhi::get_attachment_type(image_format format)
     }
 }
 
+buddy_allocator::buddy_allocator(size_t capacity, size_t min_block_size) : min_block_size{min_block_size}, used_size{0}
+{
+    size_t order = 0;
+    while((min_block_size << order) < capacity) ++order;
+    if((min_block_size << order) != capacity) throw std::logic_error("buddy_allocator capacity must be min_block_size times a power of two");
+    free_blocks.resize(order+1);
+    free_blocks[order].insert(0);
+}
+
+std::optional<size_t> buddy_allocator::allocate(size_t size, size_t alignment)
+{
+    // Blocks are aligned to their own size, so round up to the larger of the size and the alignment
+    size_t order = 0;
+    while((min_block_size << order) < std::max(size, alignment)) if(++order == free_blocks.size()) return std::nullopt;
+
+    // Find the smallest free block which can hold the allocation
+    size_t k = order;
+    while(free_blocks[k].empty()) if(++k == free_blocks.size()) return std::nullopt;
+    const size_t offset = *free_blocks[k].begin();
+    free_blocks[k].erase(free_blocks[k].begin());
+
+    // Split it until it is the right size, returning the upper halves to the free lists
+    while(k > order)
+    {
+        --k;
+        free_blocks[k].insert(offset + (min_block_size << k));
+    }
+    used_orders[offset] = order;
+    used_size += min_block_size << order;
+    return offset;
+}
+
+void buddy_allocator::free(size_t offset)
+{
+    auto it = used_orders.find(offset);
+    if(it == used_orders.end()) throw std::logic_error("buddy_allocator::free called with an offset that was not allocated");
+    size_t order = it->second;
+    used_orders.erase(it);
+    used_size -= min_block_size << order;
+
+    // Merge with our buddy for as long as it is also free
+    while(order+1 < free_blocks.size())
+    {
+        auto buddy = free_blocks[order].find(offset ^ (min_block_size << order));
+        if(buddy == free_blocks[order].end()) break;
+        offset = std::min(offset, *buddy);
+        free_blocks[order].erase(buddy);
+        ++order;
+    }
+    free_blocks[order].insert(offset);
+}
+
 size_t rhi::get_pixel_size(image_format format)
 {
     switch(format)
@@ -27,85 +80,386 @@ size_t rhi::get_pixel_size(image_format format)
     }
 }
 
+int rhi::get_layer_count(const image_desc & desc)
+{
+    const bool arrayed = desc.shape == image_shape::_2d_array || desc.shape == image_shape::cube_array;
+    if(desc.array_layers < 1 || (!arrayed && desc.array_layers != 1)) throw std::logic_error("array_layers must be 1, or at least 1 for arrayed image shapes");
+    return desc.shape == image_shape::cube || desc.shape == image_shape::cube_array ? desc.array_layers*6 : desc.array_layers;
+}
+
 emulated_descriptor_set_layout::emulated_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) : bindings{bindings}
 {
+    std::vector<descriptor_binding> dynamic_bindings;
     for(auto & b : bindings)
     {
+        if(b.index < 0) throw std::logic_error("invalid binding");
+        if(static_cast<size_t>(b.index) >= slots.size()) slots.resize(b.index+1, {slot_type::none, 0});
+        auto & s = slots[b.index];
         switch(b.type)
         {
         case rhi::descriptor_type::combined_image_sampler:
-            image_offsets[b.index] = num_images;
+            s = {slot_type::image, num_images};
             num_images += b.count;
             break;
+        case rhi::descriptor_type::uniform_buffer_dynamic:
+            dynamic_bindings.push_back(b);
+            [[fallthrough]];
         case rhi::descriptor_type::uniform_buffer:
-            buffer_offsets[b.index] = num_buffers;
+            s = {slot_type::buffer, num_buffers};
             num_buffers += b.count;
             break;
+        case rhi::descriptor_type::storage_buffer:
+            s = {slot_type::storage_buffer, num_storage_buffers};
+            num_storage_buffers += b.count;
+            break;
+        case rhi::descriptor_type::storage_image:
+            s = {slot_type::storage_image, num_storage_images};
+            num_storage_images += b.count;
+            break;
         }
     }
+
+    // Dynamic offsets are supplied in order of binding index
+    std::sort(begin(dynamic_bindings), end(dynamic_bindings), [](const descriptor_binding & a, const descriptor_binding & b) { return a.index < b.index; });
+    dynamic_offset_indices.resize(num_buffers, -1);
+    for(auto & b : dynamic_bindings) for(int i=0; i<b.count; ++i) dynamic_offset_indices[slots[b.index].offset+i] = exactly(num_dynamic_offsets++);
+    if(num_dynamic_offsets > max_dynamic_offsets) throw std::logic_error("too many dynamic uniform buffers");
 }
 
 size_t emulated_pipeline_layout::get_flat_buffer_binding(int set, int binding) const
 {
-    auto it = sets[set].layout->buffer_offsets.find(binding);
-    if(it == sets[set].layout->buffer_offsets.end()) throw std::logic_error("invalid binding");
-    return sets[set].buffer_offset + it->second;
+    return sets[set].buffer_offset + sets[set].layout->get_offset(binding, emulated_descriptor_set_layout::slot_type::buffer);
 }
 
 size_t emulated_pipeline_layout::get_flat_image_binding(int set, int binding) const
 {
-    auto it = sets[set].layout->image_offsets.find(binding);
-    if(it == sets[set].layout->image_offsets.end()) throw std::logic_error("invalid binding");
-    return sets[set].image_offset + it->second;
+    return sets[set].image_offset + sets[set].layout->get_offset(binding, emulated_descriptor_set_layout::slot_type::image);
+}
+
+size_t emulated_pipeline_layout::get_flat_storage_buffer_binding(int set, int binding) const
+{
+    return sets[set].storage_buffer_offset + sets[set].layout->get_offset(binding, emulated_descriptor_set_layout::slot_type::storage_buffer);
+}
+
+size_t emulated_pipeline_layout::get_flat_storage_image_binding(int set, int binding) const
+{
+    return sets[set].storage_image_offset + sets[set].layout->get_offset(binding, emulated_descriptor_set_layout::slot_type::storage_image);
 }
 
-emulated_pipeline_layout::emulated_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets) : base_pipeline_layout{sets}
+emulated_pipeline_layout::emulated_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) : base_pipeline_layout{sets, push_constant_size}
 {
     for(auto & s : sets)
     {
         auto & layout = static_cast<const emulated_descriptor_set_layout &>(*s);
-        this->sets.push_back({&layout, num_buffers, num_images});
+        this->sets.push_back({&layout, num_buffers, num_images, num_storage_buffers, num_storage_images});
         num_buffers += layout.num_buffers;
         num_images += layout.num_images;
+        num_storage_buffers += layout.num_storage_buffers;
+        num_storage_images += layout.num_storage_images;
     }
 }
 
+void rhi::validate_push_constant_block(const std::vector<uint32_t> & spirv)
+{
+    // Gather the types, constants and layout decorations of the module
+    struct type { spv::Op op; const uint32_t * operands; size_t operand_count; };
+    std::unordered_map<uint32_t, type> types;
+    std::unordered_map<uint32_t, uint32_t> constants, array_strides;
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> member_offsets, matrix_strides;
+    std::set<std::pair<uint32_t, uint32_t>> row_major_members;
+    uint32_t block_pointer_type = 0;
+    for(size_t i=5; i<spirv.size(); i += spirv[i] >> 16)
+    {
+        const size_t word_count = spirv[i] >> 16;
+        if(word_count == 0 || i + word_count > spirv.size()) throw std::runtime_error("invalid SPIR-V");
+        const auto op = static_cast<spv::Op>(spirv[i] & 0xFFFF);
+        switch(op)
+        {
+        case spv::OpTypeInt: case spv::OpTypeFloat: case spv::OpTypeVector: case spv::OpTypeMatrix: case spv::OpTypeArray: case spv::OpTypeStruct: case spv::OpTypePointer:
+            types[spirv[i+1]] = {op, &spirv[i+2], word_count-2};
+            break;
+        case spv::OpConstant: constants[spirv[i+2]] = spirv[i+3]; break;
+        case spv::OpVariable: if(spirv[i+3] == spv::StorageClassPushConstant) block_pointer_type = spirv[i+1]; break;
+        case spv::OpDecorate: if(spirv[i+2] == spv::DecorationArrayStride) array_strides[spirv[i+1]] = spirv[i+3]; break;
+        case spv::OpMemberDecorate:
+            if(spirv[i+3] == spv::DecorationOffset) member_offsets[{spirv[i+1], spirv[i+2]}] = spirv[i+4];
+            if(spirv[i+3] == spv::DecorationMatrixStride) matrix_strides[{spirv[i+1], spirv[i+2]}] = spirv[i+4];
+            if(spirv[i+3] == spv::DecorationRowMajor) row_major_members.insert({spirv[i+1], spirv[i+2]});
+            break;
+        }
+    }
+    if(!block_pointer_type) return;
+
+    // Compute the alignment and size of each type by std140 rules, checking the decorated offsets and strides against them
+    struct layout { uint32_t alignment, size; };
+    auto fail = []() -> layout { throw std::logic_error("push constant block does not follow std140 layout rules"); };
+    auto get_type = [&](uint32_t id) -> const type & { auto it = types.find(id); if(it == types.end()) throw std::runtime_error("invalid SPIR-V"); return it->second; };
+    std::function<layout(uint32_t, std::optional<uint32_t>, bool)> get_layout = [&](uint32_t id, std::optional<uint32_t> matrix_stride, bool row_major) -> layout
+    {
+        auto & t = get_type(id);
+        switch(t.op)
+        {
+        case spv::OpTypeInt: case spv::OpTypeFloat: return {t.operands[0]/8, t.operands[0]/8};
+        case spv::OpTypeVector:
+        {
+            const auto component = get_layout(t.operands[0], std::nullopt, false);
+            return {component.size * (t.operands[1] == 2 ? 2 : 4), component.size * t.operands[1]};
+        }
+        case spv::OpTypeMatrix: // An array of column vectors, or row vectors if row major, each aligned to at least 16 bytes
+        {
+            auto & column = get_type(t.operands[0]);
+            const auto component = get_layout(column.operands[0], std::nullopt, false);
+            const uint32_t vector_length = row_major ? t.operands[1] : column.operands[1], vector_count = row_major ? column.operands[1] : t.operands[1];
+            const uint32_t stride = std::max<uint32_t>(16, component.size * (vector_length == 2 ? 2 : 4));
+            if(!matrix_stride || *matrix_stride != stride) return fail();
+            return {stride, stride * vector_count};
+        }
+        case spv::OpTypeArray:
+        {
+            const auto element = get_layout(t.operands[0], matrix_stride, row_major);
+            const uint32_t alignment = round_up(element.alignment, 16u), stride = round_up(element.size, alignment);
+            auto decorated_stride = array_strides.find(id);
+            if(decorated_stride == array_strides.end() || decorated_stride->second != stride) return fail();
+            return {alignment, stride * constants[t.operands[1]]};
+        }
+        case spv::OpTypeStruct:
+        {
+            uint32_t alignment = 16, end = 0;
+            for(uint32_t i=0; i<t.operand_count; ++i)
+            {
+                auto stride = matrix_strides.find({id, i});
+                const auto member = get_layout(t.operands[i], stride == matrix_strides.end() ? std::nullopt : std::optional<uint32_t>{stride->second}, row_major_members.count({id, i}) != 0);
+                auto offset = member_offsets.find({id, i});
+                if(offset == member_offsets.end() || offset->second % member.alignment || offset->second < end) return fail();
+                alignment = std::max(alignment, member.alignment);
+                end = offset->second + member.size;
+            }
+            return {alignment, round_up(end, alignment)};
+        }
+        default: throw std::logic_error("push constant block contains a type which is not permitted in uniform blocks");
+        }
+    };
+    auto & pointer = get_type(block_pointer_type);
+    get_layout(pointer.operands[1], std::nullopt, false);
+}
+
+uint32_t rhi::convert_push_constants_to_uniform_block(std::vector<uint32_t> & spirv)
+{
+    uint32_t variable_id = 0;
+    for(size_t i=5; i<spirv.size(); i += spirv[i] >> 16)
+    {
+        if(spirv[i] >> 16 == 0) throw std::runtime_error("invalid SPIR-V");
+        switch(static_cast<spv::Op>(spirv[i] & 0xFFFF))
+        {
+        case spv::OpTypePointer: // result id, storage class, type
+            if(spirv[i+2] == spv::StorageClassPushConstant) spirv[i+2] = spv::StorageClassUniform;
+            break;
+        case spv::OpVariable: // result type, result id, storage class
+            if(spirv[i+3] == spv::StorageClassPushConstant)
+            {
+                spirv[i+3] = spv::StorageClassUniform;
+                variable_id = spirv[i+2];
+            }
+            break;
+        }
+    }
+    return variable_id;
+}
+
 void emulated_descriptor_pool::reset()
 {
-    for(auto & set : sets) if(set.ref_count != 0) throw std::logic_error("rhi::descriptor_pool::reset called with descriptor sets outstanding");
-    for(auto & binding : buffer_bindings) binding = {};
-    for(auto & binding : image_bindings) binding = {};
-    used_buffer_bindings = used_image_bindings = used_sets = 0;
+    for(size_t i=0; i<used_sets; ++i) if(sets[i].ref_count != 0) throw std::logic_error("rhi::descriptor_pool::reset called with descriptor sets outstanding");
+    std::fill_n(buffer_bindings.begin(), used_buffer_bindings, buffer_binding{});
+    std::fill_n(image_bindings.begin(), used_image_bindings, image_binding{});
+    std::fill_n(storage_buffer_bindings.begin(), used_storage_buffer_bindings, buffer_binding{});
+    std::fill_n(storage_image_bindings.begin(), used_storage_image_bindings, storage_image_binding{});
+    used_buffer_bindings = used_image_bindings = used_storage_buffer_bindings = used_storage_image_bindings = used_sets = 0;
 }
 
 ptr<descriptor_set> emulated_descriptor_pool::alloc(const descriptor_set_layout & layout)
 {
+    std::lock_guard<std::mutex> lock{mutex};
     auto & set_layout = static_cast<const emulated_descriptor_set_layout &>(layout);
     const size_t needed_buffer_bindings = used_buffer_bindings + set_layout.num_buffers;
     const size_t needed_image_bindings = used_image_bindings + set_layout.num_images;
-    if(needed_buffer_bindings > buffer_bindings.size()) throw std::logic_error("out of buffer bindings");
-    if(needed_image_bindings > image_bindings.size()) throw std::logic_error("out of image bindings");
-    if(used_sets == sets.size()) throw std::logic_error("out of descriptor sets");
+    const size_t needed_storage_buffer_bindings = used_storage_buffer_bindings + set_layout.num_storage_buffers;
+    const size_t needed_storage_image_bindings = used_storage_image_bindings + set_layout.num_storage_images;
+    if(needed_buffer_bindings > buffer_bindings.size() || needed_image_bindings > image_bindings.size() || used_sets == sets.size() ||
+        needed_storage_buffer_bindings > storage_buffer_bindings.size() || needed_storage_image_bindings > storage_image_bindings.size()) return nullptr;
 
     auto & set = sets[used_sets++];
     set.layout = &set_layout;
     set.buffer_bindings = buffer_bindings.data() + used_buffer_bindings;
     set.image_bindings = image_bindings.data() + used_image_bindings;
+    set.storage_buffer_bindings = storage_buffer_bindings.data() + used_storage_buffer_bindings;
+    set.storage_image_bindings = storage_image_bindings.data() + used_storage_image_bindings;
     used_buffer_bindings = needed_buffer_bindings;
     used_image_bindings = needed_image_bindings;
+    used_storage_buffer_bindings = needed_storage_buffer_bindings;
+    used_storage_image_bindings = needed_storage_image_bindings;
     return &set;
 }
 
 void emulated_descriptor_set::write(int binding, buffer_range range)
 {
-    auto it = layout->buffer_offsets.find(binding);
-    if(it == layout->buffer_offsets.end()) throw std::logic_error("invalid binding");
-    buffer_bindings[it->second] = {&range.buffer, range.offset, range.size};
+    const auto slot = layout->get_slot(binding);
+    switch(slot.type)
+    {
+    case emulated_descriptor_set_layout::slot_type::buffer: buffer_bindings[slot.offset] = {&range.buffer, range.offset, range.size}; break;
+    case emulated_descriptor_set_layout::slot_type::storage_buffer: storage_buffer_bindings[slot.offset] = {&range.buffer, range.offset, range.size}; break;
+    default: throw std::logic_error("invalid binding");
+    }
 }
 
 void emulated_descriptor_set::write(int binding, sampler & sampler, image & image)
 {
-    auto it = layout->image_offsets.find(binding);
-    if(it == layout->image_offsets.end()) throw std::logic_error("invalid binding");
-    image_bindings[it->second] = {&sampler, &image};
+    image_bindings[layout->get_offset(binding, emulated_descriptor_set_layout::slot_type::image)] = {&sampler, &image};
+}
+
+void emulated_descriptor_set::write(int binding, image & image, int mip)
+{
+    storage_image_bindings[layout->get_offset(binding, emulated_descriptor_set_layout::slot_type::storage_image)] = {&image, mip};
+}
+
+emulated_resource_table::version::version(const emulated_descriptor_set_layout & layout, std::vector<image_binding> elements) : elements{std::move(elements)}
+{
+    this->layout = &layout;
+    buffer_bindings = storage_buffer_bindings = nullptr;
+    storage_image_bindings = nullptr;
+    image_bindings = this->elements.data();
+}
+
+emulated_resource_table::emulated_resource_table(int capacity) : 
+    layout{new delete_when_unreferenced<emulated_descriptor_set_layout>{std::vector<descriptor_binding>{{0, descriptor_type::combined_image_sampler, capacity}}}},
+    current{new delete_when_unreferenced<version>{*layout, std::vector<image_binding>(capacity)}}
+{
+
+}
+
+void emulated_resource_table::write(int index, sampler & sampler, image & image)
+{
+    if(index < 0 || index >= get_capacity()) throw std::logic_error("resource table index out of range");
+    if(is_current_bound)
+    {
+        current = new delete_when_unreferenced<version>{*layout, current->elements};
+        is_current_bound = false;
+    }
+    current->elements[index] = {&sampler, &image};
+}
+
+static std::mutex recordings_mutex;
+static std::vector<std::unique_ptr<emulated_command_buffer::recording>> free_recordings;
+
+std::unique_ptr<emulated_command_buffer::recording> emulated_command_buffer::acquire_recording()
+{
+    std::lock_guard<std::mutex> lock{recordings_mutex};
+    if(free_recordings.empty()) return std::make_unique<recording>();
+    auto r = std::move(free_recordings.back());
+    free_recordings.pop_back();
+    return r;
+}
+
+void emulated_command_buffer::release_recording(std::unique_ptr<recording> r)
+{
+    // Drop references and rewind, but keep the storage itself for the next command buffer
+    r->commands.clear();
+    r->referenced_objects.clear();
+    r->recent_objects.fill(nullptr);
+    r->used_render_passes = 0;
+    std::lock_guard<std::mutex> lock{recordings_mutex};
+    free_recordings.push_back(std::move(r));
+}
+
+DOCTEST_TEST_CASE("command_stream replays commands and their trailing data in order")
+{
+    struct a { int x; };
+    struct b { size_t size; const char * get_data() const { return reinterpret_cast<const char *>(this+1); } };
+    command_stream<a, b> stream;
+    stream.push(a{1});
+    stream.push(b{5}, "hello", 5);
+    stream.push(a{2});
+
+    std::string log;
+    auto visitor = overload(
+        [&](const a & c) { log += std::to_string(c.x); },
+        [&](const b & c) { log.append(c.get_data(), c.size); }
+    );
+    stream.visit(visitor);
+    DOCTEST_CHECK(log == "1hello2");
+
+    stream.clear();
+    DOCTEST_CHECK(stream.empty());
+}
+
+DOCTEST_TEST_CASE("validate_push_constant_block accepts only std140 layouts")
+{
+    // Declares a push constant block holding a float[4] with the given array stride, or a mat4 with the given matrix stride
+    auto op = [](spv::Op op, std::initializer_list<uint32_t> operands) { std::vector<uint32_t> words {static_cast<uint32_t>(operands.size()+1) << 16 | op}; words.insert(words.end(), operands); return words; };
+    auto module = [&](spv::Op member_op, spv::Decoration stride_decoration, uint32_t stride)
+    {
+        std::vector<uint32_t> spirv {spv::MagicNumber, 0x10000, 0, 8, 0};
+        for(auto & inst : {op(spv::OpTypeFloat, {1, 32}), op(spv::OpTypeInt, {2, 32, 0}), op(spv::OpConstant, {2, 3, 4}), op(spv::OpTypeVector, {4, 1, 4}),
+            member_op == spv::OpTypeArray ? op(spv::OpTypeArray, {5, 1, 3}) : op(spv::OpTypeMatrix, {5, 4, 4}), op(spv::OpTypeStruct, {6, 5}),
+            op(spv::OpTypePointer, {7, spv::StorageClassPushConstant, 6}), op(spv::OpVariable, {7, 8, spv::StorageClassPushConstant}),
+            stride_decoration == spv::DecorationArrayStride ? op(spv::OpDecorate, {5, stride_decoration, stride}) : op(spv::OpMemberDecorate, {6, 0, stride_decoration, stride}),
+            op(spv::OpMemberDecorate, {6, 0, spv::DecorationOffset, 0})}) spirv.insert(spirv.end(), inst.begin(), inst.end());
+        return spirv;
+    };
+    DOCTEST_CHECK_NOTHROW(validate_push_constant_block({}));
+    DOCTEST_CHECK_NOTHROW(validate_push_constant_block(module(spv::OpTypeArray, spv::DecorationArrayStride, 16)));
+    DOCTEST_CHECK_THROWS_AS(validate_push_constant_block(module(spv::OpTypeArray, spv::DecorationArrayStride, 4)), std::logic_error);
+    DOCTEST_CHECK_NOTHROW(validate_push_constant_block(module(spv::OpTypeMatrix, spv::DecorationMatrixStride, 16)));
+    DOCTEST_CHECK_THROWS_AS(validate_push_constant_block(module(spv::OpTypeMatrix, spv::DecorationMatrixStride, 8)), std::logic_error);
+}
+
+DOCTEST_TEST_CASE("buddy_allocator splits and merges blocks")
+{
+    buddy_allocator alloc {1024, 64};
+    DOCTEST_CHECK(alloc.get_capacity() == 1024);
+    DOCTEST_CHECK_THROWS_AS(buddy_allocator(1000, 64), std::logic_error);
+
+    // Allocations are rounded up to a power of two, and aligned to their own size
+    auto a = alloc.allocate(100, 4);
+    auto b = alloc.allocate(64, 256);
+    auto c = alloc.allocate(64, 4);
+    DOCTEST_REQUIRE(a); DOCTEST_REQUIRE(b); DOCTEST_REQUIRE(c);
+    DOCTEST_CHECK(*a % 128 == 0);
+    DOCTEST_CHECK(*b % 256 == 0);
+    DOCTEST_CHECK(alloc.get_used_size() == 128 + 256 + 64);
+    DOCTEST_CHECK(!alloc.allocate(1024, 4));
+    DOCTEST_CHECK(!alloc.allocate(2048, 4));
+
+    // Once everything is freed, the whole range is available again
+    alloc.free(*b);
+    alloc.free(*a);
+    alloc.free(*c);
+    DOCTEST_CHECK(alloc.is_empty());
+    DOCTEST_CHECK(alloc.get_used_size() == 0);
+    DOCTEST_CHECK(alloc.allocate(1024, 4) == size_t(0));
+    DOCTEST_CHECK_THROWS_AS(alloc.free(64), std::logic_error);
+}
+
+#ifdef _WIN32
+#include <Windows.h>
+
+std::fstream rhi::open_file_beside_executable(std::string_view filename, std::ios::openmode mode)
+{
+    wchar_t buffer[1024];
+    std::wstring path {buffer, GetModuleFileNameW(nullptr, buffer, exactly(std::size(buffer)))};
+    path.resize(path.rfind(L'\\') + 1); // If no separator is found, npos+1 leaves an empty path, and the file is opened in the working directory
+    for(char ch : filename) path.push_back(ch); // Cache filenames are plain ASCII
+    return std::fstream{path.c_str(), mode};
+}
+#else
+#include <unistd.h>
+
+std::fstream rhi::open_file_beside_executable(std::string_view filename, std::ios::openmode mode)
+{
+    char buffer[1024];
+    const auto length = readlink("/proc/self/exe", buffer, sizeof(buffer));
+    std::string path {buffer, length > 0 ? static_cast<size_t>(length) : 0};
+    path.resize(path.rfind('/') + 1);
+    path.append(filename);
+    return std::fstream{path, mode};
 }
+#endif
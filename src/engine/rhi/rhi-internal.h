@@ -1,6 +1,12 @@
 #pragma once
 #include "../rhi.h"
 #include <atomic>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 
 namespace rhi
 {
@@ -22,15 +28,31 @@ namespace rhi
         using T::T;
     };
 
+    constexpr size_t max_push_constant_size = 128; // Matches the minimum value of Vulkan's maxPushConstantsSize
+
+    // Ensures that args can hold draw_count argument records of arg_size bytes, spaced stride bytes apart, as required by every backend
+    inline void validate_indirect_args(buffer_range args, int draw_count, size_t stride, size_t arg_size)
+    {
+        if(draw_count < 0) throw std::logic_error("draw_count must not be negative");
+        if(args.offset % 4 || stride % 4 || stride < arg_size) throw std::logic_error("indirect arguments must be 4 byte aligned, and stride must be at least the size of an argument record");
+        if(draw_count && (draw_count-1)*stride + arg_size > args.size) throw std::logic_error("indirect arguments out of range");
+    }
+
     // This class is used to ensure that all implementations of pipeline_layout remember the descriptor_set_layouts used to create them
     struct base_pipeline_layout : pipeline_layout
     {
         std::vector<rhi::ptr<const rhi::descriptor_set_layout>> set_layouts;
+        size_t push_constant_size;
 
-        base_pipeline_layout(array_view<const rhi::descriptor_set_layout *> set_layouts) : set_layouts{set_layouts.begin(), set_layouts.end()} {}
+        base_pipeline_layout(array_view<const rhi::descriptor_set_layout *> set_layouts, size_t push_constant_size) : set_layouts{set_layouts.begin(), set_layouts.end()}, push_constant_size{push_constant_size}
+        {
+            if(push_constant_size > max_push_constant_size) throw std::logic_error("push_constant_size exceeds 128 bytes");
+            if(push_constant_size % 4) throw std::logic_error("push_constant_size must be a multiple of 4");
+        }
 
         int get_descriptor_set_count() const final { return exactly(set_layouts.size()); }
         const descriptor_set_layout & get_descriptor_set_layout(int index) const final { return *set_layouts[index]; }
+        size_t get_push_constant_size() const final { return push_constant_size; }
     };
 
     // This class is used to ensure that all implementations of pipeline remember the pipeline_layout used to create them
@@ -43,60 +65,117 @@ namespace rhi
         const pipeline_layout & get_layout() const final { return *layout; }
     };
 
+    // This class is used to ensure that all implementations of framebuffer used with emulated_command_buffer remember whether they target a window
+    struct base_framebuffer : framebuffer
+    {
+        bool is_swapchain;
+
+        base_framebuffer(bool is_swapchain) : is_swapchain{is_swapchain} {}
+    };
+
     std::vector<client_info> & global_backend_list();
     template<class Device> void register_backend(const char * name, client_api api) { global_backend_list().push_back({name, api, [](std::function<void(const char *)> debug_callback) { return ptr<device>(new delete_when_unreferenced<Device>{debug_callback}); }}); }
     template<class Device> struct autoregister_backend { autoregister_backend(const char * name, client_api api) { register_backend<Device>(name, api); } };
+    ptr<device> create_null_device(); // Creates a device of the null backend, for tests which need a device but no GPU
+
+    // Opens a file in the directory holding the running executable, so that caches persist between runs regardless of the working directory
+    std::fstream open_file_beside_executable(std::string_view filename, std::ios::openmode mode);
 
     enum attachment_type { color, depth_stencil };
     attachment_type get_attachment_type(image_format format);
 
+    // Sub-allocates a fixed size range in power-of-two sized blocks, each aligned to its own size, merging freed blocks with their buddies
+    class buddy_allocator
+    {
+        size_t min_block_size;
+        std::vector<std::set<size_t>> free_blocks;      // free_blocks[order] holds the offsets of free blocks of size min_block_size << order
+        std::unordered_map<size_t, size_t> used_orders; // Order of each allocated block, by offset
+        size_t used_size;
+    public:
+        buddy_allocator(size_t capacity, size_t min_block_size); // capacity must be min_block_size times a power of two
+
+        size_t get_capacity() const { return min_block_size << (free_blocks.size()-1); }
+        size_t get_used_size() const { return used_size; }
+        bool is_empty() const { return used_orders.empty(); }
+
+        std::optional<size_t> allocate(size_t size, size_t alignment); // Returns the offset of the allocated range, or std::nullopt if no free block is large enough
+        void free(size_t offset);
+    };
+
     /////////////////////////////////////////////////////////////////////////////////////////
     // Emulation layer for backends which do not have a native concept of a descriptor set //
     /////////////////////////////////////////////////////////////////////////////////////////
 
+    constexpr size_t max_dynamic_offsets = 8; // Matches the minimum value of Vulkan's maxDescriptorSetUniformBuffersDynamic
+
     struct emulated_descriptor_set_layout : descriptor_set_layout
     {
+        enum class slot_type { none, buffer, image, storage_buffer, storage_image };
+        struct slot { slot_type type; size_t offset; };
+
         std::vector<descriptor_binding> bindings;
-        std::unordered_map<int, size_t> buffer_offsets;
-        std::unordered_map<int, size_t> image_offsets;
-        size_t num_buffers=0, num_images=0;
+        std::vector<slot> slots; // Indexed by binding index, giving the offset of each binding within the bindings of its type
+        size_t num_buffers=0, num_images=0, num_storage_buffers=0, num_storage_images=0;
+        std::vector<int> dynamic_offset_indices; // For each buffer binding, the index of the dynamic offset applied to it, or -1
+        size_t num_dynamic_offsets=0;
 
         emulated_descriptor_set_layout(const std::vector<descriptor_binding> & bindings);
+
+        slot get_slot(int binding) const { return binding >= 0 && static_cast<size_t>(binding) < slots.size() ? slots[binding] : slot{slot_type::none, 0}; }
+        size_t get_offset(int binding, slot_type type) const
+        {
+            const auto s = get_slot(binding);
+            if(s.type != type) throw std::logic_error("invalid binding");
+            return s.offset;
+        }
     };
 
     struct emulated_pipeline_layout : base_pipeline_layout
     {
-        struct set { ptr<const emulated_descriptor_set_layout> layout; size_t buffer_offset, image_offset; };
+        struct set { ptr<const emulated_descriptor_set_layout> layout; size_t buffer_offset, image_offset, storage_buffer_offset, storage_image_offset; };
         std::vector<set> sets;
-        size_t num_buffers=0, num_images=0;
+        size_t num_buffers=0, num_images=0, num_storage_buffers=0, num_storage_images=0;
 
-        emulated_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets);
+        emulated_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size);
+        size_t get_push_constant_buffer_binding() const { return num_buffers; } // Push constants are emulated with a uniform buffer bound to the slot after those of the descriptor sets
         size_t get_flat_buffer_binding(int set, int binding) const;
         size_t get_flat_image_binding(int set, int binding) const;        
+        size_t get_flat_storage_buffer_binding(int set, int binding) const;
+        size_t get_flat_storage_image_binding(int set, int binding) const;
     };
 
     struct buffer_binding { ptr<buffer> buffer; size_t offset, size; };
     struct image_binding { ptr<sampler> sampler; ptr<image> image; };
+    struct storage_image_binding { ptr<image> image; int mip; };
     struct emulated_descriptor_set : descriptor_set
     {
         ptr<const emulated_descriptor_set_layout> layout;
         buffer_binding * buffer_bindings;
         image_binding * image_bindings;
+        buffer_binding * storage_buffer_bindings;
+        storage_image_binding * storage_image_bindings;
 
         void write(int binding, buffer_range range) final;
         void write(int binding, sampler & sampler, image & image) final;
+        void write(int binding, image & image, int mip) final;
     };
 
     struct emulated_descriptor_pool : descriptor_pool
     {
         std::vector<buffer_binding> buffer_bindings;
         std::vector<image_binding> image_bindings;
+        std::vector<buffer_binding> storage_buffer_bindings;
+        std::vector<storage_image_binding> storage_image_bindings;
         std::vector<counted<emulated_descriptor_set>> sets;
         size_t used_buffer_bindings;
         size_t used_image_bindings;
+        size_t used_storage_buffer_bindings;
+        size_t used_storage_image_bindings;
         size_t used_sets;
+        std::mutex mutex; // Guards alloc(...), which may be called from multiple threads
 
-        emulated_descriptor_pool() : buffer_bindings{1024}, image_bindings{1024}, sets{1024}, used_buffer_bindings{0}, used_image_bindings{0}, used_sets{0}
+        emulated_descriptor_pool() : buffer_bindings{1024}, image_bindings{1024}, storage_buffer_bindings{1024}, storage_image_bindings{1024}, sets{1024}, 
+            used_buffer_bindings{0}, used_image_bindings{0}, used_storage_buffer_bindings{0}, used_storage_image_bindings{0}, used_sets{0}
         {
 
         }
@@ -105,65 +184,299 @@ namespace rhi
         ptr<descriptor_set> alloc(const descriptor_set_layout & layout) final;
     };
 
-    template<class BindBufferFunction, class BindImageFunction>
-    void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set, BindBufferFunction bind_buffer, BindImageFunction bind_image)
+    // Once its descriptor set has been handed out for binding, a resource table copies its contents into a new set before the next write, 
+    // so that commands which have already been recorded keep seeing the contents they were recorded with
+    struct emulated_resource_table : resource_table
+    {
+        struct version : emulated_descriptor_set
+        {
+            std::vector<image_binding> elements;
+            version(const emulated_descriptor_set_layout & layout, std::vector<image_binding> elements);
+        };
+        ptr<const emulated_descriptor_set_layout> layout;
+        ptr<version> current;
+        bool is_current_bound = false;
+
+        emulated_resource_table(int capacity);
+
+        int get_capacity() const final { return exactly(layout->num_images); }
+        const descriptor_set_layout & get_descriptor_set_layout() const final { return *layout; }
+        const descriptor_set & get_descriptor_set() final { is_current_bound = true; return *current; }
+        void write(int index, sampler & sampler, image & image) final;
+    };
+
+    template<class BindBufferFunction, class BindImageFunction, class BindStorageBufferFunction, class BindStorageImageFunction>
+    void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set, array_view<uint32_t> dynamic_offsets, BindBufferFunction bind_buffer, BindImageFunction bind_image,
+        BindStorageBufferFunction bind_storage_buffer, BindStorageImageFunction bind_storage_image)
     {
         const auto & p = static_cast<const emulated_pipeline_layout &>(layout);
         const auto & s = static_cast<const emulated_descriptor_set &>(set);
         if(s.layout != p.sets[set_index].layout) throw std::logic_error("descriptor_set_layout mismatch");
+        if(dynamic_offsets.size() != s.layout->num_dynamic_offsets) throw std::logic_error("wrong number of dynamic offsets");
         for(size_t i=0; i<s.layout->num_buffers; ++i)
         {
             if(!s.buffer_bindings[i].buffer) continue;
-            bind_buffer(p.sets[set_index].buffer_offset + i, *s.buffer_bindings[i].buffer, s.buffer_bindings[i].offset, s.buffer_bindings[i].size);
+            const int dynamic_index = s.layout->dynamic_offset_indices[i];
+            const size_t dynamic_offset = dynamic_index < 0 ? 0 : dynamic_offsets[dynamic_index];
+            bind_buffer(p.sets[set_index].buffer_offset + i, *s.buffer_bindings[i].buffer, s.buffer_bindings[i].offset + dynamic_offset, s.buffer_bindings[i].size);
         }
         for(size_t i=0; i<s.layout->num_images; ++i)
         {
             if(!s.image_bindings[i].image) continue;
             bind_image(p.sets[set_index].image_offset + i, *s.image_bindings[i].sampler, *s.image_bindings[i].image);
         }
+        for(size_t i=0; i<s.layout->num_storage_buffers; ++i)
+        {
+            if(!s.storage_buffer_bindings[i].buffer) continue;
+            bind_storage_buffer(p.sets[set_index].storage_buffer_offset + i, *s.storage_buffer_bindings[i].buffer, s.storage_buffer_bindings[i].offset, s.storage_buffer_bindings[i].size);
+        }
+        for(size_t i=0; i<s.layout->num_storage_images; ++i)
+        {
+            if(!s.storage_image_bindings[i].image) continue;
+            bind_storage_image(p.sets[set_index].storage_image_offset + i, *s.storage_image_bindings[i].image, s.storage_image_bindings[i].mip);
+        }
+    }
+
+    // Used by every backend as shaders are created. Throws if the push constant block of a SPIR-V module, if any, is not laid out by std140 rules, as
+    // convert_push_constants_to_uniform_block(...) keeps its offsets and strides, which uniform blocks must follow when cross-compiled to GLSL or HLSL.
+    void validate_push_constant_block(const std::vector<uint32_t> & spirv);
+
+    // Used by backends which emulate push constants with a uniform buffer. Rewrites the push constant block of a SPIR-V module, if any, as a uniform block, and returns its ID, or zero if there is none.
+    uint32_t convert_push_constants_to_uniform_block(std::vector<uint32_t> & spirv);
+
+    // Used by backends which do not support storage descriptors
+    template<class BindBufferFunction, class BindImageFunction>
+    void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set, array_view<uint32_t> dynamic_offsets, BindBufferFunction bind_buffer, BindImageFunction bind_image)
+    {
+        bind_descriptor_set(layout, set_index, set, dynamic_offsets, bind_buffer, bind_image, 
+            [](size_t, buffer &, size_t, size_t) { throw std::logic_error("storage buffers not supported"); },
+            [](size_t, image &, int) { throw std::logic_error("storage images not supported"); });
     }
 
     /////////////////////////////////////////////////////////////////////////////////////////
     // Emulation layer for backends which do not have a native concept of a command buffer //
     /////////////////////////////////////////////////////////////////////////////////////////
 
-    struct generate_mipmaps_command { ptr<image> im; };
-    struct begin_render_pass_command { render_pass_desc pass; ptr<framebuffer> framebuffer; };
+    // A bump-allocated stream of trivially copyable commands, each preceded by a type tag and optionally followed by trailing data of variable size.
+    // clear() retains the underlying storage, so a stream can be recorded repeatedly without allocating.
+    template<class... Commands> class command_stream
+    {
+        struct header { uint32_t type, words; };
+        std::vector<uint64_t> words;
+
+        template<class T> static constexpr uint32_t index_of() 
+        { 
+            constexpr bool matches[] {std::is_same_v<T, Commands>...};
+            for(uint32_t i=0; i<sizeof...(Commands); ++i) if(matches[i]) return i;
+            return sizeof...(Commands);
+        }
+        template<class T, class Visitor> static void invoke(Visitor & visitor, const void * command) { visitor(*static_cast<const T *>(command)); }
+    public:
+        bool empty() const { return words.empty(); }
+        void clear() { words.clear(); }
+
+        template<class T> void push(const T & command, const void * trailing_data=nullptr, size_t trailing_size=0)
+        {
+            static_assert(index_of<T>() < sizeof...(Commands), "T is not a command of this stream");
+            static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= alignof(uint64_t), "commands must be trivially copyable");
+            const size_t offset = words.size(), payload_words = (sizeof(T) + trailing_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+            words.resize(offset + 1 + payload_words);
+            new(&words[offset]) header{index_of<T>(), exactly(1 + payload_words)};
+            auto payload = new(&words[offset+1]) T(command);
+            if(trailing_size) memcpy(payload+1, trailing_data, trailing_size);
+        }
+
+        template<class Visitor> void visit(Visitor & visitor) const
+        {
+            using function = void (*)(Visitor &, const void *);
+            static constexpr function functions[] {&invoke<Commands, Visitor>...};
+            for(size_t i=0; i<words.size(); i += reinterpret_cast<const header &>(words[i]).words)
+            {
+                functions[reinterpret_cast<const header &>(words[i]).type](visitor, &words[i+1]);
+            }
+        }
+    };
+
+    // Commands hold raw pointers, and emulated_command_buffer keeps the objects they refer to alive. Variable-sized data trails the command in the stream.
+    struct generate_mipmaps_command { image * im; };
+    struct begin_render_pass_command { const render_pass_desc * pass; framebuffer * framebuffer; };
     struct clear_depth_command { float depth; };
     struct clear_stencil_command { uint8_t stencil; };
     struct set_viewport_rect_command { int x0, y0, x1, y1; };
     struct set_scissor_rect_command { int x0, y0, x1, y1; };    
     struct set_stencil_ref_command { uint8_t ref; };
-    struct bind_pipeline_command { ptr<const pipeline> pipe; };
-    struct bind_descriptor_set_command { ptr<const pipeline_layout> layout; int set_index; ptr<const descriptor_set> set; };
+    struct bind_pipeline_command { const pipeline * pipe; };
+    struct bind_descriptor_set_command 
+    { 
+        const pipeline_layout * layout; int set_index; const descriptor_set * set; size_t num_dynamic_offsets;
+        array_view<uint32_t> get_dynamic_offsets() const { return {reinterpret_cast<const uint32_t *>(this+1), num_dynamic_offsets}; }
+    };
+    struct push_constants_command 
+    { 
+        const pipeline_layout * layout; size_t offset, size; 
+        const void * get_data() const { return this+1; }
+    };
     struct bind_vertex_buffer_command { int index; buffer_range range; };
     struct bind_index_buffer_command { buffer_range range; };
-    struct draw_command { int first_vertex, vertex_count; };
-    struct draw_indexed_command { int first_index, index_count; };
+    struct draw_command { int first_vertex, vertex_count, first_instance, instance_count; };
+    struct draw_indexed_command { int first_index, index_count, first_instance, instance_count, vertex_offset; };
+    struct draw_indirect_command { buffer_range args; int draw_count; size_t stride; };
+    struct draw_indexed_indirect_command { buffer_range args; int draw_count; size_t stride; };
     struct end_render_pass_command {};
+    struct emulated_command_buffer;
+    struct execute_commands_command { const emulated_command_buffer * secondary; };
+    struct begin_timer_command 
+    { 
+        size_t name_length; 
+        std::string_view get_name() const { return {reinterpret_cast<const char *>(this+1), name_length}; }
+    };
+    struct end_timer_command {};
+    struct dispatch_command { int group_count_x, group_count_y, group_count_z; };
+    struct memory_barrier_command {};
 
     struct emulated_command_buffer : command_buffer
     { 
-        using command = std::variant<generate_mipmaps_command, begin_render_pass_command, clear_depth_command, clear_stencil_command,
+        using command_stream = rhi::command_stream<generate_mipmaps_command, begin_render_pass_command, clear_depth_command, clear_stencil_command,
             set_viewport_rect_command, set_scissor_rect_command, set_stencil_ref_command,
-            bind_pipeline_command, bind_descriptor_set_command, bind_vertex_buffer_command, bind_index_buffer_command, draw_command, draw_indexed_command, end_render_pass_command>;
-        std::vector<command> commands; 
-    
-        void generate_mipmaps(image & image) final { commands.push_back(generate_mipmaps_command{&image}); }
-        void begin_render_pass(const render_pass_desc & pass, framebuffer & framebuffer) final { commands.push_back(begin_render_pass_command{pass, &framebuffer}); }
-        void clear_depth(float depth) final { commands.push_back(clear_depth_command{depth}); }
-        void clear_stencil(uint8_t stencil) final { commands.push_back(clear_stencil_command{stencil}); }
-        void set_viewport_rect(int x0, int y0, int x1, int y1) final { commands.push_back(set_viewport_rect_command{x0, y0, x1, y1}); }
-        void set_scissor_rect(int x0, int y0, int x1, int y1) final { commands.push_back(set_scissor_rect_command{x0, y0, x1, y1}); }
-        void set_stencil_ref(uint8_t ref) final { commands.push_back(set_stencil_ref_command{ref}); }
-        void bind_pipeline(const pipeline & pipe) final { commands.push_back(bind_pipeline_command{&pipe}); }
-        void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set) final { commands.push_back(bind_descriptor_set_command{&layout, set_index, &set}); }
-        void bind_vertex_buffer(int index, buffer_range range) final { commands.push_back(bind_vertex_buffer_command{index, range}); }
-        void bind_index_buffer(buffer_range range) final { commands.push_back(bind_index_buffer_command{range}); }
-        void draw(int first_vertex, int vertex_count) final { commands.push_back(draw_command{first_vertex, vertex_count}); }
-        void draw_indexed(int first_index, int index_count) final { commands.push_back(draw_indexed_command{first_index, index_count}); }
-        void end_render_pass() final { commands.push_back(end_render_pass_command{}); }
-
-        template<class ExecuteCommandFunction> void execute(ExecuteCommandFunction execute_command) const { for(auto & command : commands) std::visit(execute_command, command); }
+            bind_pipeline_command, bind_descriptor_set_command, push_constants_command, bind_vertex_buffer_command, bind_index_buffer_command, draw_command, draw_indexed_command, 
+            draw_indirect_command, draw_indexed_indirect_command, execute_commands_command, end_render_pass_command, begin_timer_command, end_timer_command, dispatch_command, memory_barrier_command>;
+
+        // The storage behind a command buffer, recycled between command buffers so that recording a frame does not allocate once warmed up
+        struct recording
+        {
+            command_stream commands;
+            std::vector<ptr<const object>> referenced_objects;  // Each object is referenced once per recording, rather than once per command
+            std::array<const object *, 64> recent_objects;      // Filters out repeated references to the same objects
+            std::deque<render_pass_desc> render_passes;         // Holds the descriptions pointed to by begin_render_pass_command
+            size_t used_render_passes;
+        };
+        static std::unique_ptr<recording> acquire_recording();
+        static void release_recording(std::unique_ptr<recording> r);
+
+        std::unique_ptr<recording> rec;
+        ptr<const framebuffer> secondary_framebuffer;   // If this is a secondary command buffer, the framebuffer its commands will be executed against
+        bool in_render_pass = false;
+        bool in_secondary_pass = false;                 // True while recording a render pass whose contents must come from secondary command buffers
+        bool has_timers = false;
+        int open_timers = 0;
+        const bool is_reusable;                         // If true, may be submitted or executed any number of times
+        bool is_finished = false;                       // True once this command buffer has been submitted or executed, after which no more commands may be recorded
+
+        emulated_command_buffer(const framebuffer * secondary_framebuffer=nullptr, bool reusable=false) : rec{acquire_recording()}, secondary_framebuffer{secondary_framebuffer}, is_reusable{reusable} {}
+        ~emulated_command_buffer() { release_recording(std::move(rec)); }
+
+        // Called by backends as they submit this command buffer, and by execute_commands(...) for secondary command buffers
+        void finish()
+        {
+            if(is_finished && !is_reusable) throw std::logic_error("command buffer submitted more than once, but was not created as reusable");
+            is_finished = true;
+        }
+
+        void reference(const object & obj)
+        {
+            auto & recent = rec->recent_objects[(reinterpret_cast<uintptr_t>(&obj) >> 4) % rec->recent_objects.size()];
+            if(recent == &obj) return;
+            rec->referenced_objects.push_back(&obj);
+            recent = &obj;
+        }
+        template<class T> void record(const T & c, const void * trailing_data=nullptr, size_t trailing_size=0)
+        {
+            if(is_finished) throw std::logic_error("commands recorded into a command buffer which has already been submitted");
+            if(in_secondary_pass && !std::is_same_v<T, execute_commands_command> && !std::is_same_v<T, end_render_pass_command>) throw std::logic_error("commands in this render pass must be recorded into secondary command buffers");
+            rec->commands.push(c, trailing_data, trailing_size);
+        }
+
+        void generate_mipmaps(image & image) final { reference(image); record(generate_mipmaps_command{&image}); }
+        void begin_render_pass(const render_pass_desc & pass, framebuffer & framebuffer) final 
+        { 
+            if(secondary_framebuffer) throw std::logic_error("begin_render_pass called on a secondary command buffer");
+            if(is_reusable && static_cast<const base_framebuffer &>(framebuffer).is_swapchain) throw std::logic_error("reusable command buffers cannot begin render passes on a window's framebuffer");
+            if(rec->used_render_passes == rec->render_passes.size()) rec->render_passes.push_back(pass);
+            else rec->render_passes[rec->used_render_passes] = pass;
+            reference(framebuffer);
+            record(begin_render_pass_command{&rec->render_passes[rec->used_render_passes++], &framebuffer}); 
+            in_render_pass = true;
+            in_secondary_pass = pass.secondary_command_buffers;
+        }
+        void clear_depth(float depth) final { record(clear_depth_command{depth}); }
+        void clear_stencil(uint8_t stencil) final { record(clear_stencil_command{stencil}); }
+        void set_viewport_rect(int x0, int y0, int x1, int y1) final { record(set_viewport_rect_command{x0, y0, x1, y1}); }
+        void set_scissor_rect(int x0, int y0, int x1, int y1) final { record(set_scissor_rect_command{x0, y0, x1, y1}); }
+        void set_stencil_ref(uint8_t ref) final { record(set_stencil_ref_command{ref}); }
+        void bind_pipeline(const pipeline & pipe) final { reference(pipe); record(bind_pipeline_command{&pipe}); }
+        void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set, array_view<uint32_t> dynamic_offsets) final 
+        { 
+            if(dynamic_offsets.size() > max_dynamic_offsets) throw std::logic_error("too many dynamic offsets");
+            reference(layout);
+            reference(set);
+            record(bind_descriptor_set_command{&layout, set_index, &set, dynamic_offsets.size()}, dynamic_offsets.data(), dynamic_offsets.size()*sizeof(uint32_t)); 
+        }
+        void push_constants(const pipeline_layout & layout, size_t offset, size_t size, const void * data) final
+        {
+            if(offset + size > max_push_constant_size) throw std::logic_error("push constants out of range");
+            reference(layout);
+            record(push_constants_command{&layout, offset, size}, data, size);
+        }
+        void bind_vertex_buffer(int index, buffer_range range) final { reference(range.buffer); record(bind_vertex_buffer_command{index, range}); }
+        void bind_index_buffer(buffer_range range) final { reference(range.buffer); record(bind_index_buffer_command{range}); }
+        void draw(int first_vertex, int vertex_count, int first_instance, int instance_count) final { record(draw_command{first_vertex, vertex_count, first_instance, instance_count}); }
+        void draw_indexed(int first_index, int index_count, int first_instance, int instance_count, int vertex_offset) final { record(draw_indexed_command{first_index, index_count, first_instance, instance_count, vertex_offset}); }
+        void draw_indirect(buffer_range args, int draw_count, size_t stride) final
+        {
+            validate_indirect_args(args, draw_count, stride, sizeof(draw_indirect_args));
+            reference(args.buffer);
+            record(draw_indirect_command{args, draw_count, stride});
+        }
+        void draw_indexed_indirect(buffer_range args, int draw_count, size_t stride) final
+        {
+            validate_indirect_args(args, draw_count, stride, sizeof(draw_indexed_indirect_args));
+            reference(args.buffer);
+            record(draw_indexed_indirect_command{args, draw_count, stride});
+        }
+        void execute_commands(command_buffer & secondary) final
+        {
+            if(!in_secondary_pass) throw std::logic_error("execute_commands called outside of a render pass begun with secondary_command_buffers");
+            auto & s = static_cast<emulated_command_buffer &>(secondary);
+            if(!s.secondary_framebuffer) throw std::logic_error("execute_commands requires a secondary command buffer");
+            if(is_reusable && !s.is_reusable) throw std::logic_error("reusable command buffers may only execute reusable secondary command buffers");
+            reference(s);
+            record(execute_commands_command{&s});
+            s.finish();
+        }
+        void end_render_pass() final 
+        { 
+            if(secondary_framebuffer) throw std::logic_error("end_render_pass called on a secondary command buffer");
+            record(end_render_pass_command{}); 
+            in_render_pass = false;
+            in_secondary_pass = false;
+        }
+        void begin_timer(std::string_view name) final
+        {
+            if(secondary_framebuffer) throw std::logic_error("begin_timer called on a secondary command buffer");
+            if(is_reusable) throw std::logic_error("begin_timer called on a reusable command buffer");
+            if(in_render_pass && !has_timers) throw std::logic_error("the first timer of a command buffer must be begun outside of a render pass");
+            record(begin_timer_command{name.size()}, name.data(), name.size());
+            has_timers = true;
+            ++open_timers;
+        }
+        void end_timer() final
+        {
+            if(open_timers == 0) throw std::logic_error("end_timer called with no timer begun");
+            record(end_timer_command{});
+            --open_timers;
+        }
+        void dispatch(int group_count_x, int group_count_y, int group_count_z) final { record(dispatch_command{group_count_x, group_count_y, group_count_z}); }
+        void memory_barrier() final { record(memory_barrier_command{}); }
+
+        // Secondary command buffers are executed in place, after execute_command has been called with the execute_commands_command which refers to them
+        template<class ExecuteCommandFunction> void execute(ExecuteCommandFunction execute_command) const 
+        { 
+            auto visitor = [&](const auto & command)
+            {
+                execute_command(command);
+                if constexpr(std::is_same_v<std::decay_t<decltype(command)>, execute_commands_command>) command.secondary->execute(execute_command);
+            };
+            rec->commands.visit(visitor);
+        }
     };
 }
\ No newline at end of file
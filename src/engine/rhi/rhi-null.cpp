@@ -0,0 +1,710 @@
+#include "rhi-internal.h"
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include <thread>
+
+namespace rhi
+{
+    struct null_device : device
+    {
+        std::function<void(const char *)> debug_callback;
+        device_stats stats {};
+        std::vector<timer_result> timer_results;
+        uint64_t submitted_index=0;
+
+        null_device(std::function<void(const char *)> debug_callback) : debug_callback{debug_callback} {}
+
+        device_info get_info() const final { return {linalg::zero_to_one, false, 65536}; }
+
+        ptr<buffer> create_buffer(const buffer_desc & desc, const void * initial_data) final;
+        ptr<sampler> create_sampler(const sampler_desc & desc) final;
+        ptr<image> create_image(const image_desc & desc, std::vector<const void *> initial_data) final;
+        ptr<framebuffer> create_framebuffer(const framebuffer_desc & desc) final;
+        ptr<window> create_window(const int2 & dimensions, std::string_view title) final;
+
+        ptr<descriptor_set_layout> create_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) final { return new delete_when_unreferenced<emulated_descriptor_set_layout>{bindings}; }
+        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) final { return new delete_when_unreferenced<emulated_pipeline_layout>{sets, push_constant_size}; }
+        ptr<shader> create_shader(const shader_desc & desc) final;
+        ptr<pipeline> create_pipeline(const pipeline_desc & desc) final;
+        ptr<pipeline> create_compute_pipeline(const compute_pipeline_desc & desc) final;
+        void precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer) final;
+
+        ptr<descriptor_pool> create_descriptor_pool() final { return new delete_when_unreferenced<emulated_descriptor_pool>{}; }
+        ptr<resource_table> create_resource_table(int capacity) final;
+        ptr<command_buffer> create_command_buffer(bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(nullptr, reusable); }
+        ptr<command_buffer> create_secondary_command_buffer(const framebuffer & framebuffer, bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(&framebuffer, reusable); }
+
+        uint64_t submit(command_buffer & cmd) final;
+        uint64_t acquire_and_submit_and_present(command_buffer & cmd, window & window) final;
+        uint64_t flush_uploads() final { return submitted_index; } // Initial data is copied immediately
+        uint64_t get_last_submission_id() final { return submitted_index; }
+        void wait_until_complete(uint64_t submit_id) final {} // All work is retired by the time submit(...) returns
+        std::vector<timer_result> get_timer_results() final { return std::move(timer_results); } // No time elapses on the null device
+    };
+
+    autoregister_backend<null_device> autoregister_null_backend {"Null", client_api::null};
+
+    struct null_buffer : buffer
+    {
+        ptr<null_device> device;
+        std::vector<char> memory;
+        buffer_flags flags;
+        bool is_mapped;
+
+        // Reads the argument records of an indirect draw, as the GPU would when the draw executes
+        template<class Args> std::vector<Args> read_indirect_args(size_t offset, int draw_count, size_t stride) const
+        {
+            if(!(flags & indirect_buffer_bit)) throw std::logic_error("indirect draws require a buffer created with indirect_buffer_bit");
+            if(draw_count && offset + (draw_count-1)*stride + sizeof(Args) > memory.size()) throw std::logic_error("indirect arguments out of range");
+            std::vector<Args> args(draw_count);
+            for(int i=0; i<draw_count; ++i) memcpy(&args[i], memory.data() + offset + i*stride, sizeof(Args));
+            return args;
+        }
+
+        null_buffer(null_device * device, const buffer_desc & desc, const void * initial_data);
+        size_t get_offset_alignment() final { return 256; }
+        char * get_mapped_memory() final { return is_mapped ? memory.data() : nullptr; }
+    };
+
+    struct null_sampler : sampler
+    {
+        ptr<null_device> device;
+        sampler_desc desc;
+
+        null_sampler(null_device * device, const sampler_desc & desc) : device{device}, desc{desc} {}
+    };
+
+    struct null_image : image
+    {
+        ptr<null_device> device;
+        image_desc desc;
+
+        null_image(null_device * device, const image_desc & desc, std::vector<const void *> initial_data);
+    };
+
+    struct null_framebuffer : base_framebuffer
+    {
+        ptr<null_device> device;
+        int2 dims;
+        size_t num_color_attachments;
+        bool has_depth_attachment;
+
+        null_framebuffer(null_device * device, const int2 & dimensions, size_t num_color_attachments, bool has_depth_attachment, bool is_swapchain) : base_framebuffer{is_swapchain}, device{device}, dims{dimensions}, num_color_attachments{num_color_attachments}, has_depth_attachment{has_depth_attachment} {}
+        coord_system get_ndc_coords() const final { return {coord_axis::right, coord_axis::down, coord_axis::forward}; }
+    };
+
+    struct null_window : window
+    {
+        ptr<null_device> device;
+        GLFWwindow * glfw_window = 0;
+        ptr<null_framebuffer> swapchain_framebuffer;
+
+        null_window(null_device * device, const int2 & dimensions, std::string title);
+        ~null_window();
+        GLFWwindow * get_glfw_window() final { return glfw_window; }
+        framebuffer & get_swapchain_framebuffer() final { return *swapchain_framebuffer; }
+    };
+
+    struct null_shader : shader
+    {
+        shader_desc desc;
+
+        null_shader(const shader_desc & desc) : desc{desc} {}
+    };
+
+    struct null_pipeline : base_pipeline
+    {
+        ptr<null_device> device;
+        std::vector<vertex_binding_desc> input;
+        bool is_compute;
+
+        null_pipeline(null_device * device, const pipeline_desc & desc) : base_pipeline{*desc.layout}, device{device}, input{desc.input}, is_compute{false} {}
+        null_pipeline(null_device * device, const compute_pipeline_desc & desc) : base_pipeline{*desc.layout}, device{device}, is_compute{true} {}
+    };
+}
+
+using namespace rhi;
+
+ptr<device> rhi::create_null_device() { return new delete_when_unreferenced<null_device>{nullptr}; }
+
+std::optional<device_stats> rhi::get_null_device_stats(const device & dev)
+{
+    if(auto d = dynamic_cast<const null_device *>(&dev)) return d->stats;
+    return std::nullopt;
+}
+
+ptr<buffer> null_device::create_buffer(const buffer_desc & desc, const void * initial_data) { return new delete_when_unreferenced<null_buffer>{this, desc, initial_data}; }
+ptr<sampler> null_device::create_sampler(const sampler_desc & desc) { return new delete_when_unreferenced<null_sampler>{this, desc}; }
+ptr<image> null_device::create_image(const image_desc & desc, std::vector<const void *> initial_data) { return new delete_when_unreferenced<null_image>{this, desc, initial_data}; }
+ptr<window> null_device::create_window(const int2 & dimensions, std::string_view title) { return new delete_when_unreferenced<null_window>{this, dimensions, std::string{title}}; }
+ptr<shader> null_device::create_shader(const shader_desc & desc) { validate_push_constant_block(desc.spirv); return new delete_when_unreferenced<null_shader>{desc}; }
+ptr<pipeline> null_device::create_pipeline(const pipeline_desc & desc) { return new delete_when_unreferenced<null_pipeline>{this, desc}; }
+
+ptr<pipeline> null_device::create_compute_pipeline(const compute_pipeline_desc & desc)
+{
+    if(static_cast<const null_shader &>(*desc.stage).desc.stage != shader_stage::compute) throw std::logic_error("compute pipeline requires a compute shader");
+    return new delete_when_unreferenced<null_pipeline>{this, desc};
+}
+
+void null_device::precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer)
+{
+    if(static_cast<const null_pipeline &>(pipe).is_compute) throw std::logic_error("precompile_pipeline requires a graphics pipeline");
+}
+
+ptr<resource_table> null_device::create_resource_table(int capacity)
+{
+    if(capacity < 1 || capacity > get_info().max_resource_table_images) throw std::logic_error("resource table capacity out of range");
+    return new delete_when_unreferenced<emulated_resource_table>{capacity};
+}
+
+ptr<framebuffer> null_device::create_framebuffer(const framebuffer_desc & desc)
+{
+    auto validate_attachment = [](const framebuffer_attachment_desc & attachment)
+    {
+        auto & image_desc = static_cast<const null_image &>(*attachment.image).desc;
+        if(attachment.mip < 0 || attachment.mip >= image_desc.mip_levels) throw std::logic_error("attachment mip level out of range");
+        if(attachment.layer < 0 || attachment.layer >= get_layer_count(image_desc)) throw std::logic_error("attachment layer out of range");
+    };
+    for(auto & attachment : desc.color_attachments) validate_attachment(attachment);
+    if(desc.depth_attachment) validate_attachment(*desc.depth_attachment);
+    for(auto & attachment : desc.color_attachments) if(get_attachment_type(static_cast<const null_image &>(*attachment.image).desc.format) != attachment_type::color) throw std::logic_error("color attachment must have a color format");
+    if(desc.depth_attachment && get_attachment_type(static_cast<const null_image &>(*desc.depth_attachment->image).desc.format) != attachment_type::depth_stencil) throw std::logic_error("depth attachment must have a depth format");
+    return new delete_when_unreferenced<null_framebuffer>{this, desc.dimensions, desc.color_attachments.size(), desc.depth_attachment.has_value(), false};
+}
+
+uint64_t null_device::submit(command_buffer & cmd)
+{
+    const null_pipeline * current_pipeline = nullptr;
+    const null_pipeline * current_compute_pipeline = nullptr;
+    const null_framebuffer * current_framebuffer = nullptr;
+    bool index_buffer_bound = false;
+    size_t index_buffer_offset = 0;
+    std::vector<std::string> open_timers;
+    std::vector<timer_result> submitted_timers;
+    if(static_cast<const emulated_command_buffer &>(cmd).secondary_framebuffer) throw std::logic_error("secondary command buffers cannot be submitted directly");
+    static_cast<emulated_command_buffer &>(cmd).finish();
+
+    auto require_render_pass = [&](const char * command) { if(!current_framebuffer) throw std::logic_error(to_string(command, " called outside of a render pass")); };
+    auto require_pipeline = [&](const char * command) { require_render_pass(command); if(!current_pipeline) throw std::logic_error(to_string(command, " called with no pipeline bound")); };
+    auto require_no_render_pass = [&](const char * command) { if(current_framebuffer) throw std::logic_error(to_string(command, " called inside of a render pass")); };
+
+    static_cast<const emulated_command_buffer &>(cmd).execute(overload(
+        [&](const generate_mipmaps_command & c) { require_no_render_pass("generate_mipmaps"); },
+        [&](const begin_render_pass_command & c)
+        {
+            require_no_render_pass("begin_render_pass");
+            current_framebuffer = &static_cast<const null_framebuffer &>(*c.framebuffer);
+            if(c.pass->color_attachments.size() != current_framebuffer->num_color_attachments) throw std::logic_error("render_pass_desc does not match framebuffer color attachments");
+            if(c.pass->depth_attachment.has_value() != current_framebuffer->has_depth_attachment) throw std::logic_error("render_pass_desc does not match framebuffer depth attachment");
+            ++stats.render_passes;
+        },
+        [&](const clear_depth_command &) { require_render_pass("clear_depth"); },
+        [&](const clear_stencil_command &) { require_render_pass("clear_stencil"); },
+        [&](const set_viewport_rect_command &) { require_render_pass("set_viewport_rect"); },
+        [&](const set_scissor_rect_command &) { require_render_pass("set_scissor_rect"); },
+        [&](const set_stencil_ref_command &) { require_render_pass("set_stencil_ref"); },
+        [&](const bind_pipeline_command & c)
+        {
+            auto & pipe = static_cast<const null_pipeline &>(*c.pipe);
+            if(pipe.is_compute)
+            {
+                require_no_render_pass("bind_pipeline (compute)");
+                current_compute_pipeline = &pipe;
+            }
+            else
+            {
+                require_render_pass("bind_pipeline");
+                current_pipeline = &pipe;
+            }
+            ++stats.pipeline_binds;
+        },
+        [&](const bind_descriptor_set_command & c)
+        {
+            bind_descriptor_set(*c.layout, c.set_index, *c.set, c.get_dynamic_offsets(),
+                [&](size_t index, buffer & buffer, size_t offset, size_t size)
+                {
+                    if(offset + size > static_cast<null_buffer &>(buffer).memory.size()) throw std::logic_error("buffer binding out of range");
+                    ++stats.buffer_bindings;
+                },
+                [&](size_t index, sampler & sampler, image & image) { ++stats.image_bindings; },
+                [&](size_t index, buffer & buffer, size_t offset, size_t size)
+                {
+                    if(offset + size > static_cast<null_buffer &>(buffer).memory.size()) throw std::logic_error("storage buffer binding out of range");
+                    ++stats.storage_buffer_bindings;
+                },
+                [&](size_t index, image & image, int mip)
+                {
+                    auto & desc = static_cast<null_image &>(image).desc;
+                    if(!(desc.flags & storage_image_bit)) throw std::logic_error("storage image binding requires storage_image_bit");
+                    if(mip < 0 || mip >= desc.mip_levels) throw std::logic_error("storage image binding mip level out of range");
+                    ++stats.storage_image_bindings;
+                });
+            ++stats.descriptor_set_binds;
+        },
+        [&](const push_constants_command & c)
+        {
+            if(c.offset % 4 || c.size % 4) throw std::logic_error("push constant offset and size must be multiples of 4");
+            if(c.offset + c.size > c.layout->get_push_constant_size()) throw std::logic_error("push constants out of range of pipeline layout");
+            ++stats.push_constant_updates;
+            stats.push_constant_bytes += c.size;
+        },
+        [&](const bind_vertex_buffer_command & c)
+        {
+            require_pipeline("bind_vertex_buffer");
+            if(c.range.offset + c.range.size > static_cast<null_buffer &>(c.range.buffer).memory.size()) throw std::logic_error("vertex buffer range out of range");
+            ++stats.vertex_buffer_binds;
+        },
+        [&](const bind_index_buffer_command & c)
+        {
+            require_render_pass("bind_index_buffer");
+            if(c.range.offset + c.range.size > static_cast<null_buffer &>(c.range.buffer).memory.size()) throw std::logic_error("index buffer range out of range");
+            index_buffer_bound = true;
+            index_buffer_offset = c.range.offset;
+            ++stats.index_buffer_binds;
+        },
+        [&](const draw_command & c)
+        {
+            require_pipeline("draw");
+            ++stats.draws;
+            stats.instances += c.instance_count;
+            stats.vertices += uint64_t(c.vertex_count) * c.instance_count;
+        },
+        [&](const draw_indexed_command & c)
+        {
+            require_pipeline("draw_indexed");
+            if(!index_buffer_bound) throw std::logic_error("draw_indexed called with no index buffer bound");
+            ++stats.draws;
+            stats.instances += c.instance_count;
+            stats.vertices += uint64_t(c.index_count) * c.instance_count;
+        },
+        [&](const draw_indirect_command & c)
+        {
+            require_pipeline("draw_indirect");
+            for(auto & args : static_cast<const null_buffer &>(c.args.buffer).read_indirect_args<draw_indirect_args>(c.args.offset, c.draw_count, c.stride))
+            {
+                ++stats.draws;
+                stats.instances += args.instance_count;
+                stats.vertices += uint64_t(args.vertex_count) * args.instance_count;
+            }
+        },
+        [&](const draw_indexed_indirect_command & c)
+        {
+            require_pipeline("draw_indexed_indirect");
+            if(!index_buffer_bound) throw std::logic_error("draw_indexed_indirect called with no index buffer bound");
+            if(index_buffer_offset) throw std::logic_error("draw_indexed_indirect requires the index buffer to be bound at offset 0");
+            for(auto & args : static_cast<const null_buffer &>(c.args.buffer).read_indirect_args<draw_indexed_indirect_args>(c.args.offset, c.draw_count, c.stride))
+            {
+                ++stats.draws;
+                stats.instances += args.instance_count;
+                stats.vertices += uint64_t(args.index_count) * args.instance_count;
+            }
+        },
+        [&](const execute_commands_command & c)
+        {
+            require_render_pass("execute_commands");
+            auto & fb = static_cast<const null_framebuffer &>(*c.secondary->secondary_framebuffer);
+            if(fb.num_color_attachments != current_framebuffer->num_color_attachments || fb.has_depth_attachment != current_framebuffer->has_depth_attachment) throw std::logic_error("secondary command buffer was created for an incompatible framebuffer");
+
+            // Secondary command buffers do not inherit bound state
+            current_pipeline = nullptr;
+            index_buffer_bound = false;
+            ++stats.secondary_command_buffers;
+        },
+        [&](const end_render_pass_command &)
+        {
+            require_render_pass("end_render_pass");
+            current_framebuffer = nullptr;
+            current_pipeline = nullptr;
+        },
+        [&](const begin_timer_command & c) { open_timers.emplace_back(c.get_name()); },
+        [&](const end_timer_command &)
+        {
+            if(open_timers.empty()) throw std::logic_error("end_timer called with no timer begun");
+            submitted_timers.push_back({open_timers.back(), submitted_index+1, 0.0});
+            open_timers.pop_back();
+            ++stats.timers;
+        },
+        [&](const dispatch_command & c)
+        {
+            require_no_render_pass("dispatch");
+            if(!current_compute_pipeline) throw std::logic_error("dispatch called with no compute pipeline bound");
+            ++stats.dispatches;
+            stats.workgroups += uint64_t(c.group_count_x) * c.group_count_y * c.group_count_z;
+        },
+        [&](const memory_barrier_command &)
+        {
+            require_no_render_pass("memory_barrier");
+            ++stats.memory_barriers;
+        }
+    ));
+    if(current_framebuffer) throw std::logic_error("command buffer submitted inside of a render pass");
+    if(!open_timers.empty()) throw std::logic_error("command buffer submitted with timers still open");
+    timer_results.insert(timer_results.end(), submitted_timers.begin(), submitted_timers.end());
+    ++stats.submissions;
+    return ++submitted_index;
+}
+
+uint64_t null_device::acquire_and_submit_and_present(command_buffer & cmd, window & window)
+{
+    submit(cmd);
+    ++stats.presents;
+    return submitted_index;
+}
+
+null_buffer::null_buffer(null_device * device, const buffer_desc & desc, const void * initial_data) : device{device}, memory(desc.size), flags{desc.flags}, is_mapped{(desc.flags & mapped_memory_bit) != 0}
+{
+    if(initial_data)
+    {
+        memcpy(memory.data(), initial_data, desc.size);
+        device->stats.bytes_uploaded += desc.size;
+    }
+}
+
+null_image::null_image(null_device * device, const image_desc & desc, std::vector<const void *> initial_data) : device{device}, desc{desc}
+{
+    if((desc.flags & storage_image_bit) && (desc.flags & (color_attachment_bit|depth_attachment_bit))) throw std::logic_error("storage images cannot be used as attachments");
+
+    const size_t layer_count = get_layer_count(desc);
+    if(!initial_data.empty() && initial_data.size() != layer_count) throw std::logic_error("initial_data must supply one pointer per layer");
+
+    // We do not retain image contents, but still account for the cost of uploading them
+    const size_t layer_size = get_pixel_size(desc.format) * product(desc.dimensions);
+    for(auto data : initial_data) if(data) device->stats.bytes_uploaded += layer_size;
+}
+
+null_window::null_window(null_device * device, const int2 & dimensions, std::string title) : device{device}
+{
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfw_window = glfwCreateWindow(dimensions.x, dimensions.y, title.c_str(), nullptr, nullptr);
+    if(!glfw_window) throw std::runtime_error("glfwCreateWindow(...) failed");
+    swapchain_framebuffer = new delete_when_unreferenced<null_framebuffer>{device, dimensions, 1, true, true};
+}
+null_window::~null_window()
+{
+    glfwDestroyWindow(glfw_window);
+}
+
+DOCTEST_TEST_CASE("null backend counts and validates submitted work")
+{
+    auto dev = create_null_device();
+    const uint32_t indices[] {0,1,2};
+    auto index_buffer = dev->create_buffer({sizeof(indices), index_buffer_bit}, indices);
+    auto uniform_buffer = dev->create_buffer({256, uniform_buffer_bit|mapped_memory_bit}, nullptr);
+    DOCTEST_CHECK(uniform_buffer->get_mapped_memory() != nullptr);
+
+    auto color = dev->create_image({image_shape::_2d, {4,4,1}, 1, image_format::rgba_unorm8, color_attachment_bit}, {});
+    auto fb = dev->create_framebuffer({{4,4}, {{color, 0, 0}}});
+    auto set_layout = dev->create_descriptor_set_layout({{0, descriptor_type::uniform_buffer, 1}});
+    auto other_set_layout = dev->create_descriptor_set_layout({{0, descriptor_type::uniform_buffer, 1}});
+    auto pipe_layout = dev->create_pipeline_layout({set_layout});
+    auto pipe = dev->create_pipeline({pipe_layout, {}, {}, primitive_topology::triangles, front_face::counter_clockwise, cull_mode::back, std::nullopt, std::nullopt, {}});
+    auto pool = dev->create_descriptor_pool();
+
+    render_pass_desc pass;
+    pass.color_attachments = {{dont_care{}, dont_care{}}};
+
+    auto set = pool->alloc(*set_layout);
+    set->write(0, {*uniform_buffer, 0, 64});
+    auto cmd = dev->create_command_buffer();
+    cmd->begin_render_pass(pass, *fb);
+    cmd->bind_pipeline(*pipe);
+    cmd->bind_descriptor_set(*pipe_layout, 0, *set);
+    cmd->bind_index_buffer({*index_buffer, 0, sizeof(indices)});
+    cmd->draw_indexed(0, 3);
+    cmd->end_render_pass();
+    DOCTEST_CHECK(dev->submit(*cmd) == 1);
+
+    const auto stats = get_null_device_stats(*dev);
+    DOCTEST_REQUIRE(stats.has_value());
+    DOCTEST_CHECK(stats->submissions == 1);
+    DOCTEST_CHECK(stats->draws == 1);
+    DOCTEST_CHECK(stats->instances == 1);
+    DOCTEST_CHECK(stats->vertices == 3);
+    DOCTEST_CHECK(stats->pipeline_binds == 1);
+    DOCTEST_CHECK(stats->descriptor_set_binds == 1);
+    DOCTEST_CHECK(stats->buffer_bindings == 1);
+    DOCTEST_CHECK(stats->bytes_uploaded == sizeof(indices));
+
+    DOCTEST_SUBCASE("descriptor sets must match the layout of the pipeline they are bound to")
+    {
+        auto other_set = pool->alloc(*other_set_layout);
+        auto bad_cmd = dev->create_command_buffer();
+        bad_cmd->begin_render_pass(pass, *fb);
+        bad_cmd->bind_descriptor_set(*pipe_layout, 0, *other_set);
+        bad_cmd->end_render_pass();
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*bad_cmd), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("exhausted descriptor pools return nullptr until reset")
+    {
+        auto other_pool = dev->create_descriptor_pool();
+        std::vector<ptr<descriptor_set>> sets;
+        while(auto s = other_pool->alloc(*set_layout)) sets.push_back(s);
+        DOCTEST_CHECK(!sets.empty());
+        DOCTEST_CHECK_THROWS_AS(other_pool->reset(), std::logic_error);
+        sets.clear();
+        other_pool->reset();
+        DOCTEST_CHECK(other_pool->alloc(*set_layout) != nullptr);
+    }
+
+    DOCTEST_SUBCASE("compute dispatches are counted outside of render passes")
+    {
+        auto storage_buffer = dev->create_buffer({1024, storage_buffer_bit}, nullptr);
+        auto storage_image = dev->create_image({image_shape::_2d, {16,16,1}, 2, image_format::rgba_float16, storage_image_bit}, {});
+        auto compute_set_layout = dev->create_descriptor_set_layout({{0, descriptor_type::storage_buffer, 1}, {1, descriptor_type::storage_image, 1}});
+        auto compute_pipe_layout = dev->create_pipeline_layout({compute_set_layout});
+        auto compute_shader = dev->create_shader({shader_stage::compute, {}});
+        auto compute_pipe = dev->create_compute_pipeline({compute_pipe_layout, compute_shader});
+        auto compute_set = pool->alloc(*compute_set_layout);
+        compute_set->write(0, {*storage_buffer, 0, 1024});
+        compute_set->write(1, *storage_image, 1);
+
+        auto compute_cmd = dev->create_command_buffer();
+        compute_cmd->bind_pipeline(*compute_pipe);
+        compute_cmd->bind_descriptor_set(*compute_pipe_layout, 0, *compute_set);
+        compute_cmd->dispatch(2, 2, 1);
+        compute_cmd->memory_barrier();
+        dev->submit(*compute_cmd);
+
+        const auto compute_stats = get_null_device_stats(*dev);
+        DOCTEST_CHECK(compute_stats->dispatches == 1);
+        DOCTEST_CHECK(compute_stats->workgroups == 4);
+        DOCTEST_CHECK(compute_stats->memory_barriers == 1);
+        DOCTEST_CHECK(compute_stats->storage_buffer_bindings == 1);
+        DOCTEST_CHECK(compute_stats->storage_image_bindings == 1);
+
+        auto bad_cmd = dev->create_command_buffer();
+        bad_cmd->begin_render_pass(pass, *fb);
+        bad_cmd->dispatch(1, 1, 1);
+        bad_cmd->end_render_pass();
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*bad_cmd), std::logic_error);
+
+        dev->precompile_pipeline(*pipe, *fb);
+        DOCTEST_CHECK_THROWS_AS(dev->precompile_pipeline(*compute_pipe, *fb), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("dynamic offsets are applied to dynamic uniform buffers")
+    {
+        auto dynamic_set_layout = dev->create_descriptor_set_layout({{0, descriptor_type::uniform_buffer_dynamic, 1}});
+        auto dynamic_pipe_layout = dev->create_pipeline_layout({dynamic_set_layout});
+        auto dynamic_set = pool->alloc(*dynamic_set_layout);
+        dynamic_set->write(0, {*uniform_buffer, 0, 64});
+
+        auto dynamic_cmd = dev->create_command_buffer();
+        dynamic_cmd->bind_descriptor_set(*dynamic_pipe_layout, 0, *dynamic_set, {0});
+        dynamic_cmd->bind_descriptor_set(*dynamic_pipe_layout, 0, *dynamic_set, {192});
+        dev->submit(*dynamic_cmd);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->buffer_bindings == 3);
+
+        auto missing_cmd = dev->create_command_buffer();
+        missing_cmd->bind_descriptor_set(*dynamic_pipe_layout, 0, *dynamic_set);
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*missing_cmd), std::logic_error);
+
+        auto out_of_range_cmd = dev->create_command_buffer();
+        out_of_range_cmd->bind_descriptor_set(*dynamic_pipe_layout, 0, *dynamic_set, {256});
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*out_of_range_cmd), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("push constants are validated against the pipeline layout")
+    {
+        auto push_pipe_layout = dev->create_pipeline_layout({set_layout}, 64);
+        DOCTEST_CHECK(push_pipe_layout->get_push_constant_size() == 64);
+        DOCTEST_CHECK_THROWS_AS(dev->create_pipeline_layout({}, 256), std::logic_error);
+
+        const float4x4 transform = linalg::identity;
+        auto push_cmd = dev->create_command_buffer();
+        push_cmd->push_constants(*push_pipe_layout, 0, sizeof(transform), &transform);
+        dev->submit(*push_cmd);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->push_constant_updates == 1);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->push_constant_bytes == 64);
+
+        auto out_of_range_cmd = dev->create_command_buffer();
+        out_of_range_cmd->push_constants(*pipe_layout, 0, sizeof(transform), &transform);
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*out_of_range_cmd), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("secondary command buffers recorded on other threads are executed within render passes")
+    {
+        std::vector<ptr<command_buffer>> secondaries(4);
+        std::vector<std::thread> threads;
+        for(auto & secondary : secondaries) threads.emplace_back([&]()
+        {
+            secondary = dev->create_secondary_command_buffer(*fb);
+            auto secondary_set = pool->alloc(*set_layout);
+            secondary_set->write(0, {*uniform_buffer, 0, 64});
+            secondary->bind_pipeline(*pipe);
+            secondary->bind_descriptor_set(*pipe_layout, 0, *secondary_set);
+            secondary->draw(0, 3);
+        });
+        for(auto & thread : threads) thread.join();
+
+        auto primary = dev->create_command_buffer();
+        render_pass_desc secondary_pass = pass;
+        secondary_pass.secondary_command_buffers = true;
+        primary->begin_render_pass(secondary_pass, *fb);
+        for(auto & secondary : secondaries) primary->execute_commands(*secondary);
+        DOCTEST_CHECK_THROWS_AS(primary->draw(0, 3), std::logic_error);
+        primary->end_render_pass();
+        dev->submit(*primary);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->secondary_command_buffers == 4);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->draws == 5);
+
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*secondaries[0]), std::logic_error);
+        DOCTEST_CHECK_THROWS_AS(secondaries[0]->begin_render_pass(pass, *fb), std::logic_error);
+        auto inline_cmd = dev->create_command_buffer();
+        inline_cmd->begin_render_pass(pass, *fb);
+        DOCTEST_CHECK_THROWS_AS(inline_cmd->execute_commands(*secondaries[0]), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("reusable command buffers may be submitted more than once")
+    {
+        auto secondary = dev->create_secondary_command_buffer(*fb, true);
+        secondary->bind_pipeline(*pipe);
+        secondary->draw(0, 3);
+
+        auto reusable_cmd = dev->create_command_buffer(true);
+        render_pass_desc secondary_pass = pass;
+        secondary_pass.secondary_command_buffers = true;
+        reusable_cmd->begin_render_pass(secondary_pass, *fb);
+        reusable_cmd->execute_commands(*secondary);
+        reusable_cmd->end_render_pass();
+        secondary = nullptr;
+        for(int i=0; i<3; ++i) dev->submit(*reusable_cmd);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->draws == stats->draws + 3);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->submissions == stats->submissions + 3);
+        DOCTEST_CHECK_THROWS_AS(reusable_cmd->draw(0, 3), std::logic_error);
+        DOCTEST_CHECK_THROWS_AS(dev->create_command_buffer(true)->begin_timer("reused"), std::logic_error);
+
+        auto once_cmd = dev->create_command_buffer();
+        dev->submit(*once_cmd);
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*once_cmd), std::logic_error);
+        auto once_secondary = dev->create_secondary_command_buffer(*fb);
+        auto bad_cmd = dev->create_command_buffer(true);
+        bad_cmd->begin_render_pass(secondary_pass, *fb);
+        DOCTEST_CHECK_THROWS_AS(bad_cmd->execute_commands(*once_secondary), std::logic_error);
+
+        // Commands replayed into a window must come from a reusable secondary command buffer, executed by a primary command buffer recorded each frame
+        ptr<framebuffer> window_fb = new delete_when_unreferenced<null_framebuffer>{static_cast<null_device *>(&*dev), int2{4,4}, 1, false, true};
+        DOCTEST_CHECK_THROWS_AS(dev->create_command_buffer(true)->begin_render_pass(pass, *window_fb), std::logic_error);
+        auto window_secondary = dev->create_secondary_command_buffer(*window_fb, true);
+        window_secondary->bind_pipeline(*pipe);
+        window_secondary->draw(0, 3);
+        for(int i=0; i<2; ++i)
+        {
+            auto frame_cmd = dev->create_command_buffer();
+            frame_cmd->begin_render_pass(secondary_pass, *window_fb);
+            frame_cmd->execute_commands(*window_secondary);
+            frame_cmd->end_render_pass();
+            dev->submit(*frame_cmd);
+        }
+        DOCTEST_CHECK(get_null_device_stats(*dev)->draws == stats->draws + 5);
+    }
+
+    DOCTEST_SUBCASE("timers are reported once their submission completes")
+    {
+        auto timed_cmd = dev->create_command_buffer();
+        timed_cmd->begin_timer("frame");
+        timed_cmd->begin_render_pass(pass, *fb);
+        timed_cmd->begin_timer("draw");
+        timed_cmd->bind_pipeline(*pipe);
+        timed_cmd->draw(0, 3);
+        timed_cmd->end_timer();
+        timed_cmd->end_render_pass();
+        timed_cmd->end_timer();
+        DOCTEST_CHECK_THROWS_AS(timed_cmd->end_timer(), std::logic_error);
+        auto untimed_cmd = dev->create_command_buffer();
+        untimed_cmd->begin_render_pass(pass, *fb);
+        DOCTEST_CHECK_THROWS_AS(untimed_cmd->begin_timer("draw"), std::logic_error);
+        untimed_cmd->end_render_pass();
+        const auto id = dev->submit(*timed_cmd);
+        dev->wait_until_complete(id);
+
+        const auto results = dev->get_timer_results();
+        DOCTEST_REQUIRE(results.size() == 2);
+        DOCTEST_CHECK(results[0].name == "draw");
+        DOCTEST_CHECK(results[1].name == "frame");
+        DOCTEST_CHECK(results[1].submission_id == id);
+        DOCTEST_CHECK(dev->get_timer_results().empty());
+        DOCTEST_CHECK(get_null_device_stats(*dev)->timers == 2);
+
+        auto open_cmd = dev->create_command_buffer();
+        open_cmd->begin_timer("unfinished");
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*open_cmd), std::logic_error);
+        DOCTEST_CHECK_THROWS_AS(dev->create_secondary_command_buffer(*fb)->begin_timer("secondary"), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("indirect draws read their arguments from buffers with indirect_buffer_bit")
+    {
+        const draw_indexed_indirect_args args[] {{3, 2, 0, 0, 0}, {3, 1, 0, 0, 2}, {0, 1, 0, 0, 0}};
+        auto args_buffer = dev->create_buffer({sizeof(args), indirect_buffer_bit}, args);
+        auto indirect_cmd = dev->create_command_buffer();
+        indirect_cmd->begin_render_pass(pass, *fb);
+        indirect_cmd->bind_pipeline(*pipe);
+        indirect_cmd->bind_index_buffer({*index_buffer, 0, sizeof(indices)});
+        indirect_cmd->draw_indexed_indirect({*args_buffer, 0, sizeof(args)}, 3);
+        indirect_cmd->end_render_pass();
+        dev->submit(*indirect_cmd);
+        const auto indirect_stats = get_null_device_stats(*dev);
+        DOCTEST_CHECK(indirect_stats->draws == stats->draws + 3);
+        DOCTEST_CHECK(indirect_stats->instances == stats->instances + 4);
+        DOCTEST_CHECK(indirect_stats->vertices == stats->vertices + 9);
+
+        DOCTEST_CHECK_THROWS_AS(indirect_cmd->draw_indexed_indirect({*args_buffer, 0, sizeof(args)}, 4), std::logic_error);
+        auto bad_cmd = dev->create_command_buffer();
+        bad_cmd->begin_render_pass(pass, *fb);
+        bad_cmd->bind_pipeline(*pipe);
+        bad_cmd->bind_index_buffer({*index_buffer, 0, sizeof(indices)});
+        bad_cmd->draw_indexed_indirect({*index_buffer, 0, sizeof(indices)}, 0);
+        bad_cmd->end_render_pass();
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*bad_cmd), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("array images expose one layer per array element, and six per cube")
+    {
+        const uint32_t texels[4*4] {};
+        auto array_image = dev->create_image({image_shape::_2d_array, {4,4,1}, 1, image_format::rgba_unorm8, sampled_image_bit|color_attachment_bit, 3}, {texels, texels, texels});
+        auto cube_array_image = dev->create_image({image_shape::cube_array, {4,4,1}, 1, image_format::rgba_unorm8, sampled_image_bit|color_attachment_bit, 2}, {});
+        DOCTEST_CHECK(get_layer_count({image_shape::cube_array, {4,4,1}, 1, image_format::rgba_unorm8, sampled_image_bit, 2}) == 12);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->bytes_uploaded == stats->bytes_uploaded + sizeof(texels)*3);
+        DOCTEST_CHECK_NOTHROW(dev->create_framebuffer({{4,4}, {{array_image, 0, 2}}}));
+        DOCTEST_CHECK_NOTHROW(dev->create_framebuffer({{4,4}, {{cube_array_image, 0, 11}}}));
+        DOCTEST_CHECK_THROWS_AS(dev->create_framebuffer({{4,4}, {{array_image, 0, 3}}}), std::logic_error);
+        DOCTEST_CHECK_THROWS_AS(dev->create_image({image_shape::_2d_array, {4,4,1}, 1, image_format::rgba_unorm8, sampled_image_bit, 3}, {texels}), std::logic_error);
+        DOCTEST_CHECK_THROWS_AS(dev->create_image({image_shape::_2d, {4,4,1}, 1, image_format::rgba_unorm8, sampled_image_bit, 2}, {}), std::logic_error);
+    }
+
+    DOCTEST_SUBCASE("resource tables are copied on write once bound, so recorded commands see the contents they were recorded with")
+    {
+        DOCTEST_CHECK_THROWS_AS(dev->create_resource_table(dev->get_info().max_resource_table_images + 1), std::logic_error);
+        auto table = dev->create_resource_table(4);
+        DOCTEST_CHECK(table->get_capacity() == 4);
+        auto sampler = dev->create_sampler({filter::nearest, filter::nearest, std::nullopt, address_mode::repeat, address_mode::repeat, address_mode::repeat});
+        auto texture = dev->create_image({image_shape::_2d, {4,4,1}, 1, image_format::rgba_unorm8, sampled_image_bit}, {});
+        DOCTEST_CHECK_THROWS_AS(table->write(4, *sampler, *texture), std::logic_error);
+        auto table_layout = dev->create_pipeline_layout({&table->get_descriptor_set_layout()});
+        auto table_pipe = dev->create_pipeline({table_layout, {}, {}, primitive_topology::triangles, front_face::counter_clockwise, cull_mode::back, std::nullopt, std::nullopt, {}});
+
+        table->write(0, *sampler, *texture);
+        auto table_cmd = dev->create_command_buffer();
+        table_cmd->begin_render_pass(pass, *fb);
+        table_cmd->bind_pipeline(*table_pipe);
+        table_cmd->bind_descriptor_set(*table_layout, 0, table->get_descriptor_set());
+        table->write(1, *sampler, *texture);
+        table->write(2, *sampler, *texture);
+        table_cmd->bind_descriptor_set(*table_layout, 0, table->get_descriptor_set());
+        table_cmd->end_render_pass();
+        dev->submit(*table_cmd);
+        DOCTEST_CHECK(get_null_device_stats(*dev)->image_bindings == stats->image_bindings + 1 + 3);
+    }
+
+    DOCTEST_SUBCASE("draws require a bound pipeline")
+    {
+        auto bad_cmd = dev->create_command_buffer();
+        bad_cmd->begin_render_pass(pass, *fb);
+        bad_cmd->draw(0, 3);
+        bad_cmd->end_render_pass();
+        DOCTEST_CHECK_THROWS_AS(dev->submit(*bad_cmd), std::logic_error);
+    }
+}
@@ -1,6 +1,8 @@
 #include "rhi-internal.h"
 
 #include <map>
+#include <deque>
+#include <fstream>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "../../dep/SPIRV-Cross/spirv_glsl.hpp"
@@ -43,26 +45,52 @@ namespace rhi
         #include "rhi-tables.inl"
     }}
 
+    struct gl_shader;
     struct gl_pipeline;
     struct gl_device : device
     {
         std::function<void(const char *)> debug_callback;
         GLFWwindow * hidden_window;
+        GLuint push_constant_buffer;
         
         std::map<uint64_t, GLsync> sync_objects;
         uint64_t submitted_index=0;
 
-        struct context_objects { std::unordered_map<const gl_pipeline *, GLuint> vertex_array_objects;};
+        struct context_objects { std::unordered_map<const gl_pipeline *, GLuint> vertex_array_objects; std::vector<GLuint> free_queries; };
         std::map<GLFWwindow *, context_objects> context_specific_objects;
 
+        // GPU timers, whose timestamp queries belong to whichever context was current when they were written
+        struct gl_timestamp { GLFWwindow * context; GLuint query; };
+        struct gl_timer { uint64_t submission_id; std::string name; gl_timestamp begin, end; };
+        std::deque<gl_timer> pending_timers;
+        std::vector<timer_result> timer_results;
+
+        // Program cache, persisted between runs beside the executable so that shaders cross-compiled and programs linked once need not be again
+        constexpr static const char * program_cache_filename = "opengl-program-cache.bin";
+        struct gl_program_binary { GLenum format; std::vector<char> data; };
+        std::string driver_string;
+        std::unordered_map<uint64_t, std::string> glsl_cache;                   // Keyed by the SPIR-V of a stage and the pipeline layout it is remapped to
+        std::unordered_map<uint64_t, gl_program_binary> program_binary_cache;   // Keyed by the keys of all stages and the driver string
+        bool program_cache_dirty = false;
+
+        // Resource tables are emulated with sampler arrays, whose elements each occupy a texture unit, so they may use at most half of the units available to a stage
+        int max_resource_table_images = 0;
+
         gl_device(std::function<void(const char *)> debug_callback);
+        ~gl_device();
         
         void enable_debug_callback(GLFWwindow * window);
         void destroy_context_objects(GLFWwindow * context);
         void destroy_pipeline_objects(gl_pipeline * pipeline);
-        void bind_vertex_array(GLFWwindow * context, const gl_pipeline & pipeline);
+        GLuint get_vertex_array(GLFWwindow * context, const gl_pipeline & pipeline);
+        gl_timestamp write_timestamp(GLFWwindow * context);
+        GLuint64 read_timestamp(const gl_timestamp & timestamp);
+        void load_program_cache();
+        void save_program_cache() const;
+        const std::string & get_glsl(const pipeline_layout & layout, const gl_shader & shader, uint64_t key);
+        GLuint create_program(const pipeline_layout & layout, const std::vector<ptr<const shader>> & stages);
 
-        device_info get_info() const final { return {linalg::neg_one_to_one, false}; }
+        device_info get_info() const final { return {linalg::neg_one_to_one, false, max_resource_table_images}; }
 
         ptr<buffer> create_buffer(const buffer_desc & desc, const void * initial_data) final;
         ptr<sampler> create_sampler(const sampler_desc & desc) final;
@@ -71,17 +99,23 @@ namespace rhi
         ptr<window> create_window(const int2 & dimensions, std::string_view title) final;        
         
         ptr<descriptor_set_layout> create_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) final { return new delete_when_unreferenced<emulated_descriptor_set_layout>{bindings}; }
-        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets) final { return new delete_when_unreferenced<emulated_pipeline_layout>{sets}; }
+        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) final { return new delete_when_unreferenced<emulated_pipeline_layout>{sets, push_constant_size}; }
         ptr<shader> create_shader(const shader_desc & desc) final;
         ptr<pipeline> create_pipeline(const pipeline_desc & desc) final;
+        ptr<pipeline> create_compute_pipeline(const compute_pipeline_desc & desc) final;
+        void precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer) final {} // Programs are linked when pipelines are created
 
         ptr<descriptor_pool> create_descriptor_pool() final { return new delete_when_unreferenced<emulated_descriptor_pool>{}; }
-        ptr<command_buffer> create_command_buffer() final { return new delete_when_unreferenced<emulated_command_buffer>(); }
+        ptr<resource_table> create_resource_table(int capacity) final;
+        ptr<command_buffer> create_command_buffer(bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(nullptr, reusable); }
+        ptr<command_buffer> create_secondary_command_buffer(const framebuffer & framebuffer, bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(&framebuffer, reusable); }
 
         uint64_t submit(command_buffer & cmd) final;
         uint64_t acquire_and_submit_and_present(command_buffer & cmd, window & window) final;
+        uint64_t flush_uploads() final { return submitted_index; } // Initial data is uploaded immediately
         uint64_t get_last_submission_id() final { return submitted_index; }
         void wait_until_complete(uint64_t submit_id) final;
+        std::vector<timer_result> get_timer_results() final { return std::move(timer_results); }
     };
 
     autoregister_backend<gl_device> autoregister_gl_backend {"OpenGL 4.5 Core", client_api::opengl};
@@ -111,13 +145,14 @@ namespace rhi
     {
         ptr<gl_device> device;
         GLuint texture_object = 0;
+        GLenum internal_format;
         bool is_layered;
 
         gl_image(gl_device * device, const image_desc & desc, std::vector<const void *> initial_data);
         ~gl_image();
     };
 
-    struct gl_framebuffer : framebuffer
+    struct gl_framebuffer : base_framebuffer
     {
         ptr<gl_device> device;
         GLuint framebuffer_object = 0;  // If nonzero, this is a framebuffer object in the context of the hidden window
@@ -149,7 +184,11 @@ namespace rhi
     struct gl_pipeline : base_pipeline
     {
         struct gl_stencil { GLenum func=GL_ALWAYS, sfail=GL_KEEP, dpfail=GL_KEEP, dppass=GL_KEEP; };
-        struct gl_blend { GLboolean red_mask, green_mask, blue_mask, alpha_mask; GLenum color_op, alpha_op, src_color, dst_color, src_alpha, dst_alpha; };
+        struct gl_blend 
+        { 
+            GLboolean red_mask, green_mask, blue_mask, alpha_mask; GLenum color_op, alpha_op, src_color, dst_color, src_alpha, dst_alpha; 
+            auto tie() const { return std::tie(red_mask, green_mask, blue_mask, alpha_mask, color_op, alpha_op, src_color, dst_color, src_alpha, dst_alpha); }
+        };
         ptr<gl_device> device;
         GLuint program_object = 0;
         std::vector<rhi::vertex_binding_desc> input;
@@ -164,11 +203,191 @@ namespace rhi
 
         gl_pipeline(gl_device * device, const pipeline_desc & desc);
         ~gl_pipeline();
+    };
+
+    struct gl_compute_pipeline : base_pipeline
+    {
+        ptr<gl_device> device;
+        GLuint program_object = 0;
+
+        gl_compute_pipeline(gl_device * device, const compute_pipeline_desc & desc);
+        ~gl_compute_pipeline();
+    };
+
+    // Shadows the state set by gl_device::submit(...), so that redundant state changes and binds can be skipped. Changes to indexed buffer and texture
+    // bindings are gathered and issued with the multi-bind entry points by flush_bindings(). The state of a context is unknown when it is made current,
+    // so reset() must be called whenever the current context changes.
+    class gl_state_cache
+    {
+        static constexpr GLuint unknown = ~0u;
+        struct gl_cap { GLenum cap; bool enabled; };
+        struct gl_stencil_func { GLenum func; GLint ref; GLuint mask; };
+        struct gl_stencil_op { GLenum sfail, dpfail, dppass; };
+        struct gl_vertex_buffer { GLuint buffer; GLintptr offset; GLsizei stride; };
+        struct gl_image_unit { GLuint texture; GLint level; GLboolean layered; GLenum format; };
+        struct gl_dirty_range 
+        { 
+            size_t begin=SIZE_MAX, end=0; 
+            void add(size_t index) { begin = std::min(begin, index); end = std::max(end, index+1); }
+            bool empty() const { return begin >= end; }
+        };
+        struct gl_indexed_buffers
+        {
+            const GLenum target;
+            std::vector<GLuint> buffers; std::vector<GLintptr> offsets; std::vector<GLsizeiptr> sizes;
+            gl_dirty_range dirty;
+
+            void reset() { buffers.clear(); offsets.clear(); sizes.clear(); dirty = {}; }
+            void set(size_t index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+            {
+                if(index >= buffers.size()) { buffers.resize(index+1, unknown); offsets.resize(index+1, 0); sizes.resize(index+1, 0); }
+                if(buffers[index] == buffer && offsets[index] == offset && sizes[index] == size) return;
+                buffers[index] = buffer; offsets[index] = offset; sizes[index] = size;
+                dirty.add(index);
+            }
+            void flush()
+            {
+                if(dirty.empty()) return;
+                for(size_t i=dirty.begin; i<dirty.end; ++i) if(buffers[i] == unknown) buffers[i] = 0; // Bindings we have never set are unbound, as nothing in this submission uses them
+                glBindBuffersRange(target, exactly(dirty.begin), exactly(dirty.end-dirty.begin), buffers.data()+dirty.begin, offsets.data()+dirty.begin, sizes.data()+dirty.begin);
+                dirty = {};
+            }
+        };
 
-        void set_stencil_ref(uint8_t ref) const
+        std::vector<gl_cap> caps;
+        GLuint program, vertex_array, element_buffer, draw_indirect_buffer, draw_framebuffer;
+        std::array<GLint,4> viewport_rect, scissor_rect;
+        GLenum front_face_mode, cull_face_mode, depth_func_op;
+        GLint depth_write_mask;
+        gl_stencil_func stencil_funcs[2];
+        gl_stencil_op stencil_ops[2];
+        std::optional<GLuint> stencil_write_masks[2];
+        std::vector<std::optional<gl_pipeline::gl_blend>> blends;
+        std::vector<std::optional<gl_vertex_buffer>> vertex_buffers;
+        gl_indexed_buffers uniform_buffers {GL_UNIFORM_BUFFER}, storage_buffers {GL_SHADER_STORAGE_BUFFER};
+        std::vector<GLuint> textures, samplers;
+        gl_dirty_range dirty_textures;
+        std::vector<std::optional<gl_image_unit>> image_units;
+
+        static size_t face_index(GLenum face) { return face == GL_BACK ? 1 : 0; }
+    public:
+        gl_state_cache() { reset(); }
+
+        void reset()
+        {
+            caps.clear();
+            program = vertex_array = element_buffer = draw_indirect_buffer = draw_framebuffer = unknown;
+            viewport_rect = scissor_rect = {-1,-1,-1,-1};
+            front_face_mode = cull_face_mode = depth_func_op = unknown;
+            depth_write_mask = -1;
+            for(auto & f : stencil_funcs) f = {unknown, -1, 0};
+            for(auto & o : stencil_ops) o = {unknown, unknown, unknown};
+            for(auto & m : stencil_write_masks) m.reset();
+            blends.clear();
+            vertex_buffers.clear();
+            uniform_buffers.reset();
+            storage_buffers.reset();
+            textures.clear();
+            samplers.clear();
+            dirty_textures = {};
+            image_units.clear();
+        }
+
+        void set_enabled(GLenum cap, bool enabled)
+        {
+            auto it = std::find_if(begin(caps), end(caps), [cap](const gl_cap & c) { return c.cap == cap; });
+            if(it == end(caps)) caps.push_back({cap, !enabled}), it = caps.end()-1;
+            if(it->enabled == enabled) return;
+            if(enabled) glEnable(cap); else glDisable(cap);
+            it->enabled = enabled;
+        }
+        void use_program(GLuint p) { if(p != program) glUseProgram(program = p); }
+        void bind_vertex_array(GLuint vao)
+        {
+            if(vao == vertex_array) return;
+            glBindVertexArray(vertex_array = vao);
+            // Vertex buffer and element buffer bindings belong to the vertex array object
+            vertex_buffers.clear();
+            element_buffer = unknown;
+        }
+        void bind_vertex_buffer(GLuint index, GLuint buffer, GLintptr offset, GLsizei stride)
         {
-            glStencilFuncSeparate(GL_FRONT, stencil_front.func, ref, stencil_read_mask);
-            glStencilFuncSeparate(GL_BACK, stencil_back.func, ref, stencil_read_mask);
+            if(index >= vertex_buffers.size()) vertex_buffers.resize(index+1);
+            auto & b = vertex_buffers[index];
+            if(b && b->buffer == buffer && b->offset == offset && b->stride == stride) return;
+            glBindVertexBuffer(index, buffer, offset, stride);
+            b = gl_vertex_buffer{buffer, offset, stride};
+        }
+        void bind_element_buffer(GLuint buffer) { if(buffer != element_buffer) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer = buffer); }
+        void bind_draw_indirect_buffer(GLuint buffer) { if(buffer != draw_indirect_buffer) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_indirect_buffer = buffer); }
+        void bind_draw_framebuffer(GLuint fbo) { if(fbo != draw_framebuffer) glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer = fbo); }
+        void viewport(GLint x, GLint y, GLint w, GLint h) { const std::array<GLint,4> r {x,y,w,h}; if(r != viewport_rect) glViewport(x, y, w, h), viewport_rect = r; }
+        void scissor(GLint x, GLint y, GLint w, GLint h) { const std::array<GLint,4> r {x,y,w,h}; if(r != scissor_rect) glScissor(x, y, w, h), scissor_rect = r; }
+        void front_face(GLenum mode) { if(mode != front_face_mode) glFrontFace(front_face_mode = mode); }
+        void cull_face(GLenum mode) { if(mode != cull_face_mode) glCullFace(cull_face_mode = mode); }
+        void depth_func(GLenum op) { if(op != depth_func_op) glDepthFunc(depth_func_op = op); }
+        void depth_mask(GLboolean mask) { if(mask != depth_write_mask) glDepthMask(mask), depth_write_mask = mask; }
+        std::optional<GLboolean> get_depth_mask() const { if(depth_write_mask < 0) return std::nullopt; return static_cast<GLboolean>(depth_write_mask); }
+        void stencil_func(GLenum face, GLenum func, GLint ref, GLuint mask)
+        {
+            auto & f = stencil_funcs[face_index(face)];
+            if(f.func == func && f.ref == ref && f.mask == mask) return;
+            glStencilFuncSeparate(face, func, ref, mask);
+            f = {func, ref, mask};
+        }
+        void stencil_op(GLenum face, GLenum sfail, GLenum dpfail, GLenum dppass)
+        {
+            auto & o = stencil_ops[face_index(face)];
+            if(o.sfail == sfail && o.dpfail == dpfail && o.dppass == dppass) return;
+            glStencilOpSeparate(face, sfail, dpfail, dppass);
+            o = {sfail, dpfail, dppass};
+        }
+        void stencil_mask(GLenum face, GLuint mask)
+        {
+            auto & m = stencil_write_masks[face_index(face)];
+            if(m == mask) return;
+            glStencilMaskSeparate(face, mask);
+            m = mask;
+        }
+        std::optional<GLuint> get_stencil_mask(GLenum face) const { return stencil_write_masks[face_index(face)]; }
+        void blend(GLuint index, const gl_pipeline::gl_blend & b)
+        {
+            if(index >= blends.size()) blends.resize(index+1);
+            auto & cur = blends[index];
+            if(cur && cur->tie() == b.tie()) return;
+            glColorMaski(index, b.red_mask, b.green_mask, b.blue_mask, b.alpha_mask);
+            glBlendEquationSeparatei(index, b.color_op, b.alpha_op);
+            glBlendFuncSeparatei(index, b.src_color, b.dst_color, b.src_alpha, b.dst_alpha);
+            cur = b;
+        }
+
+        void bind_uniform_buffer(size_t index, GLuint buffer, GLintptr offset, GLsizeiptr size) { uniform_buffers.set(index, buffer, offset, size); }
+        void bind_storage_buffer(size_t index, GLuint buffer, GLintptr offset, GLsizeiptr size) { storage_buffers.set(index, buffer, offset, size); }
+        void bind_texture(size_t index, GLuint sampler, GLuint texture)
+        {
+            if(index >= textures.size()) { textures.resize(index+1, unknown); samplers.resize(index+1, unknown); }
+            if(textures[index] == texture && samplers[index] == sampler) return;
+            textures[index] = texture;
+            samplers[index] = sampler;
+            dirty_textures.add(index);
+        }
+        void bind_image_texture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLenum format)
+        {
+            if(unit >= image_units.size()) image_units.resize(unit+1);
+            auto & u = image_units[unit];
+            if(u && u->texture == texture && u->level == level && u->layered == layered && u->format == format) return;
+            glBindImageTexture(unit, texture, level, layered, 0, GL_READ_WRITE, format);
+            u = gl_image_unit{texture, level, layered, format};
+        }
+        void flush_bindings() // Must be called before any draw or dispatch
+        {
+            uniform_buffers.flush();
+            storage_buffers.flush();
+            if(dirty_textures.empty()) return;
+            for(size_t i=dirty_textures.begin; i<dirty_textures.end; ++i) if(textures[i] == unknown) textures[i] = samplers[i] = 0;
+            glBindTextures(exactly(dirty_textures.begin), exactly(dirty_textures.end-dirty_textures.begin), textures.data()+dirty_textures.begin);
+            glBindSamplers(exactly(dirty_textures.begin), exactly(dirty_textures.end-dirty_textures.begin), samplers.data()+dirty_textures.begin);
+            dirty_textures = {};
         }
     };
 }
@@ -197,6 +416,20 @@ gl_device::gl_device(std::function<void(const char *)> debug_callback) : debug_c
         debug_callback(to_string("GL_RENDERER = ", glGetString(GL_RENDERER)).c_str());
     }
     enable_debug_callback(hidden_window);
+    driver_string = to_string(glGetString(GL_VENDOR), ' ', glGetString(GL_RENDERER), ' ', glGetString(GL_VERSION));
+    GLint texture_units = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &texture_units);
+    max_resource_table_images = texture_units / 2;
+    load_program_cache();
+
+    // Push constants are emulated with a single uniform buffer, updated in place and rebound to the slot reserved by each pipeline layout
+    glCreateBuffers(1, &push_constant_buffer);
+    glNamedBufferStorage(push_constant_buffer, max_push_constant_size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+}
+
+gl_device::~gl_device()
+{
+    if(program_cache_dirty) save_program_cache();
 }
 
 void gl_device::enable_debug_callback(GLFWwindow * window)
@@ -215,10 +448,47 @@ void gl_device::destroy_context_objects(GLFWwindow * context)
 {
     glfwMakeContextCurrent(context);
     for(auto vao : context_specific_objects[context].vertex_array_objects) glDeleteVertexArrays(1, &vao.second);
+    for(auto query : context_specific_objects[context].free_queries) glDeleteQueries(1, &query);
+
+    // Timers with a timestamp in this context can no longer be resolved
+    for(auto it = pending_timers.begin(); it != pending_timers.end(); )
+    {
+        if(it->begin.context != context && it->end.context != context) { ++it; continue; }
+        for(auto & timestamp : {it->begin, it->end})
+        {
+            if(timestamp.context == context) glDeleteQueries(1, &timestamp.query);
+            else context_specific_objects[timestamp.context].free_queries.push_back(timestamp.query);
+        }
+        it = pending_timers.erase(it);
+    }
+
     context_specific_objects.erase(context);
     glfwMakeContextCurrent(hidden_window);
 }
 
+gl_device::gl_timestamp gl_device::write_timestamp(GLFWwindow * context)
+{
+    auto & queries = context_specific_objects[context].free_queries;
+    GLuint query;
+    if(queries.empty()) glGenQueries(1, &query);
+    else
+    {
+        query = queries.back();
+        queries.pop_back();
+    }
+    glQueryCounter(query, GL_TIMESTAMP);
+    return {context, query};
+}
+
+GLuint64 gl_device::read_timestamp(const gl_timestamp & timestamp)
+{
+    if(glfwGetCurrentContext() != timestamp.context) glfwMakeContextCurrent(timestamp.context);
+    GLuint64 time;
+    glGetQueryObjectui64v(timestamp.query, GL_QUERY_RESULT, &time);
+    context_specific_objects[timestamp.context].free_queries.push_back(timestamp.query);
+    return time;
+}
+
 void gl_device::destroy_pipeline_objects(gl_pipeline * pipeline)
 {
     for(auto & ctx : context_specific_objects)
@@ -233,7 +503,7 @@ void gl_device::destroy_pipeline_objects(gl_pipeline * pipeline)
     }
 }
 
-void gl_device::bind_vertex_array(GLFWwindow * context, const gl_pipeline & pipeline)
+GLuint gl_device::get_vertex_array(GLFWwindow * context, const gl_pipeline & pipeline)
 {
     auto & vertex_array = context_specific_objects[context].vertex_array_objects[&pipeline];
     if(!vertex_array)
@@ -242,6 +512,7 @@ void gl_device::bind_vertex_array(GLFWwindow * context, const gl_pipeline & pipe
         glCreateVertexArrays(1, &vertex_array);
         for(auto & buf : pipeline.input)
         {
+            glVertexArrayBindingDivisor(vertex_array, buf.index, buf.rate == input_rate::per_instance ? 1 : 0);
             for(auto & attrib : buf.attributes)
             {
                 glEnableVertexArrayAttrib(vertex_array, attrib.index);
@@ -258,7 +529,7 @@ void gl_device::bind_vertex_array(GLFWwindow * context, const gl_pipeline & pipe
             }
         }
     }
-    glBindVertexArray(vertex_array);
+    return vertex_array;
 }
 
 ptr<buffer> gl_device::create_buffer(const buffer_desc & desc, const void * initial_data) { return new delete_when_unreferenced<gl_buffer>{this, desc, initial_data}; }
@@ -266,16 +537,33 @@ ptr<sampler> gl_device::create_sampler(const sampler_desc & desc) { return new d
 ptr<image> gl_device::create_image(const image_desc & desc, std::vector<const void *> initial_data) { return new delete_when_unreferenced<gl_image>{this, desc, initial_data}; }
 ptr<framebuffer> gl_device::create_framebuffer(const framebuffer_desc & desc) { return new delete_when_unreferenced<gl_framebuffer>{this, desc}; }
 ptr<window> gl_device::create_window(const int2 & dimensions, std::string_view title) { return new delete_when_unreferenced<gl_window>{this, dimensions, std::string{title}}; }
-ptr<shader> gl_device::create_shader(const shader_desc & desc) { return new delete_when_unreferenced<gl_shader>{desc}; }
+ptr<shader> gl_device::create_shader(const shader_desc & desc) { validate_push_constant_block(desc.spirv); return new delete_when_unreferenced<gl_shader>{desc}; }
 ptr<pipeline> gl_device::create_pipeline(const pipeline_desc & desc) { return new delete_when_unreferenced<gl_pipeline>{this, desc}; }
+ptr<pipeline> gl_device::create_compute_pipeline(const compute_pipeline_desc & desc) { return new delete_when_unreferenced<gl_compute_pipeline>{this, desc}; }
+ptr<resource_table> gl_device::create_resource_table(int capacity)
+{
+    if(capacity < 1 || capacity > max_resource_table_images) throw std::logic_error("resource table capacity out of range");
+    return new delete_when_unreferenced<emulated_resource_table>{capacity};
+}
 
 uint64_t gl_device::submit(command_buffer & cmd)
 {
+    if(static_cast<const emulated_command_buffer &>(cmd).open_timers) throw std::logic_error("command buffer submitted with timers still open");
+    static_cast<emulated_command_buffer &>(cmd).finish();
     GLFWwindow * context = hidden_window;
     const gl_pipeline * current_pipeline = nullptr;
     const char * base_indices_pointer = 0;
     int framebuffer_height = 0;
+    bool in_render_pass = false;
     uint8_t stencil_ref = 0;
+    std::vector<gl_timer> open_timers;
+    gl_state_cache state;
+
+    auto set_stencil_ref = [&](const gl_pipeline & pipe, uint8_t ref)
+    {
+        state.stencil_func(GL_FRONT, pipe.stencil_front.func, ref, pipe.stencil_read_mask);
+        state.stencil_func(GL_BACK, pipe.stencil_back.func, ref, pipe.stencil_read_mask);
+    };
 
     glfwMakeContextCurrent(context);
     static_cast<const emulated_command_buffer &>(cmd).execute(overload(
@@ -287,120 +575,178 @@ uint64_t gl_device::submit(command_buffer & cmd)
         {
             auto & fb = static_cast<gl_framebuffer &>(*c.framebuffer);
             framebuffer_height = fb.dims.y;
-            context = fb.glfw_window ? fb.glfw_window : hidden_window;
-            glfwMakeContextCurrent(context);
-            glEnable(GL_FRAMEBUFFER_SRGB);
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fb.framebuffer_object);
-            glViewport(0, 0, exactly(fb.dims.x), exactly(fb.dims.y));
-            glScissor(0, 0, exactly(fb.dims.x), exactly(fb.dims.y));
-            glEnable(GL_SCISSOR_TEST);
+            auto fb_context = fb.glfw_window ? fb.glfw_window : hidden_window;
+            if(fb_context != context)
+            {
+                context = fb_context;
+                glfwMakeContextCurrent(context);
+                state.reset();
+            }
+            state.set_enabled(GL_FRAMEBUFFER_SRGB, true);
+            state.bind_draw_framebuffer(fb.framebuffer_object);
+            state.viewport(0, 0, exactly(fb.dims.x), exactly(fb.dims.y));
+            state.scissor(0, 0, exactly(fb.dims.x), exactly(fb.dims.y));
+            state.set_enabled(GL_SCISSOR_TEST, true);
+            in_render_pass = true;
 
             // Clear render targets if specified by render pass
-            for(size_t i=0; i<c.pass.color_attachments.size(); ++i)
+            for(size_t i=0; i<c.pass->color_attachments.size(); ++i)
             {
-                if(auto op = std::get_if<clear_color>(&c.pass.color_attachments[i].load_op))
+                if(auto op = std::get_if<clear_color>(&c.pass->color_attachments[i].load_op))
                 {
                     glClearColor(op->r, op->g, op->b, op->a);
                     glClear(GL_COLOR_BUFFER_BIT); // TODO: Use glClearTexImage(...) when we use multiple color attachments                            
                 }
             }
-            if(c.pass.depth_attachment)
+            if(c.pass->depth_attachment)
             {
-                if(auto op = std::get_if<clear_depth>(&c.pass.depth_attachment->load_op))
+                if(auto op = std::get_if<clear_depth>(&c.pass->depth_attachment->load_op))
                 {
-                    glDepthMask(GL_TRUE);
+                    state.depth_mask(GL_TRUE);
                     glClearDepthf(op->depth);
                     glClearStencil(op->stencil);
                     glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
                 }
             }
         },
-        [](const clear_depth_command & c)
+        [&](const clear_depth_command & c)
         {
-            GLint prev_mask;
-            glGetIntegerv(GL_DEPTH_WRITEMASK, &prev_mask);
-            glDepthMask(GL_TRUE);
+            const auto prev_mask = state.get_depth_mask();
+            state.depth_mask(GL_TRUE);
             glClearDepthf(c.depth);
             glClear(GL_DEPTH_BUFFER_BIT);
-            glDepthMask(prev_mask);
+            if(prev_mask) state.depth_mask(*prev_mask);
         },
-        [](const clear_stencil_command & c)
+        [&](const clear_stencil_command & c)
         {
-            GLint prev_front, prev_back;
-            glGetIntegerv(GL_STENCIL_WRITEMASK, &prev_front);
-            glGetIntegerv(GL_STENCIL_BACK_WRITEMASK, &prev_back);
-            glStencilMask(0xFF);
+            const auto prev_front = state.get_stencil_mask(GL_FRONT), prev_back = state.get_stencil_mask(GL_BACK);
+            state.stencil_mask(GL_FRONT, 0xFF);
+            state.stencil_mask(GL_BACK, 0xFF);
             glClearStencil(c.stencil);
             glClear(GL_STENCIL_BUFFER_BIT);
-            glStencilMaskSeparate(GL_FRONT, prev_front);
-            glStencilMaskSeparate(GL_BACK, prev_back);
+            if(prev_front) state.stencil_mask(GL_FRONT, *prev_front);
+            if(prev_back) state.stencil_mask(GL_BACK, *prev_back);
         },
         [&](const set_viewport_rect_command & c)
         {
-            glViewport(c.x0, framebuffer_height-c.y1, c.x1-c.x0, c.y1-c.y0);
+            state.viewport(c.x0, framebuffer_height-c.y1, c.x1-c.x0, c.y1-c.y0);
         },
         [&](const set_scissor_rect_command & c)
         {
-            glScissor(c.x0, framebuffer_height-c.y1, c.x1-c.x0, c.y1-c.y0);
+            state.scissor(c.x0, framebuffer_height-c.y1, c.x1-c.x0, c.y1-c.y0);
         },
         [&](const set_stencil_ref_command & c)
         {
             stencil_ref = c.ref;
-            if(current_pipeline) current_pipeline->set_stencil_ref(c.ref);
+            if(current_pipeline) set_stencil_ref(*current_pipeline, c.ref);
         },
         [&](const bind_pipeline_command & c)
         {
-            auto & pipe = static_cast<const gl_pipeline &>(*c.pipe);
-            glUseProgram(pipe.program_object);
-            bind_vertex_array(context, pipe);
-            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
-
-            for(auto cap : pipe.enable) glEnable(cap);
-            for(auto cap : pipe.disable) glDisable(cap);
-            glFrontFace(pipe.front_face);
-            glCullFace(pipe.cull_face);
-            glDepthFunc(pipe.depth_func);
-            glDepthMask(pipe.depth_mask);
-            pipe.set_stencil_ref(stencil_ref);
-            glStencilOpSeparate(GL_FRONT, pipe.stencil_front.sfail, pipe.stencil_front.dpfail, pipe.stencil_front.dppass);
-            glStencilOpSeparate(GL_BACK, pipe.stencil_back.sfail, pipe.stencil_back.dpfail, pipe.stencil_back.dppass);
-            glStencilMask(pipe.stencil_write_mask);
-            for(size_t i=0; i<pipe.blend.size(); ++i)
+            // Pipelines bound outside of a render pass are compute pipelines, which have no fixed function state
+            if(!in_render_pass)
             {
-                glColorMaski(exactly(i), pipe.blend[i].red_mask, pipe.blend[i].green_mask, pipe.blend[i].blue_mask, pipe.blend[i].alpha_mask);
-                glBlendEquationSeparatei(exactly(i), pipe.blend[i].color_op, pipe.blend[i].alpha_op);
-                glBlendFuncSeparatei(exactly(i), pipe.blend[i].src_color, pipe.blend[i].dst_color, pipe.blend[i].src_alpha, pipe.blend[i].dst_alpha);
+                state.use_program(static_cast<const gl_compute_pipeline &>(*c.pipe).program_object);
+                return;
             }
+
+            auto & pipe = static_cast<const gl_pipeline &>(*c.pipe);
+            state.use_program(pipe.program_object);
+            state.bind_vertex_array(get_vertex_array(context, pipe));
+            state.set_enabled(GL_TEXTURE_CUBE_MAP_SEAMLESS, true);
+
+            for(auto cap : pipe.enable) state.set_enabled(cap, true);
+            for(auto cap : pipe.disable) state.set_enabled(cap, false);
+            state.front_face(pipe.front_face);
+            state.cull_face(pipe.cull_face);
+            state.depth_func(pipe.depth_func);
+            state.depth_mask(pipe.depth_mask);
+            set_stencil_ref(pipe, stencil_ref);
+            state.stencil_op(GL_FRONT, pipe.stencil_front.sfail, pipe.stencil_front.dpfail, pipe.stencil_front.dppass);
+            state.stencil_op(GL_BACK, pipe.stencil_back.sfail, pipe.stencil_back.dpfail, pipe.stencil_back.dppass);
+            state.stencil_mask(GL_FRONT, pipe.stencil_write_mask);
+            state.stencil_mask(GL_BACK, pipe.stencil_write_mask);
+            for(size_t i=0; i<pipe.blend.size(); ++i) state.blend(exactly(i), pipe.blend[i]);
             current_pipeline = &pipe;
         },
-        [](const bind_descriptor_set_command & c)
-        {
-            bind_descriptor_set(*c.layout, c.set_index, *c.set, 
-                [](size_t index, buffer & buffer, size_t offset, size_t size) { glBindBufferRange(GL_UNIFORM_BUFFER, exactly(index), static_cast<gl_buffer &>(buffer).buffer_object, offset, size); },
-                [](size_t index, sampler & sampler, image & image) 
-                { 
-                    glBindSampler(exactly(index), static_cast<gl_sampler &>(sampler).sampler_object); 
-                    glBindTextureUnit(exactly(index), static_cast<gl_image &>(image).texture_object);
+        [&](const bind_descriptor_set_command & c)
+        {
+            bind_descriptor_set(*c.layout, c.set_index, *c.set, c.get_dynamic_offsets(), 
+                [&](size_t index, buffer & buffer, size_t offset, size_t size) { state.bind_uniform_buffer(index, static_cast<gl_buffer &>(buffer).buffer_object, offset, size); },
+                [&](size_t index, sampler & sampler, image & image) { state.bind_texture(index, static_cast<gl_sampler &>(sampler).sampler_object, static_cast<gl_image &>(image).texture_object); },
+                [&](size_t index, buffer & buffer, size_t offset, size_t size) { state.bind_storage_buffer(index, static_cast<gl_buffer &>(buffer).buffer_object, offset, size); },
+                [&](size_t index, image & image, int mip)
+                {
+                    auto & im = static_cast<gl_image &>(image);
+                    state.bind_image_texture(exactly(index), im.texture_object, mip, im.is_layered ? GL_TRUE : GL_FALSE, im.internal_format);
                 });
         },
+        [&](const push_constants_command & c)
+        {
+            glNamedBufferSubData(push_constant_buffer, c.offset, c.size, c.get_data());
+            state.bind_uniform_buffer(static_cast<const emulated_pipeline_layout &>(*c.layout).get_push_constant_buffer_binding(), push_constant_buffer, 0, max_push_constant_size);
+        },
         [&](const bind_vertex_buffer_command & c)
         {
             for(auto & buf : current_pipeline->input)
             {
                 if(buf.index == c.index)
                 {
-                    glBindVertexBuffer(c.index, static_cast<gl_buffer &>(c.range.buffer).buffer_object, c.range.offset, buf.stride);
+                    state.bind_vertex_buffer(c.index, static_cast<gl_buffer &>(c.range.buffer).buffer_object, c.range.offset, buf.stride);
                 }
             }        
         },
         [&](const bind_index_buffer_command & c)
         {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, static_cast<gl_buffer &>(c.range.buffer).buffer_object);
+            state.bind_element_buffer(static_cast<gl_buffer &>(c.range.buffer).buffer_object);
             base_indices_pointer = (const char *)c.range.offset;
         },
-        [&](const draw_command & c) { glDrawArrays(current_pipeline->primitive_mode, c.first_vertex, c.vertex_count); },
-        [&](const draw_indexed_command & c) { glDrawElements(current_pipeline->primitive_mode, c.index_count, GL_UNSIGNED_INT, base_indices_pointer + c.first_index*sizeof(uint32_t)); },
-        [](const end_render_pass_command &) {}
+        [&](const draw_command & c) 
+        { 
+            state.flush_bindings();
+            glDrawArraysInstancedBaseInstance(current_pipeline->primitive_mode, c.first_vertex, c.vertex_count, c.instance_count, c.first_instance); 
+        },
+        [&](const draw_indexed_command & c) 
+        { 
+            state.flush_bindings();
+            glDrawElementsInstancedBaseVertexBaseInstance(current_pipeline->primitive_mode, c.index_count, GL_UNSIGNED_INT, base_indices_pointer + c.first_index*sizeof(uint32_t), c.instance_count, c.vertex_offset, c.first_instance); 
+        },
+        [&](const draw_indirect_command & c)
+        {
+            state.flush_bindings();
+            state.bind_draw_indirect_buffer(static_cast<gl_buffer &>(c.args.buffer).buffer_object);
+            glMultiDrawArraysIndirect(current_pipeline->primitive_mode, (const void *)c.args.offset, c.draw_count, exactly(c.stride));
+        },
+        [&](const draw_indexed_indirect_command & c)
+        {
+            // The first_index of each draw is relative to the start of the element buffer, as glMultiDrawElementsIndirect takes no index offset
+            if(base_indices_pointer) throw std::logic_error("draw_indexed_indirect requires the index buffer to be bound at offset 0");
+            state.flush_bindings();
+            state.bind_draw_indirect_buffer(static_cast<gl_buffer &>(c.args.buffer).buffer_object);
+            glMultiDrawElementsIndirect(current_pipeline->primitive_mode, GL_UNSIGNED_INT, (const void *)c.args.offset, c.draw_count, exactly(c.stride));
+        },
+        [&](const execute_commands_command & c)
+        {
+            // Secondary command buffers start from the same viewport, scissor, and stencil reference as a newly begun render pass
+            auto & fb = static_cast<const gl_framebuffer &>(*c.secondary->secondary_framebuffer);
+            state.viewport(0, 0, exactly(fb.dims.x), exactly(fb.dims.y));
+            state.scissor(0, 0, exactly(fb.dims.x), exactly(fb.dims.y));
+            stencil_ref = 0;
+            if(current_pipeline) set_stencil_ref(*current_pipeline, 0);
+        },
+        [&](const end_render_pass_command &) { in_render_pass = false; },
+        [&](const begin_timer_command & c) { open_timers.push_back({submitted_index+1, std::string{c.get_name()}, write_timestamp(context)}); },
+        [&](const end_timer_command &)
+        {
+            open_timers.back().end = write_timestamp(context);
+            pending_timers.push_back(std::move(open_timers.back()));
+            open_timers.pop_back();
+        },
+        [&](const dispatch_command & c) 
+        { 
+            state.flush_bindings();
+            glDispatchCompute(c.group_count_x, c.group_count_y, c.group_count_z); 
+        },
+        [](const memory_barrier_command &) { glMemoryBarrier(GL_ALL_BARRIER_BITS); }
     ));
     sync_objects[++submitted_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     return submitted_index;
@@ -416,13 +762,25 @@ void gl_device::wait_until_complete(uint64_t submit_id)
 {
     for(auto it = sync_objects.begin(); it != sync_objects.end(); it = sync_objects.erase(it))
     {
-        if(submit_id < it->first) return;
+        if(submit_id < it->first) break;
         switch(glClientWaitSync(it->second, 0, GL_TIMEOUT_IGNORED))
         {
         case GL_TIMEOUT_EXPIRED: case GL_WAIT_FAILED: throw std::runtime_error("glClientWaitSync(...) failed");
         }
         glDeleteSync(it->second);
     }
+
+    // Every submission up to submit_id has completed, so the timestamps they wrote are available
+    if(pending_timers.empty() || submit_id < pending_timers.front().submission_id) return;
+    GLFWwindow * prev_context = glfwGetCurrentContext();
+    while(!pending_timers.empty() && pending_timers.front().submission_id <= submit_id)
+    {
+        auto & timer = pending_timers.front();
+        const GLuint64 begin = read_timestamp(timer.begin), end = read_timestamp(timer.end);
+        timer_results.push_back({std::move(timer.name), timer.submission_id, (end - begin) / 1e6});
+        pending_timers.pop_front();
+    }
+    if(glfwGetCurrentContext() != prev_context) glfwMakeContextCurrent(prev_context);
 }
 
 gl_buffer::gl_buffer(gl_device * device, const buffer_desc & desc, const void * initial_data) : device{device}
@@ -470,8 +828,9 @@ gl_sampler::~gl_sampler()
     glDeleteSamplers(1, &sampler_object);
 }
 
-gl_image::gl_image(gl_device * device, const image_desc & desc, std::vector<const void *> initial_data) : device{device}, is_layered{desc.shape == rhi::image_shape::cube}
+gl_image::gl_image(gl_device * device, const image_desc & desc, std::vector<const void *> initial_data) : device{device}, internal_format{convert_gl(desc.format).internal_format}, is_layered{desc.shape == rhi::image_shape::cube || desc.shape == rhi::image_shape::_2d_array || desc.shape == rhi::image_shape::cube_array}
 {
+    if((desc.flags & rhi::storage_image_bit) && (desc.flags & (rhi::color_attachment_bit|rhi::depth_attachment_bit))) throw std::logic_error("storage images cannot be used as attachments");
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     auto glf = convert_gl(desc.format);
     switch(desc.shape)
@@ -503,6 +862,16 @@ gl_image::gl_image(gl_device * device, const image_desc & desc, std::vector<cons
             glDeleteTextures(1, &view);
         }
         break;
+    case rhi::image_shape::_2d_array:
+    case rhi::image_shape::cube_array:
+        // Each face of a cube map array is addressed as its own layer
+        glCreateTextures(desc.shape == rhi::image_shape::cube_array ? GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_2D_ARRAY, 1, &texture_object);
+        glTextureStorage3D(texture_object, desc.mip_levels, glf.internal_format, desc.dimensions.x, desc.dimensions.y, get_layer_count(desc));
+        if(initial_data.size() == static_cast<size_t>(get_layer_count(desc)))
+        {
+            for(size_t i=0; i<initial_data.size(); ++i) glTextureSubImage3D(texture_object, 0, 0, 0, exactly(i), desc.dimensions.x, desc.dimensions.y, 1, glf.format, glf.type, initial_data[i]);
+        }
+        break;
     default: fail_fast();
     }
 }
@@ -511,7 +880,7 @@ gl_image::~gl_image()
     glDeleteTextures(1, &texture_object);
 }
 
-gl_framebuffer::gl_framebuffer(gl_device * device, const framebuffer_desc & desc) : device{device}, dims{desc.dimensions}
+gl_framebuffer::gl_framebuffer(gl_device * device, const framebuffer_desc & desc) : base_framebuffer{false}, device{device}, dims{desc.dimensions}
 {
     std::vector<GLenum> draw_buffers;
     glfwMakeContextCurrent(device->hidden_window); // Framebuffers are not shared between GL contexts, so create them all in the hidden window's context
@@ -531,7 +900,7 @@ gl_framebuffer::gl_framebuffer(gl_device * device, const framebuffer_desc & desc
     }
     glNamedFramebufferDrawBuffers(framebuffer_object, exactly(draw_buffers.size()), draw_buffers.data());
 }
-gl_framebuffer::gl_framebuffer(gl_device * device, const int2 & dimensions, const std::string & title) : device{device}, dims{dimensions} 
+gl_framebuffer::gl_framebuffer(gl_device * device, const int2 & dimensions, const std::string & title) : base_framebuffer{true}, device{device}, dims{dimensions} 
 {
     glfwDefaultWindowHints();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -561,26 +930,138 @@ gl_window::gl_window(gl_device * device, const int2 & dimensions, std::string ti
     fb = new delete_when_unreferenced<gl_framebuffer>{device, dimensions, title};
 }
 
-gl_pipeline::gl_pipeline(gl_device * device, const pipeline_desc & desc) : base_pipeline{*desc.layout}, device{device}, input{desc.input}
+// FNV-1a, used to key the program cache
+static uint64_t hash_bytes(const void * data, size_t size, uint64_t hash=14695981039346656037ull)
 {
-    std::vector<GLenum> shaders;
-    for(auto s : desc.stages)
+    for(size_t i=0; i<size; ++i) hash = (hash ^ static_cast<const uint8_t *>(data)[i]) * 1099511628211ull;
+    return hash;
+}
+template<class T> static uint64_t hash_value(const T & value, uint64_t hash) { static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "hash_value supports integers and enums"); return hash_bytes(&value, sizeof(value), hash); }
+
+void gl_device::load_program_cache()
+{
+    auto in = open_file_beside_executable(program_cache_filename, std::ios::in|std::ios::binary);
+    if(!in) return;
+    const std::vector<char> data{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+
+    // The file holds a header, followed by records of GLSL sources and program binaries. If it is malformed, start with an empty cache.
+    struct header { char magic[4]; uint32_t version; } h;
+    struct record { uint64_t key; uint32_t kind, format, size; } r;
+    if(data.size() < sizeof(h)) return;
+    memcpy(&h, data.data(), sizeof(h));
+    if(memcmp(h.magic, "WBGL", 4) != 0 || h.version != 1) return;
+    for(size_t offset = sizeof(h); offset < data.size(); offset += r.size)
+    {
+        if(data.size() - offset < sizeof(r)) return;
+        memcpy(&r, data.data() + offset, sizeof(r));
+        offset += sizeof(r);
+        if(data.size() - offset < r.size) return;
+        const auto begin = data.begin() + offset, end = begin + r.size;
+        if(r.kind == 0) glsl_cache[r.key] = std::string(begin, end);
+        if(r.kind == 1) program_binary_cache[r.key] = {r.format, std::vector<char>(begin, end)};
+    }
+}
+
+void gl_device::save_program_cache() const
+{
+    struct header { char magic[4]; uint32_t version; } h {{'W','B','G','L'}, 1};
+    struct record { uint64_t key; uint32_t kind, format, size; };
+    auto out = open_file_beside_executable(program_cache_filename, std::ios::out|std::ios::trunc|std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    for(auto & glsl : glsl_cache)
+    {
+        const record r {glsl.first, 0, 0, exactly(glsl.second.size())};
+        out.write(reinterpret_cast<const char *>(&r), sizeof(r));
+        out.write(glsl.second.data(), glsl.second.size());
+    }
+    for(auto & binary : program_binary_cache)
+    {
+        const record r {binary.first, 1, binary.second.format, exactly(binary.second.data.size())};
+        out.write(reinterpret_cast<const char *>(&r), sizeof(r));
+        out.write(binary.second.data.data(), binary.second.data.size());
+    }
+}
+
+// Cross-compiles the given SPIR-V stage to GLSL, remapping its descriptors to flat binding points
+const std::string & gl_device::get_glsl(const pipeline_layout & layout, const gl_shader & shader, uint64_t key)
+{
+    auto & glsl = glsl_cache[key];
+    if(!glsl.empty()) return glsl;
+
+    auto spirv = shader.desc.spirv;
+    const uint32_t push_constant_block = convert_push_constants_to_uniform_block(spirv);
+    spirv_cross::CompilerGLSL compiler(spirv);
+	spirv_cross::ShaderResources resources = compiler.get_shader_resources();
+	for(auto & resource : resources.uniform_buffers)
+	{
+        if(resource.id == push_constant_block)
+        {
+            compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(layout).get_push_constant_buffer_binding()));
+            continue;
+        }
+        compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(layout).get_flat_buffer_binding(compiler.get_decoration(resource.id, spv::DecorationDescriptorSet), compiler.get_decoration(resource.id, spv::DecorationBinding))));
+		compiler.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+	}
+	for(auto & resource : resources.sampled_images)
+	{
+		compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(layout).get_flat_image_binding(compiler.get_decoration(resource.id, spv::DecorationDescriptorSet), compiler.get_decoration(resource.id, spv::DecorationBinding))));
+        compiler.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+	}
+    for(auto & resource : resources.storage_buffers)
+    {
+        compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(layout).get_flat_storage_buffer_binding(compiler.get_decoration(resource.id, spv::DecorationDescriptorSet), compiler.get_decoration(resource.id, spv::DecorationBinding))));
+        compiler.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+    }
+    for(auto & resource : resources.storage_images)
+    {
+        compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(layout).get_flat_storage_image_binding(compiler.get_decoration(resource.id, spv::DecorationDescriptorSet), compiler.get_decoration(resource.id, spv::DecorationBinding))));
+        compiler.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+    }
+
+    glsl = compiler.compile();
+    program_cache_dirty = true;
+    return glsl;
+}
+
+// Links the given SPIR-V stages into a program object, reusing GLSL and program binaries from the program cache where possible
+GLuint gl_device::create_program(const pipeline_layout & layout, const std::vector<ptr<const shader>> & stages)
+{
+    // The GLSL of a stage depends on its SPIR-V and on the flat binding points assigned by the pipeline layout
+    uint64_t layout_hash = hash_bytes(nullptr, 0);
+    for(auto & set : static_cast<const emulated_pipeline_layout &>(layout).sets)
+    {
+        layout_hash = hash_value(set.layout->bindings.size(), layout_hash);
+        for(auto & b : set.layout->bindings) layout_hash = hash_value(b.count, hash_value(b.type, hash_value(b.index, layout_hash)));
+    }
+    std::vector<uint64_t> stage_keys;
+    uint64_t program_key = hash_bytes(driver_string.data(), driver_string.size());
+    for(auto s : stages)
     {
         auto & shader = static_cast<const gl_shader &>(*s);
-        spirv_cross::CompilerGLSL compiler(shader.desc.spirv);
-	    spirv_cross::ShaderResources resources = compiler.get_shader_resources();
-	    for(auto & resource : resources.uniform_buffers)
-	    {
-            compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(*desc.layout).get_flat_buffer_binding(compiler.get_decoration(resource.id, spv::DecorationDescriptorSet), compiler.get_decoration(resource.id, spv::DecorationBinding))));
-		    compiler.unset_decoration(resource.id, spv::DecorationDescriptorSet);
-	    }
-	    for(auto & resource : resources.sampled_images)
-	    {
-		    compiler.set_decoration(resource.id, spv::DecorationBinding, exactly(static_cast<const emulated_pipeline_layout &>(*desc.layout).get_flat_image_binding(compiler.get_decoration(resource.id, spv::DecorationDescriptorSet), compiler.get_decoration(resource.id, spv::DecorationBinding))));
-            compiler.unset_decoration(resource.id, spv::DecorationDescriptorSet);
-	    }
-
-        const auto glsl = compiler.compile();
+        stage_keys.push_back(hash_value(shader.desc.stage, hash_bytes(shader.desc.spirv.data(), shader.desc.spirv.size()*sizeof(uint32_t), layout_hash)));
+        program_key = hash_value(stage_keys.back(), program_key);
+    }
+
+    auto it = program_binary_cache.find(program_key);
+    if(it != program_binary_cache.end())
+    {
+        GLuint program_object = glCreateProgram();
+        glProgramBinary(program_object, it->second.format, it->second.data.data(), exactly(it->second.data.size()));
+        GLint status;
+        glGetProgramiv(program_object, GL_LINK_STATUS, &status);
+        if(status == GL_TRUE) return program_object;
+
+        // Drivers may reject binaries they previously produced, in which case we fall back to building the program from GLSL
+        glDeleteProgram(program_object);
+        program_binary_cache.erase(it);
+        program_cache_dirty = true;
+    }
+
+    std::vector<GLenum> shaders;
+    for(size_t i=0; i<stages.size(); ++i)
+    {
+        auto & shader = static_cast<const gl_shader &>(*stages[i]);
+        const auto & glsl = get_glsl(layout, shader, stage_keys[i]);
         const GLchar * source = glsl.c_str();
         GLint length = exactly(glsl.length());
         //debug_callback(source);
@@ -598,10 +1079,12 @@ gl_pipeline::gl_pipeline(gl_device * device, const pipeline_desc & desc) : base_
             std::vector<char> buffer(length);
             glGetShaderInfoLog(shader_object, exactly(buffer.size()), &length, buffer.data());
             for(auto shader : shaders) glDeleteShader(shader);
+            glsl_cache.erase(stage_keys[i]);
             throw std::runtime_error(buffer.data());
         }
     }
-    program_object = glCreateProgram();
+    GLuint program_object = glCreateProgram();
+    glProgramParameteri(program_object, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     for(auto shader : shaders) glAttachShader(program_object, shader);
     glLinkProgram(program_object);
     for(auto shader : shaders) glDeleteShader(shader);
@@ -617,6 +1100,21 @@ gl_pipeline::gl_pipeline(gl_device * device, const pipeline_desc & desc) : base_
         throw std::runtime_error(buffer.data());
     }
 
+    // Drivers which support no binary formats report a length of zero
+    glGetProgramiv(program_object, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length > 0)
+    {
+        gl_program_binary binary {0, std::vector<char>(length)};
+        glGetProgramBinary(program_object, length, &length, &binary.format, binary.data.data());
+        binary.data.resize(length);
+        program_binary_cache[program_key] = std::move(binary);
+        program_cache_dirty = true;
+    }
+    return program_object;
+}
+
+gl_pipeline::gl_pipeline(gl_device * device, const pipeline_desc & desc) : base_pipeline{*desc.layout}, device{device}, program_object{device->create_program(*desc.layout, desc.stages)}, input{desc.input}
+{
     // Rasterizer state
     switch(desc.topology)
     {
@@ -696,3 +1194,8 @@ gl_pipeline::~gl_pipeline()
     glDeleteProgram(program_object);
 }
 
+gl_compute_pipeline::gl_compute_pipeline(gl_device * device, const compute_pipeline_desc & desc) : base_pipeline{*desc.layout}, device{device}, program_object{device->create_program(*desc.layout, {desc.stage})} {}
+gl_compute_pipeline::~gl_compute_pipeline()
+{
+    glDeleteProgram(program_object);
+}
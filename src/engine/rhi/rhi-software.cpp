@@ -0,0 +1,979 @@
+#include "rhi-internal.h"
+#include <chrono>
+#include <thread>
+
+namespace rhi
+{
+    struct software_device : device
+    {
+        std::function<void(const char *)> debug_callback;
+        std::vector<timer_result> timer_results;
+        uint64_t submitted_index=0;
+
+        software_device(std::function<void(const char *)> debug_callback) : debug_callback{debug_callback} {}
+
+        device_info get_info() const final { return {linalg::zero_to_one, false, 65536}; }
+
+        ptr<buffer> create_buffer(const buffer_desc & desc, const void * initial_data) final;
+        ptr<sampler> create_sampler(const sampler_desc & desc) final;
+        ptr<image> create_image(const image_desc & desc, std::vector<const void *> initial_data) final;
+        ptr<framebuffer> create_framebuffer(const framebuffer_desc & desc) final;
+        ptr<window> create_window(const int2 & dimensions, std::string_view title) final { throw std::logic_error("the software backend cannot present to windows, render to a framebuffer and read it back with read_software_image(...)"); }
+
+        ptr<descriptor_set_layout> create_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) final { return new delete_when_unreferenced<emulated_descriptor_set_layout>{bindings}; }
+        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) final { return new delete_when_unreferenced<emulated_pipeline_layout>{sets, push_constant_size}; }
+        ptr<shader> create_shader(const shader_desc & desc) final;
+        ptr<pipeline> create_pipeline(const pipeline_desc & desc) final;
+        ptr<pipeline> create_compute_pipeline(const compute_pipeline_desc & desc) final { throw std::logic_error("the software backend does not support compute pipelines"); }
+        void precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer) final {} // Pipelines need no compilation
+
+        ptr<descriptor_pool> create_descriptor_pool() final { return new delete_when_unreferenced<emulated_descriptor_pool>{}; }
+        ptr<resource_table> create_resource_table(int capacity) final;
+        ptr<command_buffer> create_command_buffer(bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(nullptr, reusable); }
+        ptr<command_buffer> create_secondary_command_buffer(const framebuffer & framebuffer, bool reusable) final { return new delete_when_unreferenced<emulated_command_buffer>(&framebuffer, reusable); }
+
+        uint64_t submit(command_buffer & cmd) final;
+        uint64_t acquire_and_submit_and_present(command_buffer & cmd, window & window) final { throw std::logic_error("the software backend cannot present to windows"); }
+        uint64_t flush_uploads() final { return submitted_index; } // Initial data is copied immediately
+        uint64_t get_last_submission_id() final { return submitted_index; }
+        void wait_until_complete(uint64_t submit_id) final {} // All work is retired by the time submit(...) returns
+        std::vector<timer_result> get_timer_results() final { return std::move(timer_results); }
+    };
+
+    struct software_buffer : buffer
+    {
+        ptr<software_device> device;
+        std::vector<char> memory;
+        buffer_flags flags;
+        bool is_mapped;
+
+        // Reads the argument records of an indirect draw, as the GPU would when the draw executes
+        template<class Args> std::vector<Args> read_indirect_args(size_t offset, int draw_count, size_t stride) const
+        {
+            if(!(flags & indirect_buffer_bit)) throw std::logic_error("indirect draws require a buffer created with indirect_buffer_bit");
+            if(draw_count && offset + (draw_count-1)*stride + sizeof(Args) > memory.size()) throw std::logic_error("indirect arguments out of range");
+            std::vector<Args> args(draw_count);
+            for(int i=0; i<draw_count; ++i) memcpy(&args[i], memory.data() + offset + i*stride, sizeof(Args));
+            return args;
+        }
+
+        software_buffer(software_device * device, const buffer_desc & desc, const void * initial_data);
+        size_t get_offset_alignment() final { return 256; }
+        char * get_mapped_memory() final { return is_mapped ? memory.data() : nullptr; }
+    };
+
+    struct software_sampler : sampler
+    {
+        ptr<software_device> device;
+        sampler_desc desc;
+
+        software_sampler(software_device * device, const sampler_desc & desc) : device{device}, desc{desc} {}
+    };
+
+    struct software_image : image
+    {
+        ptr<software_device> device;
+        image_desc desc;
+        std::vector<std::vector<float4>> texels; // By layer and then by mip level, rounded to the precision of desc.format. Depth images hold depth in x and stencil in y.
+
+        software_image(software_device * device, const image_desc & desc, std::vector<const void *> initial_data);
+        int2 get_dimensions(int mip) const { return {std::max(desc.dimensions.x >> mip, 1), std::max(desc.dimensions.y >> mip, 1)}; }
+        std::vector<float4> & get_texels(int layer, int mip) { return texels[layer*desc.mip_levels + mip]; }
+        const std::vector<float4> & get_texels(int layer, int mip) const { return texels[layer*desc.mip_levels + mip]; }
+    };
+
+    struct software_framebuffer : base_framebuffer
+    {
+        ptr<software_device> device;
+        int2 dims;
+        std::vector<framebuffer_attachment_desc> color_attachments;
+        std::optional<framebuffer_attachment_desc> depth_attachment;
+
+        software_framebuffer(software_device * device, const framebuffer_desc & desc) : base_framebuffer{false}, device{device}, dims{desc.dimensions}, color_attachments{desc.color_attachments}, depth_attachment{desc.depth_attachment} {}
+        coord_system get_ndc_coords() const final { return {coord_axis::right, coord_axis::down, coord_axis::forward}; }
+    };
+
+    struct software_shader_module : shader
+    {
+        shader_stage stage;
+        software_shader impl;
+
+        software_shader_module(shader_stage stage, software_shader impl) : stage{stage}, impl{impl} {}
+    };
+
+    struct software_pipeline : base_pipeline
+    {
+        ptr<software_device> device;
+        pipeline_desc desc;
+        const software_shader_module * vertex_stage;
+        const software_shader_module * fragment_stage;
+
+        software_pipeline(software_device * device, const pipeline_desc & desc);
+    };
+
+    // The state bound while executing a command buffer, through which shaders reach their resources
+    struct software_state : software_shader_resources
+    {
+        struct bound_buffer { const software_buffer * buffer; size_t offset, size; };
+        struct bound_image { const software_sampler * sampler; const software_image * image; };
+        const software_pipeline * pipeline = nullptr;
+        std::vector<bound_buffer> buffers, vertex_buffers;
+        std::vector<bound_image> images;
+        bound_buffer index_buffer {};
+        std::array<char, max_push_constant_size> push_constants {};
+
+        const emulated_pipeline_layout & get_layout() const { return static_cast<const emulated_pipeline_layout &>(pipeline->get_layout()); }
+        const void * get_uniform_buffer(int set, int binding, size_t size) const final;
+        const void * get_push_constants() const final { return push_constants.data(); }
+        float4 sample(int set, int binding, int element, const float4 & coords, float lod) const final;
+    };
+
+    // The attachments of the current render pass, and the fixed function state which applies to them
+    struct software_target
+    {
+        struct attachment { std::vector<float4> * texels; int width; image_format format; };
+        int2 dims;
+        std::vector<attachment> colors;
+        std::optional<attachment> depth;
+        int x0, y0, x1, y1;                 // Viewport
+        int scissor_x0, scissor_y0, scissor_x1, scissor_y1;
+        uint8_t stencil_ref;
+    };
+
+    static std::mutex & get_software_shaders_mutex() { static std::mutex mutex; return mutex; }
+    static std::map<std::vector<uint32_t>, software_shader> & get_software_shaders() { static std::map<std::vector<uint32_t>, software_shader> shaders; return shaders; }
+}
+
+using namespace rhi;
+
+void rhi::register_software_shader(const std::vector<uint32_t> & spirv, software_shader shader)
+{
+    std::lock_guard<std::mutex> lock{get_software_shaders_mutex()};
+    get_software_shaders()[spirv] = shader;
+}
+
+ptr<device> rhi::create_software_device(debug_callback debug_callback) { return new delete_when_unreferenced<software_device>{debug_callback}; }
+
+std::optional<std::vector<float4>> rhi::read_software_image(const image & image, int mip, int layer)
+{
+    auto im = dynamic_cast<const software_image *>(&image);
+    if(!im) return std::nullopt;
+    if(mip < 0 || mip >= im->desc.mip_levels) throw std::logic_error("mip level out of range");
+    if(layer < 0 || layer >= get_layer_count(im->desc)) throw std::logic_error("layer out of range");
+    return im->get_texels(layer, mip);
+}
+
+////////////////////////////////////////////////////
+// Conversion between image formats and texel values //
+////////////////////////////////////////////////////
+
+enum class component_type { unorm, snorm, srgb, uint, sint, float16, float32 };
+struct format_info { int components, component_size; component_type type; bool has_stencil; };
+static format_info get_format_info(image_format format)
+{
+    switch(format)
+    {
+    case image_format::rgba_unorm8: return {4, 1, component_type::unorm};
+    case image_format::rgba_srgb8: return {4, 1, component_type::srgb};
+    case image_format::rgba_norm8: return {4, 1, component_type::snorm};
+    case image_format::rgba_uint8: return {4, 1, component_type::uint};
+    case image_format::rgba_int8: return {4, 1, component_type::sint};
+    case image_format::rgba_unorm16: return {4, 2, component_type::unorm};
+    case image_format::rgba_norm16: return {4, 2, component_type::snorm};
+    case image_format::rgba_uint16: return {4, 2, component_type::uint};
+    case image_format::rgba_int16: return {4, 2, component_type::sint};
+    case image_format::rgba_float16: return {4, 2, component_type::float16};
+    case image_format::rgba_uint32: return {4, 4, component_type::uint};
+    case image_format::rgba_int32: return {4, 4, component_type::sint};
+    case image_format::rgba_float32: return {4, 4, component_type::float32};
+    case image_format::rgb_uint32: return {3, 4, component_type::uint};
+    case image_format::rgb_int32: return {3, 4, component_type::sint};
+    case image_format::rgb_float32: return {3, 4, component_type::float32};
+    case image_format::rg_unorm8: return {2, 1, component_type::unorm};
+    case image_format::rg_norm8: return {2, 1, component_type::snorm};
+    case image_format::rg_uint8: return {2, 1, component_type::uint};
+    case image_format::rg_int8: return {2, 1, component_type::sint};
+    case image_format::rg_unorm16: return {2, 2, component_type::unorm};
+    case image_format::rg_norm16: return {2, 2, component_type::snorm};
+    case image_format::rg_uint16: return {2, 2, component_type::uint};
+    case image_format::rg_int16: return {2, 2, component_type::sint};
+    case image_format::rg_float16: return {2, 2, component_type::float16};
+    case image_format::rg_uint32: return {2, 4, component_type::uint};
+    case image_format::rg_int32: return {2, 4, component_type::sint};
+    case image_format::rg_float32: return {2, 4, component_type::float32};
+    case image_format::r_unorm8: return {1, 1, component_type::unorm};
+    case image_format::r_norm8: return {1, 1, component_type::snorm};
+    case image_format::r_uint8: return {1, 1, component_type::uint};
+    case image_format::r_int8: return {1, 1, component_type::sint};
+    case image_format::r_unorm16: return {1, 2, component_type::unorm};
+    case image_format::r_norm16: return {1, 2, component_type::snorm};
+    case image_format::r_uint16: return {1, 2, component_type::uint};
+    case image_format::r_int16: return {1, 2, component_type::sint};
+    case image_format::r_float16: return {1, 2, component_type::float16};
+    case image_format::r_uint32: return {1, 4, component_type::uint};
+    case image_format::r_int32: return {1, 4, component_type::sint};
+    case image_format::r_float32: return {1, 4, component_type::float32};
+    case image_format::depth_unorm16: return {1, 2, component_type::unorm};
+    case image_format::depth_unorm24_stencil8: return {1, 3, component_type::unorm, true};
+    case image_format::depth_float32: return {1, 4, component_type::float32};
+    case image_format::depth_float32_stencil8: return {1, 4, component_type::float32, true};
+    default: fail_fast();
+    }
+}
+
+static float half_to_float(uint16_t h)
+{
+    const uint32_t sign = uint32_t(h & 0x8000) << 16, exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF;
+    if(exponent == 0) return (sign ? -1.0f : 1.0f) * std::ldexp(static_cast<float>(mantissa), -24);
+    const uint32_t bits = sign | (exponent == 31 ? 0x7F800000 : (exponent + 112) << 23) | mantissa << 13;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    const uint32_t magnitude = bits & 0x7FFFFFFF;
+    if(magnitude > 0x7F800000) return sign | 0x7E00;                                                    // NaN
+    if(magnitude >= 0x477FF000) return sign | 0x7C00;                                                   // Values which round to beyond 65504 become infinite
+    if(magnitude < 0x38800000) return sign | static_cast<uint16_t>(std::nearbyint(std::abs(f) * 16777216.0f));  // Subnormal, in units of 2^-24
+    return sign | static_cast<uint16_t>((magnitude + 0xFFF + ((magnitude >> 13) & 1) - 0x38000000) >> 13);       // Normal, rounded to nearest even
+}
+
+static float srgb_to_linear(float x) { return x <= 0.04045f ? x/12.92f : std::pow((x+0.055f)/1.055f, 2.4f); }
+static float linear_to_srgb(float x) { return x <= 0.0031308f ? x*12.92f : 1.055f*std::pow(x, 1/2.4f) - 0.055f; }
+
+static float decode_component(const char * p, const format_info & f, bool is_alpha)
+{
+    auto read = [p](auto value) { memcpy(&value, p, sizeof(value)); return value; };
+    auto read_uint = [&]() -> uint32_t { return f.component_size == 1 ? read(uint8_t()) : f.component_size == 2 ? read(uint16_t()) : read(uint32_t()); };
+    auto read_int = [&]() -> int32_t { return f.component_size == 1 ? read(int8_t()) : f.component_size == 2 ? read(int16_t()) : read(int32_t()); };
+    switch(f.type)
+    {
+    case component_type::unorm: return static_cast<float>(read_uint() / double((1ull << f.component_size*8) - 1));
+    case component_type::snorm: return std::max(static_cast<float>(read_int() / double((1ull << (f.component_size*8-1)) - 1)), -1.0f);
+    case component_type::srgb: return is_alpha ? read_uint()/255.0f : srgb_to_linear(read_uint()/255.0f);
+    case component_type::uint: return static_cast<float>(read_uint());
+    case component_type::sint: return static_cast<float>(read_int());
+    case component_type::float16: return half_to_float(read(uint16_t()));
+    case component_type::float32: return read(float());
+    default: fail_fast();
+    }
+}
+
+// Rounds a value to the nearest one representable by a component of the given format, as storing it to an image would
+static float round_component(float x, const format_info & f, bool is_alpha)
+{
+    const double max_uint = double((1ull << f.component_size*8) - 1), max_int = double((1ull << (f.component_size*8-1)) - 1);
+    switch(f.type)
+    {
+    case component_type::unorm: return static_cast<float>(std::round(std::clamp(double(x), 0.0, 1.0)*max_uint)/max_uint);
+    case component_type::snorm: return static_cast<float>(std::round(std::clamp(double(x), -1.0, 1.0)*max_int)/max_int);
+    case component_type::srgb: return is_alpha ? std::round(std::clamp(x, 0.0f, 1.0f)*255)/255 : srgb_to_linear(std::round(linear_to_srgb(std::clamp(x, 0.0f, 1.0f))*255)/255);
+    case component_type::uint: return static_cast<float>(std::round(std::clamp(double(x), 0.0, max_uint)));
+    case component_type::sint: return static_cast<float>(std::round(std::clamp(double(x), -max_int-1, max_int)));
+    case component_type::float16: return half_to_float(float_to_half(x));
+    case component_type::float32: return x;
+    default: fail_fast();
+    }
+}
+
+static float4 round_texel(const float4 & texel, const format_info & f)
+{
+    float4 r {0,0,0,1};
+    for(int i=0; i<f.components; ++i) r[i] = round_component(texel[i], f, i == 3);
+    return r;
+}
+
+/////////////////////
+// Texture sampling //
+/////////////////////
+
+// Returns the texel coordinate of i within size texels, or -1 if it falls on the border
+static int apply_address_mode(int i, int size, address_mode mode)
+{
+    switch(mode)
+    {
+    case address_mode::repeat: return (i % size + size) % size;
+    case address_mode::mirrored_repeat: { const int j = (i % (2*size) + 2*size) % (2*size); return j < size ? j : 2*size-1-j; }
+    case address_mode::clamp_to_edge: return std::clamp(i, 0, size-1);
+    case address_mode::mirror_clamp_to_edge: return std::clamp(i < 0 ? -1-i : i, 0, size-1);
+    case address_mode::clamp_to_border: return i < 0 || i >= size ? -1 : i;
+    default: fail_fast();
+    }
+}
+
+static float4 sample_mip(const software_image & im, address_mode wrap_s, address_mode wrap_t, filter filter, int layer, int mip, const float2 & texcoord)
+{
+    const int2 dims = im.get_dimensions(mip);
+    auto & texels = im.get_texels(layer, mip);
+    auto fetch = [&](int x, int y) -> float4
+    {
+        x = apply_address_mode(x, dims.x, wrap_s);
+        y = apply_address_mode(y, dims.y, wrap_t);
+        return x < 0 || y < 0 ? float4{0,0,0,0} : texels[y*dims.x + x];
+    };
+    const float2 coord = texcoord * float2(dims);
+    if(filter == filter::nearest) return fetch(static_cast<int>(std::floor(coord.x)), static_cast<int>(std::floor(coord.y)));
+    const float2 base = floor(coord - 0.5f), t = coord - 0.5f - base;
+    const int x = static_cast<int>(base.x), y = static_cast<int>(base.y);
+    return lerp(lerp(fetch(x,y), fetch(x+1,y), t.x), lerp(fetch(x,y+1), fetch(x+1,y+1), t.x), t.y);
+}
+
+static float4 sample_layer(const software_image & im, const sampler_desc & s, address_mode wrap_s, address_mode wrap_t, int layer, const float2 & texcoord, float lod)
+{
+    const filter filter = lod <= 0 ? s.mag_filter : s.min_filter;
+    if(!s.mip_filter) return sample_mip(im, wrap_s, wrap_t, filter, layer, 0, texcoord);
+    lod = std::clamp(lod, 0.0f, static_cast<float>(im.desc.mip_levels-1));
+    if(*s.mip_filter == filter::nearest) return sample_mip(im, wrap_s, wrap_t, filter, layer, static_cast<int>(std::floor(lod + 0.5f)), texcoord);
+    const int mip = std::min(static_cast<int>(lod), im.desc.mip_levels-1), next_mip = std::min(mip+1, im.desc.mip_levels-1);
+    return lerp(sample_mip(im, wrap_s, wrap_t, filter, layer, mip, texcoord), sample_mip(im, wrap_s, wrap_t, filter, layer, next_mip, texcoord), lod - mip);
+}
+
+const void * software_state::get_uniform_buffer(int set, int binding, size_t size) const
+{
+    auto & b = buffers.at(get_layout().get_flat_buffer_binding(set, binding));
+    if(!b.buffer) throw std::logic_error("no uniform buffer bound");
+    if(size > b.size) throw std::logic_error("uniform buffer binding is smaller than the block which reads it");
+    return b.buffer->memory.data() + b.offset;
+}
+
+float4 software_state::sample(int set, int binding, int element, const float4 & coords, float lod) const
+{
+    auto & b = images.at(get_layout().get_flat_image_binding(set, binding) + element);
+    if(!b.image) throw std::logic_error("no image bound");
+    auto & im = *b.image;
+    auto & s = b.sampler->desc;
+    switch(im.desc.shape)
+    {
+    case image_shape::_1d: case image_shape::_2d: return sample_layer(im, s, s.wrap_s, s.wrap_t, 0, coords.xy(), lod);
+    case image_shape::_2d_array: return sample_layer(im, s, s.wrap_s, s.wrap_t, std::clamp(static_cast<int>(std::floor(coords.z + 0.5f)), 0, im.desc.array_layers-1), coords.xy(), lod);
+    case image_shape::cube: case image_shape::cube_array:
+        {
+            // Select the face by the major axis of the direction, with the texcoords of each face oriented as in Vulkan and OpenGL, and filtered within that face
+            const float3 d = coords.xyz(), a = abs(d);
+            const int axis = a.x >= a.y && a.x >= a.z ? 0 : a.y >= a.z ? 1 : 2, face = axis*2 + (d[axis] < 0);
+            const float2 sc_tc[] {{-d.z,-d.y}, {d.z,-d.y}, {d.x,d.z}, {d.x,-d.z}, {d.x,-d.y}, {-d.x,-d.y}};
+            const int cube = im.desc.shape == image_shape::cube_array ? std::clamp(static_cast<int>(std::floor(coords.w + 0.5f)), 0, im.desc.array_layers-1) : 0;
+            return sample_layer(im, s, address_mode::clamp_to_edge, address_mode::clamp_to_edge, cube*6 + face, (sc_tc[face]/a[axis] + 1.0f)/2.0f, lod);
+        }
+    default: throw std::logic_error("the software backend cannot sample 3D images");
+    }
+}
+
+//////////////////
+// Rasterization //
+//////////////////
+
+static bool compare(compare_op op, float a, float b)
+{
+    switch(op)
+    {
+    case compare_op::never: return false;
+    case compare_op::less: return a < b;
+    case compare_op::equal: return a == b;
+    case compare_op::less_or_equal: return a <= b;
+    case compare_op::greater: return a > b;
+    case compare_op::not_equal: return a != b;
+    case compare_op::greater_or_equal: return a >= b;
+    case compare_op::always: return true;
+    default: fail_fast();
+    }
+}
+
+static uint8_t apply_stencil_op(stencil_op op, uint8_t value, uint8_t ref)
+{
+    switch(op)
+    {
+    case stencil_op::keep: return value;
+    case stencil_op::zero: return 0;
+    case stencil_op::replace: return ref;
+    case stencil_op::invert: return ~value;
+    case stencil_op::increment_and_wrap: return value+1;
+    case stencil_op::increment_and_clamp: return value == 0xFF ? value : value+1;
+    case stencil_op::decrement_and_wrap: return value-1;
+    case stencil_op::decrement_and_clamp: return value == 0 ? value : value-1;
+    default: fail_fast();
+    }
+}
+
+static float4 get_blend_factor(blend_factor factor, const float4 & source, const float4 & dest)
+{
+    switch(factor)
+    {
+    case blend_factor::zero: return {0,0,0,0};
+    case blend_factor::one: return {1,1,1,1};
+    case blend_factor::constant_color: return {0,0,0,0}; // The RHI has no way to set the blend constants, which Vulkan and OpenGL default to zero
+    case blend_factor::one_minus_constant_color: return {1,1,1,1};
+    case blend_factor::source_color: return source;
+    case blend_factor::one_minus_source_color: return 1.0f - source;
+    case blend_factor::dest_color: return dest;
+    case blend_factor::one_minus_dest_color: return 1.0f - dest;
+    case blend_factor::source_alpha: return float4{source.w};
+    case blend_factor::one_minus_source_alpha: return float4{1 - source.w};
+    case blend_factor::dest_alpha: return float4{dest.w};
+    case blend_factor::one_minus_dest_alpha: return float4{1 - dest.w};
+    default: fail_fast();
+    }
+}
+
+static float4 apply_blend_op(blend_op op, const float4 & source, const float4 & dest)
+{
+    switch(op)
+    {
+    case blend_op::add: return source + dest;
+    case blend_op::subtract: return source - dest;
+    case blend_op::reverse_subtract: return dest - source;
+    case blend_op::min: return min(source, dest);
+    case blend_op::max: return max(source, dest);
+    default: fail_fast();
+    }
+}
+
+static float4 blend(const blend_state & state, const float4 & source, const float4 & dest)
+{
+    if(!state.enable) return source;
+    auto color_source = source * get_blend_factor(state.color.source_factor, source, dest), color_dest = dest * get_blend_factor(state.color.dest_factor, source, dest);
+    auto alpha_source = source * get_blend_factor(state.alpha.source_factor, source, dest), alpha_dest = dest * get_blend_factor(state.alpha.dest_factor, source, dest);
+    if(state.color.op == blend_op::min || state.color.op == blend_op::max) std::tie(color_source, color_dest) = std::tie(source, dest);
+    if(state.alpha.op == blend_op::min || state.alpha.op == blend_op::max) std::tie(alpha_source, alpha_dest) = std::tie(source, dest);
+    return {apply_blend_op(state.color.op, color_source, color_dest).xyz(), apply_blend_op(state.alpha.op, alpha_source, alpha_dest).w};
+}
+
+// Clips a convex polygon in clip space against the plane dot(plane, position) >= 0, interpolating varyings linearly, as they are still multiplied by w
+static std::vector<software_vertex> clip_polygon(const std::vector<software_vertex> & polygon, const float4 & plane)
+{
+    std::vector<software_vertex> result;
+    for(size_t i=0; i<polygon.size(); ++i)
+    {
+        auto & a = polygon[i], & b = polygon[(i+1) % polygon.size()];
+        const float da = dot(plane, a.position), db = dot(plane, b.position);
+        if(da >= 0) result.push_back(a);
+        if((da >= 0) != (db >= 0))
+        {
+            const float t = da / (da - db);
+            software_vertex v;
+            v.position = lerp(a.position, b.position, t);
+            for(int j=0; j<max_software_varyings; ++j) v.varyings[j] = lerp(a.varyings[j], b.varyings[j], t);
+            result.push_back(v);
+        }
+    }
+    return result;
+}
+
+struct raster_vertex { float2 position; float depth, inv_w; float4 varyings[max_software_varyings]; }; // Varyings are divided by w, for perspective correct interpolation
+struct raster_triangle { raster_vertex v[3]; bool front_facing; int x0, y0, x1, y1; };
+
+static void shade_fragment(const software_state & state, const software_target & target, const raster_triangle & tri, int x, int y, const float3 & weights)
+{
+    auto & desc = state.pipeline->desc;
+    float depth = weights.x*tri.v[0].depth + weights.y*tri.v[1].depth + weights.z*tri.v[2].depth;
+    if(target.depth) depth = round_component(depth, get_format_info(target.depth->format), false);
+
+    // Perform the depth and stencil tests before shading when their outcome cannot be affected by the fragment being discarded
+    float4 * depth_texel = target.depth ? &(*target.depth->texels)[y*target.depth->width + x] : nullptr;
+    const bool depth_passed = !depth_texel || !desc.depth || compare(desc.depth->test, depth, depth_texel->x);
+    const bool has_stencil = depth_texel && desc.stencil && get_format_info(target.depth->format).has_stencil;
+    if(!depth_passed && !has_stencil) return;
+
+    float4 varyings[max_software_varyings];
+    const float inv_w = weights.x*tri.v[0].inv_w + weights.y*tri.v[1].inv_w + weights.z*tri.v[2].inv_w;
+    for(int i=0; i<max_software_varyings; ++i) varyings[i] = (weights.x*tri.v[0].varyings[i] + weights.y*tri.v[1].varyings[i] + weights.z*tri.v[2].varyings[i]) / inv_w;
+    float4 colors[8] {};
+    if(target.colors.size() > countof(colors)) throw std::logic_error("the software backend supports at most 8 color attachments");
+    if(!state.pipeline->fragment_stage->impl.fragment(state, varyings, colors)) return;
+
+    if(has_stencil)
+    {
+        auto & s = *desc.stencil;
+        auto & face = tri.front_facing ? s.front : s.back;
+        const uint8_t value = static_cast<uint8_t>(depth_texel->y);
+        const bool stencil_passed = compare(face.test, static_cast<float>(target.stencil_ref & s.read_mask), static_cast<float>(value & s.read_mask));
+        const uint8_t result = apply_stencil_op(!stencil_passed ? face.stencil_fail_op : !depth_passed ? face.stencil_pass_depth_fail_op : face.stencil_pass_depth_pass_op, value, target.stencil_ref);
+        depth_texel->y = static_cast<float>((value & ~s.write_mask) | (result & s.write_mask));
+        if(!stencil_passed || !depth_passed) return;
+    }
+    if(depth_texel && desc.depth && desc.depth->write_mask) depth_texel->x = depth;
+
+    for(size_t i=0; i<target.colors.size(); ++i)
+    {
+        const blend_state b = i < desc.blend.size() ? desc.blend[i] : blend_state{true, false};
+        if(!b.write_mask) continue;
+        auto & attachment = target.colors[i];
+        auto & texel = (*attachment.texels)[y*attachment.width + x];
+        texel = round_texel(blend(b, colors[i], texel), get_format_info(attachment.format));
+    }
+}
+
+static void rasterize(const software_state & state, const software_target & target, const raster_triangle & tri, int row_begin, int row_end)
+{
+    // Edge functions are positive inside the triangle, and pixels whose centers lie exactly on an edge belong to it only if it is a top or left edge
+    auto & v = tri.v;
+    auto edge = [](const float2 & a, const float2 & b, const float2 & p) { return (b.x-a.x)*(p.y-a.y) - (b.y-a.y)*(p.x-a.x); };
+    const float area = edge(v[0].position, v[1].position, v[2].position);
+    bool top_left[3];
+    for(int i=0; i<3; ++i)
+    {
+        const float2 d = v[(i+2)%3].position - v[(i+1)%3].position;
+        top_left[i] = d.y < 0 || (d.y == 0 && d.x > 0);
+    }
+    for(int y=std::max(tri.y0, row_begin); y<std::min(tri.y1, row_end); ++y)
+    {
+        for(int x=tri.x0; x<tri.x1; ++x)
+        {
+            const float2 p {x+0.5f, y+0.5f};
+            const float3 e {edge(v[1].position, v[2].position, p), edge(v[2].position, v[0].position, p), edge(v[0].position, v[1].position, p)};
+            bool inside = true;
+            for(int i=0; i<3; ++i) inside &= e[i] > 0 || (e[i] == 0 && top_left[i]);
+            if(inside) shade_fragment(state, target, tri, x, y, e/area);
+        }
+    }
+}
+
+// Transforms vertices to window coordinates, clips, culls and rasterizes the triangles they form, three vertices per triangle.
+// Each thread owns interleaved bands of rows, and rasterizes every triangle in order within them, so the result does not depend on the number of threads.
+static void draw_triangles(const software_state & state, const software_target & target, const std::vector<software_vertex> & vertices)
+{
+    auto & desc = state.pipeline->desc;
+    std::vector<raster_triangle> triangles;
+    size_t covered_pixels = 0;
+    const int clip_x0 = std::max({target.x0, target.scissor_x0, 0}), clip_y0 = std::max({target.y0, target.scissor_y0, 0});
+    const int clip_x1 = std::min({target.x1, target.scissor_x1, target.dims.x}), clip_y1 = std::min({target.y1, target.scissor_y1, target.dims.y});
+    for(size_t i=0; i+2<vertices.size(); i+=3)
+    {
+        // Clip against the near and far planes, and keep w positive, as the viewport and scissor bound the pixels considered in x and y
+        std::vector<software_vertex> polygon {vertices[i], vertices[i+1], vertices[i+2]};
+        for(auto & plane : {float4{0,0,1,0}, float4{0,0,-1,1}, float4{0,0,0,1} - float4{0,0,0,1e-6f}}) polygon = clip_polygon(polygon, plane);
+        if(polygon.size() < 3) continue;
+
+        std::vector<raster_vertex> window(polygon.size());
+        for(size_t j=0; j<polygon.size(); ++j)
+        {
+            const float inv_w = 1 / polygon[j].position.w;
+            const float3 ndc = polygon[j].position.xyz() * inv_w;
+            window[j].position = {target.x0 + (ndc.x+1)/2*(target.x1-target.x0), target.y0 + (ndc.y+1)/2*(target.y1-target.y0)};
+            window[j].depth = ndc.z;
+            window[j].inv_w = inv_w;
+            for(int k=0; k<max_software_varyings; ++k) window[j].varyings[k] = polygon[j].varyings[k] * inv_w;
+        }
+
+        for(size_t j=1; j+1<window.size(); ++j)
+        {
+            raster_triangle tri {{window[0], window[j], window[j+1]}};
+
+            // Determine the facing of the triangle from its signed area in framebuffer coordinates, as Vulkan does
+            const float2 a = tri.v[0].position, b = tri.v[1].position, c = tri.v[2].position;
+            const float signed_area = -((a.x*b.y - b.x*a.y) + (b.x*c.y - c.x*b.y) + (c.x*a.y - a.x*c.y))/2;
+            if(signed_area == 0) continue;
+            tri.front_facing = (signed_area > 0) == (desc.front_face == front_face::counter_clockwise);
+            if(desc.cull_mode == cull_mode::back && !tri.front_facing) continue;
+            if(desc.cull_mode == cull_mode::front && tri.front_facing) continue;
+            if(signed_area > 0) std::swap(tri.v[1], tri.v[2]); // Wind every triangle the same way, so that its edge functions are positive inside
+
+            tri.x0 = std::max(clip_x0, static_cast<int>(std::floor(std::min({a.x, b.x, c.x}))));
+            tri.y0 = std::max(clip_y0, static_cast<int>(std::floor(std::min({a.y, b.y, c.y}))));
+            tri.x1 = std::min(clip_x1, static_cast<int>(std::ceil(std::max({a.x, b.x, c.x})))+1);
+            tri.y1 = std::min(clip_y1, static_cast<int>(std::ceil(std::max({a.y, b.y, c.y})))+1);
+            if(tri.x0 >= tri.x1 || tri.y0 >= tri.y1) continue;
+            covered_pixels += size_t(tri.x1 - tri.x0) * (tri.y1 - tri.y0);
+            triangles.push_back(tri);
+        }
+    }
+    if(triangles.empty()) return;
+
+    constexpr int band_rows = 8;
+    auto rasterize_bands = [&](int first_band, int band_stride)
+    {
+        for(int y=clip_y0 + first_band*band_rows; y<clip_y1; y+=band_stride*band_rows) for(auto & tri : triangles) rasterize(state, target, tri, y, y+band_rows);
+    };
+    const int thread_count = covered_pixels < 64*64 ? 1 : std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 1, (clip_y1 - clip_y0 + band_rows - 1) / band_rows);
+    if(thread_count == 1) return rasterize_bands(0, 1);
+
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(thread_count);
+    for(int i=0; i<thread_count; ++i) threads.emplace_back([&, i]() { try { rasterize_bands(i, thread_count); } catch(...) { errors[i] = std::current_exception(); } });
+    for(auto & t : threads) t.join();
+    for(auto & e : errors) if(e) std::rethrow_exception(e);
+}
+
+////////////////////////
+// Device and objects //
+////////////////////////
+
+ptr<buffer> software_device::create_buffer(const buffer_desc & desc, const void * initial_data) { return new delete_when_unreferenced<software_buffer>{this, desc, initial_data}; }
+ptr<sampler> software_device::create_sampler(const sampler_desc & desc) { return new delete_when_unreferenced<software_sampler>{this, desc}; }
+ptr<image> software_device::create_image(const image_desc & desc, std::vector<const void *> initial_data) { return new delete_when_unreferenced<software_image>{this, desc, initial_data}; }
+ptr<pipeline> software_device::create_pipeline(const pipeline_desc & desc) { return new delete_when_unreferenced<software_pipeline>{this, desc}; }
+
+ptr<shader> software_device::create_shader(const shader_desc & desc)
+{
+    validate_push_constant_block(desc.spirv);
+    if(desc.stage != shader_stage::vertex && desc.stage != shader_stage::fragment) throw std::logic_error("the software backend supports only vertex and fragment shaders");
+    std::lock_guard<std::mutex> lock{get_software_shaders_mutex()};
+    auto it = get_software_shaders().find(desc.spirv);
+    if(it == get_software_shaders().end() || !(desc.stage == shader_stage::vertex ? bool(it->second.vertex) : bool(it->second.fragment))) throw std::logic_error("no software implementation has been registered for this shader");
+    return new delete_when_unreferenced<software_shader_module>{desc.stage, it->second};
+}
+
+ptr<resource_table> software_device::create_resource_table(int capacity)
+{
+    if(capacity < 1 || capacity > get_info().max_resource_table_images) throw std::logic_error("resource table capacity out of range");
+    return new delete_when_unreferenced<emulated_resource_table>{capacity};
+}
+
+ptr<framebuffer> software_device::create_framebuffer(const framebuffer_desc & desc)
+{
+    auto validate_attachment = [&](const framebuffer_attachment_desc & attachment, attachment_type type)
+    {
+        auto & im = static_cast<const software_image &>(*attachment.image);
+        if(attachment.mip < 0 || attachment.mip >= im.desc.mip_levels) throw std::logic_error("attachment mip level out of range");
+        if(attachment.layer < 0 || attachment.layer >= get_layer_count(im.desc)) throw std::logic_error("attachment layer out of range");
+        if(get_attachment_type(im.desc.format) != type) throw std::logic_error(type == attachment_type::color ? "color attachment must have a color format" : "depth attachment must have a depth format");
+        const int2 dims = im.get_dimensions(attachment.mip);
+        if(desc.dimensions.x > dims.x || desc.dimensions.y > dims.y) throw std::logic_error("framebuffer is larger than its attachment");
+    };
+    for(auto & attachment : desc.color_attachments) validate_attachment(attachment, attachment_type::color);
+    if(desc.depth_attachment) validate_attachment(*desc.depth_attachment, attachment_type::depth_stencil);
+    return new delete_when_unreferenced<software_framebuffer>{this, desc};
+}
+
+software_buffer::software_buffer(software_device * device, const buffer_desc & desc, const void * initial_data) : device{device}, memory(desc.size), flags{desc.flags}, is_mapped{(desc.flags & mapped_memory_bit) != 0}
+{
+    if(initial_data) memcpy(memory.data(), initial_data, desc.size);
+}
+
+software_image::software_image(software_device * device, const image_desc & desc, std::vector<const void *> initial_data) : device{device}, desc{desc}
+{
+    if((desc.flags & storage_image_bit)) throw std::logic_error("the software backend does not support storage images");
+    if(desc.mip_levels < 1) throw std::logic_error("images must have at least one mip level");
+    const int layer_count = get_layer_count(desc);
+    if(!initial_data.empty() && initial_data.size() != static_cast<size_t>(layer_count)) throw std::logic_error("initial_data must supply one pointer per layer");
+
+    const bool is_depth = get_attachment_type(desc.format) == attachment_type::depth_stencil;
+    for(int layer=0; layer<layer_count; ++layer) for(int mip=0; mip<desc.mip_levels; ++mip) texels.emplace_back(product(get_dimensions(mip)), float4{0,0,0,is_depth ? 0.0f : 1.0f});
+    for(int layer=0; layer<static_cast<int>(initial_data.size()); ++layer)
+    {
+        if(!initial_data[layer]) continue;
+        if(is_depth) throw std::logic_error("the software backend cannot upload the initial contents of depth images");
+        const auto format = get_format_info(desc.format);
+        const size_t pixel_size = get_pixel_size(desc.format);
+        auto & layer_texels = get_texels(layer, 0);
+        for(size_t i=0; i<layer_texels.size(); ++i)
+        {
+            auto pixel = static_cast<const char *>(initial_data[layer]) + i*pixel_size;
+            for(int j=0; j<format.components; ++j) layer_texels[i][j] = decode_component(pixel + j*format.component_size, format, j == 3);
+        }
+    }
+}
+
+software_pipeline::software_pipeline(software_device * device, const pipeline_desc & desc) : base_pipeline{*desc.layout}, device{device}, desc{desc}, vertex_stage{nullptr}, fragment_stage{nullptr}
+{
+    if(desc.topology != primitive_topology::triangles) throw std::logic_error("the software backend draws only triangles");
+    for(auto & stage : desc.stages)
+    {
+        auto & s = static_cast<const software_shader_module &>(*stage);
+        (s.stage == shader_stage::vertex ? vertex_stage : fragment_stage) = &s;
+    }
+    if(!vertex_stage || !fragment_stage) throw std::logic_error("the software backend requires a vertex and a fragment shader");
+    for(auto & binding : desc.input) for(auto & attribute : binding.attributes) if(attribute.index < 0 || attribute.index >= max_software_attributes) throw std::logic_error("vertex attribute location out of range");
+}
+
+////////////////////////////////
+// Command buffer execution //
+////////////////////////////////
+
+uint64_t software_device::submit(command_buffer & cmd)
+{
+    software_state state;
+    std::optional<software_target> target;
+    std::vector<std::pair<std::string, std::chrono::high_resolution_clock::time_point>> open_timers;
+    std::vector<timer_result> submitted_timers;
+    if(static_cast<const emulated_command_buffer &>(cmd).secondary_framebuffer) throw std::logic_error("secondary command buffers cannot be submitted directly");
+    static_cast<emulated_command_buffer &>(cmd).finish();
+
+    auto require_render_pass = [&](const char * command) { if(!target) throw std::logic_error(to_string(command, " called outside of a render pass")); };
+    auto require_pipeline = [&](const char * command) { require_render_pass(command); if(!state.pipeline) throw std::logic_error(to_string(command, " called with no pipeline bound")); };
+    auto get_attachment = [&](const framebuffer_attachment_desc & a) -> software_target::attachment
+    {
+        auto & im = static_cast<software_image &>(*a.image);
+        return {&im.get_texels(a.layer, a.mip), im.get_dimensions(a.mip).x, im.desc.format};
+    };
+
+    // Runs the vertex shader once per index of each instance, and then draws the triangles formed by the results
+    auto draw = [&](int vertex_count, int first_instance, int instance_count, auto get_vertex_index)
+    {
+        std::vector<software_vertex> vertices;
+        for(int instance=first_instance; instance<first_instance+instance_count; ++instance)
+        {
+            std::unordered_map<int64_t, software_vertex> shaded;
+            for(int i=0; i<vertex_count; ++i)
+            {
+                const int64_t vertex_index = get_vertex_index(i);
+                auto it = shaded.find(vertex_index);
+                if(it == shaded.end())
+                {
+                    float4 attributes[max_software_attributes];
+                    for(auto & a : attributes) a = {0,0,0,1};
+                    for(auto & binding : state.pipeline->desc.input)
+                    {
+                        auto & b = state.vertex_buffers.at(binding.index);
+                        if(!b.buffer) throw std::logic_error("no vertex buffer bound");
+                        if(binding.rate == input_rate::per_vertex && vertex_index < 0) throw std::logic_error("vertex index out of range");
+                        const size_t element = binding.rate == input_rate::per_instance ? instance : static_cast<size_t>(vertex_index);
+                        for(auto & attribute : binding.attributes)
+                        {
+                            const size_t components = static_cast<size_t>(attribute.type) + 1, offset = b.offset + element*binding.stride + attribute.offset;
+                            if(offset + components*sizeof(float) > std::min(b.offset + b.size, b.buffer->memory.size())) throw std::logic_error("vertex attribute read out of range");
+                            memcpy(&attributes[attribute.index], b.buffer->memory.data() + offset, components*sizeof(float));
+                        }
+                    }
+                    software_vertex out {};
+                    state.pipeline->vertex_stage->impl.vertex(state, attributes, out);
+                    it = shaded.emplace(vertex_index, out).first;
+                }
+                vertices.push_back(it->second);
+            }
+        }
+        draw_triangles(state, *target, vertices);
+    };
+    auto draw_indexed = [&](int first_index, int index_count, int first_instance, int instance_count, int vertex_offset)
+    {
+        if(!state.index_buffer.buffer) throw std::logic_error("draw_indexed called with no index buffer bound");
+        if((first_index + index_count)*sizeof(uint32_t) > state.index_buffer.size) throw std::logic_error("indices out of range of index buffer");
+        auto indices = reinterpret_cast<const uint32_t *>(state.index_buffer.buffer->memory.data() + state.index_buffer.offset) + first_index;
+        draw(index_count, first_instance, instance_count, [&](int i) { return int64_t(indices[i]) + vertex_offset; });
+    };
+    auto for_each_texel = [&](const std::optional<software_target::attachment> & a, auto f) { if(a) for(auto & texel : *a->texels) f(texel); };
+
+    static_cast<const emulated_command_buffer &>(cmd).execute(overload(
+        [&](const generate_mipmaps_command & c)
+        {
+            if(target) throw std::logic_error("generate_mipmaps called inside of a render pass");
+            auto & im = static_cast<software_image &>(*c.im);
+            const auto format = get_format_info(im.desc.format);
+            for(int layer=0; layer<get_layer_count(im.desc); ++layer)
+            {
+                for(int mip=1; mip<im.desc.mip_levels; ++mip)
+                {
+                    const int2 src_dims = im.get_dimensions(mip-1), dims = im.get_dimensions(mip);
+                    auto & src = im.get_texels(layer, mip-1);
+                    auto & dst = im.get_texels(layer, mip);
+                    for(int y=0; y<dims.y; ++y) for(int x=0; x<dims.x; ++x)
+                    {
+                        float4 sum;
+                        for(int i=0; i<4; ++i) sum += src[std::min(y*2+i/2, src_dims.y-1)*src_dims.x + std::min(x*2+i%2, src_dims.x-1)];
+                        dst[y*dims.x+x] = round_texel(sum/4.0f, format);
+                    }
+                }
+            }
+        },
+        [&](const begin_render_pass_command & c)
+        {
+            if(target) throw std::logic_error("begin_render_pass called inside of a render pass");
+            auto & fb = static_cast<const software_framebuffer &>(*c.framebuffer);
+            if(c.pass->color_attachments.size() != fb.color_attachments.size()) throw std::logic_error("render_pass_desc does not match framebuffer color attachments");
+            if(c.pass->depth_attachment.has_value() != fb.depth_attachment.has_value()) throw std::logic_error("render_pass_desc does not match framebuffer depth attachment");
+            target = software_target{fb.dims, {}, std::nullopt, 0, 0, fb.dims.x, fb.dims.y, 0, 0, fb.dims.x, fb.dims.y, 0};
+            for(size_t i=0; i<fb.color_attachments.size(); ++i)
+            {
+                target->colors.push_back(get_attachment(fb.color_attachments[i]));
+                if(auto clear = std::get_if<clear_color>(&c.pass->color_attachments[i].load_op))
+                {
+                    const float4 value = round_texel({clear->r, clear->g, clear->b, clear->a}, get_format_info(target->colors[i].format));
+                    for(auto & texel : *target->colors[i].texels) texel = value;
+                }
+            }
+            if(fb.depth_attachment)
+            {
+                target->depth = get_attachment(*fb.depth_attachment);
+                if(auto clear = std::get_if<rhi::clear_depth>(&c.pass->depth_attachment->load_op)) for_each_texel(target->depth, [&](float4 & t) { t.x = round_component(clear->depth, get_format_info(target->depth->format), false); t.y = clear->stencil; });
+            }
+        },
+        [&](const clear_depth_command & c) { require_render_pass("clear_depth"); for_each_texel(target->depth, [&](float4 & t) { t.x = round_component(c.depth, get_format_info(target->depth->format), false); }); },
+        [&](const clear_stencil_command & c) { require_render_pass("clear_stencil"); for_each_texel(target->depth, [&](float4 & t) { t.y = c.stencil; }); },
+        [&](const set_viewport_rect_command & c) { require_render_pass("set_viewport_rect"); std::tie(target->x0, target->y0, target->x1, target->y1) = std::tie(c.x0, c.y0, c.x1, c.y1); },
+        [&](const set_scissor_rect_command & c) { require_render_pass("set_scissor_rect"); std::tie(target->scissor_x0, target->scissor_y0, target->scissor_x1, target->scissor_y1) = std::tie(c.x0, c.y0, c.x1, c.y1); },
+        [&](const set_stencil_ref_command & c) { require_render_pass("set_stencil_ref"); target->stencil_ref = c.ref; },
+        [&](const bind_pipeline_command & c) { require_render_pass("bind_pipeline"); state.pipeline = &static_cast<const software_pipeline &>(*c.pipe); },
+        [&](const bind_descriptor_set_command & c)
+        {
+            auto & layout = static_cast<const emulated_pipeline_layout &>(*c.layout);
+            state.buffers.resize(std::max(state.buffers.size(), layout.num_buffers));
+            state.images.resize(std::max(state.images.size(), layout.num_images));
+            rhi::bind_descriptor_set(*c.layout, c.set_index, *c.set, c.get_dynamic_offsets(),
+                [&](size_t index, buffer & buffer, size_t offset, size_t size)
+                {
+                    auto & b = static_cast<const software_buffer &>(buffer);
+                    if(offset + size > b.memory.size()) throw std::logic_error("buffer binding out of range");
+                    state.buffers[index] = {&b, offset, size};
+                },
+                [&](size_t index, sampler & sampler, image & image) { state.images[index] = {&static_cast<const software_sampler &>(sampler), &static_cast<const software_image &>(image)}; });
+        },
+        [&](const push_constants_command & c)
+        {
+            if(c.offset % 4 || c.size % 4) throw std::logic_error("push constant offset and size must be multiples of 4");
+            if(c.offset + c.size > c.layout->get_push_constant_size()) throw std::logic_error("push constants out of range of pipeline layout");
+            memcpy(state.push_constants.data() + c.offset, c.get_data(), c.size);
+        },
+        [&](const bind_vertex_buffer_command & c)
+        {
+            require_pipeline("bind_vertex_buffer");
+            auto & b = static_cast<const software_buffer &>(c.range.buffer);
+            if(c.range.offset + c.range.size > b.memory.size()) throw std::logic_error("vertex buffer range out of range");
+            if(state.vertex_buffers.size() <= static_cast<size_t>(c.index)) state.vertex_buffers.resize(c.index+1);
+            state.vertex_buffers[c.index] = {&b, c.range.offset, c.range.size};
+        },
+        [&](const bind_index_buffer_command & c)
+        {
+            require_render_pass("bind_index_buffer");
+            auto & b = static_cast<const software_buffer &>(c.range.buffer);
+            if(c.range.offset + c.range.size > b.memory.size()) throw std::logic_error("index buffer range out of range");
+            state.index_buffer = {&b, c.range.offset, c.range.size};
+        },
+        [&](const draw_command & c)
+        {
+            require_pipeline("draw");
+            draw(c.vertex_count, c.first_instance, c.instance_count, [&](int i) { return int64_t(c.first_vertex) + i; });
+        },
+        [&](const draw_indexed_command & c)
+        {
+            require_pipeline("draw_indexed");
+            draw_indexed(c.first_index, c.index_count, c.first_instance, c.instance_count, c.vertex_offset);
+        },
+        [&](const draw_indirect_command & c)
+        {
+            require_pipeline("draw_indirect");
+            for(auto & args : static_cast<const software_buffer &>(c.args.buffer).read_indirect_args<draw_indirect_args>(c.args.offset, c.draw_count, c.stride))
+            {
+                draw(exactly(args.vertex_count), exactly(args.first_instance), exactly(args.instance_count), [&](int i) { return int64_t(args.first_vertex) + i; });
+            }
+        },
+        [&](const draw_indexed_indirect_command & c)
+        {
+            require_pipeline("draw_indexed_indirect");
+            if(state.index_buffer.buffer && state.index_buffer.offset) throw std::logic_error("draw_indexed_indirect requires the index buffer to be bound at offset 0");
+            for(auto & args : static_cast<const software_buffer &>(c.args.buffer).read_indirect_args<draw_indexed_indirect_args>(c.args.offset, c.draw_count, c.stride))
+            {
+                draw_indexed(exactly(args.first_index), exactly(args.index_count), exactly(args.first_instance), exactly(args.instance_count), args.vertex_offset);
+            }
+        },
+        [&](const execute_commands_command & c)
+        {
+            require_render_pass("execute_commands");
+            auto & fb = static_cast<const software_framebuffer &>(*c.secondary->secondary_framebuffer);
+            if(fb.color_attachments.size() != target->colors.size() || fb.depth_attachment.has_value() != target->depth.has_value()) throw std::logic_error("secondary command buffer was created for an incompatible framebuffer");
+
+            // Secondary command buffers do not inherit bound state
+            state.pipeline = nullptr;
+            state.index_buffer = {};
+        },
+        [&](const end_render_pass_command &)
+        {
+            require_render_pass("end_render_pass");
+            target.reset();
+            state.pipeline = nullptr;
+        },
+        [&](const begin_timer_command & c) { open_timers.emplace_back(c.get_name(), std::chrono::high_resolution_clock::now()); },
+        [&](const end_timer_command &)
+        {
+            if(open_timers.empty()) throw std::logic_error("end_timer called with no timer begun");
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - open_timers.back().second;
+            submitted_timers.push_back({open_timers.back().first, submitted_index+1, elapsed.count()});
+            open_timers.pop_back();
+        },
+        [&](const dispatch_command &) { throw std::logic_error("the software backend does not support compute dispatches"); },
+        [&](const memory_barrier_command &) { if(target) throw std::logic_error("memory_barrier called inside of a render pass"); } // Commands execute one after another
+    ));
+    if(target) throw std::logic_error("command buffer submitted inside of a render pass");
+    if(!open_timers.empty()) throw std::logic_error("command buffer submitted with timers still open");
+    timer_results.insert(timer_results.end(), submitted_timers.begin(), submitted_timers.end());
+    return ++submitted_index;
+}
+
+DOCTEST_TEST_CASE("software backend rasterizes triangles into host memory")
+{
+    // Stand-ins for SPIR-V modules, whose C++ implementations pass through a position and a color, and then tint the color or replace it with a texture
+    const std::vector<uint32_t> vert_spirv {1}, tint_spirv {2}, texture_spirv {3}, unregistered_spirv {4};
+    register_software_shader(vert_spirv, {[](const software_shader_resources &, const float4 * attributes, software_vertex & out) { out.position = attributes[0]; out.varyings[0] = attributes[1]; }});
+    register_software_shader(tint_spirv, {nullptr, [](const software_shader_resources & r, const float4 * varyings, float4 * colors) { colors[0] = varyings[0] * *static_cast<const float4 *>(r.get_uniform_buffer(0, 0, sizeof(float4))); return true; }});
+    register_software_shader(texture_spirv, {nullptr, [](const software_shader_resources & r, const float4 * varyings, float4 * colors) { colors[0] = r.sample(0, 1, 0, varyings[0], 0); return true; }});
+
+    auto dev = create_software_device(nullptr);
+    DOCTEST_CHECK_THROWS_AS(dev->create_shader({shader_stage::vertex, unregistered_spirv}), std::logic_error);
+    DOCTEST_CHECK_THROWS_AS(dev->create_shader({shader_stage::vertex, tint_spirv}), std::logic_error);
+    auto vs = dev->create_shader({shader_stage::vertex, vert_spirv});
+    auto tint_fs = dev->create_shader({shader_stage::fragment, tint_spirv}), texture_fs = dev->create_shader({shader_stage::fragment, texture_spirv});
+
+    auto set_layout = dev->create_descriptor_set_layout({{0, descriptor_type::uniform_buffer, 1}, {1, descriptor_type::combined_image_sampler, 1}});
+    auto pipe_layout = dev->create_pipeline_layout({set_layout});
+    const vertex_binding_desc input {0, sizeof(float3)*2, {{0, attribute_format::float3, 0}, {1, attribute_format::float3, sizeof(float3)}}};
+    const blend_state opaque {true, false};
+    auto make_pipeline = [&](const shader * fs, front_face front_face, std::optional<depth_state> depth) { return dev->create_pipeline({pipe_layout, {input}, {vs, fs}, primitive_topology::triangles, front_face, cull_mode::back, depth, std::nullopt, {opaque}}); };
+
+    const float4 tint {0.5f, 1, 1, 1};
+    const uint8_t texels[] {255,0,0,255, 0,255,0,255, 0,0,255,255, 255,255,255,255};
+    auto uniforms = dev->create_buffer({sizeof(tint), uniform_buffer_bit}, &tint);
+    auto texture = dev->create_image({image_shape::_2d, {2,2,1}, 1, image_format::rgba_unorm8, sampled_image_bit}, {texels});
+    auto nearest = dev->create_sampler({filter::nearest, filter::nearest, std::nullopt, address_mode::clamp_to_edge, address_mode::clamp_to_edge, address_mode::clamp_to_edge});
+    auto pool = dev->create_descriptor_pool();
+    auto set = pool->alloc(*set_layout);
+    set->write(0, {*uniforms, 0, sizeof(tint)});
+    set->write(1, *nearest, *texture);
+
+    // A triangle covering the top left half of the framebuffer, which is wound clockwise in framebuffer coordinates, and a triangle covering all of it
+    const float3 vertices[] {{-1,-1,0.25f}, {1,0,0}, {1,-1,0.25f}, {1,0,0}, {-1,1,0.25f}, {1,0,0}, {-1,-1,0.75f}, {0,0,0}, {3,-1,0.75f}, {2,0,0}, {-1,3,0.75f}, {0,2,0}};
+    auto vertex_buffer = dev->create_buffer({sizeof(vertices), vertex_buffer_bit}, vertices);
+    auto render = [&](int size, std::function<void(command_buffer & cmd)> draw, bool has_depth)
+    {
+        auto color = dev->create_image({image_shape::_2d, {size,size,1}, 1, image_format::rgba_unorm8, color_attachment_bit}, {});
+        auto depth = dev->create_image({image_shape::_2d, {size,size,1}, 1, image_format::depth_float32, depth_attachment_bit}, {});
+        render_pass_desc pass {{{clear_color{0,0,0,1}, store{layout::shader_read_only_optimal}}}};
+        if(has_depth) pass.depth_attachment = {clear_depth{1,0}, dont_care{}};
+        auto fb = dev->create_framebuffer({{size,size}, {{color, 0, 0}}, has_depth ? std::optional<framebuffer_attachment_desc>{{depth, 0, 0}} : std::nullopt});
+        auto cmd = dev->create_command_buffer();
+        cmd->begin_render_pass(pass, *fb);
+        draw(*cmd);
+        cmd->end_render_pass();
+        dev->submit(*cmd);
+        auto pixels = read_software_image(*color, 0, 0);
+        DOCTEST_REQUIRE(pixels.has_value());
+        return *pixels;
+    };
+    auto draw = [&](const pipeline & pipe, int first_vertex, int vertex_count) { return [&, first_vertex, vertex_count](command_buffer & cmd)
+    {
+        cmd.bind_pipeline(pipe);
+        cmd.bind_descriptor_set(*pipe_layout, 0, *set);
+        cmd.bind_vertex_buffer(0, {*vertex_buffer, 0, sizeof(vertices)});
+        cmd.draw(first_vertex, vertex_count);
+    }; };
+
+    // Only the top left half is covered, with the vertex color multiplied by the uniform tint, and triangles wound the other way are culled
+    auto tinted = make_pipeline(tint_fs, front_face::clockwise, std::nullopt);
+    auto pixels = render(8, draw(*tinted, 0, 3), false);
+    DOCTEST_CHECK(pixels[0] == float4{128/255.0f, 0, 0, 1});
+    DOCTEST_CHECK(pixels[7*8+7] == float4{0, 0, 0, 1});
+    auto culled = make_pipeline(tint_fs, front_face::counter_clockwise, std::nullopt);
+    DOCTEST_CHECK(render(8, draw(*culled, 0, 3), false)[0] == float4{0, 0, 0, 1});
+
+    // The full screen triangle is behind the first, so only shows where the first does not cover
+    auto depth_tested = make_pipeline(tint_fs, front_face::clockwise, depth_state{compare_op::less, true});
+    pixels = render(8, [&](command_buffer & cmd) { draw(*depth_tested, 0, 3)(cmd); draw(*depth_tested, 3, 3)(cmd); }, true);
+    DOCTEST_CHECK(pixels[0] == float4{128/255.0f, 0, 0, 1});
+    DOCTEST_CHECK(pixels[7*8+7] == float4{120/255.0f, 239/255.0f, 0, 1}); // The vertex color of the full screen triangle is its texcoord, (0.9375, 0.9375) at this pixel
+
+    // Nearest sampling maps each texel of the texture to one quadrant of the framebuffer, with texcoords interpolated across the full screen triangle
+    auto textured = make_pipeline(texture_fs, front_face::clockwise, std::nullopt);
+    pixels = render(8, draw(*textured, 3, 3), false);
+    DOCTEST_CHECK(pixels[0] == float4{1, 0, 0, 1});
+    DOCTEST_CHECK(pixels[7] == float4{0, 1, 0, 1});
+    DOCTEST_CHECK(pixels[7*8] == float4{0, 0, 1, 1});
+    DOCTEST_CHECK(pixels[7*8+7] == float4{1, 1, 1, 1});
+
+    // Large triangles are rasterized by several threads, which must produce the same image every time
+    const auto large = render(256, draw(*textured, 3, 3), false);
+    DOCTEST_CHECK(large == render(256, draw(*textured, 3, 3), false));
+    DOCTEST_CHECK(large[255*256+255] == float4{1, 1, 1, 1});
+}
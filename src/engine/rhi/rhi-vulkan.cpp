@@ -8,6 +8,9 @@
 #pragma comment(lib, "vulkan-1.lib")
 #include <queue>
 #include <set>
+#include <mutex>
+#include <thread>
+#include <fstream>
 
 #include <iostream>
 
@@ -58,6 +61,13 @@ namespace rhi
         #define RHI_IMAGE_FORMAT(CASE, SIZE, TYPE, VK, DX, GLI, GLF, GLT) case CASE: return VK;
         #include "rhi-tables.inl"
     }}
+    VkDescriptorType convert_vk(descriptor_type type) { switch(type) { default: fail_fast();
+        case descriptor_type::combined_image_sampler: return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        case descriptor_type::uniform_buffer: return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        case descriptor_type::uniform_buffer_dynamic: return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        case descriptor_type::storage_buffer: return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        case descriptor_type::storage_image: return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    }}
 
     struct vk_render_pass_desc
     {
@@ -71,12 +81,53 @@ namespace rhi
     {
         VkPhysicalDevice physical_device;
         uint32_t queue_family;
+        uint32_t transfer_queue_family; // A dedicated transfer queue family, or queue_family if none is suitable
+        uint32_t timestamp_valid_bits;  // Significant bits of timestamps written on queue_family, or zero if it does not support them
         VkSurfaceFormatKHR surface_format;
         VkPresentModeKHR present_mode;
         uint32_t swap_image_count;
         VkSurfaceTransformFlagBitsKHR surface_transform;
     };
 
+    // Buffers and images are kept in separate pools, so that we never need to account for bufferImageGranularity
+    enum class vk_memory_pool { buffer, image, mapped_buffer, count };
+
+    // A large allocation of device memory, which many buffers or images are placed within
+    struct vk_memory_block
+    {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        char * mapped;                          // Blocks in the mapped_buffer pool are persistently mapped, as a VkDeviceMemory may only be mapped once
+        std::optional<buddy_allocator> buddy;   // Used by the buffer and image pools
+        VkDeviceSize linear_offset;             // Used by the mapped_buffer pool, which only reclaims space once every allocation in the block has been freed
+        size_t allocation_count;
+
+        std::optional<VkDeviceSize> suballocate(const VkMemoryRequirements & reqs);
+        void free(VkDeviceSize offset);
+    };
+
+    struct vk_allocation
+    {
+        VkDeviceMemory memory;
+        VkDeviceSize offset, size;
+        char * mapped;              // Host address corresponding to offset, for allocations from the mapped_buffer pool
+        uint32_t memory_type;
+        vk_memory_pool pool;
+        vk_memory_block * block;    // nullptr for dedicated allocations
+    };
+
+    // Command buffers are allocated from a pool owned by the thread which records them. Command buffers the device has finished 
+    // executing are queued up by the thread which retires them, and freed by the owning thread the next time it allocates.
+    struct vk_command_pool
+    {
+        VkCommandPool pool;
+        std::mutex mutex;                       // Guards retired
+        std::vector<VkCommandBuffer> retired;
+    };
+
+    struct vk_framebuffer;
+    struct vk_command_buffer;
+
     struct vk_device : device
     {
         // Core Vulkan objects
@@ -88,14 +139,30 @@ namespace rhi
         VkDevice dev {};
         VkQueue queue {};
         VkPhysicalDeviceProperties device_props {};
+        VkPhysicalDeviceFeatures enabled_features {};
+        int max_resource_table_images = 0;  // Nonzero if shaders may index arrays of sampled images with dynamically uniform expressions
         VkPhysicalDeviceMemoryProperties mem_props {};
 
-        // Resources for staging memory
+        // Device memory, sub-allocated out of large blocks per memory type and pool
+        constexpr static VkDeviceSize memory_block_size = 64*1024*1024, mapped_memory_block_size = 16*1024*1024, min_suballocation_size = 256;
+        std::vector<std::unique_ptr<vk_memory_block>> memory_blocks[VK_MAX_MEMORY_TYPES][static_cast<size_t>(vk_memory_pool::count)];
+        memory_stats mem_stats {};
+
+        // Resources for staging memory, used as a ring buffer by streaming uploads
         size_t staging_buffer_size {32*1024*1024};
         VkBuffer staging_buffer {};
-        VkDeviceMemory staging_memory {};
-        void * mapped_staging_memory {};
-        VkCommandPool staging_pool {};
+        vk_allocation staging_memory {};
+        char * mapped_staging_memory {};
+        size_t staging_ring_head {}, staging_ring_used {};
+        std::queue<std::pair<uint64_t, size_t>> staging_ring_batches; // Submission index and staging bytes consumed by each upload batch in flight
+
+        // Streaming uploads are batched into a single submission on the transfer queue, which the next submission on the main queue waits for
+        VkQueue transfer_queue {};
+        std::array<uint32_t, 2> queue_families {};  // Main and transfer queue families, which resources must be shared between if they differ
+        VkCommandPool upload_pool {};
+        VkCommandBuffer upload_cmd {};              // Command buffer collecting the current batch of uploads, if any
+        size_t upload_batch_size {};                // Staging bytes consumed by the current batch of uploads
+        std::vector<VkSemaphore> free_upload_semaphores, pending_upload_semaphores;
 
         // Scheduling
         constexpr static int fence_ring_size = 256, fence_ring_mask = 0xFF;
@@ -103,16 +170,32 @@ namespace rhi
         uint64_t submitted_index, completed_index;
         struct scheduled_action { uint64_t after_completion_index; std::function<void(vk_device &)> execute; };
         std::queue<scheduled_action> scheduled_actions;
+        std::mutex scheduled_actions_mutex;     // Objects may be released by threads recording command buffers
+
+        // Command pools for each thread which has recorded command buffers
+        std::map<std::thread::id, std::unique_ptr<vk_command_pool>> command_pools;
+        std::mutex command_pools_mutex;
 
         // Deduplicated render passes
         std::map<vk_render_pass_desc, VkRenderPass> render_passes;
+        std::mutex render_passes_mutex;
+
+        // GPU timers, written into a query pool which each primary command buffer holds until its submission completes
+        constexpr static uint32_t timestamp_queries_per_pool = 128;
+        std::vector<VkQueryPool> query_pools, free_query_pools;
+        std::mutex query_pools_mutex;
+        std::vector<timer_result> timer_results;
+
+        // Pipeline cache, persisted between runs beside the executable so that pipelines compiled once need not be compiled again
+        constexpr static const char * pipeline_cache_filename = "vulkan-pipeline-cache.bin";
+        VkPipelineCache pipeline_cache {};
 
         vk_device(std::function<void(const char *)> debug_callback);
         ~vk_device();
 
         // Core helper functions
         void destroy_immediate(VkRenderPass pass) { vkDestroyRenderPass(dev, pass, nullptr); }
-        void destroy_immediate(VkDeviceMemory memory) { vkFreeMemory(dev, memory, nullptr); }
+        void destroy_immediate(const vk_allocation & allocation) { free(allocation); }
         void destroy_immediate(VkBuffer buffer) { vkDestroyBuffer(dev, buffer, nullptr); }
         void destroy_immediate(VkSampler sampler) { vkDestroySampler(dev, sampler, nullptr); }
         void destroy_immediate(VkImage image) { vkDestroyImage(dev, image, nullptr); }
@@ -128,14 +211,32 @@ namespace rhi
         void destroy_immediate(VkSurfaceKHR surface) { vkDestroySurfaceKHR(instance, surface, nullptr); }
         void destroy_immediate(VkSwapchainKHR swapchain) { vkDestroySwapchainKHR(dev, swapchain, nullptr); }
         void destroy_immediate(GLFWwindow * window) { glfwDestroyWindow(window); }
-        template<class T> void destroy(T object) { scheduled_actions.push({submitted_index, [object](vk_device & dev) { dev.destroy_immediate(object); }}); }
-
-        VkDeviceMemory allocate(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props);
+        void schedule(uint64_t after_completion_index, std::function<void(vk_device &)> execute) { std::lock_guard<std::mutex> lock{scheduled_actions_mutex}; scheduled_actions.push({after_completion_index, std::move(execute)}); }
+        template<class T> void destroy(T object) { schedule(submitted_index + (upload_cmd ? 1 : 0), [object](vk_device & dev) { dev.destroy_immediate(object); }); } // An open upload batch will be submitted before any other work
+
+        uint32_t select_memory_type(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props) const;
+        VkDeviceMemory allocate_device_memory(uint32_t memory_type, VkDeviceSize size, char ** mapped);
+        void free_device_memory(VkDeviceMemory memory, VkDeviceSize size, bool mapped);
+        vk_allocation allocate(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props, vk_memory_pool pool);
+        void free(const vk_allocation & allocation);
         VkRenderPass get_render_pass(const vk_render_pass_desc & desc);
-        uint64_t submit(const VkSubmitInfo & submit_info);
+        std::vector<char> load_pipeline_cache_data() const;
+        void save_pipeline_cache_data() const;
+        vk_command_pool & get_command_pool();
+        ptr<vk_command_buffer> begin_command_buffer(const vk_framebuffer * secondary_framebuffer, bool reusable);
+        VkQueryPool acquire_query_pool();
+        void retire(const vk_command_buffer & cmd);
+        uint64_t submit(VkQueue queue, const VkSubmitInfo & submit_info);
+        uint64_t submit_after_uploads(VkSubmitInfo submit_info);
+
+        // Streaming uploads
+        size_t get_max_upload_chunk_size() const { return staging_buffer_size/4; }
+        template<class CreateInfo> void share_with_transfer_queue(CreateInfo & info) const;
+        VkCommandBuffer get_upload_command_buffer();
+        size_t allocate_staging_memory(size_t size, size_t alignment);
 
         // info
-        device_info get_info() const final { return {linalg::zero_to_one, false}; }
+        device_info get_info() const final { return {linalg::zero_to_one, false, max_resource_table_images}; }
 
         // resources
         ptr<buffer> create_buffer(const buffer_desc & desc, const void * initial_data) final;
@@ -145,17 +246,23 @@ namespace rhi
         ptr<window> create_window(const int2 & dimensions, std::string_view title) final;
 
         ptr<descriptor_set_layout> create_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) final;
-        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets) final;
+        ptr<pipeline_layout> create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) final;
         ptr<shader> create_shader(const shader_desc & desc) final;
         ptr<pipeline> create_pipeline(const pipeline_desc & desc) final;        
+        ptr<pipeline> create_compute_pipeline(const compute_pipeline_desc & desc) final;
+        void precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer) final;
 
         ptr<descriptor_pool> create_descriptor_pool() final;
-        ptr<command_buffer> create_command_buffer() final;
+        ptr<resource_table> create_resource_table(int capacity) final;
+        ptr<command_buffer> create_command_buffer(bool reusable) final;
+        ptr<command_buffer> create_secondary_command_buffer(const framebuffer & framebuffer, bool reusable) final;
 
         uint64_t submit(command_buffer & cmd) final;
         uint64_t acquire_and_submit_and_present(command_buffer & cmd, window & window) final;
+        uint64_t flush_uploads() final;
         uint64_t get_last_submission_id() final { return submitted_index; }
         void wait_until_complete(uint64_t submit_id) final;
+        std::vector<timer_result> get_timer_results() final { return std::move(timer_results); }
     };
 
     autoregister_backend<vk_device> autoregister_vk_backend {"Vulkan 1.0", client_api::vulkan};
@@ -163,14 +270,14 @@ namespace rhi
     struct vk_buffer : buffer
     {
         ptr<vk_device> device;
-        VkDeviceMemory memory_object;
+        vk_allocation memory;
         VkBuffer buffer_object;        
         char * mapped = 0;
 
         vk_buffer(vk_device * device, const buffer_desc & desc, const void * initial_data);
         ~vk_buffer();
 
-        size_t get_offset_alignment() final { return exactly(device->device_props.limits.minUniformBufferOffsetAlignment); }
+        size_t get_offset_alignment() final { return exactly(std::max(device->device_props.limits.minUniformBufferOffsetAlignment, device->device_props.limits.minStorageBufferOffsetAlignment)); }
         char * get_mapped_memory() final { return mapped; }
     };
 
@@ -178,11 +285,13 @@ namespace rhi
     {
         ptr<vk_device> device;
         image_desc desc;
-        VkDeviceMemory device_memory;
+        vk_allocation device_memory;
         VkImage image_object;
         VkImageView image_view;
         VkImageCreateInfo image_info;
         VkImageViewCreateInfo view_info;
+        VkImageLayout shader_layout;        // Layout the image is kept in while not in use by transfers or render passes
+        std::vector<VkImageView> mip_views; // If this is a storage image, a view of all layers of each mip level
 
         vk_image(vk_device * device, const image_desc & desc, std::vector<const void *> initial_data);
         ~vk_image();
@@ -204,6 +313,7 @@ namespace rhi
         ptr<vk_device> device;
         std::vector<VkFormat> color_formats;
         std::optional<VkFormat> depth_format;
+        VkRenderPass compatible_pass {}; // Render pass with no load or store ops, compatible with every render pass which targets this framebuffer
         int2 dims;
 
         GLFWwindow * glfw_window {};
@@ -240,10 +350,13 @@ namespace rhi
     struct vk_descriptor_set_layout : descriptor_set_layout
     {
         ptr<vk_device> device;
+        std::vector<descriptor_binding> bindings;
         VkDescriptorSetLayout layout;
 
         vk_descriptor_set_layout(vk_device * device, const std::vector<descriptor_binding> & bindings);
         ~vk_descriptor_set_layout();
+
+        VkDescriptorType get_descriptor_type(int binding) const;
     };
 
     struct vk_pipeline_layout : base_pipeline_layout
@@ -251,7 +364,7 @@ namespace rhi
         ptr<vk_device> device;
         VkPipelineLayout layout;
 
-        vk_pipeline_layout(vk_device * device, const std::vector<const descriptor_set_layout *> & sets);
+        vk_pipeline_layout(vk_device * device, const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size);
         ~vk_pipeline_layout();
     };
 
@@ -269,7 +382,8 @@ namespace rhi
     {
         ptr<vk_device> device;
         pipeline_desc desc;
-        mutable std::unordered_map<VkRenderPass, VkPipeline> pipeline_objects;
+        mutable std::mutex mutex; // Guards pipeline_objects, as pipelines may be precompiled on another thread
+        mutable std::unordered_map<VkRenderPass, VkPipeline> pipeline_objects; // Keyed by compatible render pass
 
         vk_pipeline(vk_device * device, const pipeline_desc & desc);
         ~vk_pipeline();
@@ -277,13 +391,57 @@ namespace rhi
         VkPipeline get_pipeline(VkRenderPass render_pass) const;
     };
 
+    struct vk_compute_pipeline : base_pipeline
+    {
+        ptr<vk_device> device;
+        VkPipeline pipeline_object;
+
+        vk_compute_pipeline(vk_device * device, const compute_pipeline_desc & desc);
+        ~vk_compute_pipeline();
+    };
+
     struct vk_descriptor_set : descriptor_set 
     {
         VkDevice device;
+        ptr<const vk_descriptor_set_layout> layout;
         VkDescriptorSet set;
 
         void write(int binding, buffer_range range) final;
         void write(int binding, sampler & sampler, image & image) final;
+        void write(int binding, image & image, int mip) final;
+    };
+    struct vk_resource_table : resource_table
+    {
+        // Each version of the table's contents lives in a descriptor pool of its own. Once no recorded or submitted work can refer to a version, its pool is
+        // kept as a spare, so that a table written every frame cycles through a few pools, and a new version need only copy the elements which differ from
+        // the spare's old contents. Versions may outlive their table, in which case their pools are simply destroyed.
+        struct spare { VkDescriptorPool pool; VkDescriptorSet set; std::vector<image_binding> elements; uint64_t reusable_after_index; };
+        struct spare_list { std::mutex mutex; std::vector<spare> spares; bool is_open = true; };
+        static constexpr size_t max_spares = 8;
+
+        struct version : vk_descriptor_set
+        {
+            ptr<vk_device> owner;
+            std::shared_ptr<spare_list> spares;
+            VkDescriptorPool pool;
+            std::vector<image_binding> elements;
+
+            version(vk_device * owner, const vk_descriptor_set_layout & layout, std::shared_ptr<spare_list> spares);
+            ~version();
+        };
+        ptr<vk_device> device;
+        ptr<const vk_descriptor_set_layout> layout;
+        std::shared_ptr<spare_list> spares;
+        ptr<version> current;
+        bool is_current_bound = false;
+
+        vk_resource_table(vk_device * device, int capacity);
+        ~vk_resource_table();
+
+        int get_capacity() const final { return layout->bindings[0].count; }
+        const descriptor_set_layout & get_descriptor_set_layout() const final { return *layout; }
+        const descriptor_set & get_descriptor_set() final { is_current_bound = true; return *current; }
+        void write(int index, sampler & sampler, image & image) final;
     };
     struct vk_descriptor_pool : descriptor_pool 
     {
@@ -291,6 +449,8 @@ namespace rhi
         VkDescriptorPool pool;
         std::vector<counted<vk_descriptor_set>> sets;
         size_t used_sets;
+        std::array<uint32_t, 5> used_descriptors; // Indexed by descriptor_type, so that exhaustion can be detected without relying on VK_KHR_maintenance1
+        std::mutex mutex; // Guards alloc(...), which may be called from multiple threads
 
         vk_descriptor_pool(vk_device * device);
         ~vk_descriptor_pool();
@@ -303,11 +463,23 @@ namespace rhi
     {
         ptr<vk_device> device;
         std::set<ptr<const object>> referenced_objects;
+        vk_command_pool * pool;
         VkCommandBuffer cmd;
         VkRenderPass current_pass;
-        vk_framebuffer * current_framebuffer;
+        const vk_framebuffer * current_framebuffer;
+        bool is_secondary, is_ended;
+        bool is_reusable;                                   // Reusable command buffers are freed when destroyed, rather than when retired
+        std::vector<ptr<vk_command_buffer>> secondaries;    // Secondary command buffers executed by this one, which are retired along with it
+
+        struct vk_timer { std::string name; uint32_t begin_query, end_query; };
+        VkQueryPool query_pool;                             // Acquired and reset by the first timer, if timestamps are supported
+        std::vector<vk_timer> timers;
+        std::vector<size_t> open_timers;
+
+        ~vk_command_buffer();
 
         void record_reference(const object & object);
+        void end();
         void generate_mipmaps(image & image) final;
         void begin_render_pass(const render_pass_desc & desc, framebuffer & framebuffer) final;
         void clear_depth(float depth) final;
@@ -316,12 +488,23 @@ namespace rhi
         void set_scissor_rect(int x0, int y0, int x1, int y1) final;
         void set_stencil_ref(uint8_t stencil) final;
         void bind_pipeline(const pipeline & pipe) final;
-        void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set) final;
+        void bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set, array_view<uint32_t> dynamic_offsets) final;
+        void push_constants(const pipeline_layout & layout, size_t offset, size_t size, const void * data) final;
         void bind_vertex_buffer(int index, buffer_range range) final;
         void bind_index_buffer(buffer_range range) final;
-        void draw(int first_vertex, int vertex_count) final;
-        void draw_indexed(int first_index, int index_count) final;
+        void draw(int first_vertex, int vertex_count, int first_instance, int instance_count) final;
+        void draw_indexed(int first_index, int index_count, int first_instance, int instance_count, int vertex_offset) final;
+        void draw_indirect(buffer_range args, int draw_count, size_t stride) final;
+        void draw_indexed_indirect(buffer_range args, int draw_count, size_t stride) final;
+        void execute_commands(command_buffer & secondary) final;
         void end_render_pass() final;
+        void begin_timer(std::string_view name) final;
+        void end_timer() final;
+        void dispatch(int group_count_x, int group_count_y, int group_count_z) final;
+        void memory_barrier() final;
+
+        // Outside of a render pass, pipelines and descriptor sets are bound for compute
+        VkPipelineBindPoint get_bind_point() const { return current_pass ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE; }
     };
 
     ptr<buffer> vk_device::create_buffer(const buffer_desc & desc, const void * initial_data) { return new delete_when_unreferenced<vk_buffer>{this, desc, initial_data}; }
@@ -331,11 +514,13 @@ namespace rhi
     ptr<window> vk_device::create_window(const int2 & dimensions, std::string_view title) { return new delete_when_unreferenced<vk_window>{this, dimensions, std::string{title}}; }
 
     ptr<descriptor_set_layout> vk_device::create_descriptor_set_layout(const std::vector<descriptor_binding> & bindings) { return new delete_when_unreferenced<vk_descriptor_set_layout>{this, bindings}; }
-    ptr<pipeline_layout> vk_device::create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets) { return new delete_when_unreferenced<vk_pipeline_layout>{this, sets}; }
-    ptr<shader> vk_device::create_shader(const shader_desc & desc) { return new delete_when_unreferenced<vk_shader>{this, desc}; }
+    ptr<pipeline_layout> vk_device::create_pipeline_layout(const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) { return new delete_when_unreferenced<vk_pipeline_layout>{this, sets, push_constant_size}; }
+    ptr<shader> vk_device::create_shader(const shader_desc & desc) { validate_push_constant_block(desc.spirv); return new delete_when_unreferenced<vk_shader>{this, desc}; }
     ptr<pipeline> vk_device::create_pipeline(const pipeline_desc & desc) { return new delete_when_unreferenced<vk_pipeline>{this, desc}; }
+    ptr<pipeline> vk_device::create_compute_pipeline(const compute_pipeline_desc & desc) { return new delete_when_unreferenced<vk_compute_pipeline>{this, desc}; }
 
     ptr<descriptor_pool> vk_device::create_descriptor_pool() { return new delete_when_unreferenced<vk_descriptor_pool>{this}; }
+    ptr<resource_table> vk_device::create_resource_table(int capacity) { return new delete_when_unreferenced<vk_resource_table>{this, capacity}; }
 }
 
 namespace rhi
@@ -421,9 +606,19 @@ namespace rhi
                 check("vkGetPhysicalDeviceSurfaceSupportKHR", vkGetPhysicalDeviceSurfaceSupportKHR(d, i, example_surface, &present));
                 if((queue_family_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && present) 
                 {
+                    // Prefer a transfer-only queue family for uploads, so long as it can copy arbitrary image regions
+                    uint32_t transfer_queue_family = i;
+                    for(uint32_t j=0; j<queue_family_props.size(); ++j)
+                    {
+                        const auto & props = queue_family_props[j];
+                        const auto & granularity = props.minImageTransferGranularity;
+                        if((props.queueFlags & (VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_COMPUTE_BIT|VK_QUEUE_TRANSFER_BIT)) == VK_QUEUE_TRANSFER_BIT 
+                            && granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) transfer_queue_family = j;
+                    }
+
                     vkDestroySurfaceKHR(instance, example_surface, nullptr);
                     glfwDestroyWindow(example_window);
-                    return {d, i, *surface_format, present_mode, std::min(surface_caps.minImageCount+1, surface_caps.maxImageCount), surface_caps.currentTransform};
+                    return {d, i, transfer_queue_family, queue_family_props[i].timestampValidBits, *surface_format, present_mode, std::min(surface_caps.minImageCount+1, surface_caps.maxImageCount), surface_caps.currentTransform};
                 }
             }
         }
@@ -463,12 +658,28 @@ vk_device::vk_device(std::function<void(const char *)> debug_callback) : debug_c
     std::vector<const char *> device_extensions {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
     selection = select_physical_device(instance, device_extensions);
     const float queue_priorities[] {1.0f};
-    const VkDeviceQueueCreateInfo queue_infos[] {{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, nullptr, {}, selection.queue_family, 1, queue_priorities}};
-    const VkDeviceCreateInfo device_info {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, nullptr, {}, 1, queue_infos, 1, layers, exactly(device_extensions.size()), device_extensions.data()};
+    const VkDeviceQueueCreateInfo queue_infos[] {{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, nullptr, {}, selection.queue_family, 1, queue_priorities}, {VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, nullptr, {}, selection.transfer_queue_family, 1, queue_priorities}};
+    const uint32_t queue_info_count = selection.transfer_queue_family == selection.queue_family ? 1 : 2;
+    // Indirect draws are issued as a single command where multiDrawIndirect is available, and may use first_instance where drawIndirectFirstInstance is available,
+    // cube_array images may only be created where imageCubeArray is available, and resource tables only where shaderSampledImageArrayDynamicIndexing is available
+    VkPhysicalDeviceFeatures supported_features {};
+    vkGetPhysicalDeviceFeatures(selection.physical_device, &supported_features);
+    enabled_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+    enabled_features.drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance;
+    enabled_features.imageCubeArray = supported_features.imageCubeArray;
+    enabled_features.shaderSampledImageArrayDynamicIndexing = supported_features.shaderSampledImageArrayDynamicIndexing;
+    const VkDeviceCreateInfo device_info {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, nullptr, {}, queue_info_count, queue_infos, 1, layers, exactly(device_extensions.size()), device_extensions.data(), &enabled_features};
     check("vkCreateDevice", vkCreateDevice(selection.physical_device, &device_info, nullptr, &dev));
     vkGetDeviceQueue(dev, selection.queue_family, 0, &queue);
+    vkGetDeviceQueue(dev, selection.transfer_queue_family, 0, &transfer_queue);
+    queue_families = {selection.queue_family, selection.transfer_queue_family};
     vkGetPhysicalDeviceProperties(selection.physical_device, &device_props);
     vkGetPhysicalDeviceMemoryProperties(selection.physical_device, &mem_props);
+    if(enabled_features.shaderSampledImageArrayDynamicIndexing)
+    {
+        const auto & limits = device_props.limits;
+        max_resource_table_images = exactly(std::min({limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages, limits.maxDescriptorSetSamplers, limits.maxDescriptorSetSampledImages, uint32_t(std::numeric_limits<int>::max())}));
+    }
 
     // Set up staging buffer
     VkBufferCreateInfo buffer_info {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
@@ -479,60 +690,173 @@ vk_device::vk_device(std::function<void(const char *)> debug_callback) : debug_c
 
     VkMemoryRequirements mem_reqs;
     vkGetBufferMemoryRequirements(dev, staging_buffer, &mem_reqs);
-    staging_memory = allocate(mem_reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    check("vkBindBufferMemory", vkBindBufferMemory(dev, staging_buffer, staging_memory, 0));
-    check("vkMapMemory", vkMapMemory(dev, staging_memory, 0, buffer_info.size, 0, &mapped_staging_memory));
+    staging_memory = allocate(mem_reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vk_memory_pool::mapped_buffer);
+    check("vkBindBufferMemory", vkBindBufferMemory(dev, staging_buffer, staging_memory.memory, staging_memory.offset));
+    mapped_staging_memory = staging_memory.mapped;
         
     VkCommandPoolCreateInfo command_pool_info {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
-    command_pool_info.queueFamilyIndex = selection.queue_family; // TODO: Could use an explicit transfer queue
+    command_pool_info.queueFamilyIndex = selection.transfer_queue_family;
     command_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
-    check("vkCreateCommandPool", vkCreateCommandPool(dev, &command_pool_info, nullptr, &staging_pool));
+    check("vkCreateCommandPool", vkCreateCommandPool(dev, &command_pool_info, nullptr, &upload_pool));
 
     // Initialize fence ring
     const VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
     for(auto & fence : ring_fences) check("vkCreateFence", vkCreateFence(dev, &fence_info, nullptr, &fence));
     submitted_index = completed_index = 0;
+
+    // Create pipeline cache, seeded with the contents saved by a previous run on this device, if any
+    const auto cache_data = load_pipeline_cache_data();
+    VkPipelineCacheCreateInfo pipeline_cache_info {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    pipeline_cache_info.initialDataSize = cache_data.size();
+    pipeline_cache_info.pInitialData = cache_data.data();
+    check("vkCreatePipelineCache", vkCreatePipelineCache(dev, &pipeline_cache_info, nullptr, &pipeline_cache));
 }
 
 vk_device::~vk_device()
 {
-    // Flush our queue
+    // Flush our queues
+    flush_uploads();
     wait_until_complete(submitted_index);
     for(auto & fence : ring_fences) destroy_immediate(fence);
+    for(auto semaphore : free_upload_semaphores) destroy_immediate(semaphore);
+    for(auto semaphore : pending_upload_semaphores) destroy_immediate(semaphore);
     for(auto & pair : render_passes) destroy_immediate(pair.second);
+    for(auto pool : query_pools) vkDestroyQueryPool(dev, pool, nullptr);
+    save_pipeline_cache_data();
+    vkDestroyPipelineCache(dev, pipeline_cache, nullptr);
 
     // NOTE: We expect the higher level software layer to ensure that all API objects have been destroyed by this point
-    vkDestroyCommandPool(dev, staging_pool, nullptr);
+    for(auto & pair : command_pools) vkDestroyCommandPool(dev, pair.second->pool, nullptr);
+    vkDestroyCommandPool(dev, upload_pool, nullptr);
     vkDestroyBuffer(dev, staging_buffer, nullptr);
-    vkUnmapMemory(dev, staging_memory);
-    vkFreeMemory(dev, staging_memory, nullptr);
+    free(staging_memory);
+    for(auto & type_blocks : memory_blocks) for(auto & pool_blocks : type_blocks) for(auto & block : pool_blocks) free_device_memory(block->memory, block->size, block->mapped != nullptr);
 
     vkDestroyDevice(dev, nullptr);
     vkDestroyDebugReportCallbackEXT(instance, callback, nullptr);
     vkDestroyInstance(instance, nullptr);
 }
 
-VkDeviceMemory vk_device::allocate(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props)
+uint32_t vk_device::select_memory_type(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props) const
 {
     for(uint32_t i=0; i<mem_props.memoryTypeCount; ++i)
     {
-        if(reqs.memoryTypeBits & (1 << i) && (mem_props.memoryTypes[i].propertyFlags & props) == props)
-        {
-            VkMemoryAllocateInfo alloc_info {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-            alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            alloc_info.allocationSize = reqs.size;
-            alloc_info.memoryTypeIndex = i;
-
-            VkDeviceMemory memory;
-            check("vkAllocateMemory", vkAllocateMemory(dev, &alloc_info, nullptr, &memory));
-            return memory;
-        }
+        if(reqs.memoryTypeBits & (1 << i) && (mem_props.memoryTypes[i].propertyFlags & props) == props) return i;
     }
     throw std::runtime_error("no suitable memory type");
 }
 
+VkDeviceMemory vk_device::allocate_device_memory(uint32_t memory_type, VkDeviceSize size, char ** mapped)
+{
+    VkMemoryAllocateInfo alloc_info {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = memory_type;
+
+    VkDeviceMemory memory;
+    check("vkAllocateMemory", vkAllocateMemory(dev, &alloc_info, nullptr, &memory));
+    if(mapped) check("vkMapMemory", vkMapMemory(dev, memory, 0, size, 0, reinterpret_cast<void**>(mapped)));
+    ++mem_stats.device_allocations;
+    mem_stats.device_allocated_bytes += size;
+    return memory;
+}
+
+void vk_device::free_device_memory(VkDeviceMemory memory, VkDeviceSize size, bool mapped)
+{
+    if(mapped) vkUnmapMemory(dev, memory);
+    vkFreeMemory(dev, memory, nullptr);
+    --mem_stats.device_allocations;
+    mem_stats.device_allocated_bytes -= size;
+}
+
+vk_allocation vk_device::allocate(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props, vk_memory_pool pool)
+{
+    const uint32_t memory_type = select_memory_type(reqs, props);
+    const bool is_mapped = pool == vk_memory_pool::mapped_buffer;
+    const VkDeviceSize block_size = is_mapped ? mapped_memory_block_size : memory_block_size;
+
+    // Resources which would occupy a large fraction of a block are given their own allocation
+    if(reqs.size > block_size/4)
+    {
+        char * mapped = nullptr;
+        VkDeviceMemory memory = allocate_device_memory(memory_type, reqs.size, is_mapped ? &mapped : nullptr);
+        ++mem_stats.dedicated_allocations;
+        return {memory, 0, reqs.size, mapped, memory_type, pool, nullptr};
+    }
+
+    // Otherwise place the resource in the first block with room for it, allocating a new block if necessary
+    auto & blocks = memory_blocks[memory_type][static_cast<size_t>(pool)];
+    std::optional<VkDeviceSize> offset;
+    vk_memory_block * block = nullptr;
+    for(auto & b : blocks) if(offset = b->suballocate(reqs)) { block = b.get(); break; }
+    if(!block)
+    {
+        auto & b = blocks.emplace_back(std::make_unique<vk_memory_block>());
+        b->size = block_size;
+        b->mapped = nullptr;
+        b->memory = allocate_device_memory(memory_type, block_size, is_mapped ? &b->mapped : nullptr);
+        if(!is_mapped) b->buddy.emplace(block_size, min_suballocation_size);
+        b->linear_offset = 0;
+        b->allocation_count = 0;
+        block = b.get();
+        offset = block->suballocate(reqs);
+    }
+    ++mem_stats.suballocations;
+    mem_stats.suballocated_bytes += reqs.size;
+    return {block->memory, *offset, reqs.size, block->mapped ? block->mapped + *offset : nullptr, memory_type, pool, block};
+}
+
+void vk_device::free(const vk_allocation & allocation)
+{
+    if(!allocation.block)
+    {
+        free_device_memory(allocation.memory, allocation.size, allocation.mapped != nullptr);
+        --mem_stats.dedicated_allocations;
+        return;
+    }
+
+    allocation.block->free(allocation.offset);
+    --mem_stats.suballocations;
+    mem_stats.suballocated_bytes -= allocation.size;
+
+    // Release blocks once they are empty, but keep one block per pool around to avoid repeatedly allocating and freeing it
+    auto & blocks = memory_blocks[allocation.memory_type][static_cast<size_t>(allocation.pool)];
+    if(allocation.block->allocation_count == 0 && blocks.size() > 1)
+    {
+        auto it = std::find_if(blocks.begin(), blocks.end(), [&](const std::unique_ptr<vk_memory_block> & b) { return b.get() == allocation.block; });
+        free_device_memory((*it)->memory, (*it)->size, (*it)->mapped != nullptr);
+        blocks.erase(it);
+    }
+}
+
+std::optional<VkDeviceSize> vk_memory_block::suballocate(const VkMemoryRequirements & reqs)
+{
+    std::optional<VkDeviceSize> offset;
+    if(buddy) offset = buddy->allocate(exactly(reqs.size), exactly(reqs.alignment));
+    else
+    {
+        offset = round_up(linear_offset, reqs.alignment);
+        if(*offset + reqs.size > size) return std::nullopt;
+        linear_offset = *offset + reqs.size;
+    }
+    if(offset) ++allocation_count;
+    return offset;
+}
+
+void vk_memory_block::free(VkDeviceSize offset)
+{
+    if(buddy) buddy->free(exactly(offset));
+    if(--allocation_count == 0) linear_offset = 0;
+}
+
+std::optional<memory_stats> rhi::get_vulkan_memory_stats(const device & dev)
+{
+    if(auto d = dynamic_cast<const vk_device *>(&dev)) return d->mem_stats;
+    return std::nullopt;
+}
+
 VkRenderPass vk_device::get_render_pass(const vk_render_pass_desc & desc)
 {
+    std::lock_guard<std::mutex> lock{render_passes_mutex};
     auto & pass = render_passes[desc];
     if(!pass)
     {
@@ -553,6 +877,129 @@ VkRenderPass vk_device::get_render_pass(const vk_render_pass_desc & desc)
     return pass;
 }
 
+std::vector<char> vk_device::load_pipeline_cache_data() const
+{
+    auto in = open_file_beside_executable(pipeline_cache_filename, std::ios::in|std::ios::binary);
+    if(!in) return {};
+    std::vector<char> data{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+
+    // Only use the saved data if its header matches this device and driver, otherwise start with an empty cache
+    struct header { uint32_t length, version, vendor_id, device_id; uint8_t uuid[VK_UUID_SIZE]; } h;
+    if(data.size() < sizeof(h)) return {};
+    memcpy(&h, data.data(), sizeof(h));
+    if(h.length < sizeof(h) || h.version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) return {};
+    if(h.vendor_id != device_props.vendorID || h.device_id != device_props.deviceID) return {};
+    if(memcmp(h.uuid, device_props.pipelineCacheUUID, VK_UUID_SIZE) != 0) return {};
+    return data;
+}
+
+void vk_device::save_pipeline_cache_data() const
+{
+    size_t size = 0;
+    if(vkGetPipelineCacheData(dev, pipeline_cache, &size, nullptr) != VK_SUCCESS) return;
+    std::vector<char> data(size);
+    if(vkGetPipelineCacheData(dev, pipeline_cache, &size, data.data()) != VK_SUCCESS) return;
+    open_file_beside_executable(pipeline_cache_filename, std::ios::out|std::ios::trunc|std::ios::binary).write(data.data(), size);
+}
+
+void vk_device::precompile_pipeline(const pipeline & pipe, const framebuffer & framebuffer)
+{
+    auto graphics_pipe = dynamic_cast<const vk_pipeline *>(&pipe);
+    if(!graphics_pipe) throw std::logic_error("precompile_pipeline requires a graphics pipeline");
+    graphics_pipe->get_pipeline(static_cast<const vk_framebuffer &>(framebuffer).compatible_pass);
+}
+
+template<class CreateInfo> void vk_device::share_with_transfer_queue(CreateInfo & info) const
+{
+    if(queue_families[0] == queue_families[1]) info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    else
+    {
+        info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        info.queueFamilyIndexCount = exactly(queue_families.size());
+        info.pQueueFamilyIndices = queue_families.data();
+    }
+}
+
+VkCommandBuffer vk_device::get_upload_command_buffer()
+{
+    if(!upload_cmd)
+    {
+        VkCommandBufferAllocateInfo alloc_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandPool = upload_pool;
+        alloc_info.commandBufferCount = 1;
+        check("vkAllocateCommandBuffers", vkAllocateCommandBuffers(dev, &alloc_info, &upload_cmd));
+
+        VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        check("vkBeginCommandBuffer", vkBeginCommandBuffer(upload_cmd, &begin_info));
+    }
+    return upload_cmd;
+}
+
+size_t vk_device::allocate_staging_memory(size_t size, size_t alignment)
+{
+    if(size > staging_buffer_size) throw std::logic_error("upload larger than staging buffer");
+    while(true)
+    {
+        // An empty ring has room for any allocation at its start
+        if(staging_ring_used == 0) staging_ring_head = 0;
+
+        // Place the allocation after the most recent one, wrapping around to the start of the ring if it would not fit before the end
+        size_t offset = round_up(staging_ring_head, alignment), consumed = offset - staging_ring_head + size;
+        if(offset + size > staging_buffer_size)
+        {
+            offset = 0;
+            consumed = staging_buffer_size - staging_ring_head + size;
+        }
+        if(staging_ring_used + consumed <= staging_buffer_size)
+        {
+            staging_ring_head = offset + size;
+            staging_ring_used += consumed;
+            upload_batch_size += consumed;
+            return offset;
+        }
+
+        // The ring is full, so submit the current batch and wait for the oldest batch in flight to retire
+        flush_uploads();
+        if(staging_ring_batches.empty()) throw std::logic_error("staging ring full with no upload batch in flight");
+        wait_until_complete(staging_ring_batches.front().first);
+    }
+}
+
+uint64_t vk_device::flush_uploads()
+{
+    if(!upload_cmd) return submitted_index;
+    check("vkEndCommandBuffer", vkEndCommandBuffer(upload_cmd));
+
+    VkSemaphore semaphore;
+    if(free_upload_semaphores.empty())
+    {
+        const VkSemaphoreCreateInfo semaphore_info {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+        check("vkCreateSemaphore", vkCreateSemaphore(dev, &semaphore_info, nullptr, &semaphore));
+    }
+    else
+    {
+        semaphore = free_upload_semaphores.back();
+        free_upload_semaphores.pop_back();
+    }
+
+    VkSubmitInfo submit_info {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &upload_cmd;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &semaphore;
+    const VkCommandBuffer cmd = upload_cmd;
+    upload_cmd = VK_NULL_HANDLE; // Clear first, so that submit(...) does not defer work on our account
+    submit(transfer_queue, submit_info);
+    schedule(submitted_index, [cmd](vk_device & dev) { vkFreeCommandBuffers(dev.dev, dev.upload_pool, 1, &cmd); });
+
+    pending_upload_semaphores.push_back(semaphore);
+    staging_ring_batches.push({submitted_index, upload_batch_size});
+    upload_batch_size = 0;
+    return submitted_index;
+}
+
 /////////////////////////
 // vk_device resources //
 /////////////////////////
@@ -566,41 +1013,43 @@ vk_buffer::vk_buffer(vk_device * device, const buffer_desc & desc, const void *
     if(desc.flags & rhi::index_buffer_bit) buffer_info.usage |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
     if(desc.flags & rhi::uniform_buffer_bit) buffer_info.usage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
     if(desc.flags & rhi::storage_buffer_bit) buffer_info.usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    if(initial_data) buffer_info.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if(desc.flags & rhi::indirect_buffer_bit) buffer_info.usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    if(initial_data) 
+    {
+        buffer_info.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        device->share_with_transfer_queue(buffer_info);
+    }
+    else buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     check("vkCreateBuffer", vkCreateBuffer(device->dev, &buffer_info, nullptr, &buffer_object));
 
-    // Obtain and bind memory (TODO: Pool allocations)
+    // Obtain and bind memory, from persistently mapped blocks if the buffer is to be mapped
     VkMemoryRequirements mem_reqs;
     vkGetBufferMemoryRequirements(device->dev, buffer_object, &mem_reqs);
-    VkMemoryPropertyFlags memory_property_flags = 0;
-    if(desc.flags & rhi::mapped_memory_bit) memory_property_flags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    else memory_property_flags |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    memory_object = device->allocate(mem_reqs, memory_property_flags);
-    check("vkBindBufferMemory", vkBindBufferMemory(device->dev, buffer_object, memory_object, 0));
+    if(desc.flags & rhi::mapped_memory_bit) memory = device->allocate(mem_reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vk_memory_pool::mapped_buffer);
+    else memory = device->allocate(mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vk_memory_pool::buffer);
+    check("vkBindBufferMemory", vkBindBufferMemory(device->dev, buffer_object, memory.memory, memory.offset));
 
-    // Initialize memory if requested to do so
+    // Initialize memory if requested to do so, in chunks which fit comfortably within the staging ring
     if(initial_data)
     {
-        memcpy(device->mapped_staging_memory, initial_data, desc.size);
-        auto cmd = device->create_command_buffer();
-        const VkBufferCopy copy {0, 0, desc.size};
-        vkCmdCopyBuffer(static_cast<vk_command_buffer &>(*cmd).cmd, device->staging_buffer, buffer_object, 1, &copy);
-        device->submit(*cmd);
+        for(size_t offset=0; offset<desc.size; offset += device->get_max_upload_chunk_size())
+        {
+            const size_t size = std::min(desc.size - offset, device->get_max_upload_chunk_size());
+            const size_t staging_offset = device->allocate_staging_memory(size, 16);
+            memcpy(device->mapped_staging_memory + staging_offset, reinterpret_cast<const char *>(initial_data) + offset, size);
+            const VkBufferCopy copy {staging_offset, offset, size};
+            vkCmdCopyBuffer(device->get_upload_command_buffer(), device->staging_buffer, buffer_object, 1, &copy);
+        }
     }
 
-    // Map memory if requested to do so
-    if(desc.flags & rhi::mapped_memory_bit)
-    {
-        check("vkMapMemory", vkMapMemory(device->dev, memory_object, 0, desc.size, 0, reinterpret_cast<void**>(&mapped)));
-    }        
+    // Expose mapped memory if requested to do so
+    mapped = memory.mapped;
 }
 
 vk_buffer::~vk_buffer()
 {
-    if(mapped) vkUnmapMemory(device->dev, memory_object);
     device->destroy(buffer_object);
-    device->destroy(memory_object);
+    device->destroy(memory);
 }
 
 static void transition_image(VkCommandBuffer command_buffer, VkImage image, uint32_t mip_level, uint32_t array_layer, 
@@ -615,8 +1064,12 @@ static void transition_image(VkCommandBuffer command_buffer, VkImage image, uint
 
 vk_image::vk_image(vk_device * device, const image_desc & desc, std::vector<const void *> initial_data) : device{device}, desc{desc}
 {
+    // Storage images live in VK_IMAGE_LAYOUT_GENERAL, which render passes do not preserve
+    if((desc.flags & image_flag::storage_image_bit) && (desc.flags & (image_flag::color_attachment_bit|image_flag::depth_attachment_bit))) throw std::logic_error("storage images cannot be used as attachments");
+    shader_layout = desc.flags & image_flag::storage_image_bit ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
     image_info = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
-    image_info.arrayLayers = 1;
+    image_info.arrayLayers = get_layer_count(desc);
     VkImageViewType view_type;
     switch(desc.shape)
     {
@@ -626,7 +1079,13 @@ vk_image::vk_image(vk_device * device, const image_desc & desc, std::vector<cons
     case image_shape::cube: 
         image_info.imageType = VK_IMAGE_TYPE_2D; 
         view_type = VK_IMAGE_VIEW_TYPE_CUBE;
-        image_info.arrayLayers *= 6;
+        image_info.flags |= VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+        break;
+    case image_shape::_2d_array: image_info.imageType = VK_IMAGE_TYPE_2D; view_type = VK_IMAGE_VIEW_TYPE_2D_ARRAY; break;
+    case image_shape::cube_array:
+        if(!device->enabled_features.imageCubeArray) throw std::runtime_error("cube array images not supported by this device");
+        image_info.imageType = VK_IMAGE_TYPE_2D; 
+        view_type = VK_IMAGE_VIEW_TYPE_CUBE_ARRAY;
         image_info.flags |= VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
         break;
     default: fail_fast();
@@ -642,47 +1101,76 @@ vk_image::vk_image(vk_device * device, const image_desc & desc, std::vector<cons
     if(desc.flags & image_flag::sampled_image_bit) image_info.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
     if(desc.flags & image_flag::color_attachment_bit) image_info.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
     if(desc.flags & image_flag::depth_attachment_bit) image_info.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if(desc.flags & image_flag::storage_image_bit) image_info.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    // Only images touched by the upload batch are shared with the transfer queue, as concurrent sharing can disable compression of attachments
+    if(!initial_data.empty() || desc.flags & image_flag::storage_image_bit) device->share_with_transfer_queue(image_info);
+    else image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     check("vkCreateImage", vkCreateImage(device->dev, &image_info, nullptr, &image_object));
 
     VkMemoryRequirements mem_reqs;
     vkGetImageMemoryRequirements(device->dev, image_object, &mem_reqs);
-    device_memory = device->allocate(mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    check("vkBindImageMemory", vkBindImageMemory(device->dev, image_object, device_memory, 0));
+    device_memory = device->allocate(mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vk_memory_pool::image);
+    check("vkBindImageMemory", vkBindImageMemory(device->dev, image_object, device_memory.memory, device_memory.offset));
     
+    // Uploads are recorded into the device's current upload batch. The main queue waits on a semaphore signaled by that batch, which makes 
+    // the transfers visible to all later commands, so the final transitions need not name any later stages.
     if(initial_data.size())
     {
         if(initial_data.size() != image_info.arrayLayers) throw std::logic_error("not enough initial_data pointers");
-        for(size_t layer=0; layer<initial_data.size(); ++layer) 
-        {
-            // Write initial data for this layer into the staging area
-            const size_t image_size = get_pixel_size(desc.format) * product(desc.dimensions);
-            if(image_size > device->staging_buffer_size) throw std::runtime_error("staging buffer exhausted");
-            memcpy(device->mapped_staging_memory, initial_data[layer], image_size);
-
-            VkImageSubresourceLayers layers {};
-            layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            layers.baseArrayLayer = exactly(layer);
-            layers.layerCount = 1;
+        const size_t pixel_size = get_pixel_size(desc.format), row_size = pixel_size * desc.dimensions.x, slice_size = row_size * desc.dimensions.y;
+        const size_t max_chunk_size = device->get_max_upload_chunk_size();
+        if(row_size > max_chunk_size) throw std::runtime_error("image rows too large to upload");
 
-            // Copy image contents from staging buffer into mip level zero
-            auto cmd = device->create_command_buffer();
+        // Copy a region of the initial data for a layer, consisting of whole rows, into mip level zero
+        auto upload_region = [&](uint32_t layer, int3 offset, int3 extent)
+        {
+            const size_t size = row_size * extent.y * extent.z;
+            const size_t staging_offset = device->allocate_staging_memory(size, pixel_size*4); // Buffer offsets must be multiples of both four and the texel size
+            memcpy(device->mapped_staging_memory + staging_offset, reinterpret_cast<const char *>(initial_data[layer]) + slice_size*offset.z + row_size*offset.y, size);
 
+            VkBufferImageCopy copy_region {};
+            copy_region.bufferOffset = staging_offset;
+            copy_region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, layer, 1};
+            copy_region.imageOffset = {offset.x, offset.y, offset.z};
+            copy_region.imageExtent = {static_cast<uint32_t>(extent.x), static_cast<uint32_t>(extent.y), static_cast<uint32_t>(extent.z)};
+            vkCmdCopyBufferToImage(device->get_upload_command_buffer(), device->staging_buffer, image_object, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+        };
+
+        for(uint32_t layer=0; layer<image_info.arrayLayers; ++layer) 
+        {
             // Must transition to transfer_dst_optimal before any transfers occur
-            transition_image(static_cast<vk_command_buffer &>(*cmd).cmd, image_object, 0, exactly(layer), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+            transition_image(device->get_upload_command_buffer(), image_object, 0, layer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-            // Copy to the image
-            VkBufferImageCopy copy_region {};
-            copy_region.imageSubresource = layers;
-            copy_region.imageExtent = image_info.extent;
-            vkCmdCopyBufferToImage(static_cast<vk_command_buffer &>(*cmd).cmd, device->staging_buffer, image_object, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+            // Upload groups of whole slices where possible, and otherwise groups of whole rows
+            const int3 & dims = desc.dimensions;
+            if(slice_size <= max_chunk_size)
+            {
+                const int slices_per_chunk = exactly(max_chunk_size / slice_size);
+                for(int z=0; z<dims.z; z += slices_per_chunk) upload_region(layer, {0,0,z}, {dims.x, dims.y, std::min(slices_per_chunk, dims.z-z)});
+            }
+            else 
+            {
+                const int rows_per_chunk = exactly(max_chunk_size / row_size);
+                for(int z=0; z<dims.z; ++z) for(int y=0; y<dims.y; y += rows_per_chunk) upload_region(layer, {0,y,z}, {dims.x, std::min(rows_per_chunk, dims.y-y), 1});
+            }
 
-            // After transfer finishes, transition to shader_read_only_optimal, and complete that before any shaders execute
-            transition_image(static_cast<vk_command_buffer &>(*cmd).cmd, image_object, 0, exactly(layer), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-                VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            // After transfer finishes, transition to shader_read_only_optimal (or general)
+            transition_image(device->get_upload_command_buffer(), image_object, 0, layer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, shader_layout);
+        }
+    }
 
-            device->submit(*cmd);
+    // Storage images may be written by shaders before they are ever uploaded to, so move all remaining subresources into the general layout
+    if(desc.flags & image_flag::storage_image_bit)
+    {
+        for(uint32_t layer=0; layer<image_info.arrayLayers; ++layer)
+        {
+            for(uint32_t mip=initial_data.empty() ? 0 : 1; mip<image_info.mipLevels; ++mip)
+            {
+                transition_image(device->get_upload_command_buffer(), image_object, mip, layer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, 
+                    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_GENERAL);
+            }
         }
     }
 
@@ -698,10 +1186,23 @@ vk_image::vk_image(vk_device * device, const image_desc & desc, std::vector<cons
     view_info.subresourceRange.baseArrayLayer = 0;
     view_info.subresourceRange.layerCount = image_info.arrayLayers;
     check("vkCreateImageView", vkCreateImageView(device->dev, &view_info, nullptr, &image_view));
+
+    // Storage images are bound one mip level at a time
+    if(desc.flags & image_flag::storage_image_bit)
+    {
+        for(uint32_t mip=0; mip<image_info.mipLevels; ++mip)
+        {
+            auto info = view_info;
+            info.subresourceRange.baseMipLevel = mip;
+            info.subresourceRange.levelCount = 1;
+            check("vkCreateImageView", vkCreateImageView(device->dev, &info, nullptr, &mip_views.emplace_back()));
+        }
+    }
 }
 
 vk_image::~vk_image()
 {
+    for(auto view : mip_views) device->destroy(view);
     device->destroy(image_view);
     device->destroy(image_object);
     device->destroy(device_memory);
@@ -785,8 +1286,9 @@ vk_framebuffer::vk_framebuffer(vk_device * device, const framebuffer_desc & desc
         pass_desc.depth_attachment = {dont_care{}, dont_care{}};
     }
     
+    compatible_pass = device->get_render_pass(get_render_pass_desc(pass_desc));
     VkFramebufferCreateInfo framebuffer_info {VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
-    framebuffer_info.renderPass = device->get_render_pass(get_render_pass_desc(pass_desc));
+    framebuffer_info.renderPass = compatible_pass;
     framebuffer_info.attachmentCount = exactly(views.size());
     framebuffer_info.pAttachments = views.data();
     framebuffer_info.width = exactly(desc.dimensions.x);
@@ -858,12 +1360,12 @@ vk_framebuffer::vk_framebuffer(vk_device * device, vk_image & depth_image, const
     framebuffers.resize(views.size());
     color_formats = {device->selection.surface_format.format};
     depth_format = convert_vk(rhi::image_format::depth_float32);
-    auto render_pass = device->get_render_pass(get_render_pass_desc({{{dont_care{}, dont_care{}}}, depth_attachment_desc{dont_care{}, dont_care{}}}));
+    compatible_pass = device->get_render_pass(get_render_pass_desc({{{dont_care{}, dont_care{}}}, depth_attachment_desc{dont_care{}, dont_care{}}}));
     for(size_t i=0; i<views.size(); ++i)
     {
         std::vector<VkImageView> attachments {views[i], depth_image.image_view};
         VkFramebufferCreateInfo framebuffer_info {VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
-        framebuffer_info.renderPass = render_pass;
+        framebuffer_info.renderPass = compatible_pass;
         framebuffer_info.attachmentCount = exactly(attachments.size());
         framebuffer_info.pAttachments = attachments.data();
         framebuffer_info.width = dimensions.x;
@@ -943,19 +1445,15 @@ vk_window::~vk_window()
     device->destroy(image_available);
 }
 
-vk_descriptor_set_layout::vk_descriptor_set_layout(vk_device * device, const std::vector<descriptor_binding> & bindings) : device{device}
+vk_descriptor_set_layout::vk_descriptor_set_layout(vk_device * device, const std::vector<descriptor_binding> & bindings) : device{device}, bindings{bindings}
 { 
     std::vector<VkDescriptorSetLayoutBinding> set_bindings(bindings.size());
     for(size_t i=0; i<bindings.size(); ++i)
     {
         set_bindings[i].binding = bindings[i].index;
-        switch(bindings[i].type)
-        {
-        case descriptor_type::combined_image_sampler: set_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; break;
-        case descriptor_type::uniform_buffer: set_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; break;
-        }
+        set_bindings[i].descriptorType = convert_vk(bindings[i].type);
         set_bindings[i].descriptorCount = bindings[i].count;
-        set_bindings[i].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+        set_bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
     }
         
     VkDescriptorSetLayoutCreateInfo create_info {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
@@ -967,15 +1465,23 @@ vk_descriptor_set_layout::~vk_descriptor_set_layout()
 { 
     device->destroy(layout);
 }
+VkDescriptorType vk_descriptor_set_layout::get_descriptor_type(int binding) const
+{
+    for(auto & b : bindings) if(b.index == binding) return convert_vk(b.type);
+    throw std::logic_error("invalid binding");
+}
 
-vk_pipeline_layout::vk_pipeline_layout(vk_device * device, const std::vector<const descriptor_set_layout *> & sets) : base_pipeline_layout{sets}, device{device}
+vk_pipeline_layout::vk_pipeline_layout(vk_device * device, const std::vector<const descriptor_set_layout *> & sets, size_t push_constant_size) : base_pipeline_layout{sets, push_constant_size}, device{device}
 { 
     std::vector<VkDescriptorSetLayout> set_layouts;
     for(auto s : sets) set_layouts.push_back(static_cast<const vk_descriptor_set_layout *>(s)->layout);
+    const VkPushConstantRange push_constant_range {VK_SHADER_STAGE_ALL, 0, exactly(push_constant_size)};
 
     VkPipelineLayoutCreateInfo create_info {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
     create_info.setLayoutCount = exactly(set_layouts.size());
     create_info.pSetLayouts = set_layouts.data();
+    create_info.pushConstantRangeCount = push_constant_size ? 1 : 0;
+    create_info.pPushConstantRanges = &push_constant_range;
     check("vkCreatePipelineLayout", vkCreatePipelineLayout(device->dev, &create_info, nullptr, &layout));
 }
 vk_pipeline_layout::~vk_pipeline_layout()
@@ -1000,6 +1506,7 @@ vk_pipeline::vk_pipeline(vk_device * device, const pipeline_desc & desc) : base_
 
 VkPipeline vk_pipeline::get_pipeline(VkRenderPass render_pass) const
 {
+    std::lock_guard<std::mutex> lock{mutex};
     auto & pipe = pipeline_objects[render_pass];
     if(pipe) return pipe;
 
@@ -1014,7 +1521,7 @@ VkPipeline vk_pipeline::get_pipeline(VkRenderPass render_pass) const
     std::vector<VkVertexInputAttributeDescription> attributes;
     for(auto & b : desc.input)
     {
-        bindings.push_back({(uint32_t)b.index, (uint32_t)b.stride, VK_VERTEX_INPUT_RATE_VERTEX});
+        bindings.push_back({(uint32_t)b.index, (uint32_t)b.stride, b.rate == input_rate::per_instance ? VK_VERTEX_INPUT_RATE_INSTANCE : VK_VERTEX_INPUT_RATE_VERTEX});
         for(auto & a : b.attributes) attributes.push_back({(uint32_t)a.index, (uint32_t)b.index, convert_vk(a.type), (uint32_t)a.offset});
     }
     const VkPipelineVertexInputStateCreateInfo vertex_input_state {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO, nullptr, 0, exactly(bindings.size()), bindings.data(), exactly(attributes.size()), attributes.data()};
@@ -1081,7 +1588,7 @@ VkPipeline vk_pipeline::get_pipeline(VkRenderPass render_pass) const
         render_pass, 0,
         VK_NULL_HANDLE, -1
     };
-    check("vkCreateGraphicsPipelines", vkCreateGraphicsPipelines(device->dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipe));
+    check("vkCreateGraphicsPipelines", vkCreateGraphicsPipelines(device->dev, device->pipeline_cache, 1, &pipelineInfo, nullptr, &pipe));
     return pipe;
 }
 vk_pipeline::~vk_pipeline()
@@ -1089,27 +1596,149 @@ vk_pipeline::~vk_pipeline()
     for(auto & pass_to_pipe : pipeline_objects) device->destroy(pass_to_pipe.second);
 }
 
+vk_compute_pipeline::vk_compute_pipeline(vk_device * device, const compute_pipeline_desc & desc) : base_pipeline{*desc.layout}, device{device}
+{
+    auto & shader = static_cast<const vk_shader &>(*desc.stage);
+    const VkComputePipelineCreateInfo pipeline_info 
+    {
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, nullptr, 0,
+        {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, shader.stage, shader.module, "main"},
+        static_cast<const vk_pipeline_layout &>(*desc.layout).layout,
+        VK_NULL_HANDLE, -1
+    };
+    check("vkCreateComputePipelines", vkCreateComputePipelines(device->dev, device->pipeline_cache, 1, &pipeline_info, nullptr, &pipeline_object));
+}
+vk_compute_pipeline::~vk_compute_pipeline()
+{
+    device->destroy(pipeline_object);
+}
+
 void vk_descriptor_set::write(int binding, buffer_range range) 
 {
     VkDescriptorBufferInfo buffer_info { static_cast<vk_buffer &>(range.buffer).buffer_object, range.offset, range.size };
-    VkWriteDescriptorSet write { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, set, exactly(binding), 0, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, nullptr, &buffer_info, nullptr};
+    VkWriteDescriptorSet write { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, set, exactly(binding), 0, 1, layout->get_descriptor_type(binding), nullptr, &buffer_info, nullptr};
     vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
 }
 void vk_descriptor_set::write(int binding, sampler & sampler, image & image) 
 {
-    VkDescriptorImageInfo image_info {static_cast<vk_sampler &>(sampler).sampler, static_cast<vk_image &>(image).image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    auto & im = static_cast<vk_image &>(image);
+    VkDescriptorImageInfo image_info {static_cast<vk_sampler &>(sampler).sampler, im.image_view, im.shader_layout};
     VkWriteDescriptorSet write { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, set, exactly(binding), 0, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &image_info, nullptr, nullptr};
     vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
 }
+void vk_descriptor_set::write(int binding, image & image, int mip) 
+{
+    auto & im = static_cast<vk_image &>(image);
+    if(im.mip_views.empty()) throw std::logic_error("image was not created with rhi::storage_image_bit");
+    if(mip < 0 || mip >= exactly(im.mip_views.size())) throw std::logic_error("storage image binding mip level out of range");
+    VkDescriptorImageInfo image_info {VK_NULL_HANDLE, im.mip_views[mip], VK_IMAGE_LAYOUT_GENERAL};
+    VkWriteDescriptorSet write { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, set, exactly(binding), 0, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &image_info, nullptr, nullptr};
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
 
-vk_descriptor_pool::vk_descriptor_pool(vk_device * device) : device{device}, sets{1024}, used_sets{0}
+vk_resource_table::version::version(vk_device * owner, const vk_descriptor_set_layout & layout, std::shared_ptr<spare_list> spares) : owner{owner}, spares{spares}
+{
+    this->device = owner->dev;
+    this->layout = &layout;
+    {
+        std::lock_guard<std::mutex> lock{spares->mutex};
+        auto it = std::find_if(begin(spares->spares), end(spares->spares), [owner](const spare & s) { return s.reusable_after_index <= owner->completed_index; });
+        if(it != end(spares->spares))
+        {
+            pool = it->pool;
+            set = it->set;
+            elements = std::move(it->elements);
+            spares->spares.erase(it);
+            return;
+        }
+    }
+
+    elements.resize(layout.bindings[0].count);
+    const VkDescriptorPoolSize pool_size {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, exactly(layout.bindings[0].count)};
+    VkDescriptorPoolCreateInfo descriptor_pool_info {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    descriptor_pool_info.poolSizeCount = 1;
+    descriptor_pool_info.pPoolSizes = &pool_size;
+    descriptor_pool_info.maxSets = 1;
+    check("vkCreateDescriptorPool", vkCreateDescriptorPool(owner->dev, &descriptor_pool_info, nullptr, &pool));
+
+    VkDescriptorSetAllocateInfo alloc_info {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    alloc_info.descriptorPool = pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &layout.layout;
+    check("vkAllocateDescriptorSets", vkAllocateDescriptorSets(owner->dev, &alloc_info, &set));
+}
+vk_resource_table::version::~version()
+{
+    // Work already submitted may still read this version, so it only becomes reusable once the work submitted so far has completed
+    std::lock_guard<std::mutex> lock{spares->mutex};
+    if(spares->is_open && spares->spares.size() < max_spares) spares->spares.push_back({pool, set, std::move(elements), owner->submitted_index + (owner->upload_cmd ? 1 : 0)});
+    else owner->destroy(pool);
+}
+
+vk_resource_table::vk_resource_table(vk_device * device, int capacity) : device{device}, spares{std::make_shared<spare_list>()}
+{
+    if(capacity < 1 || capacity > device->max_resource_table_images) throw std::logic_error("resource table capacity out of range");
+    layout = new delete_when_unreferenced<vk_descriptor_set_layout>{device, std::vector<descriptor_binding>{{0, descriptor_type::combined_image_sampler, capacity}}};
+    current = new delete_when_unreferenced<version>{device, *layout, spares};
+
+    // Every element of an array which shaders use must hold a valid descriptor, so elements which have not been written refer to a placeholder image
+    const uint8_t black[4] {0,0,0,0};
+    auto placeholder_sampler = device->create_sampler({filter::nearest, filter::nearest, std::nullopt, address_mode::clamp_to_edge, address_mode::clamp_to_edge, address_mode::clamp_to_edge});
+    auto placeholder_image = device->create_image({image_shape::_2d, {1,1,1}, 1, image_format::rgba_unorm8, sampled_image_bit}, {black});
+    auto & im = static_cast<vk_image &>(*placeholder_image);
+    const std::vector<VkDescriptorImageInfo> image_infos(capacity, {static_cast<vk_sampler &>(*placeholder_sampler).sampler, im.image_view, im.shader_layout});
+    const VkWriteDescriptorSet write {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, current->set, 0, 0, exactly(capacity), VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, image_infos.data(), nullptr, nullptr};
+    vkUpdateDescriptorSets(device->dev, 1, &write, 0, nullptr);
+    for(auto & e : current->elements) e = {placeholder_sampler, placeholder_image};
+}
+vk_resource_table::~vk_resource_table()
+{
+    // Spares hold references to images, so release them along with the table, and have any versions which outlive it destroy their own pools
+    std::lock_guard<std::mutex> lock{spares->mutex};
+    for(auto & s : spares->spares) device->destroy(s.pool);
+    spares->spares.clear();
+    spares->is_open = false;
+}
+
+void vk_resource_table::write(int index, sampler & sampler, image & image)
+{
+    if(index < 0 || index >= get_capacity()) throw std::logic_error("resource table index out of range");
+    if(is_current_bound)
+    {
+        // Commands already recorded may still read the current set, so continue in a copy of it. A recycled version already holds the contents it had when
+        // it was retired, so only the runs of elements which have changed since then are copied.
+        ptr<version> next = new delete_when_unreferenced<version>{device, *layout, spares};
+        std::vector<VkCopyDescriptorSet> copies;
+        const auto differs = [&](int i) { return next->elements[i].sampler != current->elements[i].sampler || next->elements[i].image != current->elements[i].image; };
+        for(int i=0, n=get_capacity(); i<n; )
+        {
+            if(!differs(i)) { ++i; continue; }
+            int end = i+1;
+            while(end < n && differs(end)) ++end;
+            copies.push_back({VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET, nullptr, current->set, 0, exactly(i), next->set, 0, exactly(i), exactly(end-i)});
+            i = end;
+        }
+        if(!copies.empty()) vkUpdateDescriptorSets(device->dev, 0, nullptr, exactly(copies.size()), copies.data());
+        next->elements = current->elements;
+        current = next;
+        is_current_bound = false;
+    }
+    auto & im = static_cast<vk_image &>(image);
+    const VkDescriptorImageInfo image_info {static_cast<vk_sampler &>(sampler).sampler, im.image_view, im.shader_layout};
+    const VkWriteDescriptorSet write {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, current->set, 0, exactly(index), 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &image_info, nullptr, nullptr};
+    vkUpdateDescriptorSets(device->dev, 1, &write, 0, nullptr);
+    current->elements[index] = {&sampler, &image};
+}
+
+constexpr uint32_t descriptors_per_pool = 1024;
+vk_descriptor_pool::vk_descriptor_pool(vk_device * device) : device{device}, sets{descriptors_per_pool}, used_sets{0}, used_descriptors{}
 { 
-    const VkDescriptorPoolSize pool_sizes[] {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,1024}, {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,1024}};
+    VkDescriptorPoolSize pool_sizes[std::tuple_size_v<decltype(used_descriptors)>];
+    for(size_t i=0; i<countof(pool_sizes); ++i) pool_sizes[i] = {convert_vk(static_cast<descriptor_type>(i)), descriptors_per_pool};
     VkDescriptorPoolCreateInfo descriptor_pool_info {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
-    descriptor_pool_info.poolSizeCount = 2;
+    descriptor_pool_info.poolSizeCount = exactly(countof(pool_sizes));
     descriptor_pool_info.pPoolSizes = pool_sizes;
-    descriptor_pool_info.maxSets = 1024;
-    descriptor_pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptor_pool_info.maxSets = descriptors_per_pool;
     check("vkCreateDescriptorPool", vkCreateDescriptorPool(device->dev, &descriptor_pool_info, nullptr, &pool));
     for(auto & set : sets) set.device = device->dev;
 }
@@ -1123,19 +1752,29 @@ void vk_descriptor_pool::reset()
     for(size_t i=0; i<used_sets; ++i)
     {
         if(sets[i].ref_count != 0) throw std::logic_error("rhi::descriptor_pool::reset called with descriptor sets outstanding");
-        vkFreeDescriptorSets(device->dev, pool, 1, &sets[i].set);
+        sets[i].layout = nullptr;
     }
+    // Individual sets are never freed, resetting the pool returns all of them at once
     vkResetDescriptorPool(device->dev, pool, 0);
     used_sets = 0;
+    used_descriptors = {};
 }
 ptr<descriptor_set> vk_descriptor_pool::alloc(const descriptor_set_layout & layout) 
 { 
-    if(used_sets == sets.size()) throw std::logic_error("out of descriptor sets");
+    std::lock_guard<std::mutex> lock{mutex};
+    auto & set_layout = static_cast<const vk_descriptor_set_layout &>(layout);
+    auto needed_descriptors = used_descriptors;
+    for(auto & b : set_layout.bindings) needed_descriptors[static_cast<size_t>(b.type)] += b.count;
+    if(used_sets == sets.size()) return nullptr;
+    for(auto n : needed_descriptors) if(n > descriptors_per_pool) return nullptr;
+
     VkDescriptorSetAllocateInfo alloc_info {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
     alloc_info.descriptorPool = pool;
     alloc_info.descriptorSetCount = 1;
-    alloc_info.pSetLayouts = &static_cast<const vk_descriptor_set_layout &>(layout).layout;
+    alloc_info.pSetLayouts = &set_layout.layout;
     check("vkAllocateDescriptorSets", vkAllocateDescriptorSets(device->dev, &alloc_info, &sets[used_sets].set));
+    sets[used_sets].layout = &set_layout;
+    used_descriptors = needed_descriptors;
     return &sets[used_sets++];
 }
 
@@ -1143,32 +1782,147 @@ ptr<descriptor_set> vk_descriptor_pool::alloc(const descriptor_set_layout & layo
 // vk_device rendering //
 //////////////////////////
 
-ptr<command_buffer> vk_device::create_command_buffer()
+vk_command_pool & vk_device::get_command_pool()
+{
+    std::lock_guard<std::mutex> lock{command_pools_mutex};
+    auto & pool = command_pools[std::this_thread::get_id()];
+    if(!pool)
+    {
+        pool = std::make_unique<vk_command_pool>();
+        VkCommandPoolCreateInfo command_pool_info {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+        command_pool_info.queueFamilyIndex = selection.queue_family;
+        command_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        check("vkCreateCommandPool", vkCreateCommandPool(dev, &command_pool_info, nullptr, &pool->pool));
+    }
+    return *pool;
+}
+
+ptr<vk_command_buffer> vk_device::begin_command_buffer(const vk_framebuffer * secondary_framebuffer, bool reusable)
 {
     ptr<vk_command_buffer> cmd {new delete_when_unreferenced<vk_command_buffer>{}};
     cmd->device = this;
+    cmd->pool = &get_command_pool();
+
+    // No other thread records from our pool, so this is our chance to free the command buffers which have been retired from it
+    std::vector<VkCommandBuffer> retired;
+    {
+        std::lock_guard<std::mutex> lock{cmd->pool->mutex};
+        swap(retired, cmd->pool->retired);
+    }
+    if(!retired.empty()) vkFreeCommandBuffers(dev, cmd->pool->pool, exactly(retired.size()), retired.data());
     
     VkCommandBufferAllocateInfo alloc_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandPool = staging_pool;
+    alloc_info.level = secondary_framebuffer ? VK_COMMAND_BUFFER_LEVEL_SECONDARY : VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = cmd->pool->pool;
     alloc_info.commandBufferCount = 1;
     check("vkAllocateCommandBuffers", vkAllocateCommandBuffers(dev, &alloc_info, &cmd->cmd));
 
+    VkCommandBufferInheritanceInfo inheritance_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
     VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    // Reusable command buffers may still be pending from a previous submission when they are submitted again
+    begin_info.flags = reusable ? VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if(secondary_framebuffer)
+    {
+        // Secondary command buffers may be executed within any render pass compatible with their framebuffer
+        inheritance_info.renderPass = secondary_framebuffer->compatible_pass;
+        begin_info.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        begin_info.pInheritanceInfo = &inheritance_info;
+    }
     check("vkBeginCommandBuffer", vkBeginCommandBuffer(cmd->cmd, &begin_info));
     cmd->current_pass = nullptr;
+    cmd->current_framebuffer = nullptr;
+    cmd->is_secondary = secondary_framebuffer != nullptr;
+    cmd->is_ended = false;
+    cmd->is_reusable = reusable;
+
+    cmd->query_pool = VK_NULL_HANDLE;
+
+    if(secondary_framebuffer)
+    {
+        // Dynamic state is not inherited from the primary command buffer, so start from the same state as a newly begun render pass
+        cmd->record_reference(*secondary_framebuffer);
+        cmd->current_pass = secondary_framebuffer->compatible_pass;
+        cmd->current_framebuffer = secondary_framebuffer;
+        cmd->set_viewport_rect(0, 0, secondary_framebuffer->dims.x, secondary_framebuffer->dims.y);
+        cmd->set_scissor_rect(0, 0, secondary_framebuffer->dims.x, secondary_framebuffer->dims.y);
+        cmd->set_stencil_ref(0);
+    }
     return cmd;
 }
 
+ptr<command_buffer> vk_device::create_command_buffer(bool reusable) { return begin_command_buffer(nullptr, reusable); }
+ptr<command_buffer> vk_device::create_secondary_command_buffer(const framebuffer & framebuffer, bool reusable) { return begin_command_buffer(&static_cast<const vk_framebuffer &>(framebuffer), reusable); }
+
+VkQueryPool vk_device::acquire_query_pool()
+{
+    std::lock_guard<std::mutex> lock{query_pools_mutex};
+    if(free_query_pools.empty())
+    {
+        VkQueryPoolCreateInfo query_pool_info {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_info.queryCount = timestamp_queries_per_pool;
+        VkQueryPool pool;
+        check("vkCreateQueryPool", vkCreateQueryPool(dev, &query_pool_info, nullptr, &pool));
+        query_pools.push_back(pool);
+        return pool;
+    }
+    auto pool = free_query_pools.back();
+    free_query_pools.pop_back();
+    return pool;
+}
+
+void vk_device::retire(const vk_command_buffer & cmd)
+{
+    if(cmd.query_pool)
+    {
+        // Once the submission has completed, read back the timestamps written by its timers
+        schedule(submitted_index, [submission_id=submitted_index, pool=cmd.query_pool, timers=cmd.timers](vk_device & dev)
+        {
+            std::vector<uint64_t> timestamps(timers.size()*2);
+            if(!timers.empty()) check("vkGetQueryPoolResults", vkGetQueryPoolResults(dev.dev, pool, 0, exactly(timestamps.size()), timestamps.size()*sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+            const uint64_t mask = dev.selection.timestamp_valid_bits < 64 ? (uint64_t(1) << dev.selection.timestamp_valid_bits) - 1 : ~uint64_t(0);
+            for(auto & timer : timers) dev.timer_results.push_back({timer.name, submission_id, ((timestamps[timer.end_query] - timestamps[timer.begin_query]) & mask) * dev.device_props.limits.timestampPeriod / 1e6});
+            std::lock_guard<std::mutex> lock{dev.query_pools_mutex};
+            dev.free_query_pools.push_back(pool);
+        });
+    }
+    // Reusable command buffers, and any secondaries they execute, are only freed once they are destroyed
+    if(cmd.is_reusable) return;
+    schedule(submitted_index, [pool=cmd.pool, cmd=cmd.cmd](vk_device &) 
+    { 
+        std::lock_guard<std::mutex> lock{pool->mutex}; 
+        pool->retired.push_back(cmd); 
+    });
+    for(auto & secondary : cmd.secondaries) if(!secondary->is_reusable) retire(*secondary);
+}
+
+vk_command_buffer::~vk_command_buffer()
+{
+    if(!is_reusable) return;
+    device->schedule(device->submitted_index, [pool=pool, cmd=cmd](vk_device &) 
+    { 
+        std::lock_guard<std::mutex> lock{pool->mutex}; 
+        pool->retired.push_back(cmd); 
+    });
+}
+
 void vk_command_buffer::record_reference(const object & object)
 {
     auto it = referenced_objects.find(&object);
     if(it == referenced_objects.end()) referenced_objects.insert(&object);
 }
 
+void vk_command_buffer::end()
+{
+    if(is_ended)
+    {
+        if(!is_reusable) throw std::logic_error("command buffer submitted more than once, but was not created as reusable");
+        return;
+    }
+    check("vkEndCommandBuffer", vkEndCommandBuffer(cmd));
+    is_ended = true;
+}
+
 void vk_command_buffer::generate_mipmaps(image & image)
 {
     record_reference(image);
@@ -1181,7 +1935,7 @@ void vk_command_buffer::generate_mipmaps(image & image)
         layers.layerCount = 1;
         VkOffset3D dims {exactly(im.image_info.extent.width), exactly(im.image_info.extent.height), exactly(im.image_info.extent.depth)};
         
-        transition_image(cmd, im.image_object, 0, exactly(layer), VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        transition_image(cmd, im.image_object, 0, exactly(layer), VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, im.shader_layout,
             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
         for(uint32_t i=1; i<im.image_info.mipLevels; ++i)
@@ -1207,13 +1961,14 @@ void vk_command_buffer::generate_mipmaps(image & image)
         for(uint32_t i=1; i<im.image_info.mipLevels; ++i)
         {
             transition_image(cmd, im.image_object, i, exactly(layer), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+                VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, im.shader_layout);
         }
     }
 }
 
 void vk_command_buffer::begin_render_pass(const render_pass_desc & pass_desc, framebuffer & framebuffer)
 {
+    if(is_secondary) throw std::logic_error("begin_render_pass called on a secondary command buffer");
     record_reference(framebuffer);
     auto & fb = static_cast<vk_framebuffer &>(framebuffer);
     std::vector<VkClearValue> clear_values;
@@ -1234,6 +1989,8 @@ void vk_command_buffer::begin_render_pass(const render_pass_desc & pass_desc, fr
         }
     }
 
+    // The swapchain image is chosen as the render pass is recorded, so a reusable command buffer would keep drawing to the same image on every submission
+    if(is_reusable && fb.swapchain) throw std::logic_error("reusable command buffers cannot begin render passes on a window's framebuffer");
     current_framebuffer = &fb;
     current_pass = device->get_render_pass(fb.get_render_pass_desc(pass_desc));
 
@@ -1243,11 +2000,14 @@ void vk_command_buffer::begin_render_pass(const render_pass_desc & pass_desc, fr
     pass_begin_info.renderArea = {{0,0},{exactly(fb.dims.x),exactly(fb.dims.y)}};
     pass_begin_info.clearValueCount = exactly(countof(clear_values));
     pass_begin_info.pClearValues = clear_values.data();
-    vkCmdBeginRenderPass(cmd, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-
-    set_viewport_rect(0, 0, fb.dims.x, fb.dims.y);
-    set_scissor_rect(0, 0, fb.dims.x, fb.dims.y);
-    set_stencil_ref(0);
+    if(pass_desc.secondary_command_buffers) vkCmdBeginRenderPass(cmd, &pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    else
+    {
+        vkCmdBeginRenderPass(cmd, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+        set_viewport_rect(0, 0, fb.dims.x, fb.dims.y);
+        set_scissor_rect(0, 0, fb.dims.x, fb.dims.y);
+        set_stencil_ref(0);
+    }
 }
 
 void vk_command_buffer::clear_depth(float depth)
@@ -1286,14 +2046,21 @@ void vk_command_buffer::set_stencil_ref(uint8_t stencil)
 void vk_command_buffer::bind_pipeline(const pipeline & pipe)
 {
     record_reference(pipe);
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, static_cast<const vk_pipeline &>(pipe).get_pipeline(current_pass));
+    if(current_pass) vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, static_cast<const vk_pipeline &>(pipe).get_pipeline(current_framebuffer->compatible_pass));
+    else vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, static_cast<const vk_compute_pipeline &>(pipe).pipeline_object);
 }
 
-void vk_command_buffer::bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set)
+void vk_command_buffer::bind_descriptor_set(const pipeline_layout & layout, int set_index, const descriptor_set & set, array_view<uint32_t> dynamic_offsets)
 {
     record_reference(layout);
     record_reference(set);
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, static_cast<const vk_pipeline_layout &>(layout).layout, set_index, 1, &static_cast<const vk_descriptor_set &>(set).set, 0, nullptr);
+    vkCmdBindDescriptorSets(cmd, get_bind_point(), static_cast<const vk_pipeline_layout &>(layout).layout, set_index, 1, &static_cast<const vk_descriptor_set &>(set).set, exactly(dynamic_offsets.size()), dynamic_offsets.data());
+}
+
+void vk_command_buffer::push_constants(const pipeline_layout & layout, size_t offset, size_t size, const void * data)
+{
+    record_reference(layout);
+    vkCmdPushConstants(cmd, static_cast<const vk_pipeline_layout &>(layout).layout, VK_SHADER_STAGE_ALL, exactly(offset), exactly(size), data);
 }
 
 void vk_command_buffer::bind_vertex_buffer(int index, buffer_range range)
@@ -1309,28 +2076,117 @@ void vk_command_buffer::bind_index_buffer(buffer_range range)
     vkCmdBindIndexBuffer(cmd, static_cast<vk_buffer &>(range.buffer).buffer_object, range.offset, VK_INDEX_TYPE_UINT32);
 }
 
-void vk_command_buffer::draw(int first_vertex, int vertex_count)
+void vk_command_buffer::draw(int first_vertex, int vertex_count, int first_instance, int instance_count)
 {
-    vkCmdDraw(cmd, vertex_count, 1, first_vertex, 0);
+    vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
 }
 
-void vk_command_buffer::draw_indexed(int first_index, int index_count)
+void vk_command_buffer::draw_indexed(int first_index, int index_count, int first_instance, int instance_count, int vertex_offset)
 {
-    vkCmdDrawIndexed(cmd, index_count, 1, first_index, 0, 0);
+    vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
+}
+
+void vk_command_buffer::draw_indirect(buffer_range args, int draw_count, size_t stride)
+{
+    validate_indirect_args(args, draw_count, stride, sizeof(draw_indirect_args));
+    record_reference(args.buffer);
+    const VkBuffer buffer = static_cast<vk_buffer &>(args.buffer).buffer_object;
+    if(device->enabled_features.multiDrawIndirect) vkCmdDrawIndirect(cmd, buffer, args.offset, draw_count, exactly(stride));
+    else for(int i=0; i<draw_count; ++i) vkCmdDrawIndirect(cmd, buffer, args.offset + i*stride, 1, exactly(stride));
+}
+
+void vk_command_buffer::draw_indexed_indirect(buffer_range args, int draw_count, size_t stride)
+{
+    validate_indirect_args(args, draw_count, stride, sizeof(draw_indexed_indirect_args));
+    record_reference(args.buffer);
+    const VkBuffer buffer = static_cast<vk_buffer &>(args.buffer).buffer_object;
+    if(device->enabled_features.multiDrawIndirect) vkCmdDrawIndexedIndirect(cmd, buffer, args.offset, draw_count, exactly(stride));
+    else for(int i=0; i<draw_count; ++i) vkCmdDrawIndexedIndirect(cmd, buffer, args.offset + i*stride, 1, exactly(stride));
+}
+
+void vk_command_buffer::execute_commands(command_buffer & secondary)
+{
+    auto & s = static_cast<vk_command_buffer &>(secondary);
+    if(!s.is_secondary) throw std::logic_error("execute_commands requires a secondary command buffer");
+    if(is_reusable && !s.is_reusable) throw std::logic_error("reusable command buffers may only execute reusable secondary command buffers");
+    s.end();
+    vkCmdExecuteCommands(cmd, 1, &s.cmd);
+    secondaries.push_back(&s);
 }
 
 void vk_command_buffer::end_render_pass()
 {
+    if(is_secondary) throw std::logic_error("end_render_pass called on a secondary command buffer");
     vkCmdEndRenderPass(cmd);
     current_pass = 0;
 }
 
-uint64_t vk_device::submit(const VkSubmitInfo & submit_info)
+void vk_command_buffer::begin_timer(std::string_view name)
+{
+    if(is_secondary) throw std::logic_error("begin_timer called on a secondary command buffer");
+    if(is_reusable) throw std::logic_error("begin_timer called on a reusable command buffer");
+    if(timers.size() == vk_device::timestamp_queries_per_pool/2) throw std::logic_error("too many timers in one command buffer");
+    if(timers.empty())
+    {
+        // Query pools can only be reset outside of a render pass, so command buffers which never begin a timer need not acquire one
+        if(current_pass) throw std::logic_error("the first timer of a command buffer must be begun outside of a render pass");
+        if(device->selection.timestamp_valid_bits)
+        {
+            query_pool = device->acquire_query_pool();
+            vkCmdResetQueryPool(cmd, query_pool, 0, vk_device::timestamp_queries_per_pool);
+        }
+    }
+    const uint32_t query = exactly(timers.size()*2);
+    timers.push_back({std::string{name}, query, query+1});
+    open_timers.push_back(timers.size()-1);
+    if(query_pool) vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, query);
+}
+
+void vk_command_buffer::end_timer()
+{
+    if(open_timers.empty()) throw std::logic_error("end_timer called with no timer begun");
+    if(query_pool) vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, timers[open_timers.back()].end_query);
+    open_timers.pop_back();
+}
+
+void vk_command_buffer::dispatch(int group_count_x, int group_count_y, int group_count_z)
+{
+    vkCmdDispatch(cmd, group_count_x, group_count_y, group_count_z);
+}
+
+void vk_command_buffer::memory_barrier()
+{
+    const VkMemoryBarrier barrier {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_SHADER_WRITE_BIT, 
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT|VK_ACCESS_INDEX_READ_BIT|VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT|VK_ACCESS_UNIFORM_READ_BIT|VK_ACCESS_SHADER_READ_BIT|VK_ACCESS_SHADER_WRITE_BIT|VK_ACCESS_TRANSFER_READ_BIT};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT|VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT|VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+uint64_t vk_device::submit(VkQueue queue, const VkSubmitInfo & submit_info)
 {
     if(completed_index + fence_ring_size == submitted_index) wait_until_complete(submitted_index - fence_ring_mask);
     check("vkQueueSubmit", vkQueueSubmit(queue, 1, &submit_info, ring_fences[submitted_index & fence_ring_mask]));
-    ++submitted_index;
-    for(uint32_t i=0; i<submit_info.commandBufferCount; ++i) scheduled_actions.push({submitted_index, [cmd=submit_info.pCommandBuffers[i]](vk_device & dev) { vkFreeCommandBuffers(dev.dev, dev.staging_pool, 1, &cmd); }});
+    return ++submitted_index;
+}
+
+uint64_t vk_device::submit_after_uploads(VkSubmitInfo submit_info)
+{
+    // Submit any outstanding uploads, and wait for every upload batch submitted since the last time we were called
+    flush_uploads();
+    std::vector<VkSemaphore> wait_semaphores {submit_info.pWaitSemaphores, submit_info.pWaitSemaphores + submit_info.waitSemaphoreCount};
+    std::vector<VkPipelineStageFlags> wait_stages {submit_info.pWaitDstStageMask, submit_info.pWaitDstStageMask + submit_info.waitSemaphoreCount};
+    for(auto semaphore : pending_upload_semaphores)
+    {
+        wait_semaphores.push_back(semaphore);
+        wait_stages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    }
+    submit_info.waitSemaphoreCount = exactly(wait_semaphores.size());
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
+    submit(queue, submit_info);
+
+    // Semaphores may be signaled again once the waits on them have completed
+    for(auto semaphore : pending_upload_semaphores) schedule(submitted_index, [semaphore](vk_device & dev) { dev.free_upload_semaphores.push_back(semaphore); });
+    pending_upload_semaphores.clear();
     return submitted_index;
 }
 
@@ -1343,26 +2199,45 @@ void vk_device::wait_until_complete(uint64_t submission_index)
         ++completed_index;
     }
 
-    while(!scheduled_actions.empty() && completed_index >= scheduled_actions.front().after_completion_index)
+    while(!staging_ring_batches.empty() && completed_index >= staging_ring_batches.front().first)
+    {
+        staging_ring_used -= staging_ring_batches.front().second;
+        staging_ring_batches.pop();
+    }
+
+    while(true)
     {
-        scheduled_actions.front().execute(*this);
-        scheduled_actions.pop();
+        std::function<void(vk_device &)> execute;
+        {
+            std::lock_guard<std::mutex> lock{scheduled_actions_mutex};
+            if(scheduled_actions.empty() || completed_index < scheduled_actions.front().after_completion_index) break;
+            execute = std::move(scheduled_actions.front().execute);
+            scheduled_actions.pop();
+        }
+        execute(*this);
     }
 }
 
 uint64_t vk_device::submit(command_buffer & cmd)
 {
-    check("vkEndCommandBuffer", vkEndCommandBuffer(static_cast<vk_command_buffer &>(cmd).cmd));
+    auto & c = static_cast<vk_command_buffer &>(cmd);
+    if(c.is_secondary) throw std::logic_error("secondary command buffers cannot be submitted directly");
+    if(!c.open_timers.empty()) throw std::logic_error("command buffer submitted with timers still open");
+    c.end();
     VkSubmitInfo submit_info {VK_STRUCTURE_TYPE_SUBMIT_INFO};
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &static_cast<vk_command_buffer &>(cmd).cmd;
-    submit(submit_info);
+    submit_info.pCommandBuffers = &c.cmd;
+    submit_after_uploads(submit_info);
+    retire(c);
     return submitted_index;
 }
 
 uint64_t vk_device::acquire_and_submit_and_present(command_buffer & cmd, window & window)
 {
-    check("vkEndCommandBuffer", vkEndCommandBuffer(static_cast<vk_command_buffer &>(cmd).cmd)); 
+    auto & c = static_cast<vk_command_buffer &>(cmd);
+    if(c.is_secondary) throw std::logic_error("secondary command buffers cannot be submitted directly");
+    if(!c.open_timers.empty()) throw std::logic_error("command buffer submitted with timers still open");
+    c.end();
 
     auto & win = static_cast<vk_window &>(window);
 
@@ -1372,10 +2247,11 @@ uint64_t vk_device::acquire_and_submit_and_present(command_buffer & cmd, window
     submit_info.pWaitSemaphores = &win.image_available;
     submit_info.pWaitDstStageMask = wait_stages;
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &static_cast<vk_command_buffer &>(cmd).cmd;
+    submit_info.pCommandBuffers = &c.cmd;
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores = &win.render_finished;
-    submit(submit_info);
+    submit_after_uploads(submit_info);
+    retire(c);
 
     VkPresentInfoKHR present_info {VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
     present_info.waitSemaphoreCount = 1;
@@ -43,6 +43,7 @@ struct shader_module
     struct type { std::variant<sampler, numeric, array, structure> contents; };
     struct interface { uint32_t location; std::string name; type type; };
     struct descriptor { uint32_t set, binding; std::string name; type type; };
+    struct push_constant_block { std::string name; type type; };
 
     std::vector<uint32_t> spirv;
     // Note: For now, only one entry point supported
@@ -50,6 +51,7 @@ struct shader_module
     std::string name;
     std::vector<descriptor> descriptors;
     std::vector<interface> inputs, outputs;
+    std::optional<push_constant_block> push_constants; // At most one push constant block per entry point
 };
 
 std::ostream & operator << (std::ostream & out, const shader_module::type & t);
@@ -258,13 +260,18 @@ shader_module load_shader_info_from_spirv(const std::vector<uint32_t> & words)
     }
     info.name = entrypoint.name;
 
-    // Harvest descriptors
+    // Harvest descriptors and push constants
     for(auto & v : mod.variables)
     {
         auto & meta = mod.metadatas[v.first];
         auto set = meta.get_decoration(spv::DecorationDescriptorSet);
         auto binding = meta.get_decoration(spv::DecorationBinding);
         if(set && binding) info.descriptors.push_back({*set, *binding, meta.name, mod.get_pointee_type(v.second.type)});
+        if(v.second.storage_class == spv::StorageClass::StorageClassPushConstant)
+        {
+            if(info.push_constants) throw std::runtime_error("SPIR-V module should have at most one push constant block");
+            info.push_constants = shader_module::push_constant_block{meta.name, mod.get_pointee_type(v.second.type)};
+        }
 
         if(auto loc = meta.get_decoration(spv::DecorationLocation))
         {
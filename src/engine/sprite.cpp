@@ -219,9 +219,8 @@ canvas_device_objects::canvas_device_objects(rhi::device & device, shader_compil
 
     sprites = device.create_image({rhi::image_shape::_2d, {pixels.dims(),1}, 1, rhi::image_format::rgba_srgb8, rhi::sampled_image_bit}, {pixels.data()});
     sampler = device.create_sampler({rhi::filter::linear, rhi::filter::linear, std::nullopt, rhi::address_mode::clamp_to_edge, rhi::address_mode::repeat});
-    per_window_layout = device.create_descriptor_set_layout({{0, rhi::descriptor_type::uniform_buffer, 1}});
     per_texture_layout = device.create_descriptor_set_layout({{0, rhi::descriptor_type::combined_image_sampler, 1}});
-    pipe_layout = device.create_pipeline_layout({per_window_layout, per_texture_layout});
+    pipe_layout = device.create_pipeline_layout({per_texture_layout}, sizeof(float4x4)); // Per-window transform is supplied via push constants
     const auto vs = device.create_shader(compiler.compile_file(rhi::shader_stage::vertex, "standard/gui/ui.vert"));
     const auto fs = device.create_shader(compiler.compile_file(rhi::shader_stage::fragment, "standard/gui/ui.frag")); 
     const rhi::blend_state translucent {true, true, {rhi::blend_factor::source_alpha, rhi::blend_op::add, rhi::blend_factor::one_minus_source_alpha}, {rhi::blend_factor::source_alpha, rhi::blend_op::add, rhi::blend_factor::one_minus_source_alpha}};
@@ -255,7 +254,7 @@ void canvas::set_target(int layer, rect<int> scissor, rhi::image * texture)
     auto & set = sets[texture];
     if(!set)
     {
-        set = pool.descriptors->alloc(*device_objects.per_texture_layout);
+        set = pool.descriptors.alloc(*device_objects.per_texture_layout);
         set->write(0, *device_objects.sampler, texture ? *texture : *device_objects.sprites);
     }
     if(!lists.empty() && lists.back().index_count == 0) lists.pop_back();
@@ -421,18 +420,15 @@ void canvas::encode_commands(rhi::command_buffer & cmd, gfx::window & win)
     const auto ortho = float4x4{{2.0f/dims.x,0,0,0}, {0,2.0f/dims.y,0,0}, {0,0,1,0}, {-1,-1,0,1}};
     const auto transform = mul(get_transform_matrix(coord_transform{ui_coords, ndc_coords}), ortho);
 
-    auto per_window_set = pool.descriptors->alloc(*device_objects.per_window_layout);
-    per_window_set->write(0, pool.uniforms.upload(transform));
-
     cmd.set_viewport_rect(0, 0, dims.x, dims.y);
     cmd.bind_pipeline(*device_objects.pipe);
-    cmd.bind_descriptor_set(*device_objects.pipe_layout, 0, *per_window_set);
+    cmd.push_constants(*device_objects.pipe_layout, 0, sizeof(transform), &transform);
     cmd.bind_vertex_buffer(0, pool.vertices.end());
     cmd.bind_index_buffer(pool.indices.end());
     for(auto & list : lists) 
     {
         cmd.set_scissor_rect(list.scissor.x0, list.scissor.y0, list.scissor.x1, list.scissor.y1);
-        cmd.bind_descriptor_set(*device_objects.pipe_layout, 1, *list.set);
+        cmd.bind_descriptor_set(*device_objects.pipe_layout, 0, *list.set);
         cmd.draw_indexed(list.first_index, list.index_count);
     }
 }
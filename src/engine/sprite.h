@@ -73,7 +73,7 @@ class canvas_device_objects
     friend class canvas;
     rhi::ptr<rhi::image> sprites;
     rhi::ptr<rhi::sampler> sampler;
-    rhi::ptr<rhi::descriptor_set_layout> per_window_layout, per_texture_layout;
+    rhi::ptr<rhi::descriptor_set_layout> per_texture_layout;
     rhi::ptr<rhi::pipeline_layout> pipe_layout;
     rhi::ptr<rhi::pipeline> pipe;
 public:
@@ -339,8 +339,7 @@ int main(int argc, const char * argv[]) try
     auto gwindow = std::make_unique<gfx::window>(*dev, int2{1280,720}, to_string("Workbench 2018 - Graph Editor"));
     
     // Create transient resources
-    gfx::transient_resource_pool pools[3] {*dev, *dev, *dev};
-    int pool_index=0;
+    gfx::frame_scheduler frames {*dev, 3};
 
     gui_state gs;
     gwindow->on_scroll = [w=gwindow->get_glfw_window(), &gs](double2 scroll) { gs.on_scroll(w, scroll.x, scroll.y); };
@@ -356,9 +355,7 @@ int main(int argc, const char * argv[]) try
         context.poll_events();
 
         // Reset resources
-        pool_index = (pool_index+1)%3;
-        auto & pool = pools[pool_index];
-        pool.begin_frame(*dev);
+        auto & pool = frames.begin_frame();
 
         // Handle the GUI
         canvas canvas {sprites, device_objects, pool};
@@ -376,8 +373,9 @@ int main(int argc, const char * argv[]) try
         cmd->end_render_pass();
 
         // Submit and end frame
+        frames.submitted();
         dev->acquire_and_submit_and_present(*cmd, gwindow->get_rhi_window());
-        pool.end_frame(*dev);
+        frames.end_frame();
     }
     return EXIT_SUCCESS;
 }
@@ -5,8 +5,10 @@
 //#include "engine/gui.h"
 //#include "engine/asset.h"
 #include "engine/gizmo.h"
+#include "engine/render.h"
 
 #include <chrono>
+#include <future>
 #include <iostream>
 
 ///////////////////////
@@ -26,6 +28,18 @@ struct asset_library
 // Scene definition //
 //////////////////////
 
+constexpr int texture_table_size = 16; // Must match RESOURCE_TABLE_SIZE in textured-pbr-table.frag
+
+// Matches the PerTableObject block of textured-pbr-table.frag, which reads its material properties per object, and its albedo map from a table of every texture
+struct table_object_uniforms
+{
+    alignas(16) float4x4 model_matrix;
+    alignas(16) float4x4 model_matrix_it;
+    alignas(16) float3 albedo_tint;
+    alignas(4) float roughness, metalness, opacity;
+    alignas(4) int32_t albedo_index;
+};
+
 struct object
 {
     std::string name;
@@ -38,6 +52,7 @@ struct object
 
     float4x4 get_model_matrix() const { return get_transform_matrix(transform); }
     pbr::object_uniforms get_object_uniforms() const { return {get_model_matrix()}; }
+    table_object_uniforms get_table_object_uniforms(int albedo_index) const { auto u = get_object_uniforms(); return {u.model_matrix, u.model_matrix_it, uniforms.albedo_tint, uniforms.roughness, uniforms.metalness, uniforms.opacity, albedo_index}; }
 
     std::optional<ray_mesh_hit> raycast(const ray & r) const
     {
@@ -99,6 +114,8 @@ struct editor
     double2 last_cursor;
 
     rect<int> viewport_rect;
+    std::vector<rhi::timer_result> gpu_timers; // From the most recent frame whose GPU work has completed
+    std::vector<std::string> frame_stats; // Frame timings and transient buffer usage, for tuning frames in flight and page sizes
     int sidebar_split = -300;
     int object_list_split = 250;
     int property_split = 100;
@@ -184,6 +201,19 @@ struct editor
             if(win->get_key(GLFW_KEY_D)) cam.move(coord_axis::right, timestep * 10);
         }
         last_cursor = cursor;
+
+        // Overlay GPU timings in the corner of the viewport
+        int2 pos = viewport_rect.corner00() + int2{4,4};
+        for(auto & timer : gpu_timers)
+        {
+            g.draw_shadowed_text(pos, g.get_style().passive_text, to_string(timer.name, ": ", std::round(timer.milliseconds*100)/100, " ms"));
+            pos.y += g.get_style().def_font.line_height;
+        }
+        for(auto & stat : frame_stats)
+        {
+            g.draw_shadowed_text(pos, g.get_style().passive_text, stat);
+            pos.y += g.get_style().def_font.line_height;
+        }
     }
 
     void object_list_gui(gui & g, const int id, rect<int> bounds)
@@ -259,12 +289,14 @@ struct pipelines
     rhi::ptr<const rhi::pipeline> skybox_pipe;
     rhi::ptr<const rhi::pipeline> colored_pbr_pipe;
     rhi::ptr<const rhi::pipeline> textured_pbr_pipe;
+    rhi::ptr<const rhi::pipeline> textured_pbr_table_pipe; // Null unless create_pipelines(...) was given a texture table layout
     rhi::ptr<const rhi::pipeline> bumped_pbr_pipe;
 
     std::array<rhi::ptr<const rhi::pipeline>,5> gizmo_passes;
+    std::vector<std::pair<rhi::ptr<const rhi::pipeline>, rhi::ptr<const rhi::pipeline>>> instanced_variants; // Used by gfx::render_queue to batch repeated objects
 };
 
-pipelines create_pipelines(rhi::device & dev, shader_compiler & compiler)
+pipelines create_pipelines(rhi::device & dev, shader_compiler & compiler, const rhi::descriptor_set_layout * texture_table_layout)
 {
     // Descriptor set layouts
     auto per_scene_layout = dev.create_descriptor_set_layout({
@@ -292,7 +324,7 @@ pipelines create_pipelines(rhi::device & dev, shader_compiler & compiler)
         {2, rhi::descriptor_type::combined_image_sampler, 1},
     });
     auto static_object_layout = dev.create_descriptor_set_layout({
-        {0, rhi::descriptor_type::uniform_buffer, 1},
+        {0, rhi::descriptor_type::uniform_buffer_dynamic, 1},
     });
 
     // Pipeline layouts
@@ -315,12 +347,13 @@ pipelines create_pipelines(rhi::device & dev, shader_compiler & compiler)
     auto skybox_vs = compiler.compile_file(rhi::shader_stage::vertex, "skybox.vert");
     auto skybox_fs = compiler.compile_file(rhi::shader_stage::fragment, "skybox.frag");
     auto vs = compiler.compile_file(rhi::shader_stage::vertex, "static-mesh.vert");
+    auto batched_vs = compiler.compile_file(rhi::shader_stage::vertex, "batched-mesh.vert");
     auto unlit_fs = compiler.compile_file(rhi::shader_stage::fragment, "colored-unlit.frag");
     auto colored_fs = compiler.compile_file(rhi::shader_stage::fragment, "colored-pbr.frag");
     auto textured_fs = compiler.compile_file(rhi::shader_stage::fragment, "textured-pbr.frag");
     auto bumped_fs = compiler.compile_file(rhi::shader_stage::fragment, "bumped-pbr.frag");
 
-    auto vss = dev.create_shader(vs), unlit_fss = dev.create_shader(unlit_fs);
+    auto vss = dev.create_shader(vs), batched_vss = dev.create_shader(batched_vs), unlit_fss = dev.create_shader(unlit_fs);
     auto colored_fss = dev.create_shader(colored_fs), textured_fss = dev.create_shader(textured_fs), bumped_fss = dev.create_shader(bumped_fs);
     auto skybox_vss = dev.create_shader(skybox_vs), skybox_fss = dev.create_shader(skybox_fs);
 
@@ -357,6 +390,25 @@ pipelines create_pipelines(rhi::device & dev, shader_compiler & compiler)
     p.textured_pbr_pipe = dev.create_pipeline({textured_pipe_layout, {mesh_vertex_binding}, {vss,textured_fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, opaque_depth, std::nullopt, {opaque}});       
     p.bumped_pbr_pipe = dev.create_pipeline({bumped_pipe_layout, {mesh_vertex_binding}, {vss,bumped_fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back , opaque_depth, std::nullopt, {opaque}});       
 
+    // Instanced variants of the object pipelines, which read object uniforms from a per-instance vertex buffer
+    const auto object_instance_binding = pbr::get_object_instance_binding(1);
+    auto add_instanced_variant = [&](rhi::ptr<const rhi::pipeline> pipe, rhi::ptr<const rhi::pipeline_layout> layout, rhi::ptr<const rhi::shader> fss)
+    {
+        p.instanced_variants.push_back({pipe, dev.create_pipeline({layout, {mesh_vertex_binding, object_instance_binding}, {batched_vss,fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, opaque_depth, std::nullopt, {opaque}})});
+    };
+    add_instanced_variant(p.light_pipe, colored_pipe_layout, unlit_fss);
+    add_instanced_variant(p.colored_pbr_pipe, colored_pipe_layout, colored_fss);
+    add_instanced_variant(p.textured_pbr_pipe, textured_pipe_layout, textured_fss);
+    add_instanced_variant(p.bumped_pbr_pipe, bumped_pipe_layout, bumped_fss);
+
+    // Textured PBR which selects its albedo map from a texture table. It has no instanced variant, as batched-mesh.vert reads only the model matrices per instance.
+    if(texture_table_layout)
+    {
+        auto textured_table_pipe_layout = dev.create_pipeline_layout({per_scene_layout, per_view_layout, texture_table_layout, static_object_layout});
+        auto textured_table_fss = dev.create_shader(compiler.compile_file(rhi::shader_stage::fragment, "textured-pbr-table.frag"));
+        p.textured_pbr_table_pipe = dev.create_pipeline({textured_table_pipe_layout, {mesh_vertex_binding}, {vss,textured_table_fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, opaque_depth, std::nullopt, {opaque}});
+    }
+
     // Pass 0 writes stencil value of '1' everywhere that the gizmo is occluded
     p.gizmo_passes[0] = dev.create_pipeline({colored_pipe_layout, {mesh_vertex_binding}, {vss,unlit_fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, rhi::depth_state{rhi::compare_op::less, false}, stencil_write_on_depth_fail, {no_color}});
     // Pass 1 renders the unoccluded fragments of the gizmo and resets the stencil to '0' at those fragments
@@ -432,7 +484,11 @@ int main(int argc, const char * argv[]) try
 
     pbr::device_objects pbr_objects = {dev, standard_sh};
     canvas_device_objects canvas_objects {*dev, compiler, sheet};
-    for(auto m : assets.meshes) m->gmesh = {*dev, m->cmesh.vertices, m->cmesh.triangles};
+
+    // All meshes share the buffers of a single arena, so that the render queue can draw one after another without rebinding them
+    gfx::mesh_arena mesh_arena {*dev, sizeof(mesh_vertex), 1<<16, 3<<16};
+    for(auto m : assets.meshes) m->gmesh = {mesh_arena, m->cmesh.vertices, m->cmesh.triangles};
+    mesh_arena.flush();
     for(auto t : assets.textures)
     {
         auto im = loader.load_image(t->name, t->linear);
@@ -442,23 +498,54 @@ int main(int argc, const char * argv[]) try
     // Samplers
     auto linear = dev->create_sampler({rhi::filter::linear, rhi::filter::linear, std::nullopt, rhi::address_mode::clamp_to_edge, rhi::address_mode::repeat});
 
+    // Where the device can index arrays of images, every texture is written to one table, from which textured materials select their albedo maps by index,
+    // so that all of their objects share a single material binding. Other devices, including D3D11, fall back to a descriptor set per material.
+    rhi::ptr<rhi::resource_table> texture_table;
+    if(dev->get_info().max_resource_table_images >= texture_table_size)
+    {
+        texture_table = dev->create_resource_table(texture_table_size);
+        for(size_t i=0; i<assets.textures.size(); ++i)
+        {
+            assets.textures[i]->table_index = exactly(i);
+            texture_table->write(assets.textures[i]->table_index, *linear, *assets.textures[i]->gtex);
+        }
+    }
+
     // Images
     auto env_spheremap = dev->create_image({rhi::image_shape::_2d, {env_spheremap_img.dimensions,1}, 1, env_spheremap_img.format, rhi::sampled_image_bit}, {env_spheremap_img.get_pixels()});
 
-    auto pipelines = create_pipelines(*dev, compiler);
+    auto pipelines = create_pipelines(*dev, compiler, texture_table ? &texture_table->get_descriptor_set_layout() : nullptr);
     light_src->pipe = pipelines.light_pipe;
     colored_pbr->pipe = pipelines.colored_pbr_pipe;
-    textured_pbr->pipe = pipelines.textured_pbr_pipe;
+    textured_pbr->pipe = pipelines.textured_pbr_table_pipe ? pipelines.textured_pbr_table_pipe : pipelines.textured_pbr_pipe;
     bumped_pbr->pipe = pipelines.bumped_pbr_pipe;
 
     // Create transient resources
-    gfx::transient_resource_pool pools[3] {*dev, *dev, *dev};
-    int pool_index=0;
+    // Pass --low-latency to keep only two frames in flight, trading some CPU/GPU overlap for a frame less of input latency
+    gfx::frame_scheduler frames {*dev, argc > 1 && std::string_view{argv[1]} == "--low-latency" ? 2 : 3};
+    gfx::descriptor_cache material_sets {*dev};
+    gfx::render_queue render_queue {pbr::material_set_index, pbr::object_set_index};
+    for(auto & [pipe, instanced] : pipelines.instanced_variants) render_queue.set_instanced_variant(*pipe, *instanced);
 
     // Do some initial work
-    pools[pool_index].begin_frame(*dev);
-    auto env = pbr_objects.create_environment_map_from_spheremap(pools[pool_index], *env_spheremap, 512, coords);
-    pools[pool_index].end_frame(*dev);
+    auto env = pbr_objects.create_environment_map_from_spheremap(frames.begin_frame(), *env_spheremap, 512, coords);
+    frames.end_frame();
+
+    // The skybox is drawn by reusable secondary command buffers, one per frame in flight, so that its commands are recorded once rather than every frame.
+    // Each reads the view from its own uniform buffer, which is only rewritten after begin_frame() has waited for the frame which last used it.
+    struct skybox_frame { rhi::ptr<rhi::buffer> view_buffer; rhi::ptr<rhi::descriptor_set> view_set; rhi::ptr<rhi::command_buffer> cmd; };
+    auto & skybox_layout = pipelines.skybox_pipe->get_layout();
+    auto skybox_descriptors = dev->create_descriptor_pool();
+    auto skybox_set = skybox_descriptors->alloc(skybox_layout.get_descriptor_set_layout(pbr::material_set_index));
+    skybox_set->write(0, pbr_objects.get_cubemap_sampler(), *env.environment_cubemap);
+    std::vector<skybox_frame> skybox_frames(frames.get_frames_in_flight());
+    for(auto & f : skybox_frames)
+    {
+        f.view_buffer = dev->create_buffer({sizeof(pbr::view_uniforms), rhi::uniform_buffer_bit|rhi::mapped_memory_bit}, nullptr);
+        f.view_set = skybox_descriptors->alloc(skybox_layout.get_descriptor_set_layout(pbr::view_set_index));
+        f.view_set->write(0, {*f.view_buffer, 0, sizeof(pbr::view_uniforms)});
+    }
+    rect<int> skybox_viewport;
 
     // Window
     gui_state gs;
@@ -471,6 +558,21 @@ int main(int argc, const char * argv[]) try
     gizmo gizmo{pipelines.gizmo_passes, arrow_x, arrow_y, arrow_z, box_yz, box_zx, box_xy};
     editor editor{assets, scene, gizmo, gwindow};
 
+    // Compile the pipelines which draw to our window on a worker thread, rather than mid-frame when they are first bound
+    auto precompiled = std::async(std::launch::async, [&dev=*dev, &fb=gwindow->get_rhi_window().get_swapchain_framebuffer(), &pipelines]
+    {
+        for(auto & pipe : {pipelines.light_pipe, pipelines.skybox_pipe, pipelines.colored_pbr_pipe, pipelines.textured_pbr_pipe, pipelines.bumped_pbr_pipe}) dev.precompile_pipeline(*pipe, fb);
+        if(pipelines.textured_pbr_table_pipe) dev.precompile_pipeline(*pipelines.textured_pbr_table_pipe, fb);
+        for(auto & pipe : pipelines.gizmo_passes) dev.precompile_pipeline(*pipe, fb);
+        for(auto & variant : pipelines.instanced_variants) dev.precompile_pipeline(*variant.second, fb);
+    });
+    auto finish_precompiling = [&precompiled]()
+    {
+        // Pipelines which failed to precompile are compiled when first bound instead, so report the failure and carry on
+        try { precompiled.get(); }
+        catch(const std::exception & e) { std::cerr << "Pipeline precompilation failed: " << e.what() << std::endl; }
+    };
+
     // Main loop
     double2 last_cursor;
     auto t0 = std::chrono::high_resolution_clock::now();
@@ -485,10 +587,31 @@ int main(int argc, const char * argv[]) try
         const auto timestep = std::chrono::duration<float>(t1-t0).count();
         t0 = t1;
 
+        // Collect the outcome of pipeline precompilation once it finishes
+        if(precompiled.valid() && precompiled.wait_for(std::chrono::seconds{0}) == std::future_status::ready) finish_precompiling();
+
         // Reset resources
-        pool_index = (pool_index+1)%3;
-        auto & pool = pools[pool_index];
-        pool.begin_frame(*dev);
+        auto & pool = frames.begin_frame();
+        material_sets.begin_frame();
+
+        // Retrieve the GPU timings of completed frames
+        auto timer_results = dev->get_timer_results();
+        if(!timer_results.empty())
+        {
+            editor.gpu_timers.clear();
+            for(auto & timer : timer_results) if(timer.submission_id == timer_results.back().submission_id) editor.gpu_timers.push_back(timer);
+        }
+        editor.frame_stats.clear();
+        const auto & timing = frames.get_average_timing();
+        editor.frame_stats.push_back(to_string(frames.get_frames_in_flight(), " frames in flight: ", std::round(timing.cpu_ms*100)/100, " ms cpu, ", std::round(timing.wait_ms*100)/100, " ms waiting for gpu, ", std::round(timing.present_ms*100)/100, " ms presenting"));
+        for(auto [name, buffer] : {std::make_pair("uniforms", &pool.uniforms), std::make_pair("vertices", &pool.vertices), std::make_pair("indices", &pool.indices)})
+        {
+            editor.frame_stats.push_back(to_string(name, ": ", buffer->get_average_frame_bytes()/1024, " KiB avg, ", buffer->get_peak_frame_bytes()/1024, " KiB peak, ", buffer->get_page_count(), " pages"));
+        }
+        const auto & queue_stats = render_queue.get_stats();
+        editor.frame_stats.push_back(to_string(queue_stats.draws, " objects in ", queue_stats.draw_calls, " draws (", queue_stats.instanced_draw_calls, " instanced): ", queue_stats.pipeline_binds, " pipeline, ", queue_stats.material_binds, " material, ", queue_stats.mesh_binds, " mesh binds"));
+        const auto arena_stats = mesh_arena.get_stats();
+        editor.frame_stats.push_back(to_string(arena_stats.meshes, " meshes in ", arena_stats.blocks, " arena blocks: ", arena_stats.used_vertices, "/", arena_stats.vertex_capacity, " vertices, ", arena_stats.used_indices, "/", arena_stats.index_capacity, " indices"));
 
         // Draw the UI
         canvas canvas {sprites, canvas_objects, pool};
@@ -516,14 +639,45 @@ int main(int argc, const char * argv[]) try
         per_scene_set.write(3, pbr_objects.get_cubemap_sampler(), *env.reflectance_cubemap);
 
         // Set up per-view uniforms for a specific framebuffer
+        const pbr::view_uniforms view_uniforms {editor.cam, vp.aspect_ratio(), fb.get_ndc_coords(), dev->get_info().z_range};
         auto per_view_set = pool.alloc_descriptor_set(*pipelines.common_layout, pbr::view_set_index);
-        per_view_set.write(0, pbr::view_uniforms{editor.cam, vp.aspect_ratio(), fb.get_ndc_coords(), dev->get_info().z_range});
+        per_view_set.write(0, view_uniforms);
 
-        // Draw objects to our primary framebuffer
+        // Record the skybox of this frame in flight, unless it was already recorded for the current viewport
+        auto & skybox = skybox_frames[frames.get_frame_count() % skybox_frames.size()];
+        memcpy(skybox.view_buffer->get_mapped_memory(), &view_uniforms, sizeof(view_uniforms));
+        if(std::tie(vp.x0, vp.y0, vp.x1, vp.y1) != std::tie(skybox_viewport.x0, skybox_viewport.y0, skybox_viewport.x1, skybox_viewport.y1))
+        {
+            for(auto & f : skybox_frames) f.cmd = nullptr;
+            skybox_viewport = vp;
+        }
+        if(!skybox.cmd)
+        {
+            skybox.cmd = dev->create_secondary_command_buffer(fb, true);
+            skybox.cmd->set_viewport_rect(vp.x0, vp.y0, vp.x1, vp.y1);
+            skybox.cmd->bind_pipeline(*pipelines.skybox_pipe);
+            skybox.cmd->bind_descriptor_set(skybox_layout, pbr::view_set_index, *skybox.view_set);
+            skybox.cmd->bind_descriptor_set(skybox_layout, pbr::material_set_index, *skybox_set);
+            box->gmesh.draw(*skybox.cmd);
+        }
+
+        // Clear our primary framebuffer and draw the skybox, in a render pass of its own, as its contents come from a secondary command buffer
         auto cmd = dev->create_command_buffer();
+        rhi::render_pass_desc skybox_pass;
+        skybox_pass.color_attachments = {{rhi::clear_color{0.05f,0.05f,0.05f,1.0f}, rhi::store{rhi::layout::attachment_optimal}}};
+        skybox_pass.depth_attachment = {rhi::clear_depth{1.0f,0}, rhi::store{rhi::layout::attachment_optimal}};
+        skybox_pass.secondary_command_buffers = true;
+        cmd->begin_timer("Frame");
+        cmd->begin_timer("Skybox");
+        cmd->begin_render_pass(skybox_pass, fb);
+        cmd->execute_commands(*skybox.cmd);
+        cmd->end_render_pass();
+        cmd->end_timer();
+
+        // Draw objects to our primary framebuffer
         rhi::render_pass_desc pass;
-        pass.color_attachments = {{rhi::clear_color{0.05f,0.05f,0.05f,1.0f}, rhi::store{rhi::layout::present_source}}};
-        pass.depth_attachment = {rhi::clear_depth{1.0f,0}, rhi::dont_care{}};
+        pass.color_attachments = {{rhi::load{rhi::layout::attachment_optimal}, rhi::store{rhi::layout::present_source}}};
+        pass.depth_attachment = {rhi::load{rhi::layout::attachment_optimal}, rhi::dont_care{}};
         cmd->begin_render_pass(pass, fb);
         cmd->set_viewport_rect(vp.x0, vp.y0, vp.x1, vp.y1);
 
@@ -531,32 +685,28 @@ int main(int argc, const char * argv[]) try
         per_scene_set.bind(*cmd);
         per_view_set.bind(*cmd);
 
-        // Draw skybox
-        cmd->bind_pipeline(*pipelines.skybox_pipe);
-        auto skybox_set = pool.alloc_descriptor_set(*pipelines.skybox_pipe, pbr::material_set_index);
-        skybox_set.write(0, pbr_objects.get_cubemap_sampler(), *env.environment_cubemap);
-        skybox_set.bind(*cmd);
-        box->gmesh.draw(*cmd);
-        
-        // Draw our objects
+        // Draw our objects, sorted to minimize state changes
+        cmd->begin_timer("Objects");
+        const float3 view_direction = editor.cam.get_direction(coord_axis::forward);
         for(auto & object : scene.objects)
         {
             if(!object.mesh || !object.material) continue;
+            const float depth = dot(object.transform.translation - editor.cam.position, view_direction);
 
             auto & pipe = object.material->pipe;
-            cmd->bind_pipeline(*pipe);
-
-            auto material_set = pool.alloc_descriptor_set(*pipe, pbr::material_set_index);
+            if(texture_table && pipe == pipelines.textured_pbr_table_pipe)
+            {
+                auto albedo = object.textures[0] ? object.textures[0] : white;
+                render_queue.add(0, *pipe, &texture_table->get_descriptor_set(), object.mesh->gmesh, object.get_table_object_uniforms(albedo->table_index), depth);
+                continue;
+            }
+            auto material_set = material_sets.begin_set(*pipe, pbr::material_set_index);
             material_set.write(0, object.uniforms);
             for(size_t i=0; i<object.material->texture_names.size(); ++i) material_set.write(exactly(1+i), *linear, object.textures[i] ? *object.textures[i]->gtex : *white->gtex);
-            material_set.bind(*cmd);
-
-            auto object_set = pool.alloc_descriptor_set(*pipe, pbr::object_set_index);
-            object_set.write(0, object.get_object_uniforms());
-            object_set.bind(*cmd);
-
-            object.mesh->gmesh.draw(*cmd);
+            render_queue.add(0, *pipe, &material_set.get(), object.mesh->gmesh, object.get_object_uniforms(), depth);
         }
+        render_queue.draw(*cmd, pool);
+        cmd->end_timer();
 
         // Draw our gizmo
         if(editor.selection)
@@ -564,13 +714,20 @@ int main(int argc, const char * argv[]) try
             gizmo.draw(*cmd, pool, editor.selection->transform.translation);
         }
 
+        cmd->begin_timer("UI");
         canvas.encode_commands(*cmd, *gwindow);
+        cmd->end_timer();
 
         // Submit and end frame
         cmd->end_render_pass();
+        cmd->end_timer();
+        frames.submitted();
         dev->acquire_and_submit_and_present(*cmd, gwindow->get_rhi_window());
-        pool.end_frame(*dev);
+        frames.end_frame();
     }
+
+    // The worker thread uses the device and pipelines, so it must finish before they are released
+    if(precompiled.valid()) finish_precompiling();
     return EXIT_SUCCESS;
 }
 catch(const std::exception & e)
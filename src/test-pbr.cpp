@@ -7,6 +7,7 @@
 #include <iostream>
 
 constexpr coord_system coords {coord_axis::right, coord_axis::forward, coord_axis::up};
+struct sphere_instance { float4x4 model_matrix; float2 roughness_metalness; };
 int main(int argc, const char * argv[]) try
 {
     // Register asset paths
@@ -16,7 +17,9 @@ int main(int argc, const char * argv[]) try
     shader_compiler compiler{loader};
     auto standard_sh = pbr::shaders::compile(compiler);
     auto vs = compiler.compile_file(rhi::shader_stage::vertex, "static-mesh.vert");
+    auto instanced_vs = compiler.compile_file(rhi::shader_stage::vertex, "instanced-mesh.vert");
     auto lit_fs = compiler.compile_file(rhi::shader_stage::fragment, "textured-pbr.frag");
+    auto instanced_lit_fs = compiler.compile_file(rhi::shader_stage::fragment, "instanced-pbr.frag");
     auto unlit_fs = compiler.compile_file(rhi::shader_stage::fragment, "colored-unlit.frag");
     auto skybox_vs = compiler.compile_file(rhi::shader_stage::vertex, "skybox.vert");
     auto skybox_fs = compiler.compile_file(rhi::shader_stage::fragment, "skybox.frag");
@@ -39,6 +42,11 @@ int main(int argc, const char * argv[]) try
     gfx::simple_mesh box = {*dev, box_mesh.vertices, box_mesh.triangles};
     gfx::simple_mesh sphere = {*dev, sphere_mesh.vertices, sphere_mesh.triangles};
 
+    // Per-instance data for a grid of spheres of varying roughness and metalness
+    std::vector<sphere_instance> sphere_instances;
+    for(int i=0; i<6; ++i) for(int j=0; j<6; ++j) sphere_instances.push_back({translation_matrix(coords(coord_axis::right)*(i*2-5.f) + coords(coord_axis::forward)*(j*2-5.f)), {(j+0.5f)/6, (i+0.5f)/6}});
+    gfx::static_buffer sphere_instance_buffer = {*dev, rhi::vertex_buffer_bit, sphere_instances};
+
     // Samplers
     auto nearest = dev->create_sampler({rhi::filter::nearest, rhi::filter::nearest, std::nullopt, rhi::address_mode::clamp_to_edge, rhi::address_mode::repeat});
 
@@ -68,7 +76,7 @@ int main(int argc, const char * argv[]) try
         {1, rhi::descriptor_type::combined_image_sampler, 1}
     });
     auto static_object_layout = dev->create_descriptor_set_layout({
-        {0, rhi::descriptor_type::uniform_buffer, 1},
+        {0, rhi::descriptor_type::uniform_buffer_dynamic, 1},
     });
 
     // Pipeline layouts
@@ -76,6 +84,7 @@ int main(int argc, const char * argv[]) try
     auto skybox_layout = dev->create_pipeline_layout({per_scene_layout, per_view_layout, skybox_material_layout});
     auto colored_object_layout = dev->create_pipeline_layout({per_scene_layout, per_view_layout, colored_pbr_layout, static_object_layout});
     auto textured_object_layout = dev->create_pipeline_layout({per_scene_layout, per_view_layout, textured_pbr_layout, static_object_layout});
+    auto instanced_object_layout = dev->create_pipeline_layout({per_scene_layout, per_view_layout, textured_pbr_layout});
 
     const auto mesh_vertex_binding = gfx::vertex_binder<mesh_vertex>(0)
         .attribute(0, &mesh_vertex::position)
@@ -83,9 +92,13 @@ int main(int argc, const char * argv[]) try
         .attribute(2, &mesh_vertex::texcoord)
         .attribute(3, &mesh_vertex::tangent)
         .attribute(4, &mesh_vertex::bitangent);
+    const auto sphere_instance_binding = gfx::vertex_binder<sphere_instance>(1, rhi::input_rate::per_instance)
+        .attribute(5, &sphere_instance::model_matrix)
+        .attribute(9, &sphere_instance::roughness_metalness);
 
     // Shaders
     auto vss = dev->create_shader(vs), lit_fss = dev->create_shader(lit_fs), unlit_fss = dev->create_shader(unlit_fs);
+    auto instanced_vss = dev->create_shader(instanced_vs), instanced_lit_fss = dev->create_shader(instanced_lit_fs);
     auto skybox_vss = dev->create_shader(skybox_vs), skybox_fss = dev->create_shader(skybox_fs);
 
     // Blend states
@@ -95,16 +108,15 @@ int main(int argc, const char * argv[]) try
     // Pipelines
     auto light_pipe = dev->create_pipeline({textured_object_layout, {mesh_vertex_binding}, {vss,unlit_fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, rhi::depth_state{rhi::compare_op::less, true}, std::nullopt, {opaque}});       
     auto solid_pipe = dev->create_pipeline({textured_object_layout, {mesh_vertex_binding}, {vss,lit_fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, rhi::depth_state{rhi::compare_op::less, true}, std::nullopt, {opaque}});       
+    auto instanced_pipe = dev->create_pipeline({instanced_object_layout, {mesh_vertex_binding, sphere_instance_binding}, {instanced_vss,instanced_lit_fss}, rhi::primitive_topology::triangles, rhi::front_face::counter_clockwise, rhi::cull_mode::back, rhi::depth_state{rhi::compare_op::less, true}, std::nullopt, {opaque}});       
     auto skybox_pipe = dev->create_pipeline({skybox_layout, {mesh_vertex_binding}, {skybox_vss,skybox_fss}, rhi::primitive_topology::triangles, rhi::front_face::clockwise, rhi::cull_mode::back, rhi::depth_state{rhi::compare_op::always, false}, std::nullopt, {opaque}});
 
     // Create transient resources
-    gfx::transient_resource_pool pools[3] {*dev, *dev, *dev};
-    int pool_index=0;
+    gfx::frame_scheduler frames {*dev, 3};
 
     // Do some initial work
-    pools[pool_index].begin_frame(*dev);
-    auto env = standard.create_environment_map_from_spheremap(pools[pool_index], *env_spheremap, 512, coords);
-    pools[pool_index].end_frame(*dev);
+    auto env = standard.create_environment_map_from_spheremap(frames.begin_frame(), *env_spheremap, 512, coords);
+    frames.end_frame();
 
     // Window
     auto gwindow = std::make_unique<gfx::window>(*dev, int2{1280,720}, to_string("Workbench 2018 - PBR Test"));
@@ -138,9 +150,7 @@ int main(int argc, const char * argv[]) try
         if(gwindow->get_key(GLFW_KEY_D)) cam.move(coord_axis::right, cam_speed);
 
         // Reset resources
-        pool_index = (pool_index+1)%3;
-        auto & pool = pools[pool_index];
-        pool.begin_frame(*dev);
+        auto & pool = frames.begin_frame();
 
         // Set up per scene uniforms
         pbr::scene_uniforms per_scene_uniforms {};
@@ -187,42 +197,35 @@ int main(int argc, const char * argv[]) try
         material_set.write(0, pbr::material_uniforms{{0.5f,0.5f,0.5f},0.5f,0});
         material_set.write(1, *nearest, *checkerboard);
         material_set.bind(*cmd);
+        auto light_object_set = pool.alloc_descriptor_set(*light_pipe, pbr::object_set_index);
+        light_object_set.write_dynamic(0, sizeof(pbr::object_uniforms));
         for(auto & p : per_scene_uniforms.point_lights)
         {
-            auto object_set = pool.alloc_descriptor_set(*light_pipe, pbr::object_set_index);
-            object_set.write(0, pbr::object_uniforms{mul(translation_matrix(p.position), scaling_matrix(float3{0.5f}))});
-            object_set.bind(*cmd);
+            light_object_set.bind(*cmd, pbr::object_uniforms{mul(translation_matrix(p.position), scaling_matrix(float3{0.5f}))});
             sphere.draw(*cmd);
         }
 
         // Draw the ground
         cmd->bind_pipeline(*solid_pipe);
         auto object_set = pool.alloc_descriptor_set(*solid_pipe, pbr::object_set_index);
-        object_set.write(0, pbr::object_uniforms{translation_matrix(cam.coords(coord_axis::down)*0.5f)});
-        object_set.bind(*cmd);
+        object_set.write_dynamic(0, sizeof(pbr::object_uniforms));
+        object_set.bind(*cmd, pbr::object_uniforms{translation_matrix(cam.coords(coord_axis::down)*0.5f)});
         ground.draw(*cmd);
 
-        // Draw a bunch of spheres
-        for(int i=0; i<6; ++i)
-        {
-            for(int j=0; j<6; ++j)
-            {
-                auto material_set = pool.alloc_descriptor_set(*solid_pipe, pbr::material_set_index);
-                material_set.write(0, pbr::material_uniforms{{1,1,1},(j+0.5f)/6,(i+0.5f)/6});
-                material_set.write(1, *nearest, *checkerboard);
-                material_set.bind(*cmd);
-
-                auto object_set = pool.alloc_descriptor_set(*solid_pipe, pbr::object_set_index);
-                object_set.write(0, pbr::object_uniforms{translation_matrix(cam.coords(coord_axis::right)*(i*2-5.f) + cam.coords(coord_axis::forward)*(j*2-5.f))});
-                object_set.bind(*cmd);
-                sphere.draw(*cmd);
-            }
-        }
+        // Draw a bunch of spheres in a single instanced draw call
+        cmd->bind_pipeline(*instanced_pipe);
+        auto instanced_material_set = pool.alloc_descriptor_set(*instanced_pipe, pbr::material_set_index);
+        instanced_material_set.write(0, pbr::material_uniforms{{1,1,1},0.5f,0,1});
+        instanced_material_set.write(1, *nearest, *checkerboard);
+        instanced_material_set.bind(*cmd);
+        cmd->bind_vertex_buffer(1, sphere_instance_buffer);
+        sphere.draw(*cmd, exactly(sphere_instances.size()));
 
         // Submit and end frame
         cmd->end_render_pass();
+        frames.submitted();
         dev->acquire_and_submit_and_present(*cmd, gwindow->get_rhi_window());
-        pool.end_frame(*dev);
+        frames.end_frame();
     }
     return EXIT_SUCCESS;
 }
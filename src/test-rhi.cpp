@@ -46,8 +46,7 @@ class device_session
     pbr::device_objects standard;
     canvas_device_objects canvas_objects;
     rhi::device_info info;
-    gfx::transient_resource_pool pools[3];
-    int pool_index=0;
+    gfx::frame_scheduler frames;
 
     gfx::simple_mesh ground, box, sphere;
 
@@ -65,7 +64,7 @@ class device_session
     double2 last_cursor;
 public:
     device_session(common_assets & assets, const std::string & name, rhi::ptr<rhi::device> dev, const int2 & window_pos) : 
-        assets{assets}, dev{dev}, standard{dev, assets.standard}, canvas_objects{*dev, assets.compiler, assets.sheet}, info{dev->get_info()}, pools{*dev, *dev, *dev}
+        assets{assets}, dev{dev}, standard{dev, assets.standard}, canvas_objects{*dev, assets.compiler, assets.sheet}, info{dev->get_info()}, frames{*dev, 3}
     {
         // Buffers
         ground = {*dev, assets.ground_mesh.vertices, assets.ground_mesh.triangles};
@@ -132,9 +131,8 @@ public:
         skybox_pipe = dev->create_pipeline({skybox_layout, {mesh_vertex_binding}, {skybox_vs,skybox_fs}, rhi::primitive_topology::triangles, rhi::front_face::clockwise, rhi::cull_mode::back, rhi::depth_state{rhi::compare_op::always, false}, std::nullopt, {opaque}});
 
         // Do some initial work
-        pools[pool_index].begin_frame(*dev);
-        env = standard.create_environment_map_from_spheremap(pools[pool_index], *env_spheremap, 512, assets.game_coords);
-        pools[pool_index].end_frame(*dev);
+        env = standard.create_environment_map_from_spheremap(frames.begin_frame(), *env_spheremap, 512, assets.game_coords);
+        frames.end_frame();
 
         // Window
         gwindow = std::make_unique<gfx::window>(*dev, int2{512,512}, to_string("Workbench 2018 Render Test (", name, ")"));
@@ -163,9 +161,7 @@ public:
     void render_frame(const camera & cam)
     {       
         // Reset resources
-        pool_index = (pool_index+1)%3;
-        auto & pool = pools[pool_index];
-        pool.begin_frame(*dev);
+        auto & pool = frames.begin_frame();
 
         // Set up per scene uniforms
         pbr::scene_uniforms per_scene_uniforms {};
@@ -199,20 +195,20 @@ public:
 
         // Draw skybox
         cmd->bind_pipeline(*skybox_pipe);
-        auto skybox_set = pool.descriptors->alloc(*skybox_material_layout);
+        auto skybox_set = pool.descriptors.alloc(*skybox_material_layout);
         skybox_set->write(0, standard.get_cubemap_sampler(), *env.environment_cubemap);
         cmd->bind_descriptor_set(*skybox_layout, pbr::material_set_index, *skybox_set);
         box.draw(*cmd);
 
         // Draw lights
         cmd->bind_pipeline(*light_pipe);
-        auto material_set = pool.descriptors->alloc(*pbr_material_layout);
+        auto material_set = pool.descriptors.alloc(*pbr_material_layout);
         material_set->write(0, pool.uniforms.upload(pbr::material_uniforms{{0.5f,0.5f,0.5f},0.5f,0}));
         material_set->write(1, *nearest, *checkerboard);
         cmd->bind_descriptor_set(*object_layout, pbr::material_set_index, *material_set);
         for(auto & p : per_scene_uniforms.point_lights)
         {
-            auto object_set = pool.descriptors->alloc(*static_object_layout);
+            auto object_set = pool.descriptors.alloc(*static_object_layout);
             object_set->write(0, pool.uniforms.upload(pbr::object_uniforms{mul(translation_matrix(p.position), scaling_matrix(float3{0.5f}))}));
             cmd->bind_descriptor_set(*object_layout, pbr::object_set_index, *object_set);
 
@@ -221,7 +217,7 @@ public:
 
         // Draw the ground
         cmd->bind_pipeline(*solid_pipe);
-        auto object_set = pool.descriptors->alloc(*static_object_layout);
+        auto object_set = pool.descriptors.alloc(*static_object_layout);
         object_set->write(0, pool.uniforms.upload(pbr::object_uniforms{translation_matrix(cam.coords(coord_axis::down)*0.5f)}));
         cmd->bind_descriptor_set(*object_layout, pbr::object_set_index, *object_set);
         ground.draw(*cmd);
@@ -231,12 +227,12 @@ public:
         {
             for(int j=0; j<6; ++j)
             {
-                material_set = pool.descriptors->alloc(*pbr_material_layout);
+                material_set = pool.descriptors.alloc(*pbr_material_layout);
                 material_set->write(0, pool.uniforms.upload(pbr::material_uniforms{{1,1,1},(j+0.5f)/6,(i+0.5f)/6}));
                 material_set->write(1, *nearest, *checkerboard);
                 cmd->bind_descriptor_set(*object_layout, pbr::material_set_index, *material_set);
 
-                object_set = pool.descriptors->alloc(*static_object_layout);
+                object_set = pool.descriptors.alloc(*static_object_layout);
                 object_set->write(0, pool.uniforms.upload(pbr::object_uniforms{translation_matrix(cam.coords(coord_axis::right)*(i*2-5.f) + cam.coords(coord_axis::forward)*(j*2-5.f))}));
                 cmd->bind_descriptor_set(*object_layout, pbr::object_set_index, *object_set);
 
@@ -252,9 +248,10 @@ public:
         canvas.encode_commands(*cmd, *gwindow);
 
         cmd->end_render_pass();
+        frames.submitted();
         dev->acquire_and_submit_and_present(*cmd, gwindow->get_rhi_window());
 
-        pool.end_frame(*dev);
+        frames.end_frame();
     }
 };
 